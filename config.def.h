@@ -80,6 +80,12 @@
 #define ACTION_FG -1
 #define ACTION_BG 239
 
+/* Directory for persistent input history, appended to one file per
+ * network and channel, as <dir>/<host>/<channel>
+ *   String
+ *   ("": no persistent input history) */
+#define INPUT_HIST_DIR ""
+
 /* Input line text colours */
 #define INPUT_FG -1
 #define INPUT_BG -1
@@ -112,6 +118,48 @@
 /* Raise terminal bell when pinged in chat */
 #define BELL_ON_PINGED 1
 
+/* Directory for chat logs, written to one file per network,
+ * channel and day, as <dir>/<host>/<channel>/<YYYY-MM-DD>.log
+ *   String
+ *   ("": no logging) */
+#define LOG_DIR ""
+
+/* Seconds between syncing written logs to disk
+ *   Integer, [0, 10, 86400]
+ *   (0: no syncing, left to the system) */
+#define LOG_FSYNC_INTERVAL 10
+
+/* Lines of logs prefilled when a buffer is first written to
+ *   Integer, [0, 100, BUFFER_LINES_MAX]
+ *   (0: no prefill) */
+#define LOG_PREFILL_LINES 100
+
+/* Session snapshot file, written on :quit and restored on start
+ *   String
+ *   ("": no snapshot) */
+#define SNAPSHOT_FILE ""
+
+/* UNIX socket publishing message, mention, join, part, lag and
+ * connection events as JSON lines, e.g. for notifications
+ *   String
+ *   ("": no events) */
+#define EVENT_SOCKET ""
+
+/* File periodically written with each server's traffic and
+ * handler stats, as printed by :stats
+ *   String
+ *   ("": no stats file) */
+#define STATS_FILE ""
+
+/* Seconds between writing STATS_FILE
+ *   Integer, [1, 60, 86400] */
+#define STATS_INTERVAL 60
+
+/* File debug builds write traced events to
+ *   String
+ *   ("": stderr) */
+#define TRACE_FILE ""
+
 /* [NETWORK] */
 
 /* Default CA certificate file path
@@ -122,20 +170,50 @@
  *   ("": a list of known paths is checked) */
 #define CA_CERT_PATH ""
 
-/* Seconds before displaying ping
- *   Integer, [0, 150, 86400]
+/* Seconds of inactivity before displaying ping and probing the
+ * server with PING, and before sending TCP keepalive probes.
+ * Per server: --ping-min
+ *   Integer, [0, 60, 86400]
  *   (0: no ping handling) */
-#define IO_PING_MIN 150
+#define IO_PING_MIN 60
 
-/* Seconds between refreshing ping display
+/* Seconds between refreshing ping display and PING probes
  *   Integer, [0, 5, 86400]
  *   (0: no ping handling) */
 #define IO_PING_REFRESH 5
 
-/* Seconds before timeout reconnect
- *   Integer, [0, 300, 86400]
+/* Seconds of inactivity before timeout reconnect. Unacknowledged
+ * data fails the connection after IO_PING_MAX - IO_PING_MIN seconds.
+ * Per server: --ping-max
+ *   Integer, [0, 90, 86400]
  *   (0: no ping timeout reconnect) */
-#define IO_PING_MAX 300
+#define IO_PING_MAX 90
+
+/* Seconds before a connection attempt times out
+ *   Integer, [1, 30, 86400] */
+#define IO_CONNECT_TIMEOUT 30
+
+/* Milliseconds between staggered connection attempts when
+ * a host resolves to multiple addresses (RFC 8305)
+ *   Integer, [10, 250, 2000] */
+#define IO_CONNECT_DELAY 250
+
+/* Seconds resolved host addresses are cached before resolving again.
+ * The last known addresses are still used when resolution fails
+ *   Integer, [0, 300, 86400]
+ *   (0: always resolve) */
+#define IO_DNS_CACHE_MAX_AGE 300
+
+/* Seconds between PING probes measuring server lag
+ *   Integer, [0, 30, 86400]
+ *   (0: no periodic lag measurement) */
+#define LAG_INTERVAL 30
+
+/* Lines of history to request per page when scrolling past the
+ * oldest buffer line, with IRCv3 draft/chathistory
+ *   Integer, [0, 50, 1000]
+ *   (0: no history requests) */
+#define CHATHISTORY_LINES 50
 
 /* Reconnect backoff base delay
  *   Integer, [1, 4, 86400] */
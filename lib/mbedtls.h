@@ -5,6 +5,7 @@
 #endif
 
 /* Enabled ciphersuites, in order of preference.
+ *   - TLS 1.3 ciphersuites, preferred when negotiated
  *   - Only ECHDE key exchanges, AEAD ciphers
  *   - Ordered by cipher:
  *     - ChaCha
@@ -21,6 +22,12 @@
  *       reveal the length of exchanged messages.
  */
 #define MBEDTLS_SSL_CIPHERSUITES                           \
+	/* TLS 1.3 */                                          \
+	MBEDTLS_TLS1_3_CHACHA20_POLY1305_SHA256,               \
+	MBEDTLS_TLS1_3_AES_256_GCM_SHA384,                     \
+	MBEDTLS_TLS1_3_AES_128_GCM_SHA256,                     \
+	MBEDTLS_TLS1_3_AES_128_CCM_SHA256,                     \
+	MBEDTLS_TLS1_3_AES_128_CCM_8_SHA256,                   \
 	/* ChaCha */                                           \
 	MBEDTLS_TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256, \
 	MBEDTLS_TLS_ECDHE_RSA_WITH_CHACHA20_POLY1305_SHA256,   \
@@ -65,9 +72,18 @@
 #define MBEDTLS_KEY_EXCHANGE_ECDHE_RSA_ENABLED
 #define MBEDTLS_POLY1305_C
 
-/* TLS 1.2 client */
+/* TLS 1.2, 1.3 client */
 #define MBEDTLS_SSL_CLI_C
 #define MBEDTLS_SSL_PROTO_TLS1_2
+#define MBEDTLS_SSL_PROTO_TLS1_3
+#define MBEDTLS_SSL_TLS1_3_COMPATIBILITY_MODE
+#define MBEDTLS_SSL_TLS1_3_KEY_EXCHANGE_MODE_EPHEMERAL_ENABLED
+#define MBEDTLS_SSL_TLS1_3_KEY_EXCHANGE_MODE_PSK_EPHEMERAL_ENABLED
+#define MBEDTLS_SSL_KEEP_PEER_CERTIFICATE
+
+/* PSA crypto, required by TLS 1.3 */
+#define MBEDTLS_PSA_CRYPTO_C
+#define MBEDTLS_USE_PSA_CRYPTO
 
 /* TLS modules */
 #define MBEDTLS_AESNI_C
@@ -85,12 +101,14 @@
 #define MBEDTLS_ENTROPY_C
 #define MBEDTLS_FS_IO
 #define MBEDTLS_GENPRIME
+#define MBEDTLS_HKDF_C
 #define MBEDTLS_HMAC_DRBG_C
 #define MBEDTLS_MD_C
 #define MBEDTLS_NET_C
 #define MBEDTLS_OID_C
 #define MBEDTLS_PEM_PARSE_C
 #define MBEDTLS_PKCS1_V15
+#define MBEDTLS_PKCS1_V21
 #define MBEDTLS_PK_C
 #define MBEDTLS_PK_PARSE_C
 #define MBEDTLS_RSA_C
@@ -100,11 +118,13 @@
 #define MBEDTLS_SHA512_C
 #define MBEDTLS_SSL_TLS_C
 #define MBEDTLS_X509_CRT_PARSE_C
+#define MBEDTLS_X509_RSASSA_PSS_SUPPORT
 #define MBEDTLS_X509_USE_C
 
 /* TLS extensions */
 #define MBEDTLS_SSL_EXTENDED_MASTER_SECRET /* RFC 7627 */
 #define MBEDTLS_SSL_SERVER_NAME_INDICATION /* RFC 6066 */
+#define MBEDTLS_SSL_SESSION_TICKETS        /* RFC 5077 */
 
 /* Crypto features */
 #define MBEDTLS_ECDSA_DETERMINISTIC
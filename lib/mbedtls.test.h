@@ -0,0 +1,7 @@
+/* Test configuration, adds the TLS server and session tickets
+ * required by the loopback TLS tests */
+
+#include "mbedtls.h"
+
+#define MBEDTLS_SSL_SRV_C
+#define MBEDTLS_SSL_TICKET_C
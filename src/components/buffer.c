@@ -11,6 +11,16 @@
 #endif
 
 static struct buffer_line* buffer_push(struct buffer*);
+static void buffer_line_set(
+	struct buffer*,
+	struct buffer_line*,
+	enum buffer_line_type,
+	const char*,
+	const char*,
+	size_t,
+	size_t,
+	char,
+	const struct timespec*);
 
 struct buffer_line*
 buffer_head(struct buffer *b)
@@ -68,35 +78,40 @@ buffer_newline(
 		const char *text_str,
 		size_t from_len,
 		size_t text_len,
-		char prefix)
+		char prefix,
+		const struct timespec *ts)
 {
-	struct buffer_line *line;
-
-	if (from_str == NULL)
-		fatal("from string is NULL");
-
-	if (text_str == NULL)
-		fatal("text string is NULL");
+	buffer_line_set(b, buffer_push(b), type, from_str, text_str, from_len, text_len, prefix, ts);
+}
 
-	line = memset(buffer_push(b), 0, sizeof(*line));
+struct buffer_line*
+buffer_prepend(
+		struct buffer *b,
+		enum buffer_line_type type,
+		const char *from_str,
+		const char *text_str,
+		size_t from_len,
+		size_t text_len,
+		char prefix,
+		const struct timespec *ts)
+{
+	/* Add a line before the buffer tail, e.g. for fetched history,
+	 * returns NULL if the buffer is full */
 
-	line->from_len = MIN(from_len + (!!prefix), FROM_LENGTH_MAX);
-	line->text_len = MIN(text_len,              TEXT_LENGTH_MAX);
+	struct buffer_line *line;
 
-	if (prefix)
-		*line->from = prefix;
+	if (buffer_size(b) == BUFFER_LINES_MAX)
+		return NULL;
 
-	memcpy(line->from + (!!prefix), from_str, line->from_len);
-	memcpy(line->text,              text_str, line->text_len);
+	/* lock empty buffer scrollback to the new line */
+	if (buffer_size(b) == 0)
+		b->scrollback = b->tail - 1;
 
-	*(line->from + line->from_len) = '\0';
-	*(line->text + line->text_len) = '\0';
+	line = &b->buffer_lines[BUFFER_MASK(--b->tail)];
 
-	line->time = time(NULL);
-	line->type = type;
+	buffer_line_set(b, line, type, from_str, text_str, from_len, text_len, prefix, ts);
 
-	if (line->from_len > b->pad)
-		b->pad = line->from_len;
+	return line;
 }
 
 void
@@ -135,3 +150,46 @@ buffer_push(struct buffer *b)
 
 	return &(b->buffer_lines[BUFFER_MASK(b->head++)]);
 }
+
+static void
+buffer_line_set(
+		struct buffer *b,
+		struct buffer_line *line,
+		enum buffer_line_type type,
+		const char *from_str,
+		const char *text_str,
+		size_t from_len,
+		size_t text_len,
+		char prefix,
+		const struct timespec *ts)
+{
+	if (from_str == NULL)
+		fatal("from string is NULL");
+
+	if (text_str == NULL)
+		fatal("text string is NULL");
+
+	memset(line, 0, sizeof(*line));
+
+	line->from_len = MIN(from_len + (!!prefix), FROM_LENGTH_MAX);
+	line->text_len = MIN(text_len,              TEXT_LENGTH_MAX);
+
+	if (prefix)
+		*line->from = prefix;
+
+	memcpy(line->from + (!!prefix), from_str, line->from_len);
+	memcpy(line->text,              text_str, line->text_len);
+
+	*(line->from + line->from_len) = '\0';
+	*(line->text + line->text_len) = '\0';
+
+	if (ts)
+		line->time = *ts;
+	else if (clock_gettime(CLOCK_REALTIME, &(line->time)))
+		fatal("clock_gettime");
+
+	line->type = type;
+
+	if (line->from_len > b->pad)
+		b->pad = line->from_len;
+}
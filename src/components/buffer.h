@@ -3,6 +3,7 @@
 
 #include "config.h"
 
+#include <stdint.h>
 #include <time.h>
 
 #define TEXT_LENGTH_MAX 510 /* FIXME: remove max lengths in favour of growable buffer */
@@ -36,7 +37,8 @@ struct buffer_line
 	char text[TEXT_LENGTH_MAX + 1];
 	size_t from_len;
 	size_t text_len;
-	time_t time;
+	struct timespec time;
+	uint64_t msgid; /* Hash of the IRCv3 msgid tag, 0 if none */
 	struct {
 		unsigned colour; /* Cached colour of `from` text */
 		unsigned cols;   /* Cached columns */
@@ -72,6 +74,17 @@ void buffer_newline(
 	const char*,
 	size_t,
 	size_t,
-	char);
+	char,
+	const struct timespec*); /* NULL: current time */
+
+struct buffer_line* buffer_prepend(
+	struct buffer*,
+	enum buffer_line_type,
+	const char*,
+	const char*,
+	size_t,
+	size_t,
+	char,
+	const struct timespec*); /* NULL: current time */
 
 #endif
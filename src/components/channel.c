@@ -138,4 +138,5 @@ channel_reset(struct channel *c)
 	user_list_free(&(c->users));
 	c->joined = 0;
 	c->_366   = 0;
+	c->who    = 0;
 }
@@ -41,9 +41,13 @@ struct channel
 	struct mode_str chanmodes_str;
 	struct server *server;
 	struct user_list users;
-	unsigned parted : 1;
-	unsigned joined : 1;
-	unsigned _366   : 1;
+	time_t history_time;  /* time of the last CHATHISTORY request */
+	unsigned history : 1; /* CHATHISTORY request pending */
+	unsigned logs    : 1; /* buffer prefilled from logs */
+	unsigned who     : 1; /* WHOX request queued */
+	unsigned parted  : 1;
+	unsigned joined  : 1;
+	unsigned _366    : 1;
 	char _[];
 };
 
@@ -4,7 +4,12 @@
 
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #define INPUT_MASK(X) ((X) & (INPUT_HIST_MAX - 1))
 
@@ -14,6 +19,29 @@
 
 #define INPUT_HIST_LINE(I, X) ((I)->hist.ptrs[INPUT_MASK((X))])
 
+struct input_hist_file
+{
+	char *map;           /* Mapping of the file, NULL if empty */
+	size_t map_len;      /* Mapping length */
+	size_t map_off;      /* Mapping offset indexed up to */
+	struct input_hist_entry {
+		uint64_t sig;    /* Entry signature */
+		uint64_t off;    /* Entry offset in file */
+		uint16_t len;    /* Entry length */
+	} *ents;
+	uint32_t n;          /* Number of entries indexed */
+	uint32_t size;       /* Size of entries allocated */
+	int fd;
+	unsigned loaded : 1;
+};
+
+static const char *input_hist_match(const char*, size_t, const char*, size_t);
+static int input_hist_file_load(struct input*);
+static int input_hist_secret(const char*);
+static int input_hist_file_sync(struct input_hist_file*);
+static uint64_t input_hist_sig(const char*, size_t);
+static void input_hist_file_free(struct input_hist_file*);
+static void input_hist_file_index(struct input_hist_file*, size_t, size_t);
 static char *input_text_copy(struct input*);
 static int input_text_isfull(struct input*);
 static int input_text_iszero(struct input*);
@@ -33,6 +61,11 @@ input_free(struct input *inp)
 {
 	while (inp->hist.tail != inp->hist.head)
 		free(INPUT_HIST_LINE(inp, inp->hist.tail++));
+
+	if (inp->hist.file)
+		input_hist_file_free(inp->hist.file);
+
+	inp->hist.file = NULL;
 }
 
 int
@@ -157,6 +190,9 @@ input_hist_back(struct input *inp)
 {
 	size_t len;
 
+	if (inp->hist.current == inp->hist.head)
+		input_hist_file_load(inp);
+
 	if (input_hist_size(inp) == 0 || inp->hist.current == inp->hist.tail)
 		return 0;
 
@@ -202,6 +238,26 @@ input_hist_push(struct input *inp)
 	if ((hist = input_text_copy(inp)) == NULL)
 		return 0;
 
+	/* Load the file before the first push, so that lines which aren't
+	 * persisted are kept in the history ring it replaces */
+	if (inp->hist.file && !inp->hist.file->loaded)
+		input_hist_file_load(inp);
+
+	if (inp->hist.file && inp->hist.file->fd >= 0 && !input_hist_secret(hist)) {
+
+		/* Appended with a single write, so that lines from
+		 * concurrent writers aren't interleaved */
+
+		size_t len = strlen(hist);
+
+		hist[len] = '\n';
+
+		if (write(inp->hist.file->fd, hist, len + 1) < 0)
+			debug("write: %s", strerror(errno));
+
+		hist[len] = 0;
+	}
+
 	if (input_hist_size(inp) == INPUT_HIST_MAX)
 		free(INPUT_HIST_LINE(inp, inp->hist.tail++));
 
@@ -210,6 +266,85 @@ input_hist_push(struct input *inp)
 	return input_reset(inp);
 }
 
+int
+input_hist_file(struct input *inp, const char *path)
+{
+	struct input_hist_file *file;
+
+	if (inp->hist.file)
+		input_hist_file_free(inp->hist.file);
+
+	if ((file = calloc(1, sizeof(*file))) == NULL)
+		fatal("calloc: %s", strerror(errno));
+
+	file->fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+
+	inp->hist.file = file;
+
+	return (file->fd < 0 ? -1 : 0);
+}
+
+uint16_t
+input_hist_search(struct input *inp, const char *str, size_t *pos, char *buf, uint16_t max)
+{
+	/* Search backwards from the entry at `pos`, inclusive, where 0
+	 * is the most recent entry. The persistent history is searched
+	 * when loaded, and is only synced with the file when starting a
+	 * new search, so that positions are stable while searching */
+
+	const char *entry = NULL;
+	size_t len = strlen(str);
+	size_t entry_len = 0;
+	size_t i;
+
+	if (*pos == 0)
+		input_hist_file_load(inp);
+
+	if (inp->hist.file && inp->hist.file->loaded) {
+
+		struct input_hist_file *file = inp->hist.file;
+		uint64_t sig = input_hist_sig(str, len);
+
+		for (i = *pos; i < file->n; i++) {
+
+			struct input_hist_entry *e = &(file->ents[file->n - i - 1]);
+
+			if ((e->sig & sig) != sig)
+				continue;
+
+			if (input_hist_match(file->map + e->off, e->len, str, len)) {
+				entry = file->map + e->off;
+				entry_len = e->len;
+				break;
+			}
+		}
+	} else {
+
+		for (i = *pos; i < input_hist_size(inp); i++) {
+
+			const char *line = INPUT_HIST_LINE(inp, inp->hist.head - i - 1);
+
+			if (input_hist_match(line, strlen(line), str, len)) {
+				entry = line;
+				entry_len = strlen(line);
+				break;
+			}
+		}
+	}
+
+	if (!entry || !max)
+		return 0;
+
+	entry_len = MIN(entry_len, (size_t)(max - 1));
+
+	memcpy(buf, entry, entry_len);
+	buf[entry_len] = 0;
+
+	*pos = i;
+
+	return entry_len;
+}
+
 uint16_t
 input_frame(struct input *inp, char *buf, uint16_t max)
 {
@@ -304,3 +439,232 @@ input_hist_size(struct input *inp)
 {
 	return (inp->hist.head - inp->hist.tail);
 }
+
+static const char*
+input_hist_match(const char *str, size_t len, const char *sub, size_t sub_len)
+{
+	const char *end;
+
+	if (sub_len == 0)
+		return str;
+
+	if (sub_len > len)
+		return NULL;
+
+	end = str + len - sub_len + 1;
+
+	while ((str = memchr(str, *sub, end - str))) {
+
+		if (!memcmp(str, sub, sub_len))
+			return str;
+
+		str++;
+	}
+
+	return NULL;
+}
+
+static int
+input_hist_secret(const char *str)
+{
+	/* Check if a line may carry credentials, e.g. PASS or OPER commands,
+	 * NickServ IDENTIFY or REGISTER, or :connect password options, and
+	 * should not be persisted */
+
+	const char *words[] = {
+		"--pass",
+		"--sasl-pass",
+		"-w",
+		"authenticate",
+		"identify",
+		"oper",
+		"pass",
+		"register",
+	};
+
+	for (size_t len; *str; str += len) {
+
+		str += strspn(str, " =");
+		str += (*str == '/' || *str == ':');
+		len = strcspn(str, " =");
+
+		for (size_t i = 0; i < ARR_LEN(words); i++) {
+			if (len == strlen(words[i]) && !strncasecmp(str, words[i], len))
+				return 1;
+		}
+	}
+
+	return 0;
+}
+
+static uint64_t
+input_hist_sig(const char *str, size_t len)
+{
+	/* Hash each character and character pair to one of 64 bits,
+	 * an entry can only contain a string if its signature is a
+	 * superset of the string's signature */
+
+	uint64_t sig = 0;
+	uint32_t c = 0;
+
+	for (size_t i = 0; i < len; i++) {
+
+		uint32_t p = (c << 8);
+
+		c = (unsigned char) str[i];
+
+		sig |= (uint64_t)1 << ((c * 0x9E3779B1u) >> 26);
+
+		if (i)
+			sig |= (uint64_t)1 << (((p | c | 0x10000) * 0x9E3779B1u) >> 26);
+	}
+
+	return sig;
+}
+
+static int
+input_hist_file_load(struct input *inp)
+{
+	/* Sync the file index, and on first load replace the history
+	 * ring with the most recent entries */
+
+	struct input_hist_file *file = inp->hist.file;
+	uint32_t i;
+
+	if (!file || file->fd < 0)
+		return -1;
+
+	if (input_hist_file_sync(file) < 0)
+		return -1;
+
+	if (file->loaded)
+		return 0;
+
+	file->loaded = 1;
+
+	while (inp->hist.tail != inp->hist.head)
+		free(INPUT_HIST_LINE(inp, inp->hist.tail++));
+
+	inp->hist.head = 0;
+	inp->hist.tail = 0;
+
+	for (i = file->n - MIN(file->n, INPUT_HIST_MAX); i < file->n; i++) {
+
+		char *str;
+
+		if ((str = malloc(file->ents[i].len + 1)) == NULL)
+			fatal("malloc: %s", strerror(errno));
+
+		memcpy(str, file->map + file->ents[i].off, file->ents[i].len);
+		str[file->ents[i].len] = 0;
+
+		INPUT_HIST_LINE(inp, inp->hist.head++) = str;
+	}
+
+	inp->hist.current = inp->hist.head;
+
+	return 0;
+}
+
+static int
+input_hist_file_sync(struct input_hist_file *file)
+{
+	/* Remap the file if it has changed size since last mapped, and
+	 * index any newly appended lines. A file that has shrunk was
+	 * rewritten, and is indexed again from the start */
+
+	struct stat st;
+	size_t len;
+	void *map;
+
+	if (fstat(file->fd, &st) < 0) {
+		debug("fstat: %s", strerror(errno));
+		return -1;
+	}
+
+	if ((len = (size_t) st.st_size) == file->map_len)
+		return 0;
+
+	if (file->map)
+		munmap(file->map, file->map_len);
+
+	file->map = NULL;
+	file->map_len = 0;
+
+	if (len < file->map_off) {
+		file->map_off = 0;
+		file->n = 0;
+	}
+
+	if (len == 0)
+		return 0;
+
+	if ((map = mmap(NULL, len, PROT_READ, MAP_SHARED, file->fd, 0)) == MAP_FAILED) {
+		debug("mmap: %s", strerror(errno));
+		file->map_off = 0;
+		file->n = 0;
+		return -1;
+	}
+
+	file->map = map;
+	file->map_len = len;
+
+	input_hist_file_index(file, file->map_off, len);
+
+	return 0;
+}
+
+static void
+input_hist_file_index(struct input_hist_file *file, size_t off, size_t len)
+{
+	/* Index complete lines in [off, len), a trailing partial line is
+	 * indexed once it's been terminated */
+
+	const char *p;
+
+	while (off < len && (p = memchr(file->map + off, '\n', len - off))) {
+
+		size_t line_len = p - (file->map + off);
+
+		if (line_len) {
+
+			struct input_hist_entry *e;
+
+			if (file->n == INPUT_HIST_FILE_MAX) {
+				file->n -= INPUT_HIST_FILE_MAX / 2;
+				memmove(file->ents, file->ents + INPUT_HIST_FILE_MAX / 2, sizeof(*e) * file->n);
+			}
+
+			if (file->n == file->size) {
+
+				file->size = (file->size ? file->size * 2 : 256);
+				file->size = MIN(file->size, INPUT_HIST_FILE_MAX);
+
+				if ((file->ents = realloc(file->ents, sizeof(*e) * file->size)) == NULL)
+					fatal("realloc: %s", strerror(errno));
+			}
+
+			e = &(file->ents[file->n++]);
+			e->off = off;
+			e->len = MIN(line_len, INPUT_LEN_MAX);
+			e->sig = input_hist_sig(file->map + off, e->len);
+		}
+
+		off += line_len + 1;
+	}
+
+	file->map_off = off;
+}
+
+static void
+input_hist_file_free(struct input_hist_file *file)
+{
+	if (file->map)
+		munmap(file->map, file->map_len);
+
+	if (file->fd >= 0)
+		close(file->fd);
+
+	free(file->ents);
+	free(file);
+}
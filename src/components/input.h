@@ -11,6 +11,13 @@
  *
  * Input history is kept as a ring buffer of strings,
  * copied into the working area when scrolling
+ *
+ * Optionally, history is appended to a file and loaded on
+ * first use by mapping it and indexing its most recent
+ * entries with a signature of their characters and character
+ * pairs, so that reverse search can reject most entries
+ * without comparing them. Lines that may carry credentials
+ * are kept in memory, but not appended to the file
  */
 
 #include <stddef.h>
@@ -33,6 +40,14 @@
 #define INPUT_HIST_MAX 16
 #endif
 
+/* Number of persistent history entries indexed for search,
+ * older entries are dropped from the index as it fills.
+ *
+ * Precluded in tests */
+#ifndef INPUT_HIST_FILE_MAX
+#define INPUT_HIST_FILE_MAX (1 << 17)
+#endif
+
 /* Input completion callback type, returning length
  * of replacement word, or 0 if no match, with args: */
 typedef uint16_t (*f_completion_cb)(
@@ -41,6 +56,8 @@ typedef uint16_t (*f_completion_cb)(
 	uint16_t, /* word replacement max length */
 	int);     /* word is start of input */
 
+struct input_hist_file;
+
 struct input
 {
 	char buf[INPUT_LEN_MAX];
@@ -49,6 +66,7 @@ struct input
 		uint16_t current; /* Ring buffer current entry */
 		uint16_t head;    /* Ring buffer head */
 		uint16_t tail;    /* Ring buffer tail */
+		struct input_hist_file *file;
 	} hist;
 	uint16_t head;        /* Gap buffer head */
 	uint16_t tail;        /* Gap buffer tail */
@@ -74,6 +92,14 @@ int input_hist_back(struct input*);
 int input_hist_forw(struct input*);
 int input_hist_push(struct input*);
 
+/* Input history persistence, returns -1 on failure to open the file */
+int input_hist_file(struct input*, const char*);
+
+/* Input history reverse search, for entries containing a string, from
+ * the given number of entries back. Returns the length of the entry
+ * written, and sets the entry's position, or returns 0 if no match */
+uint16_t input_hist_search(struct input*, const char*, size_t*, char*, uint16_t);
+
 /* Write input to string */
 uint16_t input_frame(struct input*, char*, uint16_t);
 uint16_t input_write(struct input*, char*, uint16_t, uint16_t);
@@ -1,5 +1,8 @@
 #include "src/components/ircv3.h"
 
+#include "src/utils/utils.h"
+
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -43,6 +46,124 @@ ircv3_caps_reset(struct ircv3_caps *caps)
 	#undef X
 }
 
+struct ircv3_batch*
+ircv3_batch_add(struct ircv3_batches *batches, const char *ref, const char *type, const char *params)
+{
+	struct ircv3_batch *b;
+
+	if (ircv3_batch_get(batches, ref))
+		return NULL;
+
+	if ((b = calloc(1, sizeof(*b))) == NULL)
+		fatal("calloc: %s", strerror(errno));
+
+	if (!strcmp(type, "chathistory"))
+		b->type = IRCV3_BATCH_CHATHISTORY;
+	else if (!strcmp(type, "netjoin"))
+		b->type = IRCV3_BATCH_NETJOIN;
+	else if (!strcmp(type, "netsplit"))
+		b->type = IRCV3_BATCH_NETSPLIT;
+	else
+		b->type = IRCV3_BATCH_OTHER;
+
+	b->params = irc_strdup(params ? params : "");
+	b->ref = irc_strdup(ref);
+	b->next = batches->head;
+
+	return (batches->head = b);
+}
+
+struct ircv3_batch*
+ircv3_batch_get(struct ircv3_batches *batches, const char *ref)
+{
+	struct ircv3_batch *b;
+
+	for (b = batches->head; b; b = b->next) {
+		if (!strcmp(b->ref, ref))
+			return b;
+	}
+
+	return NULL;
+}
+
+void
+ircv3_batch_del(struct ircv3_batches *batches, struct ircv3_batch *b)
+{
+	struct ircv3_batch **p;
+
+	for (p = &(batches->head); *p; p = &((*p)->next)) {
+		if (*p == b) {
+			*p = b->next;
+			break;
+		}
+	}
+
+	for (size_t i = 0; i < b->n_events; i++) {
+		free(b->events[i].chan);
+		free(b->events[i].nick);
+		free(b->events[i].text);
+		free(b->events[i].host);
+		free(b->events[i].account);
+		free(b->events[i].realname);
+	}
+
+	for (size_t i = 0; i < b->n_messages; i++)
+		free(b->messages[i]);
+
+	free(b->messages);
+	free(b->events);
+	free(b->params);
+	free(b->ref);
+	free(b);
+}
+
+struct ircv3_batch_event*
+ircv3_batch_event(struct ircv3_batch *b, const char *nick, const char *chan)
+{
+	struct ircv3_batch_event *e;
+
+	if (b->n_events == b->size) {
+
+		b->size = (b->size ? b->size * 2 : 16);
+
+		if ((b->events = realloc(b->events, sizeof(*b->events) * b->size)) == NULL)
+			fatal("realloc: %s", strerror(errno));
+	}
+
+	e = memset(&(b->events[b->n_events++]), 0, sizeof(*e));
+	e->chan = (chan ? irc_strdup(chan) : NULL);
+	e->nick = irc_strdup(nick);
+
+	return e;
+}
+
+void
+ircv3_batch_message(struct ircv3_batch *b, const struct irc_message *m)
+{
+	if (b->n_messages == b->size_messages) {
+
+		b->size_messages = (b->size_messages ? b->size_messages * 2 : 16);
+
+		if ((b->messages = realloc(b->messages, sizeof(*b->messages) * b->size_messages)) == NULL)
+			fatal("realloc: %s", strerror(errno));
+	}
+
+	b->messages[b->n_messages++] = irc_message_dup(m);
+}
+
+void
+ircv3_batches(struct ircv3_batches *batches)
+{
+	batches->head = NULL;
+}
+
+void
+ircv3_batches_reset(struct ircv3_batches *batches)
+{
+	while (batches->head)
+		ircv3_batch_del(batches, batches->head);
+}
+
 void
 ircv3_sasl(struct ircv3_sasl *sasl)
 {
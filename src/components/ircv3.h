@@ -1,6 +1,11 @@
 #ifndef RIRC_COMPONENTS_IRCV3_CAP_H
 #define RIRC_COMPONENTS_IRCV3_CAP_H
 
+#include "src/utils/utils.h"
+
+#include <stdint.h>
+#include <time.h>
+
 #define IRCV3_CAP_AUTO   (1 << 0)
 #define IRCV3_CAP_NO_DEL (1 << 1)
 #define IRCV3_CAP_NO_REQ (1 << 2)
@@ -8,13 +13,17 @@
 #define IRCV3_CAP_VERSION "302"
 
 #define IRCV3_CAPS_DEF \
-	X("account-notify", account_notify, IRCV3_CAP_AUTO) \
-	X("away-notify",    away_notify,    IRCV3_CAP_AUTO) \
-	X("chghost",        chghost,        IRCV3_CAP_AUTO) \
-	X("extended-join",  extended_join,  IRCV3_CAP_AUTO) \
-	X("invite-notify",  invite_notify,  IRCV3_CAP_AUTO) \
-	X("multi-prefix",   multi_prefix,   IRCV3_CAP_AUTO) \
-	X("sasl",           sasl,           IRCV3_CAP_AUTO)
+	X("account-notify",    account_notify, IRCV3_CAP_AUTO) \
+	X("away-notify",       away_notify,    IRCV3_CAP_AUTO) \
+	X("batch",             batch,          IRCV3_CAP_AUTO) \
+	X("chghost",           chghost,        IRCV3_CAP_AUTO) \
+	X("draft/chathistory", chathistory,    IRCV3_CAP_AUTO) \
+	X("extended-join",     extended_join,  IRCV3_CAP_AUTO) \
+	X("invite-notify",     invite_notify,  IRCV3_CAP_AUTO) \
+	X("message-tags",      message_tags,   IRCV3_CAP_AUTO) \
+	X("multi-prefix",      multi_prefix,   IRCV3_CAP_AUTO) \
+	X("sasl",              sasl,           IRCV3_CAP_AUTO) \
+	X("server-time",       server_time,    IRCV3_CAP_AUTO)
 
 /* Extended by testcases */
 #ifndef IRCV3_CAPS_TEST
@@ -60,11 +69,54 @@ struct ircv3_sasl
 	const char *pass;
 };
 
+struct ircv3_batch
+{
+	char *params;              /* batch type parameters */
+	char *ref;                 /* batch reference tag */
+	enum {
+		IRCV3_BATCH_OTHER,       /* no messages summarized */
+		IRCV3_BATCH_CHATHISTORY, /* PRIVMSG/NOTICEs deferred until closed */
+		IRCV3_BATCH_NETJOIN,     /* JOINs deferred until closed */
+		IRCV3_BATCH_NETSPLIT,    /* QUITs deferred until closed */
+	} type;
+	unsigned closed : 1;       /* deferred messages are being replayed */
+	size_t n_messages;
+	size_t size_messages;
+	struct irc_message **messages; /* other messages, replayed when closed */
+	size_t n_events;
+	size_t size;
+	struct ircv3_batch_event {
+		char *chan;
+		char *nick;
+		char *text;            /* chathistory message text */
+		char *host;            /* netjoin user@host, NULL if none */
+		char *account;         /* netjoin extended-join account, NULL if none */
+		char *realname;        /* netjoin extended-join realname, NULL if none */
+		uint64_t msgid;        /* chathistory msgid hash, 0 if none */
+		struct timespec time;  /* chathistory server-time, 0 if none */
+	} *events;
+	struct ircv3_batch *next;
+};
+
+struct ircv3_batches
+{
+	struct ircv3_batch *head;
+};
+
 struct ircv3_cap* ircv3_cap_get(struct ircv3_caps*, const char*);
 
 void ircv3_caps(struct ircv3_caps*);
 void ircv3_caps_reset(struct ircv3_caps*);
 
+struct ircv3_batch* ircv3_batch_add(struct ircv3_batches*, const char*, const char*, const char*);
+struct ircv3_batch* ircv3_batch_get(struct ircv3_batches*, const char*);
+void ircv3_batch_del(struct ircv3_batches*, struct ircv3_batch*);
+struct ircv3_batch_event* ircv3_batch_event(struct ircv3_batch*, const char*, const char*);
+void ircv3_batch_message(struct ircv3_batch*, const struct irc_message*);
+
+void ircv3_batches(struct ircv3_batches*);
+void ircv3_batches_reset(struct ircv3_batches*);
+
 void ircv3_sasl(struct ircv3_sasl*);
 void ircv3_sasl_reset(struct ircv3_sasl*);
 
@@ -8,6 +8,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <time.h>
 
 #define HANDLED_005 \
 	X(CASEMAPPING)  \
@@ -50,10 +51,13 @@ server(
 	s->mode = (mode ? irc_strdup(mode) : NULL);
 
 	s->casemapping = CASEMAPPING_RFC1459;
+	ircv3_batches(&(s->ircv3_batches));
 	ircv3_caps(&(s->ircv3_caps));
 	ircv3_sasl(&(s->ircv3_sasl));
 	mode_cfg(&(s->mode_cfg), NULL, MODE_CFG_DEFAULTS);
 
+	s->stats.t_start = server_lag_time();
+
 	s->channel = channel(host, CHANNEL_T_SERVER);
 	s->channel->server = s;
 	channel_list_add(&(s->clist), s->channel);
@@ -135,23 +139,168 @@ server_list_del(struct server_list *sl, struct server *s)
 	return s;
 }
 
+static void
+server_user_info_gc_users(struct server *s, struct channel *c, struct user *u)
+{
+	struct channel *t = s->channel;
+
+	if (u == NULL)
+		return;
+
+	server_user_info_gc_users(s, c, TREE_LEFT(u, ul));
+	server_user_info_gc_users(s, c, TREE_RIGHT(u, ul));
+
+	do {
+		if (t != c && user_list_get(&(t->users), s->casemapping, u->nick, 0))
+			return;
+	} while ((t = t->next) != s->channel);
+
+	user_info_del(&(s->user_info), s->casemapping, u->nick);
+}
+
+void
+server_user_info_gc(struct server *s, struct channel *c)
+{
+	/* Remove the cached info of a departing channel's users that
+	 * aren't on another common channel, before its users are freed */
+
+	server_user_info_gc_users(s, c, TREE_ROOT(&(c->users)));
+}
+
 void
 server_reset(struct server *s)
 {
+	ircv3_batches_reset(&(s->ircv3_batches));
 	ircv3_caps_reset(&(s->ircv3_caps));
 	ircv3_sasl_reset(&(s->ircv3_sasl));
 	memset(&(s->usermodes), 0, sizeof(s->usermodes));
 	memset(&(s->mode_str), 0, sizeof(s->mode_str));
+	user_info_free(&(s->user_info));
+	server_sendq_free(s);
+	s->lag.avg = 0;
+	s->lag.last = 0;
+	s->lag.n = 0;
+	s->lag.sent = 0;
 	s->ping = 0;
 	s->quitting = 0;
 	s->registered = 0;
+	s->who = 0;
+	s->whox = 0;
 	s->nicks.next = 0;
 }
 
+const unsigned server_lag_hist[SERVER_LAG_HIST_N - 1] = {
+	50, 100, 250, 500, 1000, 2000, 5000
+};
+
+int
+server_lag_pong(struct server *s, const char *token)
+{
+	/* Measure lag from a PONG echoing a probe's token, returns
+	 * non-zero if the token isn't a lag probe */
+
+	char *end;
+	size_t i;
+	uint64_t now = server_lag_time();
+	unsigned long long sent;
+	unsigned ms;
+
+	if (strncmp(token, SERVER_LAG_TOKEN, sizeof(SERVER_LAG_TOKEN) - 1))
+		return -1;
+
+	token += sizeof(SERVER_LAG_TOKEN) - 1;
+
+	if (!isdigit(*token))
+		return -1;
+
+	errno = 0;
+	sent = strtoull(token, &end, 10);
+
+	if (errno || *end || sent > now)
+		return -1;
+
+	ms = (unsigned) MIN((now - sent) / 1000000, 3600000);
+
+	/* Decay the average with weight 1/8 per measurement */
+	s->lag.avg = (s->lag.n ? ((s->lag.avg * 7) + ms) / 8 : ms);
+	s->lag.last = ms;
+	s->lag.n++;
+
+	for (i = 0; i < ARR_LEN(server_lag_hist) && ms >= server_lag_hist[i]; i++)
+		;
+
+	s->lag.hist[i]++;
+
+	return 0;
+}
+
+uint64_t
+server_lag_time(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+		fatal("clock_gettime: %s", strerror(errno));
+
+	return ((uint64_t)ts.tv_sec * 1000000000) + (uint64_t)ts.tv_nsec;
+}
+
+struct server_sendq_line*
+server_sendq_pop(struct server *s)
+{
+	struct server_sendq_line *line;
+
+	if ((line = s->sendq.head)) {
+		if (!(s->sendq.head = line->next))
+			s->sendq.tail = NULL;
+		s->sendq.n--;
+	}
+
+	return line;
+}
+
+void
+server_sendq_free(struct server *s)
+{
+	struct server_sendq_line *line;
+
+	while ((line = server_sendq_pop(s)))
+		free(line);
+
+	s->sendq.pending = 0;
+}
+
+void
+server_sendq_push(struct server *s, const char *target, const char *text)
+{
+	struct server_sendq_line *line;
+	size_t len_target = strlen(target);
+	size_t len_text = strlen(text);
+
+	if ((line = malloc(sizeof(*line) + len_target + len_text + 2)) == NULL)
+		fatal("malloc: %s", strerror(errno));
+
+	line->next = NULL;
+	line->target = memcpy(line->text + len_text + 1, target, len_target + 1);
+	memcpy(line->text, text, len_text + 1);
+
+	if (s->sendq.tail)
+		s->sendq.tail->next = line;
+	else
+		s->sendq.head = line;
+
+	s->sendq.tail = line;
+	s->sendq.n++;
+	s->stats.sendq_max = MAX(s->stats.sendq_max, s->sendq.n);
+}
+
 void
 server_free(struct server *s)
 {
 	channel_list_free(&(s->clist));
+	ircv3_batches_reset(&(s->ircv3_batches));
+	server_sendq_free(s);
+	user_info_free(&(s->user_info));
 
 	free((void *)s->host);
 	free((void *)s->port);
@@ -306,6 +455,12 @@ server_set_005(struct server *s, char *str)
 
 		int (*server_set)(struct server*, char*) = NULL;
 
+		if (!strcmp(opt.arg, "WHOX")) {
+			debug("Setting numeric 005 WHOX");
+			s->whox = 1;
+			continue;
+		}
+
 		#define X(cmd) \
 		if (!strcmp(opt.arg, #cmd)) \
 			server_set = server_set_##cmd;
@@ -5,10 +5,52 @@
 #include "src/components/channel.h"
 #include "src/components/ircv3.h"
 #include "src/components/mode.h"
+#include "src/components/user.h"
+
+#include <stdint.h>
 
 // TODO: move this to utils
 #define IRC_MESSAGE_LEN 510
 
+/* Lag probes are sent as PING :rirc-<monotonic ns> */
+#define SERVER_LAG_TOKEN "rirc-"
+#define SERVER_LAG_HIST_N 8
+
+/* Queued messages are sent in bursts, each followed by a PING
+ * pacing the next burst on the server's reply */
+#define SERVER_SENDQ_BURST 4
+#define SERVER_SENDQ_TOKEN "rirc-sendq"
+
+/* Received message counter slots, see irc_recv */
+#define SERVER_STATS_CMD_N 32
+
+struct server_sendq_line
+{
+	struct server_sendq_line *next;
+	char *target;
+	char text[];
+};
+
+struct server_lag
+{
+	uint64_t sent;  /* time of last probe sent, ns */
+	unsigned avg;   /* exponentially decayed lag, ms */
+	unsigned last;  /* last measured lag, ms */
+	unsigned n;     /* number of measurements */
+	unsigned hist[SERVER_LAG_HIST_N];
+};
+
+struct server_stats
+{
+	uint64_t t_start;   /* time counters started, monotonic ns */
+	unsigned sendq_max; /* send queue high water mark */
+	struct {
+		const char *name;
+		uint64_t n;
+		uint64_t ns; /* total handler time */
+	} cmd[SERVER_STATS_CMD_N];
+};
+
 struct server
 {
 	const char *host;
@@ -27,6 +69,7 @@ struct server
 	} nicks;
 	struct channel *channel;
 	struct channel_list clist;
+	struct ircv3_batches ircv3_batches;
 	struct ircv3_caps ircv3_caps;
 	struct ircv3_sasl ircv3_sasl;
 	struct mode usermodes;
@@ -34,17 +77,23 @@ struct server
 	struct mode_str mode_str;
 	struct server *next;
 	struct server *prev;
+	struct server_lag lag;
+	struct server_stats stats;
+	struct {
+		struct server_sendq_line *head;
+		struct server_sendq_line *tail;
+		unsigned n;
+		unsigned pending : 1; /* burst sent, awaiting PONG */
+	} sendq;
+	struct user_info_list user_info;
 	unsigned ping;
 	unsigned connected  : 1;
 	unsigned quitting   : 1;
 	unsigned registered : 1;
+	unsigned who        : 1; /* WHOX request pending */
+	unsigned whox       : 1; /* WHOX supported */
 	void *connection;
 	// TODO: move this to utils
-	struct {
-		size_t i;
-		char cl;
-		char buf[IRC_MESSAGE_LEN + 1]; /* callback message buffer */
-	} read;
 };
 
 struct server_list
@@ -72,9 +121,21 @@ void server_set_004(struct server*, char*);
 void server_set_005(struct server*, char*);
 void server_set_sasl(struct server*, const char*, const char*, const char*);
 
+/* Lag histogram bucket upper bounds, ms */
+extern const unsigned server_lag_hist[SERVER_LAG_HIST_N - 1];
+
+int server_lag_pong(struct server*, const char*);
+
+struct server_sendq_line* server_sendq_pop(struct server*);
+void server_sendq_free(struct server*);
+void server_sendq_push(struct server*, const char*, const char*);
+uint64_t server_lag_time(void);
+
 void server_nick_set(struct server*, const char*);
 void server_nicks_next(struct server*);
 
+void server_user_info_gc(struct server*, struct channel*);
+
 void server_reset(struct server*);
 void server_free(struct server*);
 
@@ -9,7 +9,13 @@ static inline int user_cmp(struct user*, struct user*, void *arg);
 static inline int user_ncmp(struct user*, struct user*, void *arg, size_t);
 static inline void user_free(struct user*);
 
+static struct user_info* user_info(const char*);
+static inline int user_info_cmp(struct user_info*, struct user_info*, void *arg);
+static inline int user_info_ncmp(struct user_info*, struct user_info*, void *arg, size_t);
+static inline void user_info_node_free(struct user_info*);
+
 AVL_GENERATE(user_list, user, ul, user_cmp, user_ncmp)
+AVL_GENERATE(user_info_list, user_info, ui, user_info_cmp, user_info_ncmp)
 
 static inline int
 user_cmp(struct user *u1, struct user *u2, void *arg)
@@ -119,3 +125,127 @@ user_list_free(struct user_list *ul)
 
 	memset(ul, 0, sizeof(*ul));
 }
+
+static inline int
+user_info_cmp(struct user_info *u1, struct user_info *u2, void *arg)
+{
+	return irc_strcmp(*(enum casemapping*)arg, u1->nick, u2->nick);
+}
+
+static inline int
+user_info_ncmp(struct user_info *u1, struct user_info *u2, void *arg, size_t n)
+{
+	return irc_strncmp(*(enum casemapping*)arg, u1->nick, u2->nick, n);
+}
+
+static inline void
+user_info_node_free(struct user_info *u)
+{
+	free(u->account);
+	free(u->away);
+	free(u->host);
+	free(u->realname);
+	free(u);
+}
+
+static struct user_info*
+user_info(const char *nick)
+{
+	size_t len = strlen(nick);
+	struct user_info *u;
+
+	if ((u = calloc(1, sizeof(*u) + len + 1)) == NULL)
+		fatal("calloc: %s", strerror(errno));
+
+	u->nick = memcpy(u->_, nick, len + 1);
+
+	return u;
+}
+
+struct user_info*
+user_info_add(struct user_info_list *uil, enum casemapping cm, const char *nick)
+{
+	/* Return a user's cached info, created if not found */
+
+	struct user_info *u;
+
+	if ((u = user_info_get(uil, cm, nick)) == NULL) {
+		AVL_ADD(user_info_list, uil, (u = user_info(nick)), &cm);
+		uil->count++;
+	}
+
+	return u;
+}
+
+enum user_err
+user_info_del(struct user_info_list *uil, enum casemapping cm, const char *nick)
+{
+	struct user_info *u;
+
+	if ((u = user_info_get(uil, cm, nick)) == NULL)
+		return USER_ERR_NOT_FOUND;
+
+	AVL_DEL(user_info_list, uil, u, &cm);
+	uil->count--;
+
+	user_info_node_free(u);
+
+	return USER_ERR_NONE;
+}
+
+enum user_err
+user_info_rpl(struct user_info_list *uil, enum casemapping cm, const char *nick_old, const char *nick_new)
+{
+	/* Replace a user's cached info by name, maintaining fields */
+
+	struct user_info *old, *new;
+
+	old = user_info_get(uil, cm, nick_old);
+	new = user_info_get(uil, cm, nick_new);
+
+	if (old == NULL)
+		return USER_ERR_NOT_FOUND;
+
+	/* allow nick to change case  */
+	if (new != NULL && irc_strcmp(cm, old->nick, new->nick))
+		return USER_ERR_DUPLICATE;
+
+	new = user_info(nick_new);
+	new->account  = old->account;
+	new->away     = old->away;
+	new->host     = old->host;
+	new->realname = old->realname;
+
+	AVL_DEL(user_info_list, uil, old, &cm);
+	AVL_ADD(user_info_list, uil, new, &cm);
+
+	free(old);
+
+	return USER_ERR_NONE;
+}
+
+struct user_info*
+user_info_get(struct user_info_list *uil, enum casemapping cm, const char *nick)
+{
+	struct user_info u = { .nick = nick };
+
+	return AVL_GET(user_info_list, uil, &u, &cm, 0);
+}
+
+void
+user_info_set(char **field, const char *val)
+{
+	/* Replace a cached info field, NULL to clear */
+
+	free(*field);
+
+	*field = (val ? irc_strdup(val) : NULL);
+}
+
+void
+user_info_free(struct user_info_list *uil)
+{
+	AVL_FOREACH(user_info_list, uil, user_info_node_free);
+
+	memset(uil, 0, sizeof(*uil));
+}
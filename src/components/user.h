@@ -27,10 +27,35 @@ struct user_list
 	unsigned count;
 };
 
+/* Per-server user metadata, NULL when unknown */
+struct user_info
+{
+	TREE_NODE(user_info) ui;
+	const char *nick;
+	char *account;  /* Services account, NULL if not logged in */
+	char *away;     /* Away message, NULL if not away */
+	char *host;     /* user@host */
+	char *realname;
+	char _[];
+};
+
+struct user_info_list
+{
+	TREE_HEAD(user_info);
+	unsigned count;
+};
+
 enum user_err user_list_add(struct user_list*, enum casemapping, const char*, struct mode);
 enum user_err user_list_del(struct user_list*, enum casemapping, const char*);
 enum user_err user_list_rpl(struct user_list*, enum casemapping, const char*, const char*);
 struct user* user_list_get(struct user_list*, enum casemapping, const char*, size_t);
 void user_list_free(struct user_list*);
 
+enum user_err user_info_del(struct user_info_list*, enum casemapping, const char*);
+enum user_err user_info_rpl(struct user_info_list*, enum casemapping, const char*, const char*);
+struct user_info* user_info_add(struct user_info_list*, enum casemapping, const char*);
+struct user_info* user_info_get(struct user_info_list*, enum casemapping, const char*);
+void user_info_set(char**, const char*);
+void user_info_free(struct user_info_list*);
+
 #endif
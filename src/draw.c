@@ -149,6 +149,9 @@ void
 draw_init(void)
 {
 	draw_state.drawing = 1;
+
+	/* Enable bracketed paste */
+	printf(CSI "?2004h");
 }
 
 void
@@ -156,6 +159,9 @@ draw_term(void)
 {
 	draw_state.drawing = 0;
 	draw_clear_full();
+
+	/* Disable bracketed paste */
+	printf(CSI "?2004l");
 }
 
 void
@@ -514,7 +520,7 @@ draw_buffer_line(
 		struct tm tm;
 		struct draw_attrs attrs = DRAW_ATTRS_EMPTY;
 
-		if (localtime_r(&(line->time), &tm)) {
+		if (localtime_r(&(line->time.tv_sec), &tm)) {
 			(void) snprintf(buf_h, sizeof(buf_h), "%02d", tm.tm_hour);
 			(void) snprintf(buf_m, sizeof(buf_h), "%02d", tm.tm_min);
 		}
@@ -1040,6 +1046,14 @@ draw_status(struct channel *c)
 			return;
 	}
 
+	/* -(lag) */
+	if (c->server && !c->server->ping && c->server->lag.n) {
+		if (!drawf(&attrs, &cols, STATUS_SEP_HORZ))
+			return;
+		if (!drawf(&attrs, &cols, "(lag %ums)", c->server->lag.avg))
+			return;
+	}
+
 	/* -(scrollback) */
 	if ((draw_buffer_scrollback_status(&c->buffer, scrollback, sizeof(scrollback)))) {
 		if (!drawf(&attrs, &cols, STATUS_SEP_HORZ))
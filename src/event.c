@@ -0,0 +1,536 @@
+#include "src/event.h"
+
+#include "src/utils/utils.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/* Subscribers connected at once, further connections are closed */
+#define EVENT_SUBS_MAX 8
+
+/* Bytes of pending output per subscriber, must be a power of 2 */
+#define EVENT_RING_LEN (1 << 16)
+
+/* Maximum length of a published event, longer fields are truncated */
+#define EVENT_LEN_MAX 4096
+
+#define PT_CF(X) \
+	do {                                            \
+		int _ptcf = (X);                            \
+		if (_ptcf != 0) {                           \
+			fatal("%s: %s", (#X), strerror(_ptcf)); \
+		}                                           \
+	} while (0)
+
+/* Single producer, single consumer ring of a subscriber's pending
+ * output. Slots are activated and deactivated by the writer
+ * thread, which owns an inactive slot's fields */
+struct event_sub
+{
+	atomic_size_t head;
+	char pad[64];
+	atomic_size_t tail;
+	atomic_int active;
+	unsigned dropped; /* events dropped before the next published */
+	int fd;
+	char buf[EVENT_RING_LEN];
+};
+
+static void *event_thread(void*);
+static void event_publish(enum event_type, const char*, const char*, const char*, const char*, unsigned);
+static void event_push(struct event_sub*, const char*, size_t);
+static size_t event_str(char*, size_t, const char*, const char*);
+static size_t event_utf8(const unsigned char*);
+static void event_sub_add(int);
+static void event_sub_del(struct event_sub*);
+static int event_sub_write(struct event_sub*);
+
+static const char *const event_type_strs[] = {
+#define X(TYPE, NAME) NAME,
+	EVENT_TYPES
+#undef X
+};
+
+static struct event_sub *event_subs;
+static atomic_int event_publishing;
+static atomic_int event_stop;
+static char *event_path;
+static int event_fd[2];
+static int event_soc = -1;
+static pthread_t event_tid;
+
+int
+event_init(const char *path)
+{
+	int err;
+	int soc;
+	mode_t mask;
+	struct sockaddr_un addr = {0};
+
+	if (!path || !*path)
+		return 0;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	/* Replace a socket left by an exited process, failing if another
+	 * process is still listening on it */
+	if ((soc = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return -1;
+
+	if (connect(soc, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+		close(soc);
+		errno = EADDRINUSE;
+		return -1;
+	}
+
+	if (errno == ECONNREFUSED)
+		unlink(path);
+
+	close(soc);
+
+	if ((event_soc = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return -1;
+
+	mask = umask(077);
+
+	if (bind(event_soc, (struct sockaddr *)&addr, sizeof(addr)) < 0
+	 || listen(event_soc, EVENT_SUBS_MAX) < 0
+	 || fcntl(event_soc, F_SETFD, FD_CLOEXEC) < 0
+	 || fcntl(event_soc, F_SETFL, O_NONBLOCK) < 0) {
+		err = errno;
+		umask(mask);
+		close(event_soc);
+		event_soc = -1;
+		errno = err;
+		return -1;
+	}
+
+	umask(mask);
+
+	if ((event_path = strdup(path)) == NULL)
+		fatal("strdup: %s", strerror(errno));
+
+	if ((event_subs = calloc(EVENT_SUBS_MAX, sizeof(*event_subs))) == NULL)
+		fatal("calloc: %s", strerror(errno));
+
+	if (pipe(event_fd) < 0)
+		fatal("pipe: %s", strerror(errno));
+
+	if (fcntl(event_fd[0], F_SETFL, O_NONBLOCK) < 0 || fcntl(event_fd[1], F_SETFL, O_NONBLOCK) < 0)
+		fatal("fcntl: %s", strerror(errno));
+
+	if (fcntl(event_fd[0], F_SETFD, FD_CLOEXEC) < 0 || fcntl(event_fd[1], F_SETFD, FD_CLOEXEC) < 0)
+		fatal("fcntl: %s", strerror(errno));
+
+	for (size_t i = 0; i < EVENT_SUBS_MAX; i++) {
+		atomic_init(&(event_subs[i].head), 0);
+		atomic_init(&(event_subs[i].tail), 0);
+		atomic_init(&(event_subs[i].active), 0);
+		event_subs[i].fd = -1;
+	}
+
+	atomic_init(&event_publishing, 0);
+	atomic_init(&event_stop, 0);
+
+	PT_CF(pthread_create(&event_tid, NULL, event_thread, NULL));
+
+	return 0;
+}
+
+void
+event_term(void)
+{
+	if (!event_subs)
+		return;
+
+	atomic_store(&event_stop, 1);
+
+	if (write(event_fd[1], "", 1) < 0)
+		debug("write: %s", strerror(errno));
+
+	PT_CF(pthread_join(event_tid, NULL));
+
+	for (size_t i = 0; i < EVENT_SUBS_MAX; i++) {
+		if (event_subs[i].fd >= 0)
+			close(event_subs[i].fd);
+	}
+
+	close(event_fd[0]);
+	close(event_fd[1]);
+	close(event_soc);
+	unlink(event_path);
+
+	free(event_path);
+	free(event_subs);
+
+	event_path = NULL;
+	event_subs = NULL;
+	event_soc = -1;
+}
+
+void
+event(enum event_type type, const char *host, const char *target, const char *nick, const char *text)
+{
+	event_publish(type, host, target, nick, text, 0);
+}
+
+void
+event_lag(const char *host, unsigned ms)
+{
+	event_publish(EVENT_LAG, host, NULL, NULL, NULL, ms);
+}
+
+static void
+event_publish(
+	enum event_type type,
+	const char *host,
+	const char *target,
+	const char *nick,
+	const char *text,
+	unsigned lag)
+{
+	/* Format the event once for all active subscribers, dropping it for
+	 * any without room rather than waiting. The writer thread waits
+	 * for this to return before reusing a deactivated slot */
+
+	char buf[EVENT_LEN_MAX];
+	int wake = 0;
+	size_t len = 0;
+
+	if (!event_subs)
+		return;
+
+	atomic_store(&event_publishing, 1);
+
+	for (size_t i = 0; i < EVENT_SUBS_MAX; i++) {
+
+		struct event_sub *sub = &(event_subs[i]);
+		size_t head;
+		size_t tail;
+
+		if (!atomic_load(&(sub->active)))
+			continue;
+
+		/* Fields are truncated to leave room for the lag and closing brace */
+		if (!len) {
+			len += (size_t)snprintf(buf, sizeof(buf), "{\"type\":\"%s\",\"time\":%lld",
+				event_type_strs[type], (long long)time(NULL));
+			len += event_str(buf + len, sizeof(buf) - len - 32, "host", host);
+			len += event_str(buf + len, sizeof(buf) - len - 32, "target", target);
+			len += event_str(buf + len, sizeof(buf) - len - 32, "nick", nick);
+			len += event_str(buf + len, sizeof(buf) - len - 32, "text", text);
+			if (type == EVENT_LAG)
+				len += (size_t)snprintf(buf + len, sizeof(buf) - len, ",\"ms\":%u", lag);
+			buf[len++] = '}';
+			buf[len++] = '\n';
+		}
+
+		head = atomic_load(&(sub->head));
+		tail = atomic_load(&(sub->tail));
+
+		if (sub->dropped) {
+
+			char dropped[64];
+			int n = snprintf(dropped, sizeof(dropped), "{\"type\":\"dropped\",\"count\":%u}\n", sub->dropped);
+
+			if (EVENT_RING_LEN - (tail - head) < (size_t)n + len) {
+				sub->dropped++;
+				continue;
+			}
+
+			event_push(sub, dropped, (size_t)n);
+			sub->dropped = 0;
+		}
+
+		if (EVENT_RING_LEN - (tail - head) < len) {
+			sub->dropped++;
+			continue;
+		}
+
+		event_push(sub, buf, len);
+
+		if (head == tail)
+			wake = 1;
+	}
+
+	atomic_store(&event_publishing, 0);
+
+	if (wake && write(event_fd[1], "", 1) < 0 && errno != EAGAIN)
+		debug("write: %s", strerror(errno));
+}
+
+static void
+event_push(struct event_sub *sub, const char *buf, size_t len)
+{
+	size_t tail = atomic_load(&(sub->tail));
+	size_t i = tail & (EVENT_RING_LEN - 1);
+	size_t n = MIN(len, EVENT_RING_LEN - i);
+
+	memcpy(sub->buf + i, buf, n);
+	memcpy(sub->buf, buf + n, len - n);
+
+	atomic_store(&(sub->tail), tail + len);
+}
+
+static size_t
+event_str(char *buf, size_t len, const char *key, const char *str)
+{
+	/* Append a JSON string field, escaping quotes, backslashes and
+	 * control characters, replacing bytes not part of a valid UTF-8
+	 * sequence with U+FFFD, and truncating the value to fit */
+
+	static const char hex[] = "0123456789abcdef";
+	size_t n;
+
+	if (!str)
+		return 0;
+
+	if ((n = (size_t)snprintf(buf, len, ",\"%s\":\"", key)) + 7 > len)
+		return 0;
+
+	for (; *str && n + 7 <= len; str++) {
+
+		unsigned char c = (unsigned char)*str;
+		size_t u;
+
+		if (c == '"' || c == '\\') {
+			buf[n++] = '\\';
+			buf[n++] = (char)c;
+		} else if (c < 0x20) {
+			buf[n++] = '\\';
+			buf[n++] = 'u';
+			buf[n++] = '0';
+			buf[n++] = '0';
+			buf[n++] = hex[c >> 4];
+			buf[n++] = hex[c & 0xf];
+		} else if (c < 0x80) {
+			buf[n++] = (char)c;
+		} else if ((u = event_utf8((const unsigned char *)str))) {
+			memcpy(buf + n, str, u);
+			n += u;
+			str += u - 1;
+		} else {
+			buf[n++] = (char)0xef;
+			buf[n++] = (char)0xbf;
+			buf[n++] = (char)0xbd;
+		}
+	}
+
+	buf[n++] = '"';
+
+	return n;
+}
+
+static size_t
+event_utf8(const unsigned char *str)
+{
+	/* Return the length of a valid UTF-8 sequence, or 0, rejecting
+	 * overlong encodings, surrogates and code points above U+10FFFF */
+
+	unsigned char lo = 0x80;
+	unsigned char hi = 0xbf;
+	size_t n;
+
+	if (str[0] >= 0xc2 && str[0] <= 0xdf)
+		n = 2;
+	else if (str[0] >= 0xe0 && str[0] <= 0xef)
+		n = 3;
+	else if (str[0] >= 0xf0 && str[0] <= 0xf4)
+		n = 4;
+	else
+		return 0;
+
+	if (str[0] == 0xe0)
+		lo = 0xa0;
+	if (str[0] == 0xed)
+		hi = 0x9f;
+	if (str[0] == 0xf0)
+		lo = 0x90;
+	if (str[0] == 0xf4)
+		hi = 0x8f;
+
+	if (str[1] < lo || str[1] > hi)
+		return 0;
+
+	for (size_t i = 2; i < n; i++) {
+		if ((str[i] & 0xc0) != 0x80)
+			return 0;
+	}
+
+	return n;
+}
+
+static void*
+event_thread(void *arg)
+{
+	/* Accept subscribers and write their pending output when woken
+	 * by a publish or when their sockets are writable */
+
+	struct pollfd fds[2 + EVENT_SUBS_MAX];
+	sigset_t sigset;
+
+	UNUSED(arg);
+
+	sigfillset(&sigset);
+	PT_CF(pthread_sigmask(SIG_BLOCK, &sigset, NULL));
+
+	fds[0].fd = event_soc;
+	fds[0].events = POLLIN;
+	fds[1].fd = event_fd[0];
+	fds[1].events = POLLIN;
+
+	while (!atomic_load(&event_stop)) {
+
+		char buf[64];
+
+		for (size_t i = 0; i < EVENT_SUBS_MAX; i++) {
+
+			struct event_sub *sub = &(event_subs[i]);
+
+			fds[i + 2].fd = sub->fd;
+			fds[i + 2].events = POLLIN;
+			fds[i + 2].revents = 0;
+
+			if (atomic_load(&(sub->head)) != atomic_load(&(sub->tail)))
+				fds[i + 2].events |= POLLOUT;
+		}
+
+		if (poll(fds, ARR_LEN(fds), -1) < 0) {
+			if (errno != EINTR)
+				fatal("poll: %s", strerror(errno));
+			continue;
+		}
+
+		while (read(event_fd[0], buf, sizeof(buf)) > 0)
+			continue;
+
+		if (fds[0].revents) {
+
+			int soc;
+
+			while ((soc = accept(event_soc, NULL, NULL)) >= 0)
+				event_sub_add(soc);
+		}
+
+		for (size_t i = 0; i < EVENT_SUBS_MAX; i++) {
+
+			struct event_sub *sub = &(event_subs[i]);
+
+			if (sub->fd < 0)
+				continue;
+
+			/* Subscribers aren't read from, input is discarded
+			 * to detect the socket closing */
+			if (fds[i + 2].revents & (POLLIN | POLLHUP | POLLERR)) {
+
+				ssize_t ret;
+
+				while ((ret = read(sub->fd, buf, sizeof(buf))) > 0)
+					continue;
+
+				if (ret == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+					event_sub_del(sub);
+					continue;
+				}
+			}
+
+			if (event_sub_write(sub) < 0)
+				event_sub_del(sub);
+		}
+	}
+
+	return NULL;
+}
+
+static void
+event_sub_add(int soc)
+{
+	struct event_sub *sub = NULL;
+
+	for (size_t i = 0; i < EVENT_SUBS_MAX && !sub; i++) {
+		if (event_subs[i].fd < 0)
+			sub = &(event_subs[i]);
+	}
+
+	if (!sub
+	 || fcntl(soc, F_SETFD, FD_CLOEXEC) < 0
+	 || fcntl(soc, F_SETFL, O_NONBLOCK) < 0) {
+		close(soc);
+		return;
+	}
+
+#ifdef SO_NOSIGPIPE
+	setsockopt(soc, SOL_SOCKET, SO_NOSIGPIPE, &(int){1}, sizeof(int));
+#endif
+
+	sub->fd = soc;
+	sub->dropped = 0;
+	atomic_store(&(sub->head), 0);
+	atomic_store(&(sub->tail), 0);
+	atomic_store(&(sub->active), 1);
+}
+
+static void
+event_sub_del(struct event_sub *sub)
+{
+	/* Deactivate the slot, then wait for any publish that may have
+	 * seen it active to return before it's reused */
+
+	atomic_store(&(sub->active), 0);
+
+	while (atomic_load(&event_publishing))
+		sched_yield();
+
+	close(sub->fd);
+	sub->fd = -1;
+}
+
+static int
+event_sub_write(struct event_sub *sub)
+{
+	/* Write pending output without blocking, returns -1 on error */
+
+	size_t head = atomic_load(&(sub->head));
+	size_t tail = atomic_load(&(sub->tail));
+
+	while (head != tail) {
+
+		size_t i = head & (EVENT_RING_LEN - 1);
+		size_t n = MIN(tail - head, EVENT_RING_LEN - i);
+		ssize_t ret;
+
+		if ((ret = send(sub->fd, sub->buf + i, n, MSG_NOSIGNAL)) < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+				break;
+			return -1;
+		}
+
+		head += (size_t)ret;
+		atomic_store(&(sub->head), head);
+	}
+
+	return 0;
+}
@@ -0,0 +1,55 @@
+#ifndef RIRC_EVENT_H
+#define RIRC_EVENT_H
+
+/* Event stream
+ *
+ * Events are published to subscribers connected on a UNIX socket,
+ * as one JSON object per line, e.g.:
+ *
+ *   {"type":"message","time":1609459200,"host":"irc.example.com",
+ *    "target":"#chan","nick":"nick","text":"hello"}
+ *
+ * with fields omitted when not applicable, and bytes not valid UTF-8
+ * replaced with U+FFFD. Each subscriber has a ring of pending output,
+ * written to its socket by a writer thread. Events are never waited
+ * on; when a subscriber's ring is full they're dropped for that
+ * subscriber, and the count dropped is published to it before its
+ * next event, as:
+ *
+ *   {"type":"dropped","count":3}
+ */
+
+#define EVENT_TYPES \
+	X(EVENT_CONNECT,    "connect")    \
+	X(EVENT_DISCONNECT, "disconnect") \
+	X(EVENT_JOIN,       "join")       \
+	X(EVENT_LAG,        "lag")        \
+	X(EVENT_MENTION,    "mention")    \
+	X(EVENT_MESSAGE,    "message")    \
+	X(EVENT_PART,       "part")
+
+enum event_type
+{
+#define X(TYPE, NAME) TYPE,
+	EVENT_TYPES
+#undef X
+	EVENT_T_SIZE
+};
+
+/* Start the writer thread, listening on the given UNIX socket path,
+ * returns -1 on failure, with EADDRINUSE if another process is
+ * listening on it ("": events disabled) */
+int event_init(const char*);
+
+/* Stop the writer thread, and remove the socket */
+void event_term(void);
+
+/* Publish an event to all subscribers, NULL fields are omitted, with args:
+ *   type, host, target, nick, text */
+void event(enum event_type, const char*, const char*, const char*, const char*);
+
+/* Publish a server's measured lag, with args:
+ *   host, lag in milliseconds */
+void event_lag(const char*, unsigned);
+
+#endif
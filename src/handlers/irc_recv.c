@@ -3,8 +3,10 @@
 #include "config.h"
 #include "src/components/server.h"
 #include "src/draw.h"
+#include "src/event.h"
 #include "src/handlers/irc_ctcp.h"
 #include "src/handlers/irc_recv.gperf.out"
+#include "src/handlers/irc_send.h"
 #include "src/handlers/ircv3.h"
 #include "src/io.h"
 #include "src/state.h"
@@ -26,6 +28,30 @@
 	         failf((S), "Send fail: %s", io_err(ret)); \
 	} while (0)
 
+/* Token identifying replies to WHOX requests sent by rirc */
+#define WHOX_TOKEN "745"
+
+/* Server stats slots for received messages, per handler and for
+ * messages handled otherwise */
+enum recv_stat
+{
+#define X(cmd) RECV_STAT_##cmd,
+	RECV_HANDLERS
+#undef X
+	RECV_STAT_BATCHED,
+	RECV_STAT_NUMERIC,
+	RECV_STAT_UNKNOWN,
+	RECV_STAT_N
+};
+
+_Static_assert(RECV_STAT_N <= SERVER_STATS_CMD_N, "SERVER_STATS_CMD_N");
+
+static const irc_recv_f recv_stat_handlers[] = {
+#define X(cmd) recv_##cmd,
+	RECV_HANDLERS
+#undef X
+};
+
 static int irc_generic(struct server*, struct irc_message*, const char*, const char*);
 static int irc_generic_error(struct server*, struct irc_message*);
 static int irc_generic_ignore(struct server*, struct irc_message*);
@@ -35,6 +61,12 @@ static int irc_recv_numeric(struct server*, struct irc_message*);
 static int irc_recv_threshold_filter(unsigned, unsigned);
 static int recv_mode_chanmodes(struct irc_message*, const struct mode_cfg*, struct server*, struct channel*);
 static int recv_mode_usermodes(struct irc_message*, const struct mode_cfg*, struct server*);
+static int recv_who_next(struct server*);
+static void recv_user_info_gc(struct server*, const char*);
+static int recv_ircv3_batch_chathistory(struct server*, struct ircv3_batch*);
+static int recv_ircv3_batch_event(struct server*, struct irc_message*, struct ircv3_batch*);
+static int recv_ircv3_batch_netjoin(struct server*, struct ircv3_batch*);
+static int recv_ircv3_batch_netsplit(struct server*, struct ircv3_batch*);
 
 /* List of explicitly handled IRC numeric replies */
 #define IRC_RECV_NUMERICS \
@@ -56,6 +88,7 @@ static int recv_mode_usermodes(struct irc_message*, const struct mode_cfg*, stru
 	X(312) /* RPL_WHOISSERVER */     \
 	X(313) /* RPL_WHOISOPERATOR */   \
 	X(314) /* RPL_WHOWASUSER */      \
+	X(315) /* RPL_ENDOFWHO */        \
 	X(317) /* RPL_WHOISIDLE */       \
 	X(319) /* RPL_WHOISCHANNELS */   \
 	X(320) /* RPL_WHOISSPECIAL */    \
@@ -68,6 +101,7 @@ static int recv_mode_usermodes(struct irc_message*, const struct mode_cfg*, stru
 	X(338) /* RPL_WHOISACTUALLY */   \
 	X(341) /* RPL_INVITING */        \
 	X(353) /* RPL_NAMEREPLY */       \
+	X(354) /* RPL_WHOSPCRPL */       \
 	X(366) /* RPL_ENDOFNAMES */      \
 	X(378) /* RPL_WHOISHOST */       \
 	X(379) /* RPL_WHOISMODES */      \
@@ -152,7 +186,7 @@ static const irc_recv_f irc_numerics[] = {
 	[312] = irc_recv_312,       /* RPL_WHOISSERVER */
 	[313] = irc_recv_313,       /* RPL_WHOISOPERATOR */
 	[314] = irc_recv_314,       /* RPL_WHOWASUSER */
-	[315] = irc_generic_ignore, /* RPL_ENDOFWHO */
+	[315] = irc_recv_315,       /* RPL_ENDOFWHO */
 	[317] = irc_recv_317,       /* RPL_WHOISIDLE */
 	[318] = irc_generic_ignore, /* RPL_ENDOFWHOIS */
 	[319] = irc_recv_319,       /* RPL_WHOISCHANNELS */
@@ -176,6 +210,7 @@ static const irc_recv_f irc_numerics[] = {
 	[351] = irc_generic_info,   /* RPL_VERSION */
 	[352] = irc_generic_info,   /* RPL_WHOREPLY */
 	[353] = irc_recv_353,       /* RPL_NAMEREPLY */
+	[354] = irc_recv_354,       /* RPL_WHOSPCRPL */
 	[364] = irc_generic_info,   /* RPL_LINKS */
 	[365] = irc_generic_ignore, /* RPL_ENDOFLINKS */
 	[366] = irc_recv_366,       /* RPL_ENDOFNAMES */
@@ -274,15 +309,55 @@ static unsigned threshold_quit    = FILTER_THRESHOLD_QUIT;
 int
 irc_recv(struct server *s, struct irc_message *m)
 {
-	const struct recv_handler* handler;
+	/* Messages are counted and timed per handler, in the server's
+	 * stats slot for the handler or the type of message */
 
-	if (isdigit(*m->command))
-		return irc_recv_numeric(s, m);
+	const char *name;
+	const char *ref;
+	const struct recv_handler* handler;
+	int ret;
+	size_t i;
+	struct ircv3_batch *batch;
+	uint64_t t = server_lag_time();
+
+	/* Messages of an open batch are deferred until it's closed, nested
+	 * batches are opened and closed as received */
+	if (s->ircv3_batches.head
+	 && (ref = irc_message_tag(m, "batch"))
+	 && (batch = ircv3_batch_get(&(s->ircv3_batches), ref))
+	 && !batch->closed
+	 && strcmp(m->command, "BATCH")) {
+		if ((batch->type == IRCV3_BATCH_CHATHISTORY && !strcmp(m->command, "PRIVMSG"))
+		 || (batch->type == IRCV3_BATCH_CHATHISTORY && !strcmp(m->command, "NOTICE"))
+		 || (batch->type == IRCV3_BATCH_NETJOIN && !strcmp(m->command, "JOIN"))
+		 || (batch->type == IRCV3_BATCH_NETSPLIT && !strcmp(m->command, "QUIT"))) {
+			ret = recv_ircv3_batch_event(s, m, batch);
+		} else {
+			ircv3_batch_message(batch, m);
+			ret = 0;
+		}
+		name = "[batched]";
+		i = RECV_STAT_BATCHED;
+	} else if (isdigit(*m->command)) {
+		ret = irc_recv_numeric(s, m);
+		name = "[numeric]";
+		i = RECV_STAT_NUMERIC;
+	} else if ((handler = recv_handler_lookup(m->command, m->len_command))) {
+		ret = handler->f(s, m);
+		name = handler->key;
+		for (i = 0; recv_stat_handlers[i] != handler->f; i++)
+			continue;
+	} else {
+		ret = irc_generic_unknown(s, m);
+		name = "[unknown]";
+		i = RECV_STAT_UNKNOWN;
+	}
 
-	if ((handler = recv_handler_lookup(m->command, m->len_command)))
-		return handler->f(s, m);
+	s->stats.cmd[i].name = name;
+	s->stats.cmd[i].n++;
+	s->stats.cmd[i].ns += server_lag_time() - t;
 
-	return irc_generic_unknown(s, m);
+	return ret;
 }
 
 static int
@@ -742,6 +817,20 @@ irc_recv_314(struct server *s, struct irc_message *m)
 	return 0;
 }
 
+static int
+irc_recv_315(struct server *s, struct irc_message *m)
+{
+	/* RPL_ENDOFWHO
+	 *
+	 * <mask> :End of WHO list */
+
+	UNUSED(m);
+
+	s->who = 0;
+
+	return recv_who_next(s);
+}
+
 static int
 irc_recv_317(struct server *s, struct irc_message *m)
 {
@@ -1149,6 +1238,67 @@ irc_recv_353(struct server *s, struct irc_message *m)
 	return 0;
 }
 
+static int
+irc_recv_354(struct server *s, struct irc_message *m)
+{
+	/* RPL_WHOSPCRPL
+	 *
+	 * Requested by rirc with fields %tcuhnfar, i.e.:
+	 *
+	 * <token> <channel> <user> <host> <nick> <flags> <account> :<realname> */
+
+	char *account;
+	char *channel;
+	char *flags;
+	char *host;
+	char *nick;
+	char *realname;
+	char *token;
+	char *user;
+	char userhost[IRC_MESSAGE_LEN + 1];
+	struct user_info *u;
+
+	if (!irc_message_param(m, &token) || strcmp(token, WHOX_TOKEN))
+		return irc_generic_info(s, m);
+
+	if (!irc_message_param(m, &channel))
+		failf(s, "RPL_WHOSPCRPL: channel is null");
+
+	if (!irc_message_param(m, &user))
+		failf(s, "RPL_WHOSPCRPL: user is null");
+
+	if (!irc_message_param(m, &host))
+		failf(s, "RPL_WHOSPCRPL: host is null");
+
+	if (!irc_message_param(m, &nick))
+		failf(s, "RPL_WHOSPCRPL: nick is null");
+
+	if (!irc_message_param(m, &flags))
+		failf(s, "RPL_WHOSPCRPL: flags is null");
+
+	if (!irc_message_param(m, &account))
+		failf(s, "RPL_WHOSPCRPL: account is null");
+
+	if (!irc_message_param(m, &realname))
+		failf(s, "RPL_WHOSPCRPL: realname is null");
+
+	u = user_info_add(&(s->user_info), s->casemapping, nick);
+
+	(void) snprintf(userhost, sizeof(userhost), "%s@%s", user, host);
+
+	user_info_set(&(u->host), userhost);
+	user_info_set(&(u->account), (strcmp(account, "0") ? account : NULL));
+	user_info_set(&(u->realname), realname);
+
+	/* Away message is unknown, keep it if already set */
+	if (*flags == 'H')
+		user_info_set(&(u->away), NULL);
+	else if (*flags == 'G' && !u->away)
+		user_info_set(&(u->away), "");
+
+	return 0;
+}
+
 static int
 irc_recv_366(struct server *s, struct irc_message *m)
 {
@@ -1162,10 +1312,17 @@ irc_recv_366(struct server *s, struct irc_message *m)
 	if (!irc_message_param(m, &chan))
 		failf(s, "RPL_NAMEREPLY: channel is null");
 
-	if ((c = channel_list_get(&s->clist, chan, s->casemapping)))
-		c->_366 = 1;
+	if ((c = channel_list_get(&s->clist, chan, s->casemapping)) == NULL)
+		return 0;
 
-	return 0;
+	c->_366 = 1;
+
+	if (!s->whox)
+		return 0;
+
+	c->who = 1;
+
+	return recv_who_next(s);
 }
 
 static int
@@ -1529,8 +1686,11 @@ recv_join(struct server *s, struct irc_message *m)
 	/* :nick!user@host JOIN <channel>
 	 * :nick!user@host JOIN <channel> <account> :<realname> */
 
+	char *account = NULL;
 	char *chan;
+	char *realname = NULL;
 	struct channel *c;
+	struct user_info *u;
 
 	if (!m->from)
 		failf(s, "JOIN: sender's nick is null");
@@ -1548,6 +1708,7 @@ recv_join(struct server *s, struct irc_message *m)
 		c->joined = 1;
 		c->parted = 0;
 		newlinef(c, BUFFER_LINE_JOIN, FROM_JOIN, "Joined %s", chan);
+		event(EVENT_JOIN, s->host, c->name, m->from, NULL);
 		sendf(s, "MODE %s", chan);
 		draw(DRAW_ALL);
 		return 0;
@@ -1563,22 +1724,33 @@ recv_join(struct server *s, struct irc_message *m)
 	if (user_list_add(&(c->users), s->casemapping, m->from, (struct mode){0}) == USER_ERR_DUPLICATE)
 		failf(s, "JOIN: user '%s' already on channel '%s'", m->from, chan);
 
+	event(EVENT_JOIN, s->host, c->name, m->from, NULL);
+
 	if (c == current_channel())
 		draw(DRAW_STATUS);
 
-	if (!filter) {
+	if (s->ircv3_caps.extended_join.set) {
 
-		if (s->ircv3_caps.extended_join.set) {
+		if (!irc_message_param(m, &account))
+			failf(s, "JOIN: account is null");
 
-			char *account;
-			char *realname;
+		if (!irc_message_param(m, &realname))
+			failf(s, "JOIN: realname is null");
+	}
 
-			if (!irc_message_param(m, &account))
-				failf(s, "JOIN: account is null");
+	u = user_info_add(&(s->user_info), s->casemapping, m->from);
 
-			if (!irc_message_param(m, &realname))
-				failf(s, "JOIN: realname is null");
+	if (m->host)
+		user_info_set(&(u->host), m->host);
 
+	if (s->ircv3_caps.extended_join.set) {
+		user_info_set(&(u->account), (strcmp(account, "*") ? account : NULL));
+		user_info_set(&(u->realname), realname);
+	}
+
+	if (!filter) {
+
+		if (s->ircv3_caps.extended_join.set) {
 			newlinef(c, BUFFER_LINE_JOIN, FROM_JOIN, "%s!%s has joined [%s - %s]",
 				m->from, m->host, account, realname);
 		} else {
@@ -1623,6 +1795,7 @@ recv_kick(struct server *s, struct irc_message *m)
 
 	if (!strcmp(user, s->nick)) {
 
+		server_user_info_gc(s, c);
 		channel_part(c);
 
 		if (message && *message)
@@ -1635,6 +1808,8 @@ recv_kick(struct server *s, struct irc_message *m)
 		if (user_list_del(&(c->users), s->casemapping, user) == USER_ERR_NOT_FOUND)
 			failf(s, "KICK: nick '%s' not found in '%s'", user, chan);
 
+		recv_user_info_gc(s, user);
+
 		if (message && *message)
 			newlinef(c, 0, FROM_INFO, "%s has kicked %s (%s)", m->from, user, message);
 		else
@@ -1876,6 +2051,9 @@ recv_nick(struct server *s, struct irc_message *m)
 		draw(DRAW_STATUS);
 	}
 
+	if (user_info_rpl(&(s->user_info), s->casemapping, m->from, nick) == USER_ERR_DUPLICATE)
+		user_info_del(&(s->user_info), s->casemapping, m->from);
+
 	do {
 		enum user_err ret;
 
@@ -1953,8 +2131,11 @@ recv_part(struct server *s, struct irc_message *m)
 			else
 				newlinef(c, BUFFER_LINE_PART, FROM_PART, "you have parted");
 
+			server_user_info_gc(s, c);
 			channel_part(c);
 		}
+
+		event(EVENT_PART, s->host, chan, m->from, message);
 	} else {
 		if ((c = channel_list_get(&s->clist, chan, s->casemapping)) == NULL)
 			failf(s, "PART: channel '%s' not found", chan);
@@ -1966,6 +2147,10 @@ recv_part(struct server *s, struct irc_message *m)
 		if (user_list_del(&(c->users), s->casemapping, m->from) == USER_ERR_NOT_FOUND)
 			failf(s, "PART: nick '%s' not found in '%s'", m->from, chan);
 
+		recv_user_info_gc(s, m->from);
+
+		event(EVENT_PART, s->host, c->name, m->from, message);
+
 		if (!filter) {
 
 			if (message && *message)
@@ -1998,10 +2183,26 @@ recv_ping(struct server *s, struct irc_message *m)
 static int
 recv_pong(struct server *s, struct irc_message *m)
 {
-	/* PONG <server> [<server2>] */
+	/* PONG <server> [<token>] */
 
-	UNUSED(s);
-	UNUSED(m);
+	char *server;
+	char *token;
+
+	if (!irc_message_param(m, &server))
+		failf(s, "PONG: server is null");
+
+	if (!irc_message_param(m, &token))
+		token = server;
+
+	if (!strcmp(token, SERVER_SENDQ_TOKEN)) {
+		s->sendq.pending = 0;
+		return irc_send_queue(s);
+	}
+
+	if (server_lag_pong(s, token) == 0) {
+		event_lag(s->host, s->lag.last);
+		draw(DRAW_STATUS);
+	}
 
 	return 0;
 }
@@ -2049,8 +2250,10 @@ recv_privmsg(struct server *s, struct irc_message *m)
 			urgent = 1;
 
 		newlinef(c, BUFFER_LINE_PINGED, m->from, "%s", message);
+		event(EVENT_MENTION, s->host, c->name, m->from, message);
 	} else {
 		newlinef(c, BUFFER_LINE_CHAT, m->from, "%s", message);
+		event(((c->type == CHANNEL_T_PRIVMSG) ? EVENT_MENTION : EVENT_MESSAGE), s->host, c->name, m->from, message);
 	}
 
 	if (urgent) {
@@ -2075,6 +2278,8 @@ recv_quit(struct server *s, struct irc_message *m)
 
 	irc_message_param(m, &message);
 
+	user_info_del(&(s->user_info), s->casemapping, m->from);
+
 	do {
 		/* QUIT decrements count, filter first */
 
@@ -2188,6 +2393,10 @@ recv_ircv3_account(struct server *s, struct irc_message *m)
 	if (!irc_message_param(m, &account))
 		failf(s, "ACCOUNT: account is null");
 
+	user_info_set(
+		&(user_info_add(&(s->user_info), s->casemapping, m->from)->account),
+		(strcmp(account, "*") ? account : NULL));
+
 	do {
 		if (irc_recv_threshold_filter(threshold_account, c->users.count))
 			continue;
@@ -2218,6 +2427,8 @@ recv_ircv3_away(struct server *s, struct irc_message *m)
 
 	irc_message_param(m, &message);
 
+	user_info_set(&(user_info_add(&(s->user_info), s->casemapping, m->from)->away), message);
+
 	do {
 		if (irc_recv_threshold_filter(threshold_away, c->users.count))
 			continue;
@@ -2235,6 +2446,334 @@ recv_ircv3_away(struct server *s, struct irc_message *m)
 	return 0;
 }
 
+static int
+recv_ircv3_batch(struct server *s, struct irc_message *m)
+{
+	/* :server BATCH +<reference> <type> [params]
+	 * :server BATCH -<reference> */
+
+	char *ref;
+	char *type;
+	const char *params;
+	const char *trailing;
+	int ret = 0;
+	struct ircv3_batch *b;
+
+	if (!irc_message_param(m, &ref))
+		failf(s, "BATCH: reference is null");
+
+	if (*ref == '+') {
+
+		if (!*(++ref))
+			failf(s, "BATCH: reference is empty");
+
+		if (!irc_message_param(m, &type))
+			failf(s, "BATCH: type is null");
+
+		irc_message_split(m, &params, &trailing);
+
+		if (!ircv3_batch_add(&(s->ircv3_batches), ref, type, (params ? params : trailing)))
+			failf(s, "BATCH: duplicate reference '%s'", ref);
+
+		return 0;
+	}
+
+	if (*ref == '-') {
+
+		if (!*(++ref))
+			failf(s, "BATCH: reference is empty");
+
+		if ((b = ircv3_batch_get(&(s->ircv3_batches), ref)) == NULL)
+			failf(s, "BATCH: reference '%s' not found", ref);
+
+		if (b->type == IRCV3_BATCH_CHATHISTORY)
+			ret = recv_ircv3_batch_chathistory(s, b);
+
+		if (b->type == IRCV3_BATCH_NETJOIN)
+			ret = recv_ircv3_batch_netjoin(s, b);
+
+		if (b->type == IRCV3_BATCH_NETSPLIT)
+			ret = recv_ircv3_batch_netsplit(s, b);
+
+		/* Replay other messages in the order received, after the
+		 * batch's summary */
+		b->closed = 1;
+
+		for (size_t i = 0; i < b->n_messages; i++)
+			(void) irc_recv(s, b->messages[i]);
+
+		ircv3_batch_del(&(s->ircv3_batches), b);
+
+		return ret;
+	}
+
+	failf(s, "BATCH: invalid reference '%s'", ref);
+}
+
+static int
+recv_ircv3_batch_chathistory(struct server *s, struct ircv3_batch *b)
+{
+	/* Prepend a page of fetched history to the target's buffer,
+	 * newest first, skipping messages already in the buffer.
+	 *
+	 * Messages are matched on a 64-bit hash of their msgid, a message
+	 * colliding with a buffered line's msgid is skipped as a duplicate;
+	 * at ~2^-64 per pair of lines this loss is accepted over storing
+	 * each line's msgid string */
+
+	char *params = b->params;
+	char *target;
+	struct channel *c;
+
+	if (!(target = irc_strsep(&params)))
+		failf(s, "BATCH: chathistory target is null");
+
+	if ((c = channel_list_get(&(s->clist), target, s->casemapping)) == NULL)
+		failf(s, "BATCH: chathistory target '%s' not found", target);
+
+	c->history = 0;
+
+	for (size_t i = b->n_events; i--;) {
+
+		enum buffer_line_type type;
+		struct buffer *buffer = &(c->buffer);
+		struct buffer_line *line = NULL;
+		struct ircv3_batch_event *e = &(b->events[i]);
+
+		if (e->msgid) {
+			for (unsigned j = buffer->tail; j != buffer->head; j++) {
+				if ((line = buffer_line(buffer, j))->msgid == e->msgid)
+					break;
+				line = NULL;
+			}
+		}
+
+		if (line)
+			continue;
+
+		if (!strcmp(e->nick, s->nick))
+			type = BUFFER_LINE_CHAT_RIRC;
+		else if (irc_pinged(s->casemapping, e->text, s->nick))
+			type = BUFFER_LINE_PINGED;
+		else
+			type = BUFFER_LINE_CHAT;
+
+		line = newline_prepend(
+			c,
+			type,
+			e->nick,
+			e->text,
+			strlen(e->nick),
+			strlen(e->text),
+			(e->time.tv_sec ? &(e->time) : NULL));
+
+		if (!line)
+			break;
+
+		line->msgid = e->msgid;
+	}
+
+	if (c == current_channel()) {
+		draw(DRAW_BUFFER);
+		draw(DRAW_STATUS);
+	}
+
+	return 0;
+}
+
+static int
+recv_ircv3_batch_event(struct server *s, struct irc_message *m, struct ircv3_batch *b)
+{
+	/* Defer a chathistory message, netjoin JOIN or netsplit QUIT until
+	 * the batch is closed, to be applied and summarized in a single pass */
+
+	char *chan = NULL;
+
+	if (!m->from)
+		failf(s, "%s: sender's nick is null", m->command);
+
+	if (b->type == IRCV3_BATCH_CHATHISTORY) {
+
+		char *message;
+		char *target;
+		const char *from = m->from;
+		const char *tag;
+		char text[TEXT_LENGTH_MAX + 1];
+		struct ircv3_batch_event *e;
+
+		if (!irc_message_param(m, &target))
+			failf(s, "%s: target is null", m->command);
+
+		if (!irc_message_param(m, &message))
+			failf(s, "%s: message is null", m->command);
+
+		/* Of CTCP messages, only ACTION is shown from history */
+		if (IS_CTCP(message)) {
+
+			char *p;
+
+			if (strncmp(message + 1, "ACTION", 6))
+				return 0;
+
+			message += 7;
+
+			if ((p = strchr(message, 0x01)))
+				*p = 0;
+
+			if (irc_strtrim(&message))
+				snprintf(text, sizeof(text), "%s %s", m->from, message);
+			else
+				snprintf(text, sizeof(text), "%s", m->from);
+
+			from = "*";
+			message = text;
+		}
+
+		e = ircv3_batch_event(b, from, NULL);
+		e->text = irc_strdup(message);
+
+		if ((tag = irc_message_tag(m, "msgid")))
+			e->msgid = irc_strhash(tag);
+
+		if ((tag = irc_message_tag(m, "time")))
+			irc_strtime(tag, &(e->time));
+
+		return 0;
+	}
+
+	if (b->type == IRCV3_BATCH_NETJOIN) {
+
+		char *account = NULL;
+		char *realname = NULL;
+		struct ircv3_batch_event *e;
+
+		if (!irc_message_param(m, &chan))
+			failf(s, "JOIN: channel is null");
+
+		if (s->ircv3_caps.extended_join.set) {
+
+			if (!irc_message_param(m, &account))
+				failf(s, "JOIN: account is null");
+
+			if (!irc_message_param(m, &realname))
+				failf(s, "JOIN: realname is null");
+		}
+
+		e = ircv3_batch_event(b, m->from, chan);
+		e->host = (m->host ? irc_strdup(m->host) : NULL);
+		e->account = (account ? irc_strdup(account) : NULL);
+		e->realname = (realname ? irc_strdup(realname) : NULL);
+
+		return 0;
+	}
+
+	ircv3_batch_event(b, m->from, chan);
+
+	return 0;
+}
+
+static int
+recv_ircv3_batch_netjoin(struct server *s, struct ircv3_batch *b)
+{
+	char nicks[TEXT_LENGTH_MAX + 1];
+	struct channel *c = s->channel;
+	struct user_info *u;
+
+	do {
+		int filter;
+		size_t len = 0;
+		unsigned n = 0;
+
+		if (c->type != CHANNEL_T_CHANNEL)
+			continue;
+
+		/* JOIN increments count, filter first */
+
+		filter = irc_recv_threshold_filter(threshold_join, c->users.count);
+
+		for (size_t i = 0; i < b->n_events; i++) {
+
+			struct ircv3_batch_event *e = &(b->events[i]);
+
+			if (irc_strcmp(s->casemapping, e->chan, c->name))
+				continue;
+
+			if (user_list_add(&(c->users), s->casemapping, e->nick, (struct mode){0}) == USER_ERR_DUPLICATE)
+				continue;
+
+			u = user_info_add(&(s->user_info), s->casemapping, e->nick);
+
+			if (e->host)
+				user_info_set(&(u->host), e->host);
+
+			if (e->realname) {
+				user_info_set(&(u->account), (strcmp(e->account, "*") ? e->account : NULL));
+				user_info_set(&(u->realname), e->realname);
+			}
+
+			if (n++ == 0)
+				*nicks = 0;
+
+			if (len < sizeof(nicks)) {
+				int ret = snprintf(nicks + len, sizeof(nicks) - len, "%s%s", (len ? " " : ""), e->nick);
+				len += (ret > 0 ? ret : 0);
+			}
+		}
+
+		if (n && !filter)
+			newlinef(c, BUFFER_LINE_JOIN, FROM_JOIN, "Netjoin [%s], %u joined: %s", b->params, n, nicks);
+
+	} while ((c = c->next) != s->channel);
+
+	draw(DRAW_STATUS);
+
+	return 0;
+}
+
+static int
+recv_ircv3_batch_netsplit(struct server *s, struct ircv3_batch *b)
+{
+	char nicks[TEXT_LENGTH_MAX + 1];
+	struct channel *c = s->channel;
+
+	do {
+		int filter;
+		size_t len = 0;
+		unsigned n = 0;
+
+		/* QUIT decrements count, filter first */
+
+		filter = irc_recv_threshold_filter(threshold_quit, c->users.count);
+
+		for (size_t i = 0; i < b->n_events; i++) {
+
+			struct ircv3_batch_event *e = &(b->events[i]);
+
+			if (user_list_del(&(c->users), s->casemapping, e->nick) == USER_ERR_NOT_FOUND)
+				continue;
+
+			if (n++ == 0)
+				*nicks = 0;
+
+			if (len < sizeof(nicks)) {
+				int ret = snprintf(nicks + len, sizeof(nicks) - len, "%s%s", (len ? " " : ""), e->nick);
+				len += (ret > 0 ? ret : 0);
+			}
+		}
+
+		if (n && !filter)
+			newlinef(c, BUFFER_LINE_QUIT, FROM_QUIT, "Netsplit [%s], %u quit: %s", b->params, n, nicks);
+
+	} while ((c = c->next) != s->channel);
+
+	for (size_t i = 0; i < b->n_events; i++)
+		recv_user_info_gc(s, b->events[i].nick);
+
+	draw(DRAW_STATUS);
+
+	return 0;
+}
+
 static int
 recv_ircv3_chghost(struct server *s, struct irc_message *m)
 {
@@ -2253,6 +2792,12 @@ recv_ircv3_chghost(struct server *s, struct irc_message *m)
 	if (!irc_message_param(m, &host))
 		failf(s, "CHGHOST: host is null");
 
+	char userhost[IRC_MESSAGE_LEN + 1];
+
+	(void) snprintf(userhost, sizeof(userhost), "%s@%s", user, host);
+
+	user_info_set(&(user_info_add(&(s->user_info), s->casemapping, m->from)->host), userhost);
+
 	do {
 		if (irc_recv_threshold_filter(threshold_chghost, c->users.count))
 			continue;
@@ -2267,6 +2812,44 @@ recv_ircv3_chghost(struct server *s, struct irc_message *m)
 	return 0;
 }
 
+static int
+recv_who_next(struct server *s)
+{
+	/* Send the next queued WHOX request, pacing requests
+	 * to one pending at a time, until RPL_ENDOFWHO */
+
+	struct channel *c = s->channel;
+
+	if (s->who)
+		return 0;
+
+	do {
+		if (c->who) {
+			c->who = 0;
+			s->who = 1;
+			sendf(s, "WHO %s %%tcuhnfar," WHOX_TOKEN, c->name);
+			break;
+		}
+	} while ((c = c->next) != s->channel);
+
+	return 0;
+}
+
+static void
+recv_user_info_gc(struct server *s, const char *nick)
+{
+	/* Remove a user's cached info when no longer on a common channel */
+
+	struct channel *c = s->channel;
+
+	do {
+		if (user_list_get(&(c->users), s->casemapping, nick, 0))
+			return;
+	} while ((c = c->next) != s->channel);
+
+	user_info_del(&(s->user_info), s->casemapping, nick);
+}
+
 static int
 irc_recv_threshold_filter(unsigned filter, unsigned count)
 {
@@ -83,6 +83,38 @@ irc_send_message(struct server *s, struct channel *c, const char *m)
 	return 0;
 }
 
+int
+irc_send_queue(struct server *s)
+{
+	/* Send the next burst of queued messages, followed by a PING
+	 * pacing the next burst on the server's reply. Messages to
+	 * channels no longer open are dropped */
+
+	struct channel *c;
+	struct server_sendq_line *line;
+	unsigned n = 0;
+
+	if (s->sendq.pending)
+		return 0;
+
+	while (n < SERVER_SENDQ_BURST && (line = server_sendq_pop(s))) {
+
+		if ((c = channel_list_get(&(s->clist), line->target, s->casemapping))) {
+			irc_send_message(s, c, line->text);
+			n++;
+		}
+
+		free(line);
+	}
+
+	if (n && s->sendq.n) {
+		sendf(s, s->channel, "PING :%s", SERVER_SENDQ_TOKEN);
+		s->sendq.pending = 1;
+	}
+
+	return 0;
+}
+
 static const char*
 irc_send_args(struct channel *c, char *m, enum channel_type type)
 {
@@ -6,5 +6,6 @@
 
 int irc_send_command(struct server*, struct channel*, char*);
 int irc_send_message(struct server*, struct channel*, const char*);
+int irc_send_queue(struct server*);
 
 #endif
@@ -13,28 +13,39 @@
 #include "mbedtls/net_sockets.h"
 #include "mbedtls/ssl.h"
 #include "mbedtls/x509_crt.h"
+#include "psa/crypto.h"
 
 #include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <poll.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 
 /* RFC 2812, section 2.3 */
 #define IO_MESG_LEN 510
 
 #ifndef IO_PING_MIN
-#define IO_PING_MIN 150
+#define IO_PING_MIN 60
 #elif (IO_PING_MIN < 0 || IO_PING_MIN > 86400)
 #error "IO_PING_MIN: [0, 86400]"
 #endif
@@ -46,11 +57,57 @@
 #endif
 
 #ifndef IO_PING_MAX
-#define IO_PING_MAX 300
+#define IO_PING_MAX 90
 #elif (IO_PING_MAX < 0 || IO_PING_MAX > 86400)
 #error "IO_PING_MAX: [0, 86400]"
 #endif
 
+#ifndef IO_CONNECT_TIMEOUT
+#define IO_CONNECT_TIMEOUT 30
+#elif (IO_CONNECT_TIMEOUT < 1 || IO_CONNECT_TIMEOUT > 86400)
+#error "IO_CONNECT_TIMEOUT: [1, 86400]"
+#endif
+
+#ifndef IO_CONNECT_DELAY
+#define IO_CONNECT_DELAY 250
+#elif (IO_CONNECT_DELAY < 10 || IO_CONNECT_DELAY > 2000)
+#error "IO_CONNECT_DELAY: [10, 2000]"
+#endif
+
+#ifndef IO_DNS_CACHE_MAX_AGE
+#define IO_DNS_CACHE_MAX_AGE 300
+#elif (IO_DNS_CACHE_MAX_AGE < 0 || IO_DNS_CACHE_MAX_AGE > 86400)
+#error "IO_DNS_CACHE_MAX_AGE: [0, 86400]"
+#endif
+
+/* Maximum number of resolved addresses attempted */
+#define IO_CONNECT_ADDR_MAX 16
+
+/* Interval for checking cancellation while waiting on the resolver */
+#define IO_DNS_WAIT_NS 100000000
+
+/* Connection event ring slots, and slots reserved for state events */
+#define IO_EV_RING_N    64
+#define IO_EV_RESERVE_N 8
+
+/* Interval for checking cancellation while waiting on a full event ring */
+#define IO_EV_WAIT_NS 1000000
+
+/* Events dispatched per connection per pass, and the time
+ * slice for dispatching events before checking input */
+#define IO_EV_BATCH_N  8
+#define IO_EV_SLICE_US 5000
+
+/* Attached client messages, a type and payload length byte followed
+ * by the payload */
+#define IO_CLIENT_MSG_INP 'i' /* terminal input */
+#define IO_CLIENT_MSG_WS  'w' /* terminal columns and rows */
+#define IO_CLIENT_MSG_MAX (2 + UCHAR_MAX)
+
+/* Socket buffer size for output to an attached client. Output written
+ * while it's full is dropped, and the client redrawn once writable */
+#define IO_CLIENT_SNDBUF (1 << 18)
+
 #ifndef IO_RECONNECT_BACKOFF_BASE
 #define IO_RECONNECT_BACKOFF_BASE 4
 #elif (IO_RECONNECT_BACKOFF_BASE < 1 || IO_RECONNECT_BACKOFF_BASE > 86400)
@@ -80,27 +137,16 @@
 #define PT_LK(X) PT_CF(pthread_mutex_lock((X)))
 #define PT_UL(X) PT_CF(pthread_mutex_unlock((X)))
 
-/* IO callback */
-#define IO_CB(C, X) \
-	do { \
-		int callback = 1; \
-		if (((struct connection *)(C))) { \
-			PT_LK(&(((struct connection *)(C))->mtx)); \
-			callback = ((struct connection *)(C))->callback; \
-			PT_UL(&(((struct connection *)(C))->mtx)); \
-		} \
-		if (((struct connection *)(C)) && callback) { \
-			PT_LK(&io_cb_mutex); \
-			(X); \
-			PT_UL(&io_cb_mutex); \
-		} \
-	} while (0)
+/* IO callback events, queued by connection threads */
+#define io_cxed(C)       io_ev_push((C), IO_EV_CXED, 0)
+#define io_dxed(C)       io_ev_push((C), IO_EV_DXED, 0)
+#define io_error(C, ...) io_ev_pushf((C), IO_EV_ERROR, __VA_ARGS__)
+#define io_info(C, ...)  io_ev_pushf((C), IO_EV_INFO, __VA_ARGS__)
+#define io_ping(C, P)    io_ev_push((C), IO_EV_PING, (P))
 
-#define io_cxed(C)       IO_CB(C, io_cb_cxed((C)->obj))
-#define io_dxed(C)       IO_CB(C, io_cb_dxed((C)->obj))
-#define io_error(C, ...) IO_CB(C, io_cb_error((C)->obj,  __VA_ARGS__))
-#define io_info(C, ...)  IO_CB(C, io_cb_info((C)->obj, __VA_ARGS__))
-#define io_ping(C, P)    IO_CB(C, io_cb_ping((C)->obj, P))
+/* Traffic counters are updated by the connection's thread, or the
+ * io_start thread for sent lines, and read without synchronization */
+#define io_stat(C, S, N) atomic_fetch_add_explicit(&((C)->stats.S), (N), memory_order_relaxed)
 
 /* state transition */
 #define ST_X(OLD, NEW) (((OLD) << 3) | (NEW))
@@ -112,11 +158,71 @@ enum io_err
 	IO_ERR_CXNG,
 	IO_ERR_DXED,
 	IO_ERR_FMT,
+	IO_ERR_PING,
+	IO_ERR_SOCKET,
 	IO_ERR_SSL_WRITE,
 	IO_ERR_THREAD,
 	IO_ERR_TRUNC,
 };
 
+struct io_addr
+{
+	int family;
+	int protocol;
+	int socktype;
+	socklen_t len;
+	struct sockaddr_storage addr;
+};
+
+struct io_dns
+{
+	char *host;
+	char *port;
+	char err[128];  /* last resolver error */
+	int family;
+	pthread_cond_t cnd;
+	size_t n_addrs;
+	struct io_addr addrs[IO_CONNECT_ADDR_MAX];
+	struct io_dns *next;
+	uint64_t time;  /* time of last successful resolution */
+	unsigned pending : 1;
+};
+
+struct io_ev
+{
+	enum io_ev_type {
+		IO_EV_CXED,
+		IO_EV_DXED,
+		IO_EV_ERROR,
+		IO_EV_INFO,
+		IO_EV_MESG,
+		IO_EV_PING,
+	} type;
+	struct irc_message m; /* spans into buf */
+	unsigned ping;
+	char buf[IRC_MESSAGE_TAGS_LEN + IO_MESG_LEN + 1];
+};
+
+/* Single producer, single consumer event ring. The connection thread
+ * advances the tail and the io_start thread advances the head */
+struct io_ev_ring
+{
+	atomic_size_t head;
+	char pad[64]; /* keep head and tail on separate cache lines */
+	atomic_size_t tail;
+	struct io_ev evs[IO_EV_RING_N];
+};
+
+struct io_tls_ca
+{
+	char *path;
+	mbedtls_x509_crt crt;
+	struct io_tls_ca *next;
+	time_t mtime;
+	unsigned refs;
+	unsigned stale : 1;
+};
+
 struct connection
 {
 	const void *obj;
@@ -134,28 +240,58 @@ struct connection
 		IO_ST_PING, /* Socket connected, network state in question */
 	} st_cur, /* current thread state */
 	  st_new; /* new thread state */
-	mbedtls_ctr_drbg_context tls_ctr_drbg;
-	mbedtls_entropy_context tls_entropy;
 	mbedtls_net_context net_ctx;
 	mbedtls_pk_context tls_pk_ctx;
 	mbedtls_ssl_config tls_conf;
 	mbedtls_ssl_context tls_ctx;
-	mbedtls_x509_crt tls_x509_crt_ca;
+	mbedtls_ssl_session tls_session; /* retained for resumption on reconnect */
 	mbedtls_x509_crt tls_x509_crt_client;
 	pthread_mutex_t mtx;
+	struct connection *next;
+	struct io_ev_ring ev;
+	struct {
+		size_t i;
+		char cl;
+		char buf[IRC_MESSAGE_TAGS_LEN + IO_MESG_LEN + 1];
+	} read;
+	struct io_tls_ca *tls_ca;
+	struct {
+		atomic_uint_least64_t bytes_in;
+		atomic_uint_least64_t bytes_out;
+		atomic_uint_least64_t lines_in;
+		atomic_uint_least64_t lines_out;
+		atomic_uint_least64_t parse_err;
+	} stats;
 	pthread_t tid;
 	uint32_t flags;
 	unsigned ping;
+	unsigned ping_max;
+	unsigned ping_min;
 	unsigned rx_sleep;
 	unsigned callback : 1;
+	unsigned detach : 1; /* socket kept open when stopped, see io_cx_detach */
+	unsigned tls_session_set : 1;
 };
 
 static enum io_state io_state_cxed(struct connection*);
 static enum io_state io_state_cxng(struct connection*);
 static enum io_state io_state_ping(struct connection*);
 static enum io_state io_state_rxng(struct connection*);
-static int io_cx_read(struct connection*, uint32_t);
+static int io_client_winsize(int);
+static void io_cx_close(struct connection*);
+static int io_cx_detaching(struct connection*);
+static int io_cx_frame(struct connection*, const char*, size_t);
+static int io_cx_read(struct connection*, int);
+static int io_fd_write(int, const void*, size_t);
+static int io_unix_addr(struct sockaddr_un*, const char*);
+static ssize_t io_client_recv(void);
+static void io_client_accept(void);
+static void io_client_close(void);
+static void io_client_forward(int, int, int);
+static void io_client_resume(void);
+static void io_client_stall(void);
 static void io_fatal(const char*, int);
+static void io_latency_add(uint64_t);
 static void io_sig_handle(int);
 static void io_sig_init(void);
 static void io_tty_init(void);
@@ -163,19 +299,71 @@ static void io_tty_term(void);
 static void io_tty_winsize(void);
 static void* io_thread(void*);
 
+static int io_ev_drain(uint64_t);
+static struct io_ev* io_ev_next(struct connection*, size_t);
+static void io_ev_clear(void);
+static void io_ev_commit(struct connection*);
+static void io_ev_dispatch(struct connection*, struct io_ev*);
+static void io_ev_init(void);
+static void io_ev_push(struct connection*, enum io_ev_type, unsigned);
+static void io_ev_pushf(struct connection*, enum io_ev_type, const char*, ...);
+static void io_ev_wake(void);
+
 static int io_running;
-static pthread_mutex_t io_cb_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int io_client_fd = -1; /* attached client, daemon mode */
+static int io_client_stalled; /* attached client's output dropped until writable */
+static int io_client_tty;     /* attached client's terminal size received */
+static int io_daemon_fd = -1; /* listening socket, daemon mode */
+static int io_tty_atexit;
+static int io_tty_initialized;
+static size_t io_client_len;
+static unsigned char io_client_buf[IO_CLIENT_MSG_MAX];
+static unsigned short io_client_ws[2];
+static int io_ev_fd[2] = { -1, -1 }; /* event wakeup, read and write ends */
+static struct connection *io_cx_list;
+static struct io_latency io_latency_stats;
 static struct termios term;
 static volatile sig_atomic_t flag_sigwinch_cb; /* sigwinch callback */
 
+/* DNS cache shared by all connections */
+static pthread_mutex_t io_dns_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct io_dns *io_dns_list;
+
+/* TLS state shared by all connections. The PSA key store in mbedtls 3.4
+ * isn't thread-safe, calls that create or destroy keys (setup, handshake,
+ * free) and the shared CA chains are serialised by io_tls_mutex, which is
+ * released while blocked on socket IO. Once established, reads and writes
+ * only use the connection's own keys and the DRBG's internal mutex, and
+ * aren't serialised */
+static int io_tls_initialized;
+static mbedtls_ctr_drbg_context io_tls_ctr_drbg;
+static mbedtls_entropy_context io_tls_entropy;
+static pthread_mutex_t io_tls_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct io_tls_ca *io_tls_ca_list;
+
 static const char* io_strerror(char*, size_t);
-static int io_net_connect(struct connection*);
+static int io_net_connect(struct connection*, uint64_t);
+static size_t io_net_resolve(struct connection*, struct io_addr*);
+static uint64_t io_clock_ms(void);
+static uint64_t io_clock_us(void);
+static void io_dns_addr(struct io_addr*, const struct addrinfo*);
+static void* io_dns_thread(void*);
 static void io_net_close(int);
+static void io_net_keepalive(struct connection*, int);
 
 /* TLS */
 static const char* io_tls_err(int);
+static int io_tls_ca_load(struct connection*);
 static int io_tls_establish(struct connection*);
+static int io_tls_init(void);
+static int io_tls_recv(void*, unsigned char*, size_t);
+static int io_tls_send(void*, const unsigned char*, size_t);
+static int io_tls_session_save(struct connection*);
 static int io_tls_x509_vrfy(struct connection*);
+static struct io_tls_ca* io_tls_ca_get(const char*, int, int*);
+static void io_tls_ca_free(struct io_tls_ca*);
+static void io_tls_ca_release(struct io_tls_ca**);
+static void io_tls_session_reset(struct connection*);
 #ifndef NDEBUG
 static void io_tls_debug(void*, int, const char*, int, const char*);
 #endif
@@ -214,11 +402,65 @@ connection(
 	cx->st_cur = IO_ST_DXED;
 	cx->st_new = IO_ST_INVALID;
 	cx->callback = 1;
+	cx->ping_max = IO_PING_MAX;
+	cx->ping_min = IO_PING_MIN;
+	atomic_init(&(cx->ev.head), 0);
+	atomic_init(&(cx->ev.tail), 0);
+	atomic_init(&(cx->stats.bytes_in), 0);
+	atomic_init(&(cx->stats.bytes_out), 0);
+	atomic_init(&(cx->stats.lines_in), 0);
+	atomic_init(&(cx->stats.lines_out), 0);
+	atomic_init(&(cx->stats.parse_err), 0);
+	mbedtls_ssl_session_init(&(cx->tls_session));
 	PT_CF(pthread_mutex_init(&(cx->mtx), NULL));
 
+	cx->next = io_cx_list;
+	io_cx_list = cx;
+
 	return cx;
 }
 
+void
+io_cx_cfg(struct connection *cx, struct io_cx_cfg *cfg)
+{
+	PT_LK(&(cx->mtx));
+	cfg->tls_ca_file = cx->tls_ca_file;
+	cfg->tls_ca_path = cx->tls_ca_path;
+	cfg->tls_cert = cx->tls_cert;
+	cfg->flags = cx->flags;
+	cfg->ping_max = cx->ping_max;
+	cfg->ping_min = cx->ping_min;
+	cfg->active = (cx->st_cur != IO_ST_DXED && cx->st_cur != IO_ST_INVALID);
+	cfg->fd = ((cx->detach && cx->st_cur == IO_ST_DXED) ? cx->net_ctx.fd : -1);
+	cfg->rbuf = cx->read.buf;
+	cfg->rbuf_len = ((cfg->fd < 0) ? 0 : cx->read.i);
+	PT_UL(&(cx->mtx));
+}
+
+void
+io_cx_stats(struct connection *cx, struct io_stats *stats)
+{
+	stats->bytes_in = atomic_load_explicit(&(cx->stats.bytes_in), memory_order_relaxed);
+	stats->bytes_out = atomic_load_explicit(&(cx->stats.bytes_out), memory_order_relaxed);
+	stats->lines_in = atomic_load_explicit(&(cx->stats.lines_in), memory_order_relaxed);
+	stats->lines_out = atomic_load_explicit(&(cx->stats.lines_out), memory_order_relaxed);
+	stats->parse_err = atomic_load_explicit(&(cx->stats.parse_err), memory_order_relaxed);
+}
+
+int
+io_set_ping(struct connection *cx, unsigned ping_min, unsigned ping_max)
+{
+	if (ping_max && ping_min > ping_max)
+		return IO_ERR_PING;
+
+	PT_LK(&(cx->mtx));
+	cx->ping_max = ping_max;
+	cx->ping_min = ping_min;
+	PT_UL(&(cx->mtx));
+
+	return IO_ERR_NONE;
+}
+
 int
 io_cx(struct connection *cx)
 {
@@ -256,6 +498,114 @@ io_cx(struct connection *cx)
 	return err;
 }
 
+int
+io_cx_attach(struct connection *cx, int fd, const char *buf, size_t len)
+{
+	/* Start the connection thread directly in the connected state,
+	 * on a socket from io_cx_detach, without emitting io_cb_cxed */
+
+	enum io_err err = IO_ERR_NONE;
+	sigset_t sigset;
+	sigset_t sigset_old;
+	socklen_t addr_len;
+	struct sockaddr_storage addr;
+	struct stat st;
+
+	addr_len = sizeof(addr);
+
+	if (fstat(fd, &st) < 0 || !S_ISSOCK(st.st_mode))
+		return IO_ERR_SOCKET;
+
+	if (getpeername(fd, (struct sockaddr *)&addr, &addr_len) < 0)
+		return IO_ERR_DXED;
+
+	if (fcntl(fd, F_SETFD, FD_CLOEXEC) < 0)
+		return IO_ERR_SOCKET;
+
+	PT_LK(&(cx->mtx));
+
+	if (cx->flags & IO_TLS_ENABLED) {
+		err = IO_ERR_SOCKET;
+	} else if (cx->st_cur != IO_ST_DXED) {
+		err = IO_ERR_CXED;
+	} else {
+		mbedtls_net_init(&(cx->net_ctx));
+		cx->net_ctx.fd = fd;
+		cx->detach = 0;
+		cx->ping = 0;
+		cx->read.cl = 0;
+		cx->read.i = 0;
+
+		/* Unframed input can't contain a complete line */
+		if (len && !memchr(buf, '\n', len))
+			(void) io_cx_frame(cx, buf, MIN(len, sizeof(cx->read.buf) - 1));
+
+		cx->st_cur = IO_ST_CXED;
+
+		if (sigfillset(&sigset) == -1)
+			fatal("sigfillset: %s", strerror(errno));
+		PT_CF(pthread_sigmask(SIG_BLOCK, &sigset, &sigset_old));
+		if (pthread_create(&(cx->tid), NULL, io_thread, cx) < 0) {
+			cx->st_cur = IO_ST_DXED;
+			err = IO_ERR_THREAD;
+		}
+		PT_CF(pthread_sigmask(SIG_SETMASK, &sigset_old, NULL));
+	}
+
+	PT_UL(&(cx->mtx));
+
+	return err;
+}
+
+int
+io_cx_detach(struct connection *cx)
+{
+	/* Stop the connection thread without closing its socket or
+	 * emitting io_cb_dxed, and dispatch its remaining events. Only
+	 * plaintext sockets can be detached, TLS state can't be carried
+	 * over to another process */
+
+	int fd;
+	int fd_flags;
+	size_t head;
+
+	PT_LK(&(cx->mtx));
+
+	if ((cx->flags & IO_TLS_ENABLED)
+	 || (cx->st_cur != IO_ST_CXED && cx->st_cur != IO_ST_PING)
+	 || (cx->st_new != IO_ST_INVALID)) {
+		PT_UL(&(cx->mtx));
+		return -1;
+	}
+
+	cx->detach = 1;
+	cx->st_new = IO_ST_DXED;
+
+	PT_UL(&(cx->mtx));
+
+	PT_CF(pthread_kill(cx->tid, SIGUSR1));
+	PT_CF(pthread_join(cx->tid, NULL));
+
+	while ((head = atomic_load(&(cx->ev.head))) != atomic_load(&(cx->ev.tail))) {
+		io_ev_dispatch(cx, &(cx->ev.evs[head % IO_EV_RING_N]));
+		atomic_store(&(cx->ev.head), head + 1);
+	}
+
+	if ((fd = cx->net_ctx.fd) < 0) {
+		cx->detach = 0;
+		return -1;
+	}
+
+	/* A partial line's trailing CR is kept for framing on attach */
+	if (cx->read.i && cx->read.cl == '\r' && cx->read.i < sizeof(cx->read.buf))
+		cx->read.buf[cx->read.i++] = '\r';
+
+	if ((fd_flags = fcntl(fd, F_GETFD)) < 0 || fcntl(fd, F_SETFD, fd_flags & ~FD_CLOEXEC) < 0)
+		fatal("fcntl: %s", strerror(errno));
+
+	return fd;
+}
+
 int
 io_dx(struct connection *cx, int destroy)
 {
@@ -268,18 +618,24 @@ io_dx(struct connection *cx, int destroy)
 		cx->st_new = IO_ST_DXED;
 		PT_UL(&(cx->mtx));
 
-		/* HACK: temporarily unlock the callback mutex, for cases when the
-		 * connection thread might be already simultaneously waiting on it.
-		 * Setting `destroy` prevents the thread from attempting additional
-		 * callbacks before moving to the DXED state */
+		/* The connection thread drops events rather than waiting on
+		 * a full event ring once a new state is set, its remaining
+		 * events are dispatched after returning, or discarded with
+		 * the connection when destroyed */
 		PT_CF(pthread_kill(cx->tid, SIGUSR1));
-		PT_UL(&io_cb_mutex);
 		PT_CF(pthread_join(cx->tid, NULL));
-		PT_LK(&io_cb_mutex);
 	}
 
 	if (destroy) {
+		struct connection **cxp = &io_cx_list;
+
+		while (*cxp != cx)
+			cxp = &((*cxp)->next);
+
+		*cxp = cx->next;
+
 		PT_CF(pthread_mutex_destroy(&(cx->mtx)));
+		mbedtls_ssl_session_free(&(cx->tls_session));
 		free((void*)cx->host);
 		free((void*)cx->port);
 		free((void*)cx->tls_ca_file);
@@ -345,42 +701,266 @@ io_sendf(struct connection *cx, const char *fmt, ...)
 		}
 	} while ((written += ret) < len);
 
+	io_stat(cx, bytes_out, len);
+	io_stat(cx, lines_out, 1);
+
 	return IO_ERR_NONE;
 }
 
 void
 io_init(void)
 {
+	/* The terminal is initialized when io_start is first called,
+	 * unless running as a daemon */
+
+	io_ev_init();
 	io_sig_init();
+}
+
+int
+io_daemon(const char *path)
+{
+	/* Listen for a client on a UNIX socket, replacing a stale socket
+	 * left by an exited daemon, then detach from the terminal and
+	 * discard output until attached */
+
+	int fd;
+	int soc;
+	mode_t mask;
+	pid_t pid;
+	struct sigaction sa = {0};
+	struct sockaddr_un addr;
+
+	if (io_unix_addr(&addr, path) < 0)
+		return -1;
+
+	if ((soc = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return -1;
+
+	if (connect(soc, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+		close(soc);
+		errno = EADDRINUSE;
+		return -1;
+	}
+
+	if (errno == ECONNREFUSED)
+		unlink(path);
+
+	close(soc);
+
+	if ((soc = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return -1;
+
+	mask = umask(077);
+
+	if (bind(soc, (struct sockaddr *)&addr, sizeof(addr)) < 0
+	 || listen(soc, 1) < 0
+	 || fcntl(soc, F_SETFD, FD_CLOEXEC) < 0) {
+		int err = errno;
+		umask(mask);
+		close(soc);
+		errno = err;
+		return -1;
+	}
+
+	umask(mask);
+
+	/* Detach from the terminal's session once listening, so the parent
+	 * exits when a client can attach. A daemon started by an upgrade
+	 * is a session leader without a terminal, and keeps its pid */
+	if ((fd = open("/dev/tty", O_RDWR | O_NOCTTY)) >= 0)
+		close(fd);
+
+	if (fd >= 0 || getsid(0) != getpid()) {
+		fflush(stdout);
+
+		if ((pid = fork()) < 0)
+			fatal("fork: %s", strerror(errno));
+
+		if (pid > 0)
+			_exit(EXIT_SUCCESS);
+
+		if (setsid() < 0)
+			fatal("setsid: %s", strerror(errno));
+	}
+
+	if ((fd = open("/dev/null", O_RDWR)) < 0)
+		fatal("open: %s", strerror(errno));
+
+	if (dup2(fd, STDIN_FILENO) < 0
+	 || dup2(fd, STDOUT_FILENO) < 0
+	 || dup2(fd, STDERR_FILENO) < 0)
+		fatal("dup2: %s", strerror(errno));
+
+	close(fd);
+
+	/* Writes to a client that has exited fail with EPIPE instead, and
+	 * hangups from the terminal started on are ignored */
+	sa.sa_handler = SIG_IGN;
+	sigemptyset(&sa.sa_mask);
+
+	if (sigaction(SIGPIPE, &sa, NULL) < 0)
+		fatal("sigaction - SIGPIPE: %s", strerror(errno));
+
+	if (sigaction(SIGHUP, &sa, NULL) < 0)
+		fatal("sigaction - SIGHUP: %s", strerror(errno));
+
+	io_daemon_fd = soc;
+
+	return 0;
+}
+
+int
+io_daemon_detach(void)
+{
+	if (io_client_fd < 0)
+		return -1;
+
+	io_client_close();
+
+	return 0;
+}
+
+int
+io_attach(const char *path)
+{
+	/* Forward terminal input and size changes to a daemon's socket, and
+	 * write its output to the terminal, until the daemon detaches the
+	 * client or exits */
+
+	int soc;
+	struct sigaction sa = {0};
+	struct sockaddr_un addr;
+
+	if (io_unix_addr(&addr, path) < 0)
+		return -1;
+
+	if ((soc = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return -1;
+
+	if (connect(soc, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		int err = errno;
+		close(soc);
+		errno = err;
+		return -1;
+	}
+
+	sa.sa_handler = SIG_IGN;
+	sigemptyset(&sa.sa_mask);
+
+	if (sigaction(SIGPIPE, &sa, NULL) < 0)
+		fatal("sigaction - SIGPIPE: %s", strerror(errno));
+
 	io_tty_init();
+
+	flag_sigwinch_cb = 1;
+
+	io_client_forward(soc, STDIN_FILENO, STDOUT_FILENO);
+
+	close(soc);
+
+	return 0;
+}
+
+const unsigned io_latency_hist[IO_LATENCY_HIST_N - 1] = {
+	250, 500, 1000, 2500, 5000, 10000, 25000
+};
+
+void
+io_latency(struct io_latency *latency)
+{
+	*latency = io_latency_stats;
 }
 
 void
 io_start(void)
 {
+	/* All callbacks are dispatched from this thread: input is read
+	 * from stdin, or the attached client when running as a daemon,
+	 * and connection events are drained from each connection's event
+	 * ring when woken by its thread.
+	 *
+	 * Input latency is measured from when input was last seen idle,
+	 * an upper bound on the time input was waiting */
+
+	int timeout = -1;
+	struct pollfd fds[3];
+	uint64_t t_idle = 0;
+
+	if (io_daemon_fd < 0 && !io_tty_initialized)
+		io_tty_init();
+
+	fds[1].fd = io_ev_fd[0];
+	fds[1].events = POLLIN;
+	fds[2].fd = io_daemon_fd;
+	fds[2].events = POLLIN;
+
 	io_running = 1;
 
-	io_tty_winsize();
+	if (io_daemon_fd < 0)
+		io_tty_winsize();
 
 	while (io_running) {
 
 		char buf[128];
-		ssize_t ret = read(STDIN_FILENO, buf, sizeof(buf));
+		ssize_t ret;
+		uint64_t t_now;
+
+		/* Negative fds, i.e. no client attached, are ignored */
+		fds[0].fd = ((io_daemon_fd < 0) ? STDIN_FILENO : io_client_fd);
+		fds[0].events = (io_client_stalled ? (POLLIN | POLLOUT) : POLLIN);
+
+		if (poll(fds, 3, timeout) < 0) {
+			if (errno != EINTR)
+				fatal("poll: %s", strerror(errno));
+			fds[0].revents = 0;
+			fds[1].revents = 0;
+			fds[2].revents = 0;
+		}
 
-		if (ret > 0) {
-			PT_LK(&io_cb_mutex);
-			io_cb_read_inp(buf, ret);
-			PT_UL(&io_cb_mutex);
-		} else {
-			if (errno == EINTR) {
-				if (flag_sigwinch_cb) {
-					flag_sigwinch_cb = 0;
-					io_tty_winsize();
-				}
-			} else {
+		if (fds[0].revents & POLLOUT) {
+			fds[0].revents &= ~POLLOUT;
+			io_client_resume();
+		}
+
+		t_now = io_clock_us();
+
+		if (timeout < 0 || !fds[0].revents)
+			t_idle = t_now;
+
+		if (fds[0].revents) {
+			if (io_daemon_fd >= 0) {
+				ret = io_client_recv();
+			} else if ((ret = read(STDIN_FILENO, buf, sizeof(buf))) > 0) {
+				io_cb_read_inp(buf, ret);
+			} else if (ret == 0 || errno != EINTR) {
 				fatal("read: %s", ret ? strerror(errno) : "EOF");
 			}
+			if (ret > 0) {
+				t_now = io_clock_us();
+				io_latency_add(t_now - t_idle);
+				t_idle = t_now;
+			}
+		}
+
+		if (fds[2].revents)
+			io_client_accept();
+
+		if (flag_sigwinch_cb) {
+			flag_sigwinch_cb = 0;
+			if (io_daemon_fd < 0)
+				io_tty_winsize();
 		}
+
+		/* Output to the client would block, or the client exited */
+		if (io_client_fd >= 0 && ferror(stdout))
+			io_client_stall();
+
+		if (fds[1].revents)
+			io_ev_clear();
+
+		/* Continue without blocking while events remain */
+		timeout = (io_running && io_ev_drain(io_clock_us() + IO_EV_SLICE_US)) ? 0 : -1;
 	}
 }
 
@@ -390,6 +970,33 @@ io_stop(void)
 	io_running = 0;
 }
 
+void
+io_term(void)
+{
+	/* Restore the terminal before exiting by exec, which skips
+	 * exit handlers. If exec fails, io_start initializes it again */
+
+	if (io_tty_initialized)
+		io_tty_term();
+
+	io_tty_initialized = 0;
+}
+
+static void
+io_latency_add(uint64_t us)
+{
+	size_t i;
+	unsigned t = (unsigned) MIN(us, UINT_MAX);
+
+	for (i = 0; i < ARR_LEN(io_latency_hist) && t >= io_latency_hist[i]; i++)
+		;
+
+	io_latency_stats.hist[i]++;
+	io_latency_stats.max = MAX(io_latency_stats.max, t);
+	io_latency_stats.sum += t;
+	io_latency_stats.n++;
+}
+
 static void
 io_tty_winsize(void)
 {
@@ -398,65 +1005,325 @@ io_tty_winsize(void)
 	if (ioctl(0, TIOCGWINSZ, &tty_ws) < 0)
 		fatal("ioctl: %s", strerror(errno));
 
-	PT_LK(&io_cb_mutex);
 	io_cb_sigwinch(tty_ws.ws_col, tty_ws.ws_row);
-	PT_UL(&io_cb_mutex);
 }
 
-const char*
-io_err(int err)
+static int
+io_client_winsize(int soc)
 {
-	switch (err) {
-		case IO_ERR_NONE:      return "success";
-		case IO_ERR_CXED:      return "socket connected";
-		case IO_ERR_CXNG:      return "socket connection in progress";
-		case IO_ERR_DXED:      return "socket not connected";
-		case IO_ERR_FMT:       return "failed to format message";
-		case IO_ERR_THREAD:    return "failed to create thread";
-		case IO_ERR_SSL_WRITE: return "ssl write failure";
-		case IO_ERR_TRUNC:     return "data truncated";
-		default:
-			return "unknown error";
-	}
-}
+	/* Send the terminal size to the daemon */
 
-static enum io_state
-io_state_rxng(struct connection *cx)
-{
-	if (cx->rx_sleep == 0) {
-		cx->rx_sleep = IO_RECONNECT_BACKOFF_BASE;
-	} else {
-		cx->rx_sleep = MIN(
-			IO_RECONNECT_BACKOFF_FACTOR * cx->rx_sleep,
-			IO_RECONNECT_BACKOFF_MAX
-		);
-	}
+	struct winsize tty_ws;
+	unsigned char msg[2 + 2 * sizeof(unsigned short)];
+	unsigned short ws[2];
 
-	io_info(cx, "Attemping reconnect in %02u:%02u",
-		(cx->rx_sleep / 60),
-		(cx->rx_sleep % 60));
+	if (ioctl(0, TIOCGWINSZ, &tty_ws) < 0)
+		fatal("ioctl: %s", strerror(errno));
 
-	sleep(cx->rx_sleep);
+	ws[0] = tty_ws.ws_col;
+	ws[1] = tty_ws.ws_row;
 
-	return IO_ST_CXNG;
+	msg[0] = IO_CLIENT_MSG_WS;
+	msg[1] = sizeof(ws);
+	memcpy(msg + 2, ws, sizeof(ws));
+
+	return io_fd_write(soc, msg, sizeof(msg));
 }
 
-static enum io_state
-io_state_cxng(struct connection *cx)
+static ssize_t
+io_client_recv(void)
 {
-	if ((io_net_connect(cx)) < 0)
-		return IO_ST_RXNG;
+	/* Read from the attached client and dispatch its complete messages,
+	 * returning the number of input bytes dispatched */
 
-	if ((cx->flags & IO_TLS_ENABLED) && io_tls_establish(cx) < 0)
-		return IO_ST_RXNG;
+	size_t len;
+	ssize_t n = 0;
+	ssize_t ret;
+	unsigned char *p = io_client_buf;
 
-	return IO_ST_CXED;
-}
+	ret = read(io_client_fd, io_client_buf + io_client_len, sizeof(io_client_buf) - io_client_len);
 
-static enum io_state
-io_state_cxed(struct connection *cx)
-{
-	int ret;
+	if (ret <= 0) {
+		if (ret == 0 || (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK))
+			io_client_close();
+		return 0;
+	}
+
+	io_client_len += (size_t)ret;
+
+	while (io_client_len >= 2 && io_client_len >= (len = 2 + p[1])) {
+
+		switch (p[0]) {
+			case IO_CLIENT_MSG_INP:
+				if (len > 2)
+					io_cb_read_inp((char *)p + 2, len - 2);
+				n += (ssize_t)(len - 2);
+				break;
+			case IO_CLIENT_MSG_WS:
+				if (len - 2 != sizeof(io_client_ws))
+					goto error;
+				memcpy(io_client_ws, p + 2, sizeof(io_client_ws));
+				if (!io_client_tty) {
+					io_client_tty = 1;
+					io_cb_tty(1);
+				}
+				io_cb_sigwinch(io_client_ws[0], io_client_ws[1]);
+				break;
+			default:
+				goto error;
+		}
+
+		/* Detached by callback */
+		if (io_client_fd < 0)
+			return n;
+
+		io_client_len -= len;
+		p += len;
+	}
+
+	memmove(io_client_buf, p, io_client_len);
+
+	return n;
+
+error:
+	io_client_close();
+
+	return n;
+}
+
+static void
+io_client_accept(void)
+{
+	/* Attach a client, replacing the attached client. Output is
+	 * written once the client's terminal size is received, without
+	 * blocking on a client that isn't reading */
+
+	int soc;
+	int sndbuf = IO_CLIENT_SNDBUF;
+
+	if ((soc = accept(io_daemon_fd, NULL, NULL)) < 0)
+		return;
+
+	if (fcntl(soc, F_SETFD, FD_CLOEXEC) < 0
+	 || fcntl(soc, F_SETFL, O_NONBLOCK) < 0
+	 || setsockopt(soc, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf)) < 0) {
+		close(soc);
+		return;
+	}
+
+	io_client_close();
+
+	fflush(stdout);
+
+	if (dup2(soc, STDOUT_FILENO) < 0)
+		fatal("dup2: %s", strerror(errno));
+
+	io_client_fd = soc;
+}
+
+static void
+io_client_close(void)
+{
+	/* Detach the client, discarding output until the next is attached */
+
+	if (io_client_fd < 0)
+		return;
+
+	if (io_client_tty)
+		io_cb_tty(0);
+
+	fflush(stdout);
+
+	io_client_stall();
+
+	close(io_client_fd);
+
+	io_client_fd = -1;
+	io_client_len = 0;
+	io_client_stalled = 0;
+	io_client_tty = 0;
+}
+
+static void
+io_client_forward(int soc, int in, int out)
+{
+	/* Frame input read from in, and write output read from soc to out,
+	 * until either is closed */
+
+	char buf[4096];
+	ssize_t ret;
+	struct pollfd fds[2];
+
+	fds[0].fd = in;
+	fds[0].events = POLLIN;
+	fds[1].fd = soc;
+	fds[1].events = POLLIN;
+
+	for (;;) {
+
+		if (flag_sigwinch_cb) {
+			flag_sigwinch_cb = 0;
+			if (io_client_winsize(soc) < 0)
+				break;
+		}
+
+		if (poll(fds, 2, -1) < 0) {
+			if (errno != EINTR)
+				fatal("poll: %s", strerror(errno));
+			continue;
+		}
+
+		if (fds[1].revents) {
+			if ((ret = read(soc, buf, sizeof(buf))) < 0 && errno == EINTR)
+				continue;
+			if (ret <= 0 || io_fd_write(out, buf, ret) < 0)
+				break;
+		}
+
+		if (fds[0].revents) {
+			if ((ret = read(in, buf + 2, UCHAR_MAX)) < 0 && errno == EINTR)
+				continue;
+			if (ret <= 0)
+				break;
+			buf[0] = IO_CLIENT_MSG_INP;
+			buf[1] = (char)ret;
+			if (io_fd_write(soc, buf, ret + 2) < 0)
+				break;
+		}
+	}
+}
+
+static void
+io_client_resume(void)
+{
+	/* Write output to the client again once writable, redrawn in full */
+
+	if (dup2(io_client_fd, STDOUT_FILENO) < 0)
+		fatal("dup2: %s", strerror(errno));
+
+	io_client_stalled = 0;
+
+	if (io_client_tty)
+		io_cb_sigwinch(io_client_ws[0], io_client_ws[1]);
+}
+
+static void
+io_client_stall(void)
+{
+	/* Discard output, including any left buffered by a failed write,
+	 * until the client is writable. A client that exited is closed
+	 * when its socket is read */
+
+	int fd;
+
+	if ((fd = open("/dev/null", O_WRONLY)) < 0)
+		fatal("open: %s", strerror(errno));
+
+	if (dup2(fd, STDOUT_FILENO) < 0)
+		fatal("dup2: %s", strerror(errno));
+
+	close(fd);
+
+	fflush(stdout);
+	clearerr(stdout);
+
+	io_client_stalled = 1;
+}
+
+static int
+io_fd_write(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t ret;
+
+	while (len) {
+		if ((ret = write(fd, p, len)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		len -= (size_t)ret;
+		p += ret;
+	}
+
+	return 0;
+}
+
+static int
+io_unix_addr(struct sockaddr_un *addr, const char *path)
+{
+	memset(addr, 0, sizeof(*addr));
+
+	if (strlen(path) >= sizeof(addr->sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	addr->sun_family = AF_UNIX;
+	strcpy(addr->sun_path, path);
+
+	return 0;
+}
+
+const char*
+io_err(int err)
+{
+	switch (err) {
+		case IO_ERR_NONE:      return "success";
+		case IO_ERR_CXED:      return "socket connected";
+		case IO_ERR_CXNG:      return "socket connection in progress";
+		case IO_ERR_DXED:      return "socket not connected";
+		case IO_ERR_FMT:       return "failed to format message";
+		case IO_ERR_PING:      return "ping-min exceeds ping-max";
+		case IO_ERR_SOCKET:    return "invalid socket";
+		case IO_ERR_THREAD:    return "failed to create thread";
+		case IO_ERR_SSL_WRITE: return "ssl write failure";
+		case IO_ERR_TRUNC:     return "data truncated";
+		default:
+			return "unknown error";
+	}
+}
+
+static enum io_state
+io_state_rxng(struct connection *cx)
+{
+	if (cx->rx_sleep == 0) {
+		cx->rx_sleep = IO_RECONNECT_BACKOFF_BASE;
+	} else {
+		cx->rx_sleep = MIN(
+			IO_RECONNECT_BACKOFF_FACTOR * cx->rx_sleep,
+			IO_RECONNECT_BACKOFF_MAX
+		);
+	}
+
+	io_info(cx, "Attemping reconnect in %02u:%02u",
+		(cx->rx_sleep / 60),
+		(cx->rx_sleep % 60));
+
+	sleep(cx->rx_sleep);
+
+	return IO_ST_CXNG;
+}
+
+static enum io_state
+io_state_cxng(struct connection *cx)
+{
+	cx->read.cl = 0;
+	cx->read.i = 0;
+
+	if ((io_net_connect(cx, SEC_IN_MS(IO_CONNECT_TIMEOUT))) < 0)
+		return IO_ST_RXNG;
+
+	if ((cx->flags & IO_TLS_ENABLED) && io_tls_establish(cx) < 0)
+		return IO_ST_RXNG;
+
+	return IO_ST_CXED;
+}
+
+static enum io_state
+io_state_cxed(struct connection *cx)
+{
+	int ret;
 
 	do {
 		enum io_state st;
@@ -468,7 +1335,7 @@ io_state_cxed(struct connection *cx)
 		if (st != IO_ST_INVALID)
 			return st;
 
-	} while ((ret = io_cx_read(cx, SEC_IN_MS(IO_PING_MIN))) > 0);
+	} while ((ret = io_cx_read(cx, (cx->ping_min ? (int)SEC_IN_MS(cx->ping_min) : -1))) > 0);
 
 	if (ret == MBEDTLS_ERR_SSL_TIMEOUT)
 		return IO_ST_PING;
@@ -488,18 +1355,10 @@ io_state_cxed(struct connection *cx)
 			break;
 	}
 
-	mbedtls_net_free(&(cx->net_ctx));
+	if (ret == MBEDTLS_ERR_SSL_WANT_READ && io_cx_detaching(cx))
+		return IO_ST_DXED;
 
-	if (cx->flags & IO_TLS_ENABLED) {
-		mbedtls_ctr_drbg_free(&(cx->tls_ctr_drbg));
-		mbedtls_entropy_free(&(cx->tls_entropy));
-		mbedtls_pk_free(&(cx->tls_pk_ctx));
-		mbedtls_ssl_config_free(&(cx->tls_conf));
-		mbedtls_ssl_free(&(cx->tls_ctx));
-		mbedtls_x509_crt_free(&(cx->tls_x509_crt_ca));
-		mbedtls_x509_crt_free(&(cx->tls_x509_crt_client));
-
-	}
+	io_cx_close(cx);
 
 	return IO_ST_CXNG;
 }
@@ -509,8 +1368,9 @@ io_state_ping(struct connection *cx)
 {
 	int ret;
 
-	if (cx->ping >= IO_PING_MAX)
-		return IO_ST_CXNG;
+	/* Timeout reported on transition, the connection is torn down */
+	if (cx->ping_max && cx->ping >= cx->ping_max)
+		goto timeout;
 
 	if ((ret = io_cx_read(cx, SEC_IN_MS(IO_PING_REFRESH))) > 0)
 		return IO_ST_CXED;
@@ -533,17 +1393,12 @@ io_state_ping(struct connection *cx)
 			break;
 	}
 
-	mbedtls_net_free(&(cx->net_ctx));
+	if (ret == MBEDTLS_ERR_SSL_WANT_READ && io_cx_detaching(cx))
+		return IO_ST_DXED;
 
-	if (cx->flags & IO_TLS_ENABLED) {
-		mbedtls_ctr_drbg_free(&(cx->tls_ctr_drbg));
-		mbedtls_entropy_free(&(cx->tls_entropy));
-		mbedtls_pk_free(&(cx->tls_pk_ctx));
-		mbedtls_ssl_config_free(&(cx->tls_conf));
-		mbedtls_ssl_free(&(cx->tls_ctx));
-		mbedtls_x509_crt_free(&(cx->tls_x509_crt_ca));
-		mbedtls_x509_crt_free(&(cx->tls_x509_crt_client));
-	}
+timeout:
+
+	io_cx_close(cx);
 
 	return IO_ST_CXNG;
 }
@@ -564,9 +1419,11 @@ io_thread(void *arg)
 
 	PT_CF(pthread_sigmask(SIG_UNBLOCK, &sigset, NULL));
 
-	cx->st_cur = IO_ST_CXNG;
-
-	io_info(cx, "Connecting to %s:%s", cx->host, cx->port);
+	/* Attached connections start connected */
+	if (cx->st_cur != IO_ST_CXED) {
+		cx->st_cur = IO_ST_CXNG;
+		io_info(cx, "Connecting to %s:%s", cx->host, cx->port);
+	}
 
 	do {
 		enum io_state st_cur;
@@ -611,6 +1468,11 @@ io_thread(void *arg)
 				break;
 			case ST_X(IO_ST_CXED, IO_ST_DXED): /* B3 */
 			case ST_X(IO_ST_PING, IO_ST_DXED): /* B4 */
+				if (cx->detach && cx->net_ctx.fd >= 0)
+					break;
+				/* Disconnected between reads */
+				if (cx->net_ctx.fd >= 0)
+					io_cx_close(cx);
 				io_info(cx, "Connection closed");
 				io_dxed(cx);
 				break;
@@ -623,7 +1485,7 @@ io_thread(void *arg)
 				io_error(cx, " .. Connection failed -- retrying");
 				break;
 			case ST_X(IO_ST_CXED, IO_ST_PING): /* G */
-				io_ping(cx, (cx->ping = IO_PING_MIN));
+				io_ping(cx, (cx->ping = cx->ping_min));
 				break;
 			case ST_X(IO_ST_PING, IO_ST_PING): /* H */
 				io_ping(cx, (cx->ping += IO_PING_REFRESH));
@@ -640,8 +1502,90 @@ io_thread(void *arg)
 	return NULL;
 }
 
+static void
+io_cx_close(struct connection *cx)
+{
+	/* Close a connected socket, and free its TLS state */
+
+	mbedtls_net_free(&(cx->net_ctx));
+
+	if (cx->flags & IO_TLS_ENABLED) {
+		if (mbedtls_ssl_get_version_number(&(cx->tls_ctx)) == MBEDTLS_SSL_VERSION_TLS1_3)
+			io_tls_session_save(cx);
+		PT_LK(&io_tls_mutex);
+		mbedtls_pk_free(&(cx->tls_pk_ctx));
+		mbedtls_ssl_config_free(&(cx->tls_conf));
+		mbedtls_ssl_free(&(cx->tls_ctx));
+		mbedtls_x509_crt_free(&(cx->tls_x509_crt_client));
+		PT_UL(&io_tls_mutex);
+		io_tls_ca_release(&(cx->tls_ca));
+	}
+}
+
 static int
-io_cx_read(struct connection *cx, uint32_t timeout)
+io_cx_detaching(struct connection *cx)
+{
+	int detach;
+
+	PT_LK(&(cx->mtx));
+	detach = cx->detach;
+	PT_UL(&(cx->mtx));
+
+	return detach;
+}
+
+static int
+io_cx_frame(struct connection *cx, const char *buf, size_t n)
+{
+	/* Frame CRLF delimited messages and parse them into event slots.
+	 * Waiting for a slot applies backpressure to the socket while the
+	 * ring is full. Returns non-zero if messages were dropped */
+
+	size_t ci = cx->read.i;
+
+	for (size_t i = 0; i < n; i++) {
+
+		char cc = buf[i];
+
+		if (ci && cc == '\n' && ((i && buf[i - 1] == '\r') || (!i && cx->read.cl == '\r'))) {
+
+			struct io_ev *ev;
+
+			cx->read.buf[ci] = 0;
+
+			debug_recv(ci, cx->read.buf);
+
+			if (!(ev = io_ev_next(cx, IO_EV_RESERVE_N))) {
+				cx->read.i = 0;
+				return -1;
+			}
+
+			memcpy(ev->buf, cx->read.buf, ci + 1);
+
+			io_stat(cx, lines_in, 1);
+
+			if (irc_message_parse(&(ev->m), ev->buf) != 0) {
+				io_stat(cx, parse_err, 1);
+				io_error(cx, "failed to parse message");
+			} else {
+				ev->type = IO_EV_MESG;
+				io_ev_commit(cx);
+			}
+
+			ci = 0;
+		} else if (ci < sizeof(cx->read.buf) - 1 && cc && cc != '\n' && cc != '\r') {
+			cx->read.buf[ci++] = cc;
+		}
+	}
+
+	cx->read.cl = buf[n - 1];
+	cx->read.i = ci;
+
+	return 0;
+}
+
+static int
+io_cx_read(struct connection *cx, int timeout)
 {
 	int ret;
 	struct pollfd fd[1];
@@ -650,37 +1594,236 @@ io_cx_read(struct connection *cx, uint32_t timeout)
 	fd[0].fd = cx->net_ctx.fd;
 	fd[0].events = POLLIN;
 
-	while ((ret = poll(fd, 1, timeout)) < 0 && errno == EAGAIN)
-		continue;
+	do {
+		/* Records already read from the socket aren't polled */
+		if (!(cx->flags & IO_TLS_ENABLED) || !mbedtls_ssl_check_pending(&(cx->tls_ctx))) {
+
+			while ((ret = poll(fd, 1, timeout)) < 0 && errno == EAGAIN)
+				continue;
+
+			if (ret == 0)
+				return MBEDTLS_ERR_SSL_TIMEOUT;
+
+			if (ret < 0 && errno == EINTR)
+				return MBEDTLS_ERR_SSL_WANT_READ;
+
+			if (ret < 0)
+				fatal("poll: %s", strerror(errno));
+		}
 
-	if (ret == 0)
-		return MBEDTLS_ERR_SSL_TIMEOUT;
+		if (cx->flags & IO_TLS_ENABLED) {
+			ret = mbedtls_ssl_read(&(cx->tls_ctx), buf, sizeof(buf));
+		} else {
+			ret = mbedtls_net_recv(&(cx->net_ctx), buf, sizeof(buf));
+		}
+
+		/* TLS 1.3 session tickets are received after the handshake,
+		 * saving the newest and continuing to read */
+		if (ret == MBEDTLS_ERR_SSL_RECEIVED_NEW_SESSION_TICKET)
+			io_tls_session_save(cx);
 
-	if (ret < 0 && errno == EINTR)
+	} while (ret == MBEDTLS_ERR_SSL_RECEIVED_NEW_SESSION_TICKET);
+
+	if (ret > 0)
+		io_stat(cx, bytes_in, (size_t)ret);
+
+	if (ret > 0 && io_cx_frame(cx, (char *)buf, (size_t)ret))
 		return MBEDTLS_ERR_SSL_WANT_READ;
 
-	if (ret < 0)
-		fatal("poll: %s", strerror(errno));
+	return ret;
+}
+
+static int
+io_ev_drain(uint64_t deadline)
+{
+	/* Dispatch pending events in batches per connection, until none
+	 * remain or the deadline passes, then flush once. Returns non-zero
+	 * if any events remain */
 
-	if (cx->flags & IO_TLS_ENABLED) {
-		ret = mbedtls_ssl_read(&(cx->tls_ctx), buf, sizeof(buf));
-	} else {
-		ret = mbedtls_net_recv(&(cx->net_ctx), buf, sizeof(buf));
+	int dispatched = 0;
+	int remaining;
+
+	do {
+		struct connection *cx;
+
+		remaining = 0;
+
+		for (cx = io_cx_list; cx && io_running; cx = cx->next) {
+
+			size_t head;
+			size_t n;
+
+			for (n = 0; n < IO_EV_BATCH_N; n++) {
+
+				if ((head = atomic_load(&(cx->ev.head))) == atomic_load(&(cx->ev.tail)))
+					break;
+
+				/* The slot is released to the producer after dispatch */
+				io_ev_dispatch(cx, &(cx->ev.evs[head % IO_EV_RING_N]));
+
+				atomic_store(&(cx->ev.head), head + 1);
+			}
+
+			if (n)
+				dispatched = 1;
+
+			if (n == IO_EV_BATCH_N)
+				remaining = 1;
+		}
+
+	} while (remaining && io_running && io_clock_us() < deadline);
+
+	if (dispatched)
+		io_cb_flush();
+
+	return remaining;
+}
+
+static struct io_ev*
+io_ev_next(struct connection *cx, size_t reserve)
+{
+	/* Return the connection thread's next free event slot, waiting while
+	 * fewer than `reserve` slots remain free. Returns NULL if a new state
+	 * has been set or the connection is closing, since the io_start
+	 * thread might be waiting to join this thread */
+
+	size_t tail = atomic_load(&(cx->ev.tail));
+
+	while (IO_EV_RING_N - (tail - atomic_load(&(cx->ev.head))) <= reserve) {
+
+		int closing;
+		struct timespec ts = { .tv_sec = 0, .tv_nsec = IO_EV_WAIT_NS };
+
+		PT_LK(&(cx->mtx));
+		closing = (!cx->callback || cx->st_cur == IO_ST_DXED || cx->st_new != IO_ST_INVALID);
+		PT_UL(&(cx->mtx));
+
+		if (closing)
+			return NULL;
+
+		(void) nanosleep(&ts, NULL);
+	}
+
+	return &(cx->ev.evs[tail % IO_EV_RING_N]);
+}
+
+static void
+io_ev_clear(void)
+{
+	char buf[64];
+
+	while (read(io_ev_fd[0], buf, sizeof(buf)) > 0)
+		continue;
+}
+
+static void
+io_ev_commit(struct connection *cx)
+{
+	size_t tail = atomic_load(&(cx->ev.tail));
+
+	atomic_store(&(cx->ev.tail), tail + 1);
+
+	/* Wake the io_start thread only when the ring was empty,
+	 * otherwise it's already draining this connection's events */
+	if (atomic_load(&(cx->ev.head)) == tail)
+		io_ev_wake();
+}
+
+static void
+io_ev_dispatch(struct connection *cx, struct io_ev *ev)
+{
+	switch (ev->type) {
+		case IO_EV_CXED:
+			io_cb_cxed(cx->obj);
+			break;
+		case IO_EV_DXED:
+			io_cb_dxed(cx->obj);
+			break;
+		case IO_EV_ERROR:
+			io_cb_error(cx->obj, "%s", ev->buf);
+			break;
+		case IO_EV_INFO:
+			io_cb_info(cx->obj, "%s", ev->buf);
+			break;
+		case IO_EV_MESG:
+			io_cb_read_soc(&(ev->m), cx->obj);
+			break;
+		case IO_EV_PING:
+			io_cb_ping(cx->obj, ev->ping);
+			break;
+		default:
+			fatal("unknown event: %d", ev->type);
 	}
+}
 
-	if (ret > 0) {
-		PT_LK(&io_cb_mutex);
-		io_cb_read_soc((char *)buf, (size_t)ret,  cx->obj);
-		PT_UL(&io_cb_mutex);
+static void
+io_ev_init(void)
+{
+#ifdef __linux__
+	if ((io_ev_fd[0] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0)
+		fatal("eventfd: %s", strerror(errno));
+
+	io_ev_fd[1] = io_ev_fd[0];
+#else
+	if (pipe(io_ev_fd) < 0)
+		fatal("pipe: %s", strerror(errno));
+
+	for (int i = 0; i < 2; i++) {
+		if (fcntl(io_ev_fd[i], F_SETFD, FD_CLOEXEC) < 0)
+			fatal("fcntl: %s", strerror(errno));
+		if (fcntl(io_ev_fd[i], F_SETFL, fcntl(io_ev_fd[i], F_GETFL) | O_NONBLOCK) < 0)
+			fatal("fcntl: %s", strerror(errno));
 	}
+#endif
+}
 
-	return ret;
+static void
+io_ev_push(struct connection *cx, enum io_ev_type type, unsigned ping)
+{
+	struct io_ev *ev;
+
+	if (!(ev = io_ev_next(cx, 0)))
+		return;
+
+	ev->type = type;
+	ev->ping = ping;
+
+	io_ev_commit(cx);
+}
+
+static void
+io_ev_pushf(struct connection *cx, enum io_ev_type type, const char *fmt, ...)
+{
+	struct io_ev *ev;
+	va_list ap;
+
+	if (!(ev = io_ev_next(cx, 0)))
+		return;
+
+	va_start(ap, fmt);
+	(void) vsnprintf(ev->buf, sizeof(ev->buf), fmt, ap);
+	va_end(ap);
+
+	ev->type = type;
+
+	io_ev_commit(cx);
+}
+
+static void
+io_ev_wake(void)
+{
+	/* A full pipe or eventfd counter already signals a wakeup */
+
+	uint64_t n = 1;
+
+	if (write(io_ev_fd[1], &n, sizeof(n)) < 0 && errno != EAGAIN && errno != EINTR)
+		fatal("write: %s", strerror(errno));
 }
 
 static void
 io_fatal(const char *f, int errnum)
 {
-	char errbuf[512];
+	char errbuf[256];
 
 	if (strerror_r(errnum, errbuf, sizeof(errbuf)) == 0) {
 		fatal("%s: (%d): %s", f, errnum, errbuf);
@@ -731,8 +1874,11 @@ io_tty_init(void)
 	if (tcsetattr(STDIN_FILENO, TCSANOW, &nterm) < 0)
 		fatal("tcsetattr: %s", strerror(errno));
 
-	if (atexit(io_tty_term))
+	if (!io_tty_atexit && atexit(io_tty_term))
 		fatal("atexit");
+
+	io_tty_atexit = 1;
+	io_tty_initialized = 1;
 }
 
 static void
@@ -744,85 +1890,432 @@ io_tty_term(void)
 		fatal_noexit("tcsetattr: %s", strerror(errno));
 }
 
-static int
-io_net_connect(struct connection *cx)
+static int
+io_net_connect(struct connection *cx, uint64_t timeout)
+{
+	/* Race non-blocking connects to the resolved addresses (RFC 8305):
+	 *  - a new attempt starts every IO_CONNECT_DELAY ms, or immediately
+	 *    when no attempt is in progress
+	 *  - the first socket connected wins, all others are closed
+	 *  - all attempts fail after the timeout, in ms */
+
+	char buf[MAX(INET6_ADDRSTRLEN, 512)];
+	const void *addr;
+	int err = 0;
+	int ret;
+	int soc = -1;
+	size_t i = 0;
+	size_t n_addrs;
+	size_t n_fds = 0;
+	struct io_addr addrs[IO_CONNECT_ADDR_MAX];
+	struct io_addr *fds_addrs[IO_CONNECT_ADDR_MAX];
+	struct io_addr *p = NULL;
+	struct pollfd fds[IO_CONNECT_ADDR_MAX];
+	uint64_t t_deadline;
+	uint64_t t_next;
+	uint64_t t_now;
+
+	if (!(n_addrs = io_net_resolve(cx, addrs)))
+		return -1;
+
+	t_now = io_clock_ms();
+	t_next = t_now;
+	t_deadline = t_now + timeout;
+
+	while (soc < 0) {
+
+		size_t j;
+
+		if (i < n_addrs && (t_now >= t_next || !n_fds)) {
+
+			int fd;
+			int flags;
+
+			p = &(addrs[i++]);
+
+			t_next = t_now + IO_CONNECT_DELAY;
+
+			if ((fd = socket(p->family, p->socktype, p->protocol)) == -1) {
+				err = errno;
+				t_next = t_now;
+				continue;
+			}
+
+			/* Sockets not detached for an upgrade are closed by exec */
+			if ((flags = fcntl(fd, F_GETFL)) == -1
+			 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1
+			 || fcntl(fd, F_SETFD, FD_CLOEXEC) == -1) {
+				err = errno;
+				t_next = t_now;
+				io_net_close(fd);
+				continue;
+			}
+
+			if (connect(fd, (struct sockaddr*)&(p->addr), p->len) == 0) {
+				soc = fd;
+				break;
+			}
+
+			if (errno == EINTR) {
+				io_net_close(fd);
+				goto err;
+			}
+
+			if (errno != EINPROGRESS) {
+				err = errno;
+				t_next = t_now;
+				io_net_close(fd);
+				continue;
+			}
+
+			fds[n_fds].fd = fd;
+			fds[n_fds].events = POLLOUT;
+			fds[n_fds].revents = 0;
+			fds_addrs[n_fds] = p;
+			n_fds++;
+		}
+
+		if (!n_fds || t_now >= t_deadline)
+			break;
+
+		if (i < n_addrs)
+			ret = poll(fds, n_fds, (int)(MIN(t_deadline, t_next) - t_now));
+		else
+			ret = poll(fds, n_fds, (int)(t_deadline - t_now));
+
+		if (ret < 0 && errno == EINTR)
+			goto err;
+
+		if (ret < 0) {
+			err = errno;
+			break;
+		}
+
+		for (j = 0; j < n_fds && soc < 0;) {
+
+			int soc_err = 0;
+			socklen_t len = sizeof(soc_err);
+
+			if (!fds[j].revents) {
+				j++;
+				continue;
+			}
+
+			if (getsockopt(fds[j].fd, SOL_SOCKET, SO_ERROR, &soc_err, &len) == -1)
+				soc_err = errno;
+
+			if (!soc_err) {
+				soc = fds[j].fd;
+				p = fds_addrs[j];
+			} else {
+				err = soc_err;
+				io_net_close(fds[j].fd);
+			}
+
+			/* remove from in-progress set */
+			n_fds--;
+			fds[j] = fds[n_fds];
+			fds_addrs[j] = fds_addrs[n_fds];
+		}
+
+		t_now = io_clock_ms();
+	}
+
+	if (soc < 0 && t_now >= t_deadline) {
+		io_error(cx, " .. Failed to connect: timeout");
+		goto err;
+	}
+
+	if (soc < 0) {
+		errno = err;
+		io_error(cx, " .. Failed to connect: %s", io_strerror(buf, sizeof(buf)));
+		goto err;
+	}
+
+	if ((ret = fcntl(soc, F_GETFL)) == -1 || fcntl(soc, F_SETFL, ret & ~O_NONBLOCK) == -1) {
+		io_error(cx, " .. Failed to set socket blocking: %s", io_strerror(buf, sizeof(buf)));
+		io_net_close(soc);
+		soc = -1;
+		goto err;
+	}
+
+	if (p->family == AF_INET)
+		addr = &(((struct sockaddr_in*)&(p->addr))->sin_addr);
+	else
+		addr = &(((struct sockaddr_in6*)&(p->addr))->sin6_addr);
+
+	if (inet_ntop(p->family, addr, buf, sizeof(buf)))
+		io_info(cx, " .. Connected [%s]", buf);
+
+	io_net_keepalive(cx, soc);
+
+err:
+	while (n_fds)
+		io_net_close(fds[--n_fds].fd);
+
+	return (cx->net_ctx.fd = soc);
+}
+
+static size_t
+io_net_resolve(struct connection *cx, struct io_addr *addrs)
+{
+	/* Resolve the connection's host from the process-wide cache. Expired
+	 * or missing entries are resolved by a detached resolver thread, shared
+	 * by all connections waiting on the same host. When resolution fails
+	 * the last known good addresses are used, if any.
+	 *
+	 * Returns the number of addresses copied, or 0 on failure */
+
+	char err[128] = {0};
+	int family = AF_UNSPEC;
+	size_t n = 0;
+	struct io_dns *dns;
+	uint64_t t_deadline = io_clock_ms() + SEC_IN_MS(IO_CONNECT_TIMEOUT);
+
+	if (cx->flags & IO_IPV_4)
+		family = AF_INET;
+
+	if (cx->flags & IO_IPV_6)
+		family = AF_INET6;
+
+	PT_LK(&io_dns_mutex);
+
+	for (dns = io_dns_list; dns; dns = dns->next) {
+		if (dns->family == family && !strcmp(dns->host, cx->host) && !strcmp(dns->port, cx->port))
+			break;
+	}
+
+	if (!dns) {
+
+		if ((dns = calloc(1, sizeof(*dns))) == NULL)
+			fatal("calloc: %s", strerror(errno));
+
+		dns->family = family;
+		dns->host = irc_strdup(cx->host);
+		dns->port = irc_strdup(cx->port);
+		dns->next = io_dns_list;
+		PT_CF(pthread_cond_init(&(dns->cnd), NULL));
+		io_dns_list = dns;
+	}
+
+	if (dns->n_addrs && (io_clock_ms() - dns->time) < SEC_IN_MS(IO_DNS_CACHE_MAX_AGE)) {
+		n = dns->n_addrs;
+		memcpy(addrs, dns->addrs, n * sizeof(*addrs));
+		goto out;
+	}
+
+	if (!dns->pending) {
+
+		pthread_attr_t attr;
+		pthread_t tid;
+		sigset_t sigset;
+		sigset_t sigset_old;
+
+		if (sigfillset(&sigset) == -1)
+			fatal("sigfillset: %s", strerror(errno));
+
+		PT_CF(pthread_attr_init(&attr));
+		PT_CF(pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED));
+		PT_CF(pthread_sigmask(SIG_BLOCK, &sigset, &sigset_old));
+
+		if (pthread_create(&tid, &attr, io_dns_thread, dns))
+			snprintf(dns->err, sizeof(dns->err), "failed to create thread");
+		else
+			dns->pending = 1;
+
+		PT_CF(pthread_sigmask(SIG_SETMASK, &sigset_old, NULL));
+		PT_CF(pthread_attr_destroy(&attr));
+	}
+
+	while (dns->pending && io_clock_ms() < t_deadline) {
+
+		enum io_state st;
+		struct timespec ts;
+
+		PT_LK(&(cx->mtx));
+		st = cx->st_new;
+		PT_UL(&(cx->mtx));
+
+		/* state set by io_cx/io_dx, cancelled */
+		if (st != IO_ST_INVALID)
+			goto out;
+
+		if (clock_gettime(CLOCK_REALTIME, &ts) < 0)
+			fatal("clock_gettime: %s", strerror(errno));
+
+		if ((ts.tv_nsec += IO_DNS_WAIT_NS) >= 1000000000) {
+			ts.tv_nsec -= 1000000000;
+			ts.tv_sec++;
+		}
+
+		if ((errno = pthread_cond_timedwait(&(dns->cnd), &io_dns_mutex, &ts)) && errno != ETIMEDOUT)
+			io_fatal("pthread_cond_timedwait", errno);
+	}
+
+	/* On failure, copy the last known addresses and the error, which
+	 * are reported after io_dns_mutex is released */
+	n = dns->n_addrs;
+	memcpy(addrs, dns->addrs, n * sizeof(*addrs));
+
+	if (dns->pending || *dns->err)
+		snprintf(err, sizeof(err), "%s", (dns->pending ? "timeout" : dns->err));
+
+out:
+
+	PT_UL(&io_dns_mutex);
+
+	if (*err && n)
+		io_info(cx, " .. Failed to resolve host: %s, using last known addresses", err);
+
+	if (*err && !n)
+		io_error(cx, " .. Failed to resolve host: %s", err);
+
+	return n;
+}
+
+static void*
+io_dns_thread(void *arg)
 {
-	char buf[MAX(INET6_ADDRSTRLEN, 512)];
-	const void *addr;
+	/* Resolve a cache entry's host. Entries are never freed and their
+	 * host, port and family are immutable, read here without locking */
+
 	int ret;
-	int soc = -1;
-	struct addrinfo *p, *res;
+	struct io_dns *dns = arg;
+	struct addrinfo *p1, *p2, *res;
 	struct addrinfo hints = {
-		.ai_family   = AF_UNSPEC,
+		.ai_family   = dns->family,
 		.ai_flags    = AI_PASSIVE,
 		.ai_protocol = IPPROTO_TCP,
 		.ai_socktype = SOCK_STREAM,
 	};
 
-	if (cx->flags & IO_IPV_4)
-		hints.ai_family = AF_INET;
+	errno = 0;
 
-	if (cx->flags & IO_IPV_6)
-		hints.ai_family = AF_INET6;
+	while ((ret = getaddrinfo(dns->host, dns->port, &hints, &res)) == EAI_SYSTEM && errno == EINTR)
+		continue;
 
-	errno = 0;
+	PT_LK(&io_dns_mutex);
 
-	if ((ret = getaddrinfo(cx->host, cx->port, &hints, &res))) {
+	if (ret == EAI_SYSTEM) {
+		io_strerror(dns->err, sizeof(dns->err));
+	} else if (ret) {
+		snprintf(dns->err, sizeof(dns->err), "%s", gai_strerror(ret));
+	} else {
 
-		if (ret == EAI_SYSTEM && errno == EINTR)
-			return -1;
+		/* Interleave address families, starting with the first resolved */
+		dns->n_addrs = 0;
 
-		if (ret == EAI_SYSTEM) {
-			io_error(cx, " .. Failed to resolve host: %s",
-				io_strerror(buf, sizeof(buf)));
-		} else {
-			io_error(cx, " .. Failed to resolve host: %s",
-				gai_strerror(ret));
+		for (p1 = res, p2 = res; dns->n_addrs < IO_CONNECT_ADDR_MAX;) {
+
+			while (p1 && p1->ai_family != res->ai_family)
+				p1 = p1->ai_next;
+
+			while (p2 && p2->ai_family == res->ai_family)
+				p2 = p2->ai_next;
+
+			if (!p1 && !p2)
+				break;
+
+			if (p1) {
+				io_dns_addr(&(dns->addrs[dns->n_addrs++]), p1);
+				p1 = p1->ai_next;
+			}
+
+			if (p2 && dns->n_addrs < IO_CONNECT_ADDR_MAX) {
+				io_dns_addr(&(dns->addrs[dns->n_addrs++]), p2);
+				p2 = p2->ai_next;
+			}
 		}
 
-		return -1;
+		dns->err[0] = 0;
+		dns->time = io_clock_ms();
+
+		freeaddrinfo(res);
 	}
 
-	ret = -1;
+	dns->pending = 0;
 
-	for (p = res; p; p = p->ai_next) {
+	PT_CF(pthread_cond_broadcast(&(dns->cnd)));
+	PT_UL(&io_dns_mutex);
 
-		if ((soc = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) == -1)
-			continue;
+	return NULL;
+}
 
-		if (connect(soc, p->ai_addr, p->ai_addrlen) == 0)
-			break;
+static void
+io_dns_addr(struct io_addr *addr, const struct addrinfo *ai)
+{
+	addr->family = ai->ai_family;
+	addr->protocol = ai->ai_protocol;
+	addr->socktype = ai->ai_socktype;
+	addr->len = MIN(ai->ai_addrlen, sizeof(addr->addr));
+	memcpy(&(addr->addr), ai->ai_addr, addr->len);
+}
 
-		io_net_close(soc);
+static uint64_t
+io_clock_ms(void)
+{
+	struct timespec ts;
 
-		if (errno == EINTR)
-			goto err;
-	}
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+		fatal("clock_gettime: %s", strerror(errno));
 
-	if (!p && soc < 0) {
-		io_error(cx, " .. Failed to obtain socket: %s", io_strerror(buf, sizeof(buf)));
-		goto err;
-	}
+	return ((uint64_t)ts.tv_sec * 1000) + ((uint64_t)ts.tv_nsec / 1000000);
+}
 
-	if (!p && soc >= 0) {
-		io_error(cx, " .. Failed to connect: %s", io_strerror(buf, sizeof(buf)));
-		goto err;
-	}
+static uint64_t
+io_clock_us(void)
+{
+	struct timespec ts;
 
-	if (p->ai_family == AF_INET)
-		addr = &(((struct sockaddr_in*)p->ai_addr)->sin_addr);
-	else
-		addr = &(((struct sockaddr_in6*)p->ai_addr)->sin6_addr);
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+		fatal("clock_gettime: %s", strerror(errno));
 
-	if (inet_ntop(p->ai_family, addr, buf, sizeof(buf)))
-		io_info(cx, " .. Connected [%s]", buf);
+	return ((uint64_t)ts.tv_sec * 1000000) + ((uint64_t)ts.tv_nsec / 1000);
+}
+
+static void
+io_net_keepalive(struct connection *cx, int soc)
+{
+	/* Detect a dead peer at the transport level: keepalive probes after
+	 * ping_min seconds of inactivity, and unacknowledged data (e.g. an
+	 * active PING) fails the socket after the remaining ping window */
 
-	ret = soc;
+	char buf[512];
+	int ret = 0;
+	int val;
 
-err:
-	freeaddrinfo(res);
+	if (cx->ping_min) {
+
+		val = 1;
+		ret |= setsockopt(soc, SOL_SOCKET, SO_KEEPALIVE, &val, sizeof(val));
+
+#ifdef TCP_KEEPIDLE
+		val = (int)cx->ping_min;
+		ret |= setsockopt(soc, IPPROTO_TCP, TCP_KEEPIDLE, &val, sizeof(val));
+#endif
+
+#ifdef TCP_KEEPINTVL
+		val = MAX(IO_PING_REFRESH, 1);
+		ret |= setsockopt(soc, IPPROTO_TCP, TCP_KEEPINTVL, &val, sizeof(val));
+#endif
+
+#ifdef TCP_KEEPCNT
+		if (cx->ping_max > cx->ping_min) {
+			val = (int)MAX((cx->ping_max - cx->ping_min) / MAX(IO_PING_REFRESH, 1), 1);
+			ret |= setsockopt(soc, IPPROTO_TCP, TCP_KEEPCNT, &val, sizeof(val));
+		}
+#endif
+	}
+
+#ifdef TCP_USER_TIMEOUT
+	if (cx->ping_max > cx->ping_min) {
+		val = (int)SEC_IN_MS(cx->ping_max - cx->ping_min);
+		ret |= setsockopt(soc, IPPROTO_TCP, TCP_USER_TIMEOUT, &val, sizeof(val));
+	}
+#endif
 
-	return (cx->net_ctx.fd = ret);
+	if (ret)
+		io_error(cx, " .. Failed to set keepalive: %s", io_strerror(buf, sizeof(buf)));
 }
 
 static void
@@ -850,27 +2343,26 @@ static void
 io_tls_debug(void *ctx, int level, const char *file, int line, const char *msg)
 {
 	UNUSED(ctx);
+	UNUSED(file);
 	UNUSED(level);
+	UNUSED(line);
+	UNUSED(msg);
 
 	/* msg minus newline */
-	debug("mbedtls: %s:%04d: %.*s", file, line, (int)(strlen(msg) - 1), msg);
+	debug_tls(file, (unsigned)line, "%.*s", (int)(strlen(msg) - 1), msg);
 }
 #endif
 
 static int
 io_tls_establish(struct connection *cx)
 {
-	const unsigned char pers[] = "rirc-drbg-seed";
 	int ret;
 
 	io_info(cx, " .. Establishing TLS connection");
 
-	mbedtls_ctr_drbg_init(&(cx->tls_ctr_drbg));
-	mbedtls_entropy_init(&(cx->tls_entropy));
 	mbedtls_pk_init(&(cx->tls_pk_ctx));
 	mbedtls_ssl_init(&(cx->tls_ctx));
 	mbedtls_ssl_config_init(&(cx->tls_conf));
-	mbedtls_x509_crt_init(&(cx->tls_x509_crt_ca));
 	mbedtls_x509_crt_init(&(cx->tls_x509_crt_client));
 
 #ifndef NDEBUG
@@ -895,78 +2387,39 @@ io_tls_establish(struct connection *cx)
 		goto err;
 	}
 
+	/* Negotiate TLS 1.3 where available, TLS 1.2 fallback */
 	mbedtls_ssl_conf_min_tls_version(&(cx->tls_conf), MBEDTLS_SSL_VERSION_TLS1_2);
-	mbedtls_ssl_conf_max_tls_version(&(cx->tls_conf), MBEDTLS_SSL_VERSION_TLS1_2);
-
-	if ((ret = mbedtls_ctr_drbg_seed(
-			&(cx->tls_ctr_drbg),
-			mbedtls_entropy_func,
-			&(cx->tls_entropy),
-			pers,
-			sizeof(pers)))) {
+	mbedtls_ssl_conf_max_tls_version(&(cx->tls_conf), MBEDTLS_SSL_VERSION_TLS1_3);
+
+	if ((ret = io_tls_init())) {
 		io_error(cx, " .. %s ", io_tls_err(ret));
 		goto err;
 	}
 
-	ret = -1;
-
-	if (ret < 0 && cx->tls_ca_file) {
-		if ((ret = mbedtls_x509_crt_parse_file(&(cx->tls_x509_crt_ca), cx->tls_ca_file)) < 0) {
-			io_error(cx, " .. Failed to load CA cert file: '%s': %s", cx->tls_ca_file, io_tls_err(ret));
-			goto err;
-		}
-	}
-
-	if (ret < 0 && cx->tls_ca_path) {
-		if ((ret = mbedtls_x509_crt_parse_path(&(cx->tls_x509_crt_ca), cx->tls_ca_path)) < 0) {
-			io_error(cx, " .. Failed to load CA cert path: '%s': %s", cx->tls_ca_path, io_tls_err(ret));
-			goto err;
-		}
-	}
-
-	if (ret < 0 && default_ca_file && *default_ca_file) {
-		if ((ret = mbedtls_x509_crt_parse_file(&(cx->tls_x509_crt_ca), default_ca_file)) < 0) {
-			io_error(cx, " .. Failed to load CA cert file: '%s': %s", default_ca_file, io_tls_err(ret));
-			goto err;
-		}
-	}
-
-	if (ret < 0 && default_ca_path && *default_ca_path) {
-		if ((ret = mbedtls_x509_crt_parse_path(&(cx->tls_x509_crt_ca), default_ca_path)) < 0) {
-			io_error(cx, " .. Failed to load CA cert path: '%s': %s", default_ca_path, io_tls_err(ret));
-			goto err;
-		}
-	}
-
-	if (ret < 0) {
-
-		size_t i;
-
-		for (i = 0; i < ARR_LEN(default_ca_certs); i++) {
-			if ((ret = mbedtls_x509_crt_parse_file(&(cx->tls_x509_crt_ca), default_ca_certs[i])) >= 0)
-				break;
-		}
-
-		if (i == ARR_LEN(default_ca_certs)) {
-			io_error(cx, " .. Failed to load default CA certs: %s", io_tls_err(ret));
-			goto err;
-		}
-	}
+	if (!(cx->flags & IO_TLS_VRFY_DISABLED) && io_tls_ca_load(cx) < 0)
+		goto err;
 
 	if (cx->tls_cert) {
 
-		if ((ret = mbedtls_x509_crt_parse_file(&(cx->tls_x509_crt_client), cx->tls_cert)) < 0) {
+		PT_LK(&io_tls_mutex);
+		ret = mbedtls_x509_crt_parse_file(&(cx->tls_x509_crt_client), cx->tls_cert);
+		PT_UL(&io_tls_mutex);
+
+		if (ret < 0) {
 			io_error(cx, " .. Failed to load client cert: '%s': %s", cx->tls_cert, io_tls_err(ret));
 			goto err;
 		}
 
-		if ((ret = mbedtls_pk_parse_keyfile(
+		PT_LK(&io_tls_mutex);
+		ret = mbedtls_pk_parse_keyfile(
 			&(cx->tls_pk_ctx),
 			cx->tls_cert,
 			NULL,
 			mbedtls_ctr_drbg_random,
-			&(cx->tls_ctr_drbg))))
-		{
+			&io_tls_ctr_drbg);
+		PT_UL(&io_tls_mutex);
+
+		if (ret) {
 			io_error(cx, " .. Failed to load client cert key: '%s': %s", cx->tls_cert, io_tls_err(ret));
 			goto err;
 		}
@@ -977,12 +2430,12 @@ io_tls_establish(struct connection *cx)
 		}
 	}
 
-	mbedtls_ssl_conf_rng(&(cx->tls_conf), mbedtls_ctr_drbg_random, &(cx->tls_ctr_drbg));
+	mbedtls_ssl_conf_rng(&(cx->tls_conf), mbedtls_ctr_drbg_random, &io_tls_ctr_drbg);
 
 	if (cx->flags & IO_TLS_VRFY_DISABLED) {
 		mbedtls_ssl_conf_authmode(&(cx->tls_conf), MBEDTLS_SSL_VERIFY_NONE);
 	} else {
-		mbedtls_ssl_conf_ca_chain(&(cx->tls_conf), &(cx->tls_x509_crt_ca), NULL);
+		mbedtls_ssl_conf_ca_chain(&(cx->tls_conf), &(cx->tls_ca->crt), NULL);
 
 		if (cx->flags & IO_TLS_VRFY_OPTIONAL)
 			mbedtls_ssl_conf_authmode(&(cx->tls_conf), MBEDTLS_SSL_VERIFY_OPTIONAL);
@@ -996,7 +2449,11 @@ io_tls_establish(struct connection *cx)
 		goto err;
 	}
 
-	if ((ret = mbedtls_ssl_setup(&(cx->tls_ctx), &(cx->tls_conf)))) {
+	PT_LK(&io_tls_mutex);
+	ret = mbedtls_ssl_setup(&(cx->tls_ctx), &(cx->tls_conf));
+	PT_UL(&io_tls_mutex);
+
+	if (ret) {
 		io_error(cx, " .. %s ", io_tls_err(ret));
 		goto err;
 	}
@@ -1009,16 +2466,25 @@ io_tls_establish(struct connection *cx)
 	mbedtls_ssl_set_bio(
 		&(cx->tls_ctx),
 		&(cx->net_ctx),
-		mbedtls_net_send,
-		mbedtls_net_recv,
+		io_tls_send,
+		io_tls_recv,
 		NULL);
 
+	if (cx->tls_session_set && (ret = mbedtls_ssl_set_session(&(cx->tls_ctx), &(cx->tls_session)))) {
+		io_tls_session_reset(cx);
+		io_error(cx, " .. Failed to set TLS session: %s", io_tls_err(ret));
+	}
+
+	PT_LK(&io_tls_mutex);
+
 	while ((ret = mbedtls_ssl_handshake(&(cx->tls_ctx)))) {
 		if (ret != MBEDTLS_ERR_SSL_WANT_READ
 		 && ret != MBEDTLS_ERR_SSL_WANT_WRITE)
 			break;
 	}
 
+	PT_UL(&io_tls_mutex);
+
 	if (ret && cx->flags & IO_TLS_VRFY_DISABLED) {
 		io_error(cx, " .. %s ", io_tls_err(ret));
 		goto err;
@@ -1032,6 +2498,14 @@ io_tls_establish(struct connection *cx)
 		goto err;
 	}
 
+	/* Established connections read and write without io_tls_mutex */
+	mbedtls_ssl_set_bio(
+		&(cx->tls_ctx),
+		&(cx->net_ctx),
+		mbedtls_net_send,
+		mbedtls_net_recv,
+		NULL);
+
 	switch (mbedtls_ssl_get_version_number(&(cx->tls_ctx))) {
 		case MBEDTLS_SSL_VERSION_TLS1_2:
 			io_info(cx, " .. TLS 1.2 connection established");
@@ -1047,24 +2521,288 @@ io_tls_establish(struct connection *cx)
 	io_info(cx, " .... Version:     %s", mbedtls_ssl_get_version(&(cx->tls_ctx)));
 	io_info(cx, " .... Ciphersuite: %s", mbedtls_ssl_get_ciphersuite(&(cx->tls_ctx)));
 
+	/* TLS 1.3 session tickets are received after the handshake,
+	 * and are instead saved when read, or the connection closed */
+	if (mbedtls_ssl_get_version_number(&(cx->tls_ctx)) == MBEDTLS_SSL_VERSION_TLS1_2)
+		io_info(cx, " .... Session:     %s", (io_tls_session_save(cx) ? "resumed" : "new"));
+
 	return 0;
 
 err:
 
 	io_error(cx, " .. TLS connection failure");
 
-	mbedtls_ctr_drbg_free(&(cx->tls_ctr_drbg));
-	mbedtls_entropy_free(&(cx->tls_entropy));
+	io_tls_session_reset(cx);
+
+	PT_LK(&io_tls_mutex);
 	mbedtls_pk_free(&(cx->tls_pk_ctx));
 	mbedtls_ssl_config_free(&(cx->tls_conf));
 	mbedtls_ssl_free(&(cx->tls_ctx));
-	mbedtls_x509_crt_free(&(cx->tls_x509_crt_ca));
 	mbedtls_x509_crt_free(&(cx->tls_x509_crt_client));
+	PT_UL(&io_tls_mutex);
+	io_tls_ca_release(&(cx->tls_ca));
 	mbedtls_net_free(&(cx->net_ctx));
 
 	return -1;
 }
 
+static int
+io_tls_init(void)
+{
+	/* Initialize PSA crypto and seed the process-wide DRBG shared
+	 * by all connections, once */
+
+	const unsigned char pers[] = "rirc-drbg-seed";
+	int ret = 0;
+
+	PT_LK(&io_tls_mutex);
+
+	if (!io_tls_initialized && psa_crypto_init() != PSA_SUCCESS)
+		ret = MBEDTLS_ERR_ERROR_GENERIC_ERROR;
+
+	if (!io_tls_initialized && !ret) {
+
+		mbedtls_ctr_drbg_init(&io_tls_ctr_drbg);
+		mbedtls_entropy_init(&io_tls_entropy);
+
+		if ((ret = mbedtls_ctr_drbg_seed(
+				&io_tls_ctr_drbg,
+				mbedtls_entropy_func,
+				&io_tls_entropy,
+				pers,
+				sizeof(pers)))) {
+			mbedtls_ctr_drbg_free(&io_tls_ctr_drbg);
+			mbedtls_entropy_free(&io_tls_entropy);
+		} else {
+			io_tls_initialized = 1;
+		}
+	}
+
+	PT_UL(&io_tls_mutex);
+
+	return ret;
+}
+
+static int
+io_tls_recv(void *ctx, unsigned char *buf, size_t len)
+{
+	/* Receive with io_tls_mutex released while blocked on the socket */
+
+	int ret;
+
+	PT_UL(&io_tls_mutex);
+	ret = mbedtls_net_recv(ctx, buf, len);
+	PT_LK(&io_tls_mutex);
+
+	return ret;
+}
+
+static int
+io_tls_send(void *ctx, const unsigned char *buf, size_t len)
+{
+	/* Send with io_tls_mutex released while blocked on the socket */
+
+	int ret;
+
+	PT_UL(&io_tls_mutex);
+	ret = mbedtls_net_send(ctx, buf, len);
+	PT_LK(&io_tls_mutex);
+
+	return ret;
+}
+
+static int
+io_tls_ca_load(struct connection *cx)
+{
+	int ret = -1;
+
+	if (ret < 0 && cx->tls_ca_file) {
+		if (!(cx->tls_ca = io_tls_ca_get(cx->tls_ca_file, 0, &ret))) {
+			io_error(cx, " .. Failed to load CA cert file: '%s': %s", cx->tls_ca_file, io_tls_err(ret));
+			return -1;
+		}
+	}
+
+	if (ret < 0 && cx->tls_ca_path) {
+		if (!(cx->tls_ca = io_tls_ca_get(cx->tls_ca_path, 1, &ret))) {
+			io_error(cx, " .. Failed to load CA cert path: '%s': %s", cx->tls_ca_path, io_tls_err(ret));
+			return -1;
+		}
+	}
+
+	if (ret < 0 && default_ca_file && *default_ca_file) {
+		if (!(cx->tls_ca = io_tls_ca_get(default_ca_file, 0, &ret))) {
+			io_error(cx, " .. Failed to load CA cert file: '%s': %s", default_ca_file, io_tls_err(ret));
+			return -1;
+		}
+	}
+
+	if (ret < 0 && default_ca_path && *default_ca_path) {
+		if (!(cx->tls_ca = io_tls_ca_get(default_ca_path, 1, &ret))) {
+			io_error(cx, " .. Failed to load CA cert path: '%s': %s", default_ca_path, io_tls_err(ret));
+			return -1;
+		}
+	}
+
+	if (ret < 0) {
+
+		size_t i;
+
+		for (i = 0; i < ARR_LEN(default_ca_certs); i++) {
+			if ((cx->tls_ca = io_tls_ca_get(default_ca_certs[i], 0, &ret)))
+				break;
+		}
+
+		if (i == ARR_LEN(default_ca_certs)) {
+			io_error(cx, " .. Failed to load default CA certs: %s", io_tls_err(ret));
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static struct io_tls_ca*
+io_tls_ca_get(const char *path, int dir, int *ret)
+{
+	/* Get a shared reference to the CA chain parsed from a file or
+	 * directory, parsed once and reparsed only when its mtime changes.
+	 * Stale chains still referenced are freed on their last release */
+
+	struct io_tls_ca *ca;
+	struct io_tls_ca **ca_p;
+	struct stat st;
+
+	if (stat(path, &st) < 0) {
+		*ret = MBEDTLS_ERR_X509_FILE_IO_ERROR;
+		return NULL;
+	}
+
+	PT_LK(&io_tls_mutex);
+
+	for (ca_p = &io_tls_ca_list; (ca = *ca_p); ca_p = &(ca->next)) {
+		if (!strcmp(ca->path, path))
+			break;
+	}
+
+	if (ca && ca->mtime == st.st_mtime) {
+		ca->refs++;
+		*ret = 0;
+		goto out;
+	}
+
+	if (ca) {
+		*ca_p = ca->next;
+
+		if (ca->refs)
+			ca->stale = 1;
+		else
+			io_tls_ca_free(ca);
+	}
+
+	if ((ca = calloc(1, sizeof(*ca))) == NULL)
+		fatal("calloc: %s", strerror(errno));
+
+	mbedtls_x509_crt_init(&(ca->crt));
+
+	if (dir)
+		*ret = mbedtls_x509_crt_parse_path(&(ca->crt), path);
+	else
+		*ret = mbedtls_x509_crt_parse_file(&(ca->crt), path);
+
+	if (*ret < 0) {
+		mbedtls_x509_crt_free(&(ca->crt));
+		free(ca);
+		ca = NULL;
+		goto out;
+	}
+
+	ca->path = irc_strdup(path);
+	ca->mtime = st.st_mtime;
+	ca->refs = 1;
+	ca->next = io_tls_ca_list;
+	io_tls_ca_list = ca;
+
+out:
+
+	PT_UL(&io_tls_mutex);
+
+	return ca;
+}
+
+static void
+io_tls_ca_release(struct io_tls_ca **ca)
+{
+	if (!*ca)
+		return;
+
+	PT_LK(&io_tls_mutex);
+
+	if (--(*ca)->refs == 0 && (*ca)->stale)
+		io_tls_ca_free(*ca);
+
+	PT_UL(&io_tls_mutex);
+
+	*ca = NULL;
+}
+
+static void
+io_tls_ca_free(struct io_tls_ca *ca)
+{
+	mbedtls_x509_crt_free(&(ca->crt));
+	free(ca->path);
+	free(ca);
+}
+
+static int
+io_tls_session_save(struct connection *cx)
+{
+	/* Retain the established session (ID or ticket) to be offered on the
+	 * next handshake. A resumed TLS 1.2 session keeps the offered master
+	 * secret, whereas session IDs are empty or random when using tickets,
+	 * returns non-zero if this session was resumed.
+	 *
+	 * A session is exported at most once, the session previously saved is
+	 * kept when no newer session is available */
+
+	int resumed = 0;
+	mbedtls_ssl_session session;
+
+	mbedtls_ssl_session_init(&session);
+
+	if (mbedtls_ssl_get_session(&(cx->tls_ctx), &session)) {
+		mbedtls_ssl_session_free(&session);
+		return 0;
+	}
+
+	/* mbedtls has no public API to query whether a handshake was resumed,
+	 * nor accessors for a session's ID or master secret, and the session
+	 * ID can't be compared since it's empty or random when using tickets.
+	 * The master secret is only reused by a resumed session */
+	if (cx->tls_session_set
+	 && !memcmp(
+			session.MBEDTLS_PRIVATE(master),
+			cx->tls_session.MBEDTLS_PRIVATE(master),
+			sizeof(session.MBEDTLS_PRIVATE(master))))
+		resumed = 1;
+
+	mbedtls_ssl_session_free(&(cx->tls_session));
+
+	cx->tls_session = session;
+	cx->tls_session_set = 1;
+
+	return resumed;
+}
+
+static void
+io_tls_session_reset(struct connection *cx)
+{
+	mbedtls_ssl_session_free(&(cx->tls_session));
+	mbedtls_ssl_session_init(&(cx->tls_session));
+
+	cx->tls_session_set = 0;
+}
+
 static int
 io_tls_x509_vrfy(struct connection *cx)
 {
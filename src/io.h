@@ -55,12 +55,42 @@
  *   (H) on ping timeout update: io_cb_ping
  *   (I) on ping normal:         io_cb_ping
  *
+ * While a connection's network state is in question (G,H) the
+ * io_cb_ping callback is expected to actively probe the server
+ *
  * Successful reads on stdin and connected sockets result in data callbacks:
  *   from stdin:  io_cb_read_inp
  *   from socket: io_cb_read_soc
  *
+ * Socket data is framed into lines and parsed on the connection's thread,
+ * io_cb_read_soc receives each parsed message, valid until it returns
+ *
+ * Connection events are dispatched in batches, each followed by a single
+ * io_cb_flush callback, e.g. to draw once per batch rather than per event
+ *
  * SIGWINCH results in a non signal-handler context callback io_cb_singwinch
  *
+ * All callbacks are invoked from the thread running io_start. Connection
+ * threads queue their events on a per-connection lock-free ring, which is
+ * drained in order by the io_start thread when woken. A connection's
+ * callbacks must not destroy that connection with io_dx
+ *
+ * Pending input is always handled before connection events, which are
+ * dispatched in small batches per connection for a bounded time slice
+ * before input is checked again. The latency from input becoming readable
+ * to its callback returning is recorded in a histogram, see io_latency
+ *
+ * Running as a daemon, input is read from a single client attached on a
+ * UNIX socket rather than stdin, and stdout is redirected to the client.
+ * The client's terminal results in callbacks io_cb_tty, when attached or
+ * detached, and io_cb_sigwinch with its size. While no client is attached
+ * output is discarded, as is output to a client that isn't reading, which
+ * is redrawn by io_cb_sigwinch once its socket is writable
+ *
+ * A connected plaintext connection can be detached from its socket,
+ * e.g. to be carried across exec, and later attached to it, entering
+ * the cxed state directly without (A) or (D)
+ *
  * Failed connection attempts enter a retry cycle with exponential
  * backoff time given by:
  *   t(n) = t(n - 1) * factor
@@ -83,7 +113,46 @@
 #define IO_TLS_VRFY_OPTIONAL (1 << 7)
 #define IO_TLS_VRFY_REQUIRED (1 << 8)
 
+#define IO_LATENCY_HIST_N 8
+
+struct io_latency
+{
+	uint64_t sum; /* us */
+	unsigned hist[IO_LATENCY_HIST_N];
+	unsigned max; /* us */
+	unsigned n;
+};
+
+/* Input latency histogram bucket upper bounds, us */
+extern const unsigned io_latency_hist[IO_LATENCY_HIST_N - 1];
+
+/* Connection traffic counters */
+struct io_stats
+{
+	uint64_t bytes_in;
+	uint64_t bytes_out;
+	uint64_t lines_in;
+	uint64_t lines_out;
+	uint64_t parse_err; /* lines received failing to parse */
+};
+
+/* Connection settings, as given to connection() and io_set_ping() */
+struct io_cx_cfg
+{
+	const char *tls_ca_file;
+	const char *tls_ca_path;
+	const char *tls_cert;
+	uint32_t flags;
+	unsigned ping_max;
+	unsigned ping_min;
+	int fd;               /* detached socket, or -1 */
+	const char *rbuf;     /* detached socket's unframed input */
+	size_t rbuf_len;
+	unsigned active : 1; /* connected, or connecting */
+};
+
 struct connection;
+struct irc_message;
 
 struct connection* connection(
 	const void*, /* callback object */
@@ -94,32 +163,71 @@ struct connection* connection(
 	const char*, /* tls_cert */
 	uint32_t);   /* flags */
 
+/* Set connection dead-peer detection thresholds, in seconds:
+ *   ping_min: inactivity before probing with PING, and TCP keepalive
+ *   ping_max: inactivity before reconnecting, and TCP user timeout
+ * Fails if ping_min exceeds a non-zero ping_max */
+int io_set_ping(struct connection*, unsigned, unsigned);
+
+/* Get connection settings, valid for the connection's lifetime */
+void io_cx_cfg(struct connection*, struct io_cx_cfg*);
+
+/* Get connection traffic counters, since the connection was created */
+void io_cx_stats(struct connection*, struct io_stats*);
+
 /* Explicit direction of net state */
 int io_cx(struct connection*);
 int io_dx(struct connection*, int);
 
+/* Detach a connected plaintext connection from its socket, left open and
+ * inheritable across exec, returning the socket or -1 */
+int io_cx_detach(struct connection*);
+
+/* Attach a disconnected connection to a detached socket and its unframed
+ * input, resuming in the connected state, returning non-zero error */
+int io_cx_attach(struct connection*, int, const char*, size_t);
+
 /* Formatted write to connection */
 int io_sendf(struct connection*, const char*, ...);
 
 /* IO error string */
 const char* io_err(int);
 
+/* Input to callback completion latency */
+void io_latency(struct io_latency*);
+
 /* IO data callback */
 void io_cb_read_inp(char*, size_t);
-void io_cb_read_soc(char*, size_t, const void*);
+void io_cb_read_soc(struct irc_message*, const void*);
+
+/* Connection events dispatched */
+void io_cb_flush(void);
 
 /* IO event callbacks */
 void io_cb_cxed(const void*);
 void io_cb_dxed(const void*);
 void io_cb_ping(const void*, unsigned);
 void io_cb_sigwinch(unsigned, unsigned);
+void io_cb_tty(int);
 
 /* IO informational callbacks */
 void io_cb_error(const void*, const char*, ...);
 void io_cb_info(const void*, const char*, ...);
 
+/* Run as a daemon listening on a UNIX socket path, detached from the
+ * terminal once listening, returning -1 on failure */
+int io_daemon(const char*);
+
+/* Detach the daemon's attached client, returning -1 if none */
+int io_daemon_detach(void);
+
+/* Attach the terminal to a daemon listening on a UNIX socket path,
+ * returning when detached, or -1 on failure */
+int io_attach(const char*);
+
 void io_init(void);
 void io_start(void);
 void io_stop(void);
+void io_term(void);
 
 #endif
@@ -0,0 +1,632 @@
+#include "src/log.h"
+
+#include "config.h"
+#include "src/utils/utils.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef LOG_FSYNC_INTERVAL
+#define LOG_FSYNC_INTERVAL 10
+#elif (LOG_FSYNC_INTERVAL < 0 || LOG_FSYNC_INTERVAL > 86400)
+#error "LOG_FSYNC_INTERVAL: [0, 86400]"
+#endif
+
+/* Ring slots for queued lines, must be a power of 2 */
+#define LOG_RING_N 512
+
+/* Files kept open, least recently used files are closed first
+ *
+ * Precluded in tests */
+#ifndef LOG_FILES_MAX
+#define LOG_FILES_MAX 16
+#endif
+
+/* Milliseconds between writing queued lines, the writer is woken
+ * sooner when the ring is half full */
+#define LOG_FLUSH_MS 250
+
+/* Bytes written per file per write, and maximum path length */
+#define LOG_BUF_LEN  8192
+#define LOG_PATH_MAX 1024
+
+/* Maximum lengths of a queued line's fields */
+#define LOG_HOST_MAX 255
+#define LOG_CHAN_MAX 200
+#define LOG_FROM_MAX 100
+#define LOG_TEXT_MAX 510
+
+#define PT_CF(X) \
+	do {                                            \
+		int _ptcf = (X);                            \
+		if (_ptcf != 0) {                           \
+			fatal("%s: %s", (#X), strerror(_ptcf)); \
+		}                                           \
+	} while (0)
+
+struct log_ev
+{
+	time_t t;
+	unsigned dropped; /* lines dropped before this line */
+	char buf[LOG_HOST_MAX + LOG_CHAN_MAX + LOG_FROM_MAX + LOG_TEXT_MAX + 4];
+};
+
+struct log_file
+{
+	char host[LOG_HOST_MAX + 1];
+	char chan[LOG_CHAN_MAX + 1];
+	char buf[LOG_BUF_LEN];
+	size_t len;
+	unsigned long used; /* least recently used order */
+	int day;            /* year and day of year of the file */
+	int fd;
+	unsigned dirty : 1; /* written since last sync */
+};
+
+static void *log_thread(void*);
+static void log_drain(void);
+static void log_sync(void);
+static void log_write(struct log_ev*);
+static int log_tail_file(const char*, unsigned, log_tail_cb, void*, unsigned*);
+static int log_day_cmp(const void*, const void*);
+static int log_time(const char*, size_t, time_t*);
+static size_t log_copy(char*, size_t, const char*, size_t);
+static size_t log_path(char*, size_t, const char*, const char*);
+static struct log_file *log_file(const char*, const char*, const struct tm*);
+static void log_file_close(struct log_file*);
+static void log_file_flush(struct log_file*);
+static int log_file_open(struct log_file*, const struct tm*);
+
+static struct
+{
+	atomic_size_t head;
+	char pad[64];
+	atomic_size_t tail;
+	struct log_ev evs[LOG_RING_N];
+} *log_ring;
+
+static struct log_file log_files[LOG_FILES_MAX];
+static atomic_int log_stop;
+static char *log_dir;
+static int log_fd[2];
+static pthread_t log_tid;
+static unsigned log_dropped;
+static unsigned long log_used;
+
+void
+log_init(const char *dir)
+{
+	if (!dir || !*dir)
+		return;
+
+	if ((log_dir = strdup(dir)) == NULL)
+		fatal("strdup: %s", strerror(errno));
+
+	if ((log_ring = calloc(1, sizeof(*log_ring))) == NULL)
+		fatal("calloc: %s", strerror(errno));
+
+	if (pipe(log_fd) < 0)
+		fatal("pipe: %s", strerror(errno));
+
+	if (fcntl(log_fd[0], F_SETFL, O_NONBLOCK) < 0 || fcntl(log_fd[1], F_SETFL, O_NONBLOCK) < 0)
+		fatal("fcntl: %s", strerror(errno));
+
+	for (size_t i = 0; i < LOG_FILES_MAX; i++)
+		log_files[i].fd = -1;
+
+	atomic_init(&(log_ring->head), 0);
+	atomic_init(&(log_ring->tail), 0);
+	atomic_init(&log_stop, 0);
+
+	tzset();
+
+	PT_CF(pthread_create(&log_tid, NULL, log_thread, NULL));
+}
+
+void
+log_term(void)
+{
+	if (!log_ring)
+		return;
+
+	atomic_store(&log_stop, 1);
+
+	if (write(log_fd[1], "", 1) < 0)
+		debug("write: %s", strerror(errno));
+
+	PT_CF(pthread_join(log_tid, NULL));
+
+	close(log_fd[0]);
+	close(log_fd[1]);
+
+	free(log_dir);
+	free(log_ring);
+
+	log_dir = NULL;
+	log_ring = NULL;
+}
+
+void
+log_line(const char *host, const char *chan, time_t t, const char *from, const char *text)
+{
+	/* Queue a line for the writer thread, dropping it if the ring
+	 * is full rather than waiting */
+
+	struct log_ev *ev;
+	size_t head;
+	size_t tail;
+	size_t len = 0;
+
+	if (!log_ring)
+		return;
+
+	head = atomic_load(&(log_ring->head));
+	tail = atomic_load(&(log_ring->tail));
+
+	if (tail - head == LOG_RING_N) {
+		log_dropped++;
+		return;
+	}
+
+	ev = &(log_ring->evs[tail % LOG_RING_N]);
+	ev->t = t;
+	ev->dropped = log_dropped;
+
+	len += log_copy(ev->buf + len, sizeof(ev->buf) - len, host, LOG_HOST_MAX);
+	len += log_copy(ev->buf + len, sizeof(ev->buf) - len, chan, LOG_CHAN_MAX);
+	len += log_copy(ev->buf + len, sizeof(ev->buf) - len, from, LOG_FROM_MAX);
+	len += log_copy(ev->buf + len, sizeof(ev->buf) - len, text, LOG_TEXT_MAX);
+
+	log_dropped = 0;
+
+	atomic_store(&(log_ring->tail), tail + 1);
+
+	if (tail + 1 - head == LOG_RING_N / 2 && write(log_fd[1], "", 1) < 0 && errno != EAGAIN)
+		debug("write: %s", strerror(errno));
+}
+
+unsigned
+log_tail(const char *host, const char *chan, unsigned max, log_tail_cb cb, void *arg)
+{
+	/* Read a channel's log files newest first, from the end of each
+	 * file, parsing only as many lines as requested */
+
+	char path[LOG_PATH_MAX];
+	char (*days)[sizeof("YYYY-MM-DD.log")] = NULL;
+	size_t n_days = 0;
+	size_t size = 0;
+	size_t path_len;
+	struct dirent *de;
+	unsigned n = 0;
+	DIR *d;
+
+	if (!log_dir || !max)
+		return 0;
+
+	if ((path_len = log_path(path, sizeof(path) - sizeof("/YYYY-MM-DD.log"), host, chan)) == 0)
+		return 0;
+
+	if (!(d = opendir(path)))
+		return 0;
+
+	while ((de = readdir(d))) {
+
+		if (strlen(de->d_name) != sizeof(days[0]) - 1 || strcmp(de->d_name + 10, ".log"))
+			continue;
+
+		if (n_days == size) {
+
+			size = (size ? size * 2 : 16);
+
+			if ((days = realloc(days, sizeof(days[0]) * size)) == NULL)
+				fatal("realloc: %s", strerror(errno));
+		}
+
+		memcpy(days[n_days++], de->d_name, sizeof(days[0]));
+	}
+
+	closedir(d);
+
+	/* ISO dates sort lexically, newest last */
+	if (n_days)
+		qsort(days, n_days, sizeof(days[0]), log_day_cmp);
+
+	while (n_days-- && n < max) {
+
+		snprintf(path + path_len, sizeof(path) - path_len, "/%s", days[n_days]);
+
+		if (log_tail_file(path, max, cb, arg, &n))
+			break;
+	}
+
+	free(days);
+
+	return n;
+}
+
+static int
+log_tail_file(const char *path, unsigned max, log_tail_cb cb, void *arg, unsigned *n)
+{
+	/* Parse lines backwards from the end of a log file, skipping any
+	 * trailing partial line. Returns non-zero if the callback stopped */
+
+	struct stat st;
+	const char *map;
+	size_t end;
+	int fd;
+	int ret = 0;
+
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+		return 0;
+
+	if (fstat(fd, &st) < 0 || st.st_size == 0) {
+		close(fd);
+		return 0;
+	}
+
+	if ((map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+		debug("mmap: %s: %s", path, strerror(errno));
+		close(fd);
+		return 0;
+	}
+
+	end = st.st_size;
+
+	while (end && map[end - 1] != '\n')
+		end--;
+
+	while (end && *n < max) {
+
+		const char *line;
+		const char *from;
+		const char *text;
+		const char *line_end = map + end - 1;
+		time_t t;
+
+		for (end--; end && map[end - 1] != '\n'; end--)
+			continue;
+
+		line = map + end;
+
+		if (!(from = memchr(line, ' ', line_end - line)))
+			continue;
+
+		if (!(text = memchr(from + 1, ' ', line_end - (from + 1))))
+			continue;
+
+		if (log_time(line, from - line, &t) < 0)
+			continue;
+
+		from++;
+		text++;
+
+		(*n)++;
+
+		if ((ret = (*cb)(t, from, text - from - 1, text, line_end - text, arg)))
+			break;
+	}
+
+	munmap((void *)map, st.st_size);
+	close(fd);
+
+	return ret;
+}
+
+static int
+log_day_cmp(const void *a, const void *b)
+{
+	return strcmp(a, b);
+}
+
+static int
+log_time(const char *str, size_t len, time_t *t)
+{
+	/* Parse a timestamp written as "%Y-%m-%dT%H:%M:%S%z" */
+
+	char buf[32];
+	int Y, M, D, h, m, s, z;
+	long days, doy, era, yoe;
+
+	if (len >= sizeof(buf))
+		return -1;
+
+	memcpy(buf, str, len);
+	buf[len] = 0;
+
+	if (sscanf(buf, "%4d-%2d-%2dT%2d:%2d:%2d%5d", &Y, &M, &D, &h, &m, &s, &z) != 7)
+		return -1;
+
+	if (M < 1 || M > 12)
+		return -1;
+
+	/* Days since epoch of the civil date */
+	Y -= (M <= 2);
+	era = (Y >= 0 ? Y : Y - 399) / 400;
+	yoe = Y - era * 400;
+	doy = (153 * (M + (M > 2 ? -3 : 9)) + 2) / 5 + D - 1;
+	days = era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + doy - 719468;
+
+	*t = (time_t)days * 86400 + h * 3600 + m * 60 + s - ((z / 100) * 3600 + (z % 100) * 60);
+
+	return 0;
+}
+
+static size_t
+log_path(char *path, size_t size, const char *host, const char *chan)
+{
+	/* Write the directory path of a channel's logs, <dir>/<host>/<channel>,
+	 * with path separators and leading dots replaced, and channel names
+	 * case folded. Returns the path length, or 0 if it doesn't fit */
+
+	size_t dir_len = strlen(log_dir);
+	size_t host_len = dir_len + 1 + strlen(host);
+	int len;
+
+	len = snprintf(path, size, "%s/%s/%s", log_dir, host, chan);
+
+	if (len < 0 || (size_t)len >= size)
+		return 0;
+
+	for (size_t i = dir_len + 1; i < (size_t)len; i++) {
+		if (path[i] == '/' && i != host_len)
+			path[i] = '_';
+		else if (i > host_len)
+			path[i] = tolower((unsigned char) path[i]);
+	}
+
+	if (path[dir_len + 1] == '.')
+		path[dir_len + 1] = '_';
+
+	if (path[host_len + 1] == '.')
+		path[host_len + 1] = '_';
+
+	return len;
+}
+
+static size_t
+log_copy(char *buf, size_t size, const char *str, size_t max)
+{
+	size_t len = MIN(strlen(str), MIN(max, size - 1));
+
+	memcpy(buf, str, len);
+	buf[len] = 0;
+
+	return len + 1;
+}
+
+static void*
+log_thread(void *arg)
+{
+	/* Drain queued lines on an interval or when woken, so that
+	 * lines are written in batches per file */
+
+	struct pollfd pfd = { .fd = log_fd[0], .events = POLLIN };
+	time_t t_sync = time(NULL);
+	sigset_t sigset;
+
+	UNUSED(arg);
+
+	sigfillset(&sigset);
+	PT_CF(pthread_sigmask(SIG_BLOCK, &sigset, NULL));
+
+	for (;;) {
+
+		char buf[64];
+		int stop = atomic_load(&log_stop);
+
+		if (!stop && poll(&pfd, 1, LOG_FLUSH_MS) < 0 && errno != EINTR)
+			fatal("poll: %s", strerror(errno));
+
+		while (read(log_fd[0], buf, sizeof(buf)) > 0)
+			continue;
+
+		log_drain();
+
+		for (size_t i = 0; i < LOG_FILES_MAX; i++)
+			log_file_flush(&log_files[i]);
+
+		if (LOG_FSYNC_INTERVAL && time(NULL) - t_sync >= LOG_FSYNC_INTERVAL) {
+			log_sync();
+			t_sync = time(NULL);
+		}
+
+		if (stop)
+			break;
+	}
+
+	for (size_t i = 0; i < LOG_FILES_MAX; i++)
+		log_file_close(&log_files[i]);
+
+	return NULL;
+}
+
+static void
+log_drain(void)
+{
+	size_t head = atomic_load(&(log_ring->head));
+
+	while (head != atomic_load(&(log_ring->tail))) {
+		log_write(&(log_ring->evs[head % LOG_RING_N]));
+		atomic_store(&(log_ring->head), ++head);
+	}
+}
+
+static void
+log_sync(void)
+{
+	for (size_t i = 0; i < LOG_FILES_MAX; i++) {
+
+		struct log_file *f = &log_files[i];
+
+		if (f->fd >= 0 && f->dirty) {
+			if (fsync(f->fd) < 0)
+				debug("fsync: %s", strerror(errno));
+			f->dirty = 0;
+		}
+	}
+}
+
+static void
+log_write(struct log_ev *ev)
+{
+	const char *host = ev->buf;
+	const char *chan = host + strlen(host) + 1;
+	const char *from = chan + strlen(chan) + 1;
+	const char *text = from + strlen(from) + 1;
+	char ts[32];
+	struct log_file *f;
+	struct tm tm;
+	int len;
+
+	if (!localtime_r(&(ev->t), &tm) || !strftime(ts, sizeof(ts), "%Y-%m-%dT%H:%M:%S%z", &tm))
+		return;
+
+	if (!(f = log_file(host, chan, &tm)))
+		return;
+
+	/* Room for the line, and a note of dropped lines */
+	if (f->len + sizeof(ev->buf) + (sizeof(ts) * 2) + 64 > sizeof(f->buf))
+		log_file_flush(f);
+
+	if (ev->dropped && (len = snprintf(f->buf + f->len, sizeof(f->buf) - f->len,
+			"%s -- %u lines not logged\n", ts, ev->dropped)) > 0)
+		f->len += len;
+
+	if ((len = snprintf(f->buf + f->len, sizeof(f->buf) - f->len,
+			"%s %s %s\n", ts, from, text)) > 0)
+		f->len += len;
+}
+
+static struct log_file*
+log_file(const char *host, const char *chan, const struct tm *tm)
+{
+	/* Return the open file for a line, replacing the previous day's
+	 * file for the same channel, or the least recently used file */
+
+	struct log_file *f = NULL;
+	int day = tm->tm_year * 1000 + tm->tm_yday;
+
+	for (size_t i = 0; i < LOG_FILES_MAX; i++) {
+
+		struct log_file *tmp = &log_files[i];
+
+		if (tmp->fd >= 0 && !strcmp(tmp->host, host) && !strcmp(tmp->chan, chan)) {
+
+			if (tmp->day == day) {
+				tmp->used = ++log_used;
+				return tmp;
+			}
+
+			f = tmp;
+			break;
+		}
+
+		if (!f || (f->fd >= 0 && (tmp->fd < 0 || tmp->used < f->used)))
+			f = tmp;
+	}
+
+	log_file_close(f);
+
+	snprintf(f->host, sizeof(f->host), "%s", host);
+	snprintf(f->chan, sizeof(f->chan), "%s", chan);
+
+	if (log_file_open(f, tm) < 0)
+		return NULL;
+
+	f->day = day;
+	f->used = ++log_used;
+
+	return f;
+}
+
+static int
+log_file_open(struct log_file *f, const struct tm *tm)
+{
+	/* Open <dir>/<host>/<channel>/<YYYY-MM-DD>.log, creating
+	 * directories as needed */
+
+	char path[LOG_PATH_MAX];
+	size_t dir_len = strlen(log_dir);
+	size_t host_len = dir_len + 1 + strlen(f->host);
+	size_t chan_len;
+
+	if ((chan_len = log_path(path, sizeof(path) - sizeof("/YYYY-MM-DD.log"), f->host, f->chan)) == 0) {
+		debug("log path too long: %s/%s", f->host, f->chan);
+		return -1;
+	}
+
+	strftime(path + chan_len, sizeof(path) - chan_len, "/%Y-%m-%d.log", tm);
+
+	path[dir_len] = 0;
+	mkdir(path, 0700);
+	path[dir_len] = '/';
+	path[host_len] = 0;
+	mkdir(path, 0700);
+	path[host_len] = '/';
+	path[chan_len] = 0;
+	mkdir(path, 0700);
+	path[chan_len] = '/';
+
+	if ((f->fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600)) < 0) {
+		debug("open: %s: %s", path, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+static void
+log_file_close(struct log_file *f)
+{
+	if (f->fd < 0)
+		return;
+
+	log_file_flush(f);
+
+	if (f->dirty && fsync(f->fd) < 0)
+		debug("fsync: %s", strerror(errno));
+
+	close(f->fd);
+
+	f->dirty = 0;
+	f->fd = -1;
+}
+
+static void
+log_file_flush(struct log_file *f)
+{
+	size_t written = 0;
+
+	while (f->fd >= 0 && written < f->len) {
+
+		ssize_t ret;
+
+		if ((ret = write(f->fd, f->buf + written, f->len - written)) < 0) {
+
+			if (errno == EINTR)
+				continue;
+
+			debug("write: %s", strerror(errno));
+			break;
+		}
+
+		written += ret;
+	}
+
+	if (written)
+		f->dirty = 1;
+
+	f->len = 0;
+}
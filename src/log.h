@@ -0,0 +1,42 @@
+#ifndef RIRC_LOG_H
+#define RIRC_LOG_H
+
+/* Chat logging
+ *
+ * Lines are logged to one file per network, channel and day:
+ *
+ *   <dir>/<host>/<channel>/<YYYY-MM-DD>.log
+ *
+ * as lines of: "<YYYY-MM-DD>T<HH:MM:SS><+ZZZZ> <from> <text>"
+ *
+ * Lines are queued on a lock-free ring for a writer thread,
+ * which batches writes per file, keeps recently used files open
+ * and periodically syncs written files to disk. Lines are never
+ * waited on; when the ring is full they're dropped, and the count
+ * dropped is noted in the next logged line's file
+ */
+
+#include <time.h>
+
+/* Start the writer thread, logging to the given directory
+ * ("": logging disabled) */
+void log_init(const char*);
+
+/* Stop the writer thread, after writing any queued lines */
+void log_term(void);
+
+/* Log tail callback, for lines read newest first, returning non-zero
+ * to stop reading, with args:
+ *   time, from, from length, text, text length, callback arg */
+typedef int (*log_tail_cb)(time_t, const char*, size_t, const char*, size_t, void*);
+
+/* Read up to the given number of lines most recently logged for a
+ * channel, returning the number read, with args:
+ *   host, channel, max lines, callback, callback arg */
+unsigned log_tail(const char*, const char*, unsigned, log_tail_cb, void*);
+
+/* Queue a line for logging, with args:
+ *   host, channel, time, from, text */
+void log_line(const char*, const char*, time_t, const char*, const char*);
+
+#endif
@@ -2,8 +2,12 @@
 
 #include "config.h"
 #include "src/draw.h"
+#include "src/event.h"
 #include "src/io.h"
+#include "src/log.h"
+#include "src/snapshot.h"
 #include "src/state.h"
+#include "src/trace.h"
 
 #include <errno.h>
 #include <getopt.h>
@@ -26,6 +30,13 @@ static const char* rirc_opt_str(char);
 static const char* rirc_pw_name(void);
 static int rirc_parse_args(int, char**);
 
+/* Session file written by :upgrade, set by the upgrading process */
+static const char *rirc_upgrade_path;
+
+/* UNIX socket paths to run as a daemon on, or to attach to */
+static const char *rirc_attach_path;
+static const char *rirc_daemon_path;
+
 #ifdef CA_CERT_FILE
 const char *default_ca_file = CA_CERT_FILE;
 #else
@@ -66,12 +77,17 @@ static const char *const rirc_help =
 "\nrirc v" STR(VERSION) " ~ Richard C. Robbins <mail@rcr.io>"
 "\n"
 "\nUsage:"
-"\n  rirc [-hv] [-s host [options] ...]"
+"\n  rirc [-hv] [--daemon=SOCKET] [-s host [options] ...]"
+"\n  rirc --attach=SOCKET"
 "\n"
 "\nInfo:"
 "\n  -h, --help      Print help message and exit"
 "\n  -v, --version   Print rirc version and exit"
 "\n"
+"\nSession:"
+"\n      --daemon=SOCKET   Run without a terminal, listening for --attach"
+"\n      --attach=SOCKET   Attach the terminal to a daemon"
+"\n"
 "\nOptions:"
 "\n  -s, --server=HOST         Set connection hostname"
 "\n  -p, --port=PORT           Set connection port"
@@ -91,6 +107,8 @@ static const char *const rirc_help =
 "\n      --sasl-pass=PASS      Authenticate with SASL password"
 "\n      --ipv4                Use IPv4 addresses only"
 "\n      --ipv6                Use IPv6 addresses only"
+"\n      --ping-min=SECS       Set inactivity before PING probes"
+"\n      --ping-max=SECS       Set inactivity before reconnect"
 "\n";
 
 static const char *const rirc_version =
@@ -122,6 +140,11 @@ rirc_opt_str(char c)
 		case '7': return "--sasl-pass";
 		case '8': return "--ipv4";
 		case '9': return "--ipv6";
+		case 'A': return "--ping-min";
+		case 'B': return "--ping-max";
+		case 'C': return "--upgrade";
+		case 'D': return "--daemon";
+		case 'E': return "--attach";
 		default:
 			fatal("unknown option flag '%c'", c);
 	}
@@ -167,6 +190,8 @@ rirc_parse_args(int argc, char **argv)
 		int ipv;
 		int tls;
 		int tls_vrfy;
+		unsigned ping_max;
+		unsigned ping_min;
 		struct server *s;
 	} cli_servers[MAX_CLI_SERVERS];
 
@@ -191,6 +216,11 @@ rirc_parse_args(int argc, char **argv)
 		{"sasl-pass",   required_argument, 0, '7'},
 		{"ipv4",        no_argument,       0, '8'},
 		{"ipv6",        no_argument,       0, '9'},
+		{"ping-min",    required_argument, 0, 'A'},
+		{"ping-max",    required_argument, 0, 'B'},
+		{"upgrade",     required_argument, 0, 'C'},
+		{"daemon",      required_argument, 0, 'D'},
+		{"attach",      required_argument, 0, 'E'},
 		{0, 0, 0, 0}
 	};
 
@@ -229,6 +259,8 @@ rirc_parse_args(int argc, char **argv)
 				cli_servers[n_servers - 1].ipv         = IO_IPV_UNSPEC;
 				cli_servers[n_servers - 1].tls         = IO_TLS_ENABLED;
 				cli_servers[n_servers - 1].tls_vrfy    = IO_TLS_VRFY_REQUIRED;
+				cli_servers[n_servers - 1].ping_max    = IO_PING_MAX;
+				cli_servers[n_servers - 1].ping_min    = IO_PING_MIN;
 				break;
 
 			#define CHECK_SERVER_OPTARG(OPT_C, REQ) \
@@ -346,8 +378,36 @@ rirc_parse_args(int argc, char **argv)
 				cli_servers[n_servers -1].ipv = IO_IPV_6;
 				break;
 
+			case 'A': /* Set inactivity before PING probes */
+				CHECK_SERVER_OPTARG(opt_c, 1);
+				if (irc_strtou(optarg, &(cli_servers[n_servers - 1].ping_min), 86400)) {
+					arg_error("invalid option for '--ping-min' '%s'", optarg);
+					return -1;
+				}
+				break;
+
+			case 'B': /* Set inactivity before reconnect */
+				CHECK_SERVER_OPTARG(opt_c, 1);
+				if (irc_strtou(optarg, &(cli_servers[n_servers - 1].ping_max), 86400)) {
+					arg_error("invalid option for '--ping-max' '%s'", optarg);
+					return -1;
+				}
+				break;
+
 			#undef CHECK_SERVER_OPTARG
 
+			case 'C': /* Resume a session from :upgrade */
+				rirc_upgrade_path = optarg;
+				break;
+
+			case 'D': /* Run as a daemon */
+				rirc_daemon_path = optarg;
+				break;
+
+			case 'E': /* Attach to a daemon */
+				rirc_attach_path = optarg;
+				break;
+
 			case 'h':
 				puts(rirc_help);
 				exit(EXIT_SUCCESS);
@@ -375,6 +435,11 @@ rirc_parse_args(int argc, char **argv)
 		return -1;
 	}
 
+	if (rirc_attach_path && (rirc_daemon_path || n_servers)) {
+		arg_error("option '%s' cannot be used with other options", rirc_opt_str('E'));
+		return -1;
+	}
+
 	for (size_t i = 0; i < n_servers; i++) {
 
 		if (cli_servers[i].port == NULL)
@@ -400,6 +465,14 @@ rirc_parse_args(int argc, char **argv)
 			 cli_servers[i].tls |
 			 cli_servers[i].tls_vrfy));
 
+		if (io_set_ping(
+				cli_servers[i].s->connection,
+				cli_servers[i].ping_min,
+				cli_servers[i].ping_max)) {
+			arg_error("'--ping-min' %u exceeds '--ping-max' %u", cli_servers[i].ping_min, cli_servers[i].ping_max);
+			return -1;
+		}
+
 		if (server_list_add(state_server_list(), cli_servers[i].s)) {
 			arg_error("duplicate server: %s:%s", cli_servers[i].host, cli_servers[i].port);
 			return -1;
@@ -438,9 +511,68 @@ rirc_parse_args(int argc, char **argv)
 }
 
 #ifndef TESTING
+static void
+rirc_start(void)
+{
+	/* Start tracing, logging, events and drawing. A daemon draws
+	 * only while a client is attached, see io_cb_tty */
+
+#ifndef NDEBUG
+	if (trace_init(TRACE_FILE) < 0)
+		newlinef(current_channel(), 0, FROM_ERROR, "trace: %s: %s", TRACE_FILE, strerror(errno));
+#endif
+
+	log_init(LOG_DIR);
+
+	if (event_init(EVENT_SOCKET) < 0)
+		newlinef(current_channel(), 0, FROM_ERROR, "events: %s: %s", EVENT_SOCKET, strerror(errno));
+
+	if (!rirc_daemon_path)
+		draw_init();
+}
+
+static int
+rirc_upgrade(const char *path)
+{
+	/* Exec the upgraded binary found by name, rather than the running
+	 * binary, which may since have been replaced. A daemon listens
+	 * again on its socket, its attached client is detached.
+	 *
+	 * Logs, events and traces are flushed before exec, connections
+	 * not detached for the upgrade are closed by exec. Returns an
+	 * error number if exec fails, after restarting them */
+
+	char arg[4096];
+	char arg_daemon[4096];
+	char *args[] = { (char *)runtime_name, arg, NULL, NULL };
+	int err = ENAMETOOLONG;
+
+	if (rirc_daemon_path) {
+		snprintf(arg_daemon, sizeof(arg_daemon), "--daemon=%s", rirc_daemon_path);
+		args[2] = arg_daemon;
+	}
+
+	if (snprintf(arg, sizeof(arg), "--upgrade=%s", path) < (int)sizeof(arg)) {
+		draw_term();
+		log_term();
+		event_term();
+		trace_term();
+		fflush(stdout);
+		io_term();
+		execvp(runtime_name, args);
+		err = errno;
+		rirc_start();
+	}
+
+	return err;
+}
+
 int
 main(int argc, char **argv)
 {
+	char upgrade_path[4096];
+	int upgrade;
+
 	if (argc)
 		runtime_name = argv[0];
 
@@ -463,10 +595,49 @@ main(int argc, char **argv)
 		return EXIT_FAILURE;
 	}
 
-	draw_init();
-	io_start();
+	if (rirc_attach_path) {
+		state_term();
+		if (io_attach(rirc_attach_path) < 0) {
+			fprintf(stderr, "%s: attach: %s: %s\n", runtime_name, rirc_attach_path, strerror(errno));
+			return EXIT_FAILURE;
+		}
+		return EXIT_SUCCESS;
+	}
+
+	if (rirc_daemon_path && io_daemon(rirc_daemon_path) < 0) {
+		fprintf(stderr, "%s: daemon: %s: %s\n", runtime_name, rirc_daemon_path, strerror(errno));
+		state_term();
+		return EXIT_FAILURE;
+	}
+
+	if (rirc_upgrade_path) {
+		if (snapshot_read(rirc_upgrade_path, 1) < 0)
+			newlinef(current_channel(), 0, FROM_ERROR, "upgrade: %s: %s", rirc_upgrade_path, strerror(errno));
+		unlink(rirc_upgrade_path);
+	} else if (*SNAPSHOT_FILE && snapshot_read(SNAPSHOT_FILE, 0) < 0 && errno != ENOENT) {
+		newlinef(current_channel(), 0, FROM_ERROR, "snapshot: %s: %s", SNAPSHOT_FILE, strerror(errno));
+	}
+
+	rirc_start();
+
+	/* The session is kept if exec fails, the upgrade is abandoned */
+	do {
+		io_start();
+
+		if ((upgrade = state_upgrade(upgrade_path, sizeof(upgrade_path))) > 0) {
+			int err = rirc_upgrade(upgrade_path);
+			state_upgrade_abort(upgrade_path);
+			newlinef(current_channel(), 0, FROM_ERROR, "upgrade: %s: %s", runtime_name, strerror(err));
+			upgrade = -1;
+		}
+
+	} while (upgrade < 0);
+
 	draw_term();
 	state_term();
+	log_term();
+	event_term();
+	trace_term();
 
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,724 @@
+#include "src/snapshot.h"
+
+#include "src/components/buffer.h"
+#include "src/components/channel.h"
+#include "src/components/input.h"
+#include "src/components/ircv3.h"
+#include "src/components/mode.h"
+#include "src/components/server.h"
+#include "src/components/user.h"
+#include "src/io.h"
+#include "src/state.h"
+#include "src/utils/utils.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SNAPSHOT_MAGIC "RIRCSNAP"
+#define SNAPSHOT_BOM   0x01020304u
+
+/* Length of NULL strings */
+#define SNAPSHOT_NULL UINT32_MAX
+
+/* Maximum length of restored settings strings */
+#define SNAPSHOT_STR_MAX 1024
+
+/* Channel flags */
+#define SNAPSHOT_PARTED (1 << 0)
+#define SNAPSHOT_JOINED (1 << 1)
+
+struct snapshot_r
+{
+	const char *p;
+	const char *end;
+	struct channel *current;
+	uint32_t i_server;
+	uint32_t i_channel;
+	int attached;
+	int err;
+	int resume;
+};
+
+static int snapshot_r_server(struct snapshot_r*, int, uint32_t);
+static int snapshot_r_channel(struct snapshot_r*, int, struct server*, int);
+static const char *snapshot_r_mem(struct snapshot_r*, size_t*);
+static void snapshot_r_mode(struct snapshot_r*, struct mode*);
+static const char *snapshot_r_str(struct snapshot_r*, char*);
+static uint32_t snapshot_r_u32(struct snapshot_r*);
+static uint64_t snapshot_r_u64(struct snapshot_r*);
+static void snapshot_w_channel(FILE*, struct channel*);
+static void snapshot_w_server(FILE*, struct server*);
+static void snapshot_w_mem(FILE*, const char*, size_t);
+static void snapshot_w_mode(FILE*, const struct mode*);
+static void snapshot_w_str(FILE*, const char*);
+static void snapshot_w_u32(FILE*, uint32_t);
+static void snapshot_w_u64(FILE*, uint64_t);
+static void snapshot_w_users(FILE*, struct user*);
+
+int
+snapshot_write(const char *path)
+{
+	/* Written to a temporary file, synced and renamed over the path,
+	 * so that a failed write never replaces a previous snapshot */
+
+	char tmp[4096];
+	struct channel *c = current_channel();
+	struct server *s;
+	uint32_t n_servers = 0;
+	uint32_t i_server = 0;
+	uint32_t i_channel = 0;
+	long size;
+	FILE *f;
+	int errno_tmp;
+	int fd;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) < 0)
+		return -1;
+
+	if (!(f = fdopen(fd, "w"))) {
+		errno_tmp = errno;
+		close(fd);
+		unlink(tmp);
+		errno = errno_tmp;
+		return -1;
+	}
+
+	if ((s = state_server_list()->head)) {
+		do {
+			n_servers++;
+
+			if (c->server == s) {
+
+				struct channel *tmp_c = s->channel;
+
+				i_server = n_servers;
+
+				while (tmp_c != c) {
+					tmp_c = tmp_c->next;
+					i_channel++;
+				}
+			}
+		} while ((s = s->next) != state_server_list()->head);
+	}
+
+	fwrite(SNAPSHOT_MAGIC, 1, sizeof(SNAPSHOT_MAGIC) - 1, f);
+	snapshot_w_u32(f, SNAPSHOT_VERSION);
+	snapshot_w_u32(f, SNAPSHOT_BOM);
+	snapshot_w_u64(f, 0);
+	snapshot_w_u32(f, i_server);
+	snapshot_w_u32(f, i_channel);
+	snapshot_w_u32(f, n_servers);
+
+	if ((s = state_server_list()->head)) {
+		do {
+			snapshot_w_server(f, s);
+		} while ((s = s->next) != state_server_list()->head);
+	}
+
+	/* Write the file size to the header */
+	if ((size = ftell(f)) >= 0 && !fseek(f, sizeof(SNAPSHOT_MAGIC) - 1 + 8, SEEK_SET))
+		snapshot_w_u64(f, size);
+
+	if (size < 0 || ferror(f) || fflush(f) || fsync(fd) < 0) {
+		errno_tmp = (errno ? errno : EIO);
+		fclose(f);
+		unlink(tmp);
+		errno = errno_tmp;
+		return -1;
+	}
+
+	if (fclose(f) || rename(tmp, path) < 0) {
+		errno_tmp = errno;
+		unlink(tmp);
+		errno = errno_tmp;
+		return -1;
+	}
+
+	return 0;
+}
+
+int
+snapshot_read(const char *path, int resume)
+{
+	/* The snapshot is read twice in place, first validating it, then
+	 * restoring it, so that an invalid snapshot restores nothing */
+
+	struct snapshot_r r;
+	struct stat st;
+	const char *map;
+	uint32_t n_servers;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+		return -1;
+
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	if ((size_t)st.st_size < sizeof(SNAPSHOT_MAGIC) - 1 + 16) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+
+	if ((map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+		close(fd);
+		return -1;
+	}
+
+	close(fd);
+
+	for (int apply = 0; apply < 2; apply++) {
+
+		r.p = map + sizeof(SNAPSHOT_MAGIC) - 1;
+		r.end = map + st.st_size;
+		r.current = NULL;
+		r.resume = resume;
+		r.err = 0;
+
+		if (memcmp(map, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC) - 1)
+		 || snapshot_r_u32(&r) != SNAPSHOT_VERSION
+		 || snapshot_r_u32(&r) != SNAPSHOT_BOM
+		 || snapshot_r_u64(&r) != (uint64_t)st.st_size)
+			r.err = 1;
+
+		r.i_server = snapshot_r_u32(&r);
+		r.i_channel = snapshot_r_u32(&r);
+
+		n_servers = snapshot_r_u32(&r);
+
+		for (uint32_t i = 0; i < n_servers && !r.err; i++)
+			snapshot_r_server(&r, apply, i + 1);
+
+		if (r.err || r.p != r.end) {
+			munmap((void *)map, st.st_size);
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	munmap((void *)map, st.st_size);
+
+	if (r.current)
+		channel_set_current(r.current);
+
+	return 0;
+}
+
+static int
+snapshot_r_server(struct snapshot_r *r, int apply, uint32_t i_server)
+{
+	char host[SNAPSHOT_STR_MAX];
+	char port[SNAPSHOT_STR_MAX];
+	char pass[SNAPSHOT_STR_MAX];
+	char username[SNAPSHOT_STR_MAX];
+	char realname[SNAPSHOT_STR_MAX];
+	char mode[SNAPSHOT_STR_MAX];
+	char nicks[SNAPSHOT_STR_MAX];
+	char tls_ca_file[SNAPSHOT_STR_MAX];
+	char tls_ca_path[SNAPSHOT_STR_MAX];
+	char tls_cert[SNAPSHOT_STR_MAX];
+	char sasl_user[SNAPSHOT_STR_MAX];
+	char sasl_pass[SNAPSHOT_STR_MAX];
+	char nick[SNAPSHOT_STR_MAX];
+	char prefix_f[SNAPSHOT_STR_MAX];
+	char prefix_t[SNAPSHOT_STR_MAX];
+	const char *p_host        = snapshot_r_str(r, host);
+	const char *p_port        = snapshot_r_str(r, port);
+	const char *p_pass        = snapshot_r_str(r, pass);
+	const char *p_username    = snapshot_r_str(r, username);
+	const char *p_realname    = snapshot_r_str(r, realname);
+	const char *p_mode        = snapshot_r_str(r, mode);
+	const char *p_nicks       = snapshot_r_str(r, nicks);
+	const char *p_tls_ca_file = snapshot_r_str(r, tls_ca_file);
+	const char *p_tls_ca_path = snapshot_r_str(r, tls_ca_path);
+	const char *p_tls_cert    = snapshot_r_str(r, tls_cert);
+	const char *p_sasl_user   = snapshot_r_str(r, sasl_user);
+	const char *p_sasl_pass   = snapshot_r_str(r, sasl_pass);
+	uint32_t flags            = snapshot_r_u32(r);
+	uint32_t ping_min         = snapshot_r_u32(r);
+	uint32_t ping_max         = snapshot_r_u32(r);
+	uint32_t sasl_mech        = snapshot_r_u32(r);
+	uint32_t active           = snapshot_r_u32(r);
+	uint32_t fd               = snapshot_r_u32(r);
+	size_t rbuf_len           = 0;
+	const char *p_rbuf        = snapshot_r_mem(r, &rbuf_len);
+	const char *p_nick        = snapshot_r_str(r, nick);
+	uint32_t registered       = snapshot_r_u32(r);
+	uint32_t casemapping      = snapshot_r_u32(r);
+	uint32_t whox             = snapshot_r_u32(r);
+	struct mode_cfg mode_cfg;
+	struct mode usermodes;
+	uint32_t n_caps;
+	uint32_t n_channels;
+	struct server *s = NULL;
+
+	snapshot_r_mode(r, &(mode_cfg.chanmodes));
+	snapshot_r_mode(r, &(mode_cfg.usermodes));
+	snapshot_r_mode(r, &(mode_cfg.CHANMODES.A));
+	snapshot_r_mode(r, &(mode_cfg.CHANMODES.B));
+	snapshot_r_mode(r, &(mode_cfg.CHANMODES.C));
+	snapshot_r_mode(r, &(mode_cfg.CHANMODES.D));
+	snapshot_r_mode(r, &usermodes);
+
+	const char *p_prefix_f = snapshot_r_str(r, prefix_f);
+	const char *p_prefix_t = snapshot_r_str(r, prefix_t);
+
+	if (!p_host || !p_port || !p_username || !p_realname || !p_nick || !p_prefix_f || !p_prefix_t)
+		r->err = 1;
+
+	if (casemapping > CASEMAPPING_STRICT_RFC1459)
+		r->err = 1;
+
+	if (!r->err && (strlen(p_prefix_f) >= MODE_STR_LEN || strlen(p_prefix_f) != strlen(p_prefix_t)))
+		r->err = 1;
+
+	if (r->err)
+		return -1;
+
+	r->attached = 0;
+
+	if (apply && !(s = server_list_get(state_server_list(), p_host, p_port))) {
+
+		s = server(p_host, p_port, p_pass, p_username, p_realname, p_mode);
+
+		if (p_nicks && server_set_nicks(s, p_nicks))
+			debug("invalid nicks: %s", p_nicks);
+
+		if (sasl_mech == IRCV3_SASL_MECH_EXTERNAL)
+			server_set_sasl(s, "EXTERNAL", NULL, NULL);
+
+		if (sasl_mech == IRCV3_SASL_MECH_PLAIN)
+			server_set_sasl(s, "PLAIN", p_sasl_user, p_sasl_pass);
+
+		s->connection = connection(s, p_host, p_port, p_tls_ca_file, p_tls_ca_path, p_tls_cert, flags);
+
+		(void) io_set_ping(s->connection, ping_min, ping_max);
+
+		server_list_add(state_server_list(), s);
+
+		/* Resumed connections keep their registration */
+		if (r->resume && (int32_t)fd >= 0 && !io_cx_attach(s->connection, (int32_t)fd, p_rbuf, rbuf_len)) {
+			r->attached = 1;
+			s->connected = 1;
+			s->registered = !!registered;
+			s->casemapping = casemapping;
+			s->whox = !!whox;
+			s->mode_cfg = mode_cfg;
+			s->usermodes = usermodes;
+			strcpy(s->mode_cfg.PREFIX.F, p_prefix_f);
+			strcpy(s->mode_cfg.PREFIX.T, p_prefix_t);
+			server_nick_set(s, p_nick);
+			mode_str(&(s->usermodes), &(s->mode_str));
+		} else if (active) {
+			io_cx(s->connection);
+		}
+	}
+
+	n_caps = snapshot_r_u32(r);
+
+	while (n_caps-- && !r->err) {
+
+		const char *cap;
+		size_t len;
+
+		if (!(cap = snapshot_r_mem(r, &len)))
+			r->err = 1;
+
+		if (r->err || !r->attached)
+			continue;
+
+		#define X(CAP, VAR, ATTRS) \
+		if (len == sizeof(CAP) - 1 && !memcmp(cap, CAP, len)) { \
+			s->ircv3_caps.VAR.set = 1; \
+			s->ircv3_caps.VAR.supported = 1; \
+		}
+		IRCV3_CAPS
+		#undef X
+	}
+
+	n_channels = snapshot_r_u32(r);
+
+	for (uint32_t i = 0; i < n_channels && !r->err; i++)
+		snapshot_r_channel(r, apply, s, (i_server == r->i_server && i == r->i_channel));
+
+	return (r->err ? -1 : 0);
+}
+
+static int
+snapshot_r_channel(struct snapshot_r *r, int apply, struct server *s, int current)
+{
+	char name[SNAPSHOT_STR_MAX];
+	char key[SNAPSHOT_STR_MAX];
+	char text[SNAPSHOT_STR_MAX];
+	char tmp[2];
+	uint32_t type = snapshot_r_u32(r);
+	uint32_t flags = snapshot_r_u32(r);
+	const char *p_name = snapshot_r_str(r, name);
+	const char *p_key = snapshot_r_str(r, key);
+	const char *p_text = snapshot_r_str(r, text);
+	uint32_t n_hist;
+	uint32_t n_lines;
+	uint32_t n_users;
+	struct channel *c = NULL;
+	struct mode chanmodes;
+	int input;
+	int lines;
+
+	if (!p_name || !p_text || (type != CHANNEL_T_CHANNEL && type != CHANNEL_T_PRIVMSG && type != CHANNEL_T_SERVER))
+		r->err = 1;
+
+	if (r->err)
+		return -1;
+
+	if (apply) {
+		if (type == CHANNEL_T_SERVER) {
+			c = s->channel;
+		} else if (!(c = channel_list_get(&(s->clist), p_name, s->casemapping))) {
+			c = channel(p_name, type);
+			c->server = s;
+			c->parted = !!(flags & SNAPSHOT_PARTED);
+			channel_list_add(&(s->clist), c);
+		}
+
+		if (p_key && !c->key)
+			channel_key_add(c, p_key);
+
+		if (current)
+			r->current = c;
+	}
+
+	snapshot_r_mode(r, &chanmodes);
+
+	n_users = snapshot_r_u32(r);
+
+	if (apply && r->attached) {
+		c->chanmodes = chanmodes;
+		c->joined = !!(flags & SNAPSHOT_JOINED);
+		mode_str(&(c->chanmodes), &(c->chanmodes_str));
+	}
+
+	while (n_users-- && !r->err) {
+
+		char user[SNAPSHOT_STR_MAX];
+		const char *p_user = snapshot_r_str(r, user);
+		struct mode prfxmodes;
+
+		snapshot_r_mode(r, &prfxmodes);
+
+		if (!p_user)
+			r->err = 1;
+
+		if (!r->err && apply && r->attached)
+			user_list_add(&(c->users), s->casemapping, p_user, prfxmodes);
+	}
+
+	n_hist = snapshot_r_u32(r);
+
+	/* Input is restored only to channels with no input or history */
+	input = (apply && c->input.hist.head == c->input.hist.tail && !input_write(&(c->input), tmp, sizeof(tmp), 0));
+
+	while (n_hist-- && !r->err) {
+
+		const char *str;
+		size_t len;
+
+		if ((str = snapshot_r_mem(r, &len)) && input) {
+			input_insert(&(c->input), str, len);
+			input_hist_push(&(c->input));
+		}
+	}
+
+	if (input)
+		input_insert(&(c->input), p_text, strlen(p_text));
+
+	n_lines = snapshot_r_u32(r);
+
+	lines = (apply && buffer_size(&(c->buffer)) == 0);
+
+	while (n_lines-- && !r->err) {
+
+		struct timespec ts;
+		uint32_t line_type = snapshot_r_u32(r);
+		const char *from;
+		const char *str;
+		size_t from_len;
+		size_t len;
+		uint64_t msgid;
+
+		ts.tv_sec = (time_t) snapshot_r_u64(r);
+		ts.tv_nsec = (long) snapshot_r_u64(r);
+		msgid = snapshot_r_u64(r);
+		from = snapshot_r_mem(r, &from_len);
+		str = snapshot_r_mem(r, &len);
+
+		if (!from || !str || line_type >= BUFFER_LINE_T_SIZE || ts.tv_nsec < 0 || ts.tv_nsec >= 1000000000)
+			r->err = 1;
+
+		if (r->err || !lines)
+			continue;
+
+		buffer_newline(&(c->buffer), line_type, from, str, from_len, len, 0, &ts);
+		buffer_head(&(c->buffer))->msgid = msgid;
+		c->buffer.time_last = ts.tv_sec;
+	}
+
+	if (apply)
+		c->logs = 1;
+
+	return (r->err ? -1 : 0);
+}
+
+static const char*
+snapshot_r_mem(struct snapshot_r *r, size_t *len)
+{
+	/* Returns a pointer to string in place, or NULL */
+
+	uint32_t n = snapshot_r_u32(r);
+	const char *str = r->p;
+
+	if (r->err || n == SNAPSHOT_NULL)
+		return NULL;
+
+	if ((size_t)(r->end - r->p) < n) {
+		r->err = 1;
+		return NULL;
+	}
+
+	r->p += n;
+	*len = n;
+
+	return str;
+}
+
+static void
+snapshot_r_mode(struct snapshot_r *r, struct mode *m)
+{
+	m->prefix = (char) snapshot_r_u32(r);
+	m->lower = snapshot_r_u32(r);
+	m->upper = snapshot_r_u32(r);
+}
+
+static const char*
+snapshot_r_str(struct snapshot_r *r, char *buf)
+{
+	/* Returns a copy of a string in `buf`, or NULL */
+
+	const char *str;
+	size_t len;
+
+	if (!(str = snapshot_r_mem(r, &len)))
+		return NULL;
+
+	if (len >= SNAPSHOT_STR_MAX || memchr(str, 0, len)) {
+		r->err = 1;
+		return NULL;
+	}
+
+	memcpy(buf, str, len);
+	buf[len] = 0;
+
+	return buf;
+}
+
+static uint32_t
+snapshot_r_u32(struct snapshot_r *r)
+{
+	uint32_t u = 0;
+
+	if ((size_t)(r->end - r->p) < sizeof(u))
+		r->err = 1;
+
+	if (r->err)
+		return 0;
+
+	memcpy(&u, r->p, sizeof(u));
+	r->p += sizeof(u);
+
+	return u;
+}
+
+static uint64_t
+snapshot_r_u64(struct snapshot_r *r)
+{
+	uint64_t u = 0;
+
+	if ((size_t)(r->end - r->p) < sizeof(u))
+		r->err = 1;
+
+	if (r->err)
+		return 0;
+
+	memcpy(&u, r->p, sizeof(u));
+	r->p += sizeof(u);
+
+	return u;
+}
+
+static void
+snapshot_w_server(FILE *f, struct server *s)
+{
+	char nicks[SNAPSHOT_STR_MAX];
+	const char *nick = s->nicks.base;
+	struct channel *c = s->channel;
+	struct io_cx_cfg cfg;
+	size_t len = 0;
+	uint32_t n_caps = 0;
+
+	for (size_t i = 0; i < s->nicks.size; i++) {
+		len += snprintf(nicks + len, sizeof(nicks) - len, "%s%s", (i ? "," : ""), nick);
+		len = MIN(len, sizeof(nicks) - 1);
+		nick += strlen(nick) + 1;
+	}
+
+	io_cx_cfg(s->connection, &cfg);
+
+	snapshot_w_str(f, s->host);
+	snapshot_w_str(f, s->port);
+	snapshot_w_str(f, s->pass);
+	snapshot_w_str(f, s->username);
+	snapshot_w_str(f, s->realname);
+	snapshot_w_str(f, s->mode);
+	snapshot_w_str(f, (s->nicks.size ? nicks : NULL));
+	snapshot_w_str(f, cfg.tls_ca_file);
+	snapshot_w_str(f, cfg.tls_ca_path);
+	snapshot_w_str(f, cfg.tls_cert);
+	snapshot_w_str(f, s->ircv3_sasl.user);
+	snapshot_w_str(f, s->ircv3_sasl.pass);
+	snapshot_w_u32(f, cfg.flags);
+	snapshot_w_u32(f, cfg.ping_min);
+	snapshot_w_u32(f, cfg.ping_max);
+	snapshot_w_u32(f, s->ircv3_sasl.mech);
+	snapshot_w_u32(f, (cfg.active || cfg.fd >= 0));
+	snapshot_w_u32(f, (uint32_t) cfg.fd);
+	snapshot_w_mem(f, cfg.rbuf, cfg.rbuf_len);
+	snapshot_w_str(f, (s->nick ? s->nick : ""));
+	snapshot_w_u32(f, s->registered);
+	snapshot_w_u32(f, s->casemapping);
+	snapshot_w_u32(f, s->whox);
+	snapshot_w_mode(f, &(s->mode_cfg.chanmodes));
+	snapshot_w_mode(f, &(s->mode_cfg.usermodes));
+	snapshot_w_mode(f, &(s->mode_cfg.CHANMODES.A));
+	snapshot_w_mode(f, &(s->mode_cfg.CHANMODES.B));
+	snapshot_w_mode(f, &(s->mode_cfg.CHANMODES.C));
+	snapshot_w_mode(f, &(s->mode_cfg.CHANMODES.D));
+	snapshot_w_mode(f, &(s->usermodes));
+	snapshot_w_str(f, s->mode_cfg.PREFIX.F);
+	snapshot_w_str(f, s->mode_cfg.PREFIX.T);
+
+	#define X(CAP, VAR, ATTRS) \
+	n_caps += s->ircv3_caps.VAR.set;
+	IRCV3_CAPS
+	#undef X
+
+	snapshot_w_u32(f, n_caps);
+
+	#define X(CAP, VAR, ATTRS) \
+	if (s->ircv3_caps.VAR.set) \
+		snapshot_w_str(f, CAP);
+	IRCV3_CAPS
+	#undef X
+
+	snapshot_w_u32(f, s->clist.count);
+
+	do {
+		snapshot_w_channel(f, c);
+	} while ((c = c->next) != s->channel);
+}
+
+static void
+snapshot_w_channel(FILE *f, struct channel *c)
+{
+	char text[INPUT_LEN_MAX + 1];
+	struct input *inp = &(c->input);
+
+	input_write(inp, text, sizeof(text), 0);
+
+	snapshot_w_u32(f, c->type);
+	snapshot_w_u32(f, (c->parted ? SNAPSHOT_PARTED : 0) | (c->joined ? SNAPSHOT_JOINED : 0));
+	snapshot_w_str(f, c->name);
+	snapshot_w_str(f, c->key);
+	snapshot_w_str(f, text);
+	snapshot_w_mode(f, &(c->chanmodes));
+	snapshot_w_u32(f, c->users.count);
+	snapshot_w_users(f, TREE_ROOT(&(c->users)));
+	snapshot_w_u32(f, (uint16_t)(inp->hist.head - inp->hist.tail));
+
+	for (uint16_t i = inp->hist.tail; i != inp->hist.head; i++)
+		snapshot_w_str(f, inp->hist.ptrs[i & (INPUT_HIST_MAX - 1)]);
+
+	snapshot_w_u32(f, buffer_size(&(c->buffer)));
+
+	for (unsigned i = c->buffer.tail; i != c->buffer.head; i++) {
+
+		struct buffer_line *line = buffer_line(&(c->buffer), i);
+
+		snapshot_w_u32(f, line->type);
+		snapshot_w_u64(f, (uint64_t) line->time.tv_sec);
+		snapshot_w_u64(f, (uint64_t) line->time.tv_nsec);
+		snapshot_w_u64(f, line->msgid);
+		snapshot_w_mem(f, line->from, line->from_len);
+		snapshot_w_mem(f, line->text, line->text_len);
+	}
+}
+
+static void
+snapshot_w_mem(FILE *f, const char *str, size_t len)
+{
+	snapshot_w_u32(f, len);
+	fwrite(str, 1, len, f);
+}
+
+static void
+snapshot_w_mode(FILE *f, const struct mode *m)
+{
+	snapshot_w_u32(f, (unsigned char) m->prefix);
+	snapshot_w_u32(f, m->lower);
+	snapshot_w_u32(f, m->upper);
+}
+
+static void
+snapshot_w_str(FILE *f, const char *str)
+{
+	if (str)
+		snapshot_w_mem(f, str, strlen(str));
+	else
+		snapshot_w_u32(f, SNAPSHOT_NULL);
+}
+
+static void
+snapshot_w_u32(FILE *f, uint32_t u)
+{
+	fwrite(&u, sizeof(u), 1, f);
+}
+
+static void
+snapshot_w_u64(FILE *f, uint64_t u)
+{
+	fwrite(&u, sizeof(u), 1, f);
+}
+
+static void
+snapshot_w_users(FILE *f, struct user *u)
+{
+	if (u) {
+		snapshot_w_users(f, TREE_LEFT(u, ul));
+		snapshot_w_str(f, u->nick);
+		snapshot_w_mode(f, &(u->prfxmodes));
+		snapshot_w_users(f, TREE_RIGHT(u, ul));
+	}
+}
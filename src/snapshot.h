@@ -0,0 +1,34 @@
+#ifndef RIRC_SNAPSHOT_H
+#define RIRC_SNAPSHOT_H
+
+/* Session snapshots
+ *
+ * Servers, channels, buffers and input are written to a versioned
+ * binary file, in order:
+ *
+ *   header:  magic, version, byte order mark, file size, current
+ *            channel's server and channel index, server count
+ *   server:  settings, connection settings, session, channel count
+ *   channel: type, flags, name, key, session, input, input history, buffer
+ *
+ * Integers are native byte order, strings are length prefixed, and
+ * the file is restored by mapping it and reading it in place. Servers
+ * are merged with any of the same host and port, and only empty
+ * buffers are restored
+ *
+ * A server's session is its registration, modes, capabilities and
+ * channel membership. It's written for every server but restored only
+ * when resuming a connection detached from its socket before exec,
+ * see io_cx_detach
+ */
+
+#define SNAPSHOT_VERSION 2
+
+/* Write a snapshot to a file, replacing it, returns -1 on failure */
+int snapshot_write(const char*);
+
+/* Restore a snapshot from a file, returns -1 on failure, with args:
+ *   path, resume connections detached by the writing process */
+int snapshot_read(const char*, int);
+
+#endif
@@ -3,28 +3,53 @@
 #include "config.h"
 #include "src/components/channel.h"
 #include "src/draw.h"
+#include "src/event.h"
 #include "src/handlers/irc_recv.h"
 #include "src/handlers/irc_send.h"
 #include "src/io.h"
+#include "src/log.h"
 #include "src/rirc.h"
+#include "src/snapshot.h"
+#include "src/trace.h"
 #include "src/utils/utils.h"
 
 #include <ctype.h>
+#include <errno.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 /* See: https://vt100.net/docs/vt100-ug/chapter3.html */
 #define CTRL(k) ((k) & 0x1f)
 
+/* Seconds between CHATHISTORY requests, and before a pending request expires */
+#define HISTORY_INTERVAL 2
+#define HISTORY_TIMEOUT  30
+
+/* Bracketed paste sequences, and maximum pasted input retained */
+#define PASTE_BEGIN   "\x1b[200~"
+#define PASTE_END     "\x1b[201~"
+#define PASTE_LEN_MAX (1 << 20)
+
 #define COMMAND_HANDLERS \
 	X(clear) \
 	X(close) \
 	X(connect) \
+	X(detach) \
 	X(disconnect) \
-	X(quit)
+	X(lag) \
+	X(latency) \
+	X(quit) \
+	X(snapshot) \
+	X(stats) \
+	X(trace) \
+	X(upgrade) \
+	X(whois)
 
 #define X(CMD) \
 static void command_##CMD(struct channel*, char*);
@@ -32,15 +57,37 @@ COMMAND_HANDLERS
 #undef X
 
 static void newlinev(struct channel*, enum buffer_line_type, const char*, const char*, va_list);
+static int newline_date(struct channel*, const struct timespec*, int);
+static int newline_date_eq(time_t, time_t);
+static int newline_date_fmt(char*, size_t, time_t);
+static int newline_date_is(const struct buffer_line*);
+
+static void state_channel_logs(struct channel*);
+static int state_channel_logs_cb(time_t, const char*, size_t, const char*, size_t, void*);
+
+static void state_lag_probe(struct server*);
 
+static void state_stats(struct server*, void (*)(void*, const char*), void*);
+static void state_stats_dump(void);
+static void state_stats_fputs(void*, const char*);
+static void state_stats_newline(void*, const char*);
+static void state_trace_newline(const char*, void*);
+
+static int state_input(const char*, size_t);
 static int state_input_linef(struct channel*);
 static int state_input_ctrlch(const char*, size_t);
 static int state_input_action(const char*, size_t);
+static int state_input_paste(const char*, size_t);
+static int state_input_paste_end(void);
+static void state_paste_append(const char*, size_t);
+static void state_input_hist(struct channel*);
+static void state_input_search(int);
 
 static void buffer_scrollback_tail(void);
 static void buffer_scrollback_head(void);
 static void buffer_scrollback_back(void);
 static void buffer_scrollback_forw(void);
+static void buffer_scrollback_history(struct channel*);
 
 static uint16_t state_complete(char*, uint16_t, uint16_t, int);
 static uint16_t state_complete_list(char*, uint16_t, uint16_t, const char**);
@@ -55,6 +102,8 @@ static void channel_move_next(void);
 static int action_clear(char);
 static int action_close(char);
 static int action_error(char);
+static int action_paste(char);
+static int action_search(char);
 static int (*action_handler)(char);
 static char action_buff[256];
 
@@ -65,6 +114,24 @@ static struct
 	struct channel *current_channel; /* the current channel being drawn */
 	struct channel *default_channel; /* the default rirc channel at startup */
 	struct server_list servers;
+	const struct timespec *time;     /* server-time of the message being handled */
+	uint64_t msgid;                  /* msgid hash of the message being handled */
+	uint64_t stats_dumped;           /* time STATS_FILE was last written, ns */
+	struct {
+		char *buf;
+		size_t len;
+		size_t size;
+		size_t end;                  /* length of PASTE_END matched */
+		unsigned active : 1;
+	} paste;                         /* bracketed paste input */
+	unsigned upgrade : 1;            /* :upgrade pending, see state_upgrade */
+	struct {
+		char str[64];
+		char match[INPUT_LEN_MAX + 1];
+		size_t len;
+		size_t pos;                  /* history position of the match */
+		uint16_t match_len;
+	} search;                        /* input history reverse search */
 } state;
 
 static unsigned state_tty_cols;
@@ -136,6 +203,9 @@ state_term(void)
 	action_handler = NULL;
 	action_buff[0] = 0;
 
+	free(state.paste.buf);
+	memset(&(state.paste), 0, sizeof(state.paste));
+
 	if ((s1 = state_server_list()->head) == NULL)
 		return;
 
@@ -150,6 +220,75 @@ state_term(void)
 	state.servers.tail = NULL;
 }
 
+int
+state_upgrade(char *path, size_t len)
+{
+	/* Detach plaintext connections from their sockets and write the
+	 * session for the upgraded process to resume. On failure the
+	 * connections are reattached and the upgrade is abandoned */
+
+	struct server *s;
+	int err;
+	int fd;
+
+	if (!state.upgrade)
+		return 0;
+
+	state.upgrade = 0;
+
+	if (snprintf(path, len, "%s/rirc.upgrade.XXXXXX", (getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp")) >= (int)len) {
+		newlinef(current_channel(), 0, FROM_ERROR, "upgrade: %s", strerror(ENAMETOOLONG));
+		return -1;
+	}
+
+	if ((fd = mkstemp(path)) < 0) {
+		newlinef(current_channel(), 0, FROM_ERROR, "upgrade: %s: %s", path, strerror(errno));
+		return -1;
+	}
+
+	close(fd);
+
+	if ((s = state_server_list()->head)) {
+		do {
+			(void) io_cx_detach(s->connection);
+		} while ((s = s->next) != state_server_list()->head);
+	}
+
+	if (snapshot_write(path) == 0)
+		return 1;
+
+	err = errno;
+
+	state_upgrade_abort(path);
+
+	newlinef(current_channel(), 0, FROM_ERROR, "upgrade: %s: %s", path, strerror(err));
+
+	return -1;
+}
+
+void
+state_upgrade_abort(const char *path)
+{
+	/* Abandon a prepared upgrade, removing its session file and
+	 * reattaching connections to their detached sockets */
+
+	struct io_cx_cfg cfg;
+	struct server *s;
+	int ret;
+
+	unlink(path);
+
+	if ((s = state_server_list()->head)) {
+		do {
+			io_cx_cfg(s->connection, &cfg);
+
+			if (cfg.fd >= 0 && (ret = io_cx_attach(s->connection, cfg.fd, cfg.rbuf, cfg.rbuf_len)))
+				server_error(s, "upgrade: failed to resume connection: %s", io_err(ret));
+
+		} while ((s = s->next) != state_server_list()->head);
+	}
+}
+
 unsigned
 state_cols(void)
 {
@@ -210,32 +349,26 @@ newlinev(struct channel *c, enum buffer_line_type type, const char *from, const
 		}
 	}
 
+	if (!c->logs)
+		state_channel_logs(c);
+
 	/* new date separator */
-	struct tm tm_old;
-	struct tm tm_new;
+	struct timespec ts;
+
+	if (state.time)
+		ts = *state.time;
+	else if (clock_gettime(CLOCK_REALTIME, &ts))
+		fatal("clock_gettime");
 
 	time_t t_old = c->buffer.time_last;
-	time_t t_new = time(NULL);
+	time_t t_new = ts.tv_sec;
 
 	if ((c->type == CHANNEL_T_CHANNEL
 	  || c->type == CHANNEL_T_PRIVMSG
 	  || c->type == CHANNEL_T_SERVER)
-	 && localtime_r(&t_old, &tm_old)
-	 && localtime_r(&t_new, &tm_new)
-	 && (tm_old.tm_year != tm_new.tm_year
-	  || tm_old.tm_yday != tm_new.tm_yday))
+	 && !newline_date_eq(t_old, t_new))
 	{
-		char buf_date[64];
-
-		if (strftime(buf_date, sizeof(buf_date), "-- %e %b %Y --", &tm_new))
-			buffer_newline(
-				&(c->buffer),
-				BUFFER_LINE_OTHER,
-				FROM_INFO,
-				buf_date,
-				strlen(FROM_INFO),
-				strlen(buf_date),
-				0);
+		newline_date(c, &ts, 0);
 	}
 
 	c->buffer.time_last = t_new;
@@ -247,7 +380,13 @@ newlinev(struct channel *c, enum buffer_line_type type, const char *from, const
 		text_str,
 		from_len,
 		text_len,
-		prefix);
+		prefix,
+		&ts);
+
+	buffer_head(&(c->buffer))->msgid = state.msgid;
+
+	if (c->server && c->type != CHANNEL_T_RIRC)
+		log_line(c->server->host, c->name, t_new, from_str, text_str);
 
 	if (c == current_channel()) {
 		draw(DRAW_BUFFER);
@@ -258,15 +397,186 @@ newlinev(struct channel *c, enum buffer_line_type type, const char *from, const
 	}
 }
 
+static int
+newline_date(struct channel *c, const struct timespec *ts, int prepend)
+{
+	/* Add a date separator line, or prepend it, returning 0 if the
+	 * buffer is full */
+
+	char buf_date[64];
+
+	if (!newline_date_fmt(buf_date, sizeof(buf_date), ts->tv_sec))
+		return 1;
+
+	if (prepend)
+		return !!buffer_prepend(
+			&(c->buffer),
+			BUFFER_LINE_OTHER,
+			FROM_INFO,
+			buf_date,
+			strlen(FROM_INFO),
+			strlen(buf_date),
+			0,
+			ts);
+
+	buffer_newline(
+		&(c->buffer),
+		BUFFER_LINE_OTHER,
+		FROM_INFO,
+		buf_date,
+		strlen(FROM_INFO),
+		strlen(buf_date),
+		0,
+		ts);
+
+	return 1;
+}
+
+static int
+newline_date_eq(time_t t1, time_t t2)
+{
+	struct tm tm1;
+	struct tm tm2;
+
+	return (localtime_r(&t1, &tm1)
+	     && localtime_r(&t2, &tm2)
+	     && tm1.tm_year == tm2.tm_year
+	     && tm1.tm_yday == tm2.tm_yday);
+}
+
+static int
+newline_date_fmt(char *buf, size_t len, time_t t)
+{
+	struct tm tm;
+
+	return (localtime_r(&t, &tm) && strftime(buf, len, "-- %e %b %Y --", &tm));
+}
+
+static int
+newline_date_is(const struct buffer_line *line)
+{
+	/* Check if a line is the date separator for its time */
+
+	char buf_date[64];
+
+	return (line->type == BUFFER_LINE_OTHER
+	     && !strcmp(line->from, FROM_INFO)
+	     && newline_date_fmt(buf_date, sizeof(buf_date), line->time.tv_sec)
+	     && !strcmp(line->text, buf_date));
+}
+
+struct buffer_line*
+newline_prepend(
+		struct channel *c,
+		enum buffer_line_type type,
+		const char *from_str,
+		const char *text_str,
+		size_t from_len,
+		size_t text_len,
+		const struct timespec *ts)
+{
+	/* Prepend a line older than a channel's buffered lines, e.g. fetched
+	 * history or logged lines, keeping a date separator above each day's
+	 * lines. Returns NULL if the buffer is full */
+
+	struct buffer *b = &(c->buffer);
+	struct buffer_line *line;
+	struct buffer_line *tail = buffer_tail(b);
+	struct buffer_line tmp;
+	struct timespec t;
+
+	if (ts)
+		t = *ts;
+	else if (clock_gettime(CLOCK_REALTIME, &t))
+		fatal("clock_gettime");
+
+	if (tail && newline_date_is(tail) && newline_date_eq(tail->time.tv_sec, t.tv_sec)) {
+
+		/* same day, swap the line below the day's separator */
+		if (!(line = buffer_prepend(b, type, from_str, text_str, from_len, text_len, 0, &t)))
+			return NULL;
+
+		tmp = *line;
+		*line = *tail;
+		*tail = tmp;
+
+		return tail;
+	}
+
+	if (BUFFER_LINES_MAX - buffer_size(b) < (tail && !newline_date_is(tail) && !newline_date_eq(tail->time.tv_sec, t.tv_sec) ? 3 : 2))
+		return NULL;
+
+	/* the buffer's oldest line is from a later day, without a separator */
+	if (tail && !newline_date_is(tail) && !newline_date_eq(tail->time.tv_sec, t.tv_sec))
+		newline_date(c, &(tail->time), 1);
+
+	if (!buffer_size(b))
+		b->time_last = t.tv_sec;
+
+	line = buffer_prepend(b, type, from_str, text_str, from_len, text_len, 0, &t);
+
+	newline_date(c, &t, 1);
+
+	return line;
+}
+
+static void
+state_channel_logs(struct channel *c)
+{
+	/* Prefill a buffer with the lines most recently logged, when
+	 * first written to, prepending lines and date separators */
+
+	c->logs = 1;
+
+	if (!LOG_PREFILL_LINES || !c->server || c->type == CHANNEL_T_RIRC || buffer_size(&(c->buffer)))
+		return;
+
+	log_tail(c->server->host, c->name, MIN(LOG_PREFILL_LINES, BUFFER_LINES_MAX), state_channel_logs_cb, c);
+}
+
+static int
+state_channel_logs_cb(time_t t, const char *from, size_t from_len, const char *text, size_t text_len, void *arg)
+{
+	char buf[FROM_LENGTH_MAX + 1];
+	enum buffer_line_type type;
+	struct channel *c = arg;
+	struct timespec ts = { .tv_sec = t };
+
+	from_len = MIN(from_len, FROM_LENGTH_MAX);
+	memcpy(buf, from, from_len);
+	buf[from_len] = 0;
+
+	if (!strcmp(buf, FROM_INFO))
+		type = BUFFER_LINE_OTHER;
+	else if (!strcmp(buf, FROM_ERROR))
+		type = BUFFER_LINE_SERVER_ERROR;
+	else if (!strcmp(buf, FROM_JOIN))
+		type = BUFFER_LINE_JOIN;
+	else if (!strcmp(buf, FROM_PART))
+		type = BUFFER_LINE_PART;
+	else if (c->server->nick && !strcmp(buf, c->server->nick))
+		type = BUFFER_LINE_CHAT_RIRC;
+	else
+		type = BUFFER_LINE_CHAT;
+
+	return !newline_prepend(c, type, from, text, from_len, text_len, &ts);
+}
+
 static int
 state_input_action(const char *input, size_t len)
 {
 	/* Waiting for user confirmation */
 
+	/* Escape sequences are ignored, other input is handled bytewise */
+	if (len > 1 && *input == 0x1b)
+		return 0;
+
 	/* ^c canceled the action, or the action was resolved */
-	if (len == 1 && (*input == CTRL('c') || action_handler(*input))) {
-		action_handler = NULL;
-		return 1;
+	for (; len; input++, len--) {
+		if (*input == CTRL('c') || action_handler(*input)) {
+			action_handler = NULL;
+			return 1;
+		}
 	}
 
 	return 0;
@@ -308,6 +618,35 @@ action_close(char c)
 	return 0;
 }
 
+static int
+action_paste(char c)
+{
+	if (toupper(c) == 'N') {
+		state.paste.len = 0;
+		return 1;
+	}
+
+	if (toupper(c) == 'Y') {
+
+		struct channel *chan = current_channel();
+		size_t i;
+
+		/* Lines were split in place on line breaks */
+		for (i = 0; i < state.paste.len; i += strlen(state.paste.buf + i) + 1) {
+			if (state.paste.buf[i])
+				server_sendq_push(chan->server, chan->name, state.paste.buf + i);
+		}
+
+		state.paste.len = 0;
+
+		irc_send_queue(chan->server);
+
+		return 1;
+	}
+
+	return 0;
+}
+
 void
 action(int (*a_handler)(char), const char *fmt, ...)
 {
@@ -332,6 +671,51 @@ action(int (*a_handler)(char), const char *fmt, ...)
 	}
 }
 
+static int
+action_search(char c)
+{
+	/* Reverse incremental search of input history: input extends
+	 * the search string, ^r finds the next older match and
+	 * line feed accepts the match as input */
+
+	struct channel *c_cur = current_channel();
+
+	switch (c) {
+
+		case 0x0A:
+		case 0x0D:
+			if (state.search.match_len) {
+				input_reset(&(c_cur->input));
+				input_insert(&(c_cur->input), state.search.match, state.search.match_len);
+			}
+			return 1;
+
+		case 0x1b:
+			return 1;
+
+		case CTRL('r'):
+			state_input_search(1);
+			break;
+
+		case 0x08:
+		case 0x7F:
+			if (state.search.len)
+				state.search.str[--state.search.len] = 0;
+			state.search.pos = 0;
+			state_input_search(0);
+			break;
+
+		default:
+			if (isprint(c) && state.search.len < sizeof(state.search.str) - 1) {
+				state.search.str[state.search.len++] = c;
+				state.search.str[state.search.len] = 0;
+				state_input_search(0);
+			}
+	}
+
+	return 0;
+}
+
 const char*
 action_message(void)
 {
@@ -389,6 +773,7 @@ state_channel_close(int action_confirm)
 		else
 			channel_set_current(channel_get_next(c));
 
+		server_user_info_gc(s, c);
 		channel_list_del(&(s->clist), c);
 		channel_free(c);
 		return;
@@ -438,6 +823,10 @@ buffer_scrollback_back(void)
 {
 	struct buffer *b = &(current_channel()->buffer);
 
+	/* Oldest line is in view, fetch more */
+	if (b->buffer_i_top == b->tail)
+		buffer_scrollback_history(current_channel());
+
 	if (buffer_line(b, b->scrollback) != (buffer_tail(b))) {
 		draw(DRAW_BUFFER_BACK);
 		draw(DRAW_BUFFER);
@@ -457,6 +846,52 @@ buffer_scrollback_forw(void)
 	}
 }
 
+static void
+buffer_scrollback_history(struct channel *c)
+{
+	/* Request the page of history preceding the oldest buffer line,
+	 * to be prepended when the chathistory batch is received */
+
+	int ret;
+	struct buffer_line *line;
+	struct server *s = c->server;
+	time_t t = time(NULL);
+	unsigned n = MIN(CHATHISTORY_LINES, BUFFER_LINES_MAX - buffer_size(&(c->buffer)));
+
+	if (n == 0)
+		return;
+
+	if (c->type != CHANNEL_T_CHANNEL && c->type != CHANNEL_T_PRIVMSG)
+		return;
+
+	if (!s->registered || !s->ircv3_caps.batch.set || !s->ircv3_caps.chathistory.set)
+		return;
+
+	if (t - c->history_time < (c->history ? HISTORY_TIMEOUT : HISTORY_INTERVAL))
+		return;
+
+	if ((line = buffer_tail(&(c->buffer)))) {
+
+		char buf[sizeof("YYYY-MM-DDThh:mm:ss")];
+		struct tm tm;
+
+		if (!gmtime_r(&(line->time.tv_sec), &tm) || !strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &tm))
+			return;
+
+		ret = io_sendf(s->connection, "CHATHISTORY BEFORE %s timestamp=%s.%03ldZ %u",
+			c->name, buf, (line->time.tv_nsec / 1000000), n);
+	} else {
+		ret = io_sendf(s->connection, "CHATHISTORY LATEST %s * %u", c->name, n);
+	}
+
+	if (ret) {
+		server_error(s, "sendf fail: %s", io_err(ret));
+	} else {
+		c->history = 1;
+		c->history_time = t;
+	}
+}
+
 struct channel*
 channel_get_first(void)
 {
@@ -675,6 +1110,8 @@ command_connect(struct channel *c, char *args)
 		int ipv                 = IO_IPV_UNSPEC;
 		int tls                 = IO_TLS_ENABLED;
 		int tls_vrfy            = IO_TLS_VRFY_REQUIRED;
+		unsigned ping_max       = IO_PING_MAX;
+		unsigned ping_min       = IO_PING_MIN;
 
 		while ((arg = irc_strsep(&args))) {
 
@@ -773,12 +1210,33 @@ command_connect(struct channel *c, char *args)
 				ipv = IO_IPV_4;
 			} else if (!strcmp(arg, "--ipv6")) {
 				ipv = IO_IPV_6;
+			} else if (!strcmp(arg, "--ping-min")) {
+				if (!(arg = irc_strsep(&args))) {
+					action(action_error, "connect: '--ping-min' requires an argument");
+					return;
+				} else if (irc_strtou(arg, &ping_min, 86400)) {
+					action(action_error, "connect: invalid option for '--ping-min' '%s'", arg);
+					return;
+				}
+			} else if (!strcmp(arg, "--ping-max")) {
+				if (!(arg = irc_strsep(&args))) {
+					action(action_error, "connect: '--ping-max' requires an argument");
+					return;
+				} else if (irc_strtou(arg, &ping_max, 86400)) {
+					action(action_error, "connect: invalid option for '--ping-max' '%s'", arg);
+					return;
+				}
 			} else {
 				action(action_error, "connect: unknown option '%s'", arg);
 				return;
 			}
 		}
 
+		if (ping_max && ping_min > ping_max) {
+			action(action_error, "connect: '--ping-min' %u exceeds '--ping-max' %u", ping_min, ping_max);
+			return;
+		}
+
 		if (port == NULL)
 			port = (tls == IO_TLS_ENABLED) ? "6697" : "6667";
 
@@ -814,6 +1272,8 @@ command_connect(struct channel *c, char *args)
 			tls_cert,
 			(ipv | tls | tls_vrfy));
 
+		(void) io_set_ping(s->connection, ping_min, ping_max);
+
 		if ((ret = io_cx(s->connection)))
 			server_error(s, "failed to connect: %s", io_err(ret));
 
@@ -821,6 +1281,24 @@ command_connect(struct channel *c, char *args)
 	}
 }
 
+static void
+command_detach(struct channel *c, char *args)
+{
+	/* :detach, detach the client attached to a daemon */
+
+	UNUSED(c);
+
+	char *arg;
+
+	if ((arg = irc_strsep(&args))) {
+		action(action_error, "detach: Unknown arg '%s'", arg);
+		return;
+	}
+
+	if (io_daemon_detach() < 0)
+		action(action_error, "detach: Not running as a daemon");
+}
+
 static void
 command_disconnect(struct channel *c, char *args)
 {
@@ -841,6 +1319,72 @@ command_disconnect(struct channel *c, char *args)
 		action(action_error, "disconnect: %s", io_err(err));
 }
 
+static void
+command_lag(struct channel *c, char *args)
+{
+	/* :lag, print the current server's lag and lag histogram */
+
+	char *arg;
+	size_t i;
+	struct server *s;
+
+	if (!(s = c->server)) {
+		action(action_error, "lag: This is not a server");
+		return;
+	}
+
+	if ((arg = irc_strsep(&args))) {
+		action(action_error, "lag: Unknown arg '%s'", arg);
+		return;
+	}
+
+	if (!s->lag.n) {
+		action(action_error, "lag: No lag measured");
+		return;
+	}
+
+	newlinef(c, 0, FROM_INFO, "Lag: %ums (last %ums, %u measured)", s->lag.avg, s->lag.last, s->lag.n);
+
+	for (i = 0; i < SERVER_LAG_HIST_N; i++) {
+		if (i < ARR_LEN(server_lag_hist))
+			newlinef(c, 0, FROM_INFO, " .. < %4ums: %u", server_lag_hist[i], s->lag.hist[i]);
+		else
+			newlinef(c, 0, FROM_INFO, " .. >=%4ums: %u", server_lag_hist[i - 1], s->lag.hist[i]);
+	}
+}
+
+static void
+command_latency(struct channel *c, char *args)
+{
+	/* :latency, print the input latency histogram */
+
+	char *arg;
+	size_t i;
+	struct io_latency latency;
+
+	if ((arg = irc_strsep(&args))) {
+		action(action_error, "latency: Unknown arg '%s'", arg);
+		return;
+	}
+
+	io_latency(&latency);
+
+	if (!latency.n) {
+		action(action_error, "latency: No input measured");
+		return;
+	}
+
+	newlinef(c, 0, FROM_INFO, "Input latency: %uus (max %uus, %u measured)",
+		(unsigned)(latency.sum / latency.n), latency.max, latency.n);
+
+	for (i = 0; i < IO_LATENCY_HIST_N; i++) {
+		if (i < ARR_LEN(io_latency_hist))
+			newlinef(c, 0, FROM_INFO, " .. < %5uus: %u", io_latency_hist[i], latency.hist[i]);
+		else
+			newlinef(c, 0, FROM_INFO, " .. >=%5uus: %u", io_latency_hist[i - 1], latency.hist[i]);
+	}
+}
+
 static void
 command_quit(struct channel *c, char *args)
 {
@@ -853,9 +1397,153 @@ command_quit(struct channel *c, char *args)
 		return;
 	}
 
+	if (*SNAPSHOT_FILE && snapshot_write(SNAPSHOT_FILE) < 0)
+		debug("snapshot: %s: %s", SNAPSHOT_FILE, strerror(errno));
+
+	io_stop();
+}
+
+static void
+command_snapshot(struct channel *c, char *args)
+{
+	/* :snapshot [path], write a snapshot of the session */
+
+	char *arg;
+	const char *path;
+
+	if (!(path = irc_strsep(&args)))
+		path = SNAPSHOT_FILE;
+
+	if ((arg = irc_strsep(&args))) {
+		action(action_error, "snapshot: Unknown arg '%s'", arg);
+		return;
+	}
+
+	if (!*path) {
+		action(action_error, "snapshot: No file configured");
+		return;
+	}
+
+	if (snapshot_write(path) < 0) {
+		action(action_error, "snapshot: %s: %s", path, strerror(errno));
+		return;
+	}
+
+	newlinef(c, 0, FROM_INFO, "Snapshot written to '%s'", path);
+}
+
+static void
+command_stats(struct channel *c, char *args)
+{
+	/* :stats, print the current server's traffic and handler stats */
+
+	char *arg;
+	struct server *s;
+
+	if (!(s = c->server)) {
+		action(action_error, "stats: This is not a server");
+		return;
+	}
+
+	if ((arg = irc_strsep(&args))) {
+		action(action_error, "stats: Unknown arg '%s'", arg);
+		return;
+	}
+
+	state_stats(s, state_stats_newline, c);
+}
+
+static void
+command_trace(struct channel *c, char *args)
+{
+	/* :trace [count], print the most recently traced events */
+
+	char *arg;
+	char *end;
+	unsigned long n = 20;
+
+	if ((arg = irc_strsep(&args))) {
+
+		errno = 0;
+		n = strtoul(arg, &end, 10);
+
+		if (!isdigit(*arg) || *end || errno || !n) {
+			action(action_error, "trace: Invalid count '%s'", arg);
+			return;
+		}
+	}
+
+	if ((arg = irc_strsep(&args))) {
+		action(action_error, "trace: Unknown arg '%s'", arg);
+		return;
+	}
+
+	if (!trace_tail((unsigned)MIN(n, UINT_MAX), state_trace_newline, c))
+		action(action_error, "trace: No events traced");
+}
+
+static void
+command_upgrade(struct channel *c, char *args)
+{
+	/* :upgrade, restart rirc in place, resuming plaintext connections */
+
+	UNUSED(c);
+
+	char *arg;
+
+	if ((arg = irc_strsep(&args))) {
+		action(action_error, "upgrade: Unknown arg '%s'", arg);
+		return;
+	}
+
+	state.upgrade = 1;
+
 	io_stop();
 }
 
+static void
+command_whois(struct channel *c, char *args)
+{
+	/* :whois <nick>, lookup cached user info without a network round trip */
+
+	char *arg;
+	const char *nick;
+	struct user_info *u;
+
+	if (!c->server) {
+		action(action_error, "whois: This is not a server");
+		return;
+	}
+
+	if (!(nick = irc_strsep(&args))) {
+		action(action_error, "whois: Nick required");
+		return;
+	}
+
+	if ((arg = irc_strsep(&args))) {
+		action(action_error, "whois: Unknown arg '%s'", arg);
+		return;
+	}
+
+	if (!(u = user_info_get(&(c->server->user_info), c->server->casemapping, nick))) {
+		action(action_error, "whois: No info cached for '%s'", nick);
+		return;
+	}
+
+	newlinef(c, 0, FROM_INFO, "%s!%s (%s)",
+		u->nick,
+		(u->host ? u->host : "*"),
+		(u->realname ? u->realname : "*"));
+
+	if (u->account)
+		newlinef(c, 0, FROM_INFO, "%s is logged in as %s", u->nick, u->account);
+
+	if (u->away && *u->away)
+		newlinef(c, 0, FROM_INFO, "%s is away: %s", u->nick, u->away);
+	else if (u->away)
+		newlinef(c, 0, FROM_INFO, "%s is away", u->nick);
+}
+
 static int
 state_input_ctrlch(const char *c, size_t len)
 {
@@ -869,9 +1557,24 @@ state_input_ctrlch(const char *c, size_t len)
 		if (len == 1)
 			return 0;
 
+		/* bracketed paste, possibly followed by pasted input */
+		if (len >= sizeof(PASTE_BEGIN) - 1 && !strncmp(c, PASTE_BEGIN + 1, sizeof(PASTE_BEGIN) - 2)) {
+
+			state.paste.active = 1;
+			state.paste.end = 0;
+			state.paste.len = 0;
+
+			c += sizeof(PASTE_BEGIN) - 2;
+			len -= sizeof(PASTE_BEGIN) - 1;
+
+			return (len ? state_input_paste(c, len) : 0);
+		}
+
 		/* arrow up */
-		else if (!strncmp(c, "[A", len - 1))
+		else if (!strncmp(c, "[A", len - 1)) {
+			state_input_hist(current_channel());
 			return input_hist_back(&(current_channel()->input));
+		}
 
 		/* arrow down */
 		else if (!strncmp(c, "[B", len - 1))
@@ -959,6 +1662,15 @@ state_input_ctrlch(const char *c, size_t len)
 			state_channel_close(1);
 			break;
 
+		case CTRL('r'):
+			/* Search input history */
+			state_input_hist(current_channel());
+			state.search.str[0] = 0;
+			state.search.len = 0;
+			state.search.pos = 0;
+			state_input_search(0);
+			break;
+
 		case CTRL('u'):
 			/* Scoll buffer up */
 			buffer_scrollback_back();
@@ -973,6 +1685,190 @@ state_input_ctrlch(const char *c, size_t len)
 	return 0;
 }
 
+static int
+state_input(const char *buf, size_t len)
+{
+	if (state.paste.active)
+		return state_input_paste(buf, len);
+	else if (action_handler)
+		return state_input_action(buf, len);
+	else if (iscntrl(*buf))
+		return state_input_ctrlch(buf, len);
+	else
+		return input_insert(&current_channel()->input, buf, len);
+}
+
+static int
+state_input_paste(const char *buf, size_t len)
+{
+	/* Accumulate pasted input until PASTE_END, which might be split
+	 * across reads, input following it is handled normally */
+
+	for (size_t i = 0; i < len; i++) {
+
+		if (buf[i] == PASTE_END[state.paste.end]) {
+
+			if (++state.paste.end < sizeof(PASTE_END) - 1)
+				continue;
+
+			if (i + 1 < len)
+				return (state_input_paste_end() | state_input(buf + i + 1, len - i - 1));
+
+			return state_input_paste_end();
+		}
+
+		/* A partial match was pasted input */
+		state_paste_append(PASTE_END, state.paste.end);
+
+		if ((state.paste.end = (buf[i] == PASTE_END[0])) == 0)
+			state_paste_append(buf + i, 1);
+	}
+
+	return 0;
+}
+
+static int
+state_input_paste_end(void)
+{
+	/* Single line pastes are inserted as input, multiple lines
+	 * are offered to send as messages to the current channel */
+
+	struct channel *c = current_channel();
+	const char *line = NULL;
+	unsigned lines = 0;
+	size_t i;
+
+	state.paste.active = 0;
+	state.paste.end = 0;
+
+	/* Split lines in place, terminating the last */
+	for (i = 0; i < state.paste.len; i++) {
+		if (state.paste.buf[i] == '\r' || state.paste.buf[i] == '\n')
+			state.paste.buf[i] = 0;
+	}
+
+	if (state.paste.len)
+		state.paste.buf[state.paste.len] = 0;
+
+	for (i = 0; i < state.paste.len; i += strlen(state.paste.buf + i) + 1) {
+		if (state.paste.buf[i] && !lines++)
+			line = state.paste.buf + i;
+	}
+
+	if (lines == 0)
+		return 0;
+
+	if (lines == 1) {
+		state.paste.len = 0;
+		return input_insert(&(c->input), line, strlen(line));
+	}
+
+	if (!c->server || !(c->type == CHANNEL_T_CHANNEL || c->type == CHANNEL_T_PRIVMSG))
+		action(action_error, "paste: This is not a channel");
+	else if (!c->server->registered)
+		action(action_error, "paste: Not registered with server");
+	else if (c->type == CHANNEL_T_CHANNEL && (!c->joined || c->parted))
+		action(action_error, "paste: Not on channel");
+	else
+		action(action_paste, "Send %u lines to '%s'?   [y/n]", lines, c->name);
+
+	if (action_handler != action_paste)
+		state.paste.len = 0;
+
+	return 0;
+}
+
+static void
+state_paste_append(const char *buf, size_t len)
+{
+	/* Pasted input beyond PASTE_LEN_MAX is discarded, one byte
+	 * is always reserved for terminating the last line */
+
+	len = MIN(len, PASTE_LEN_MAX - state.paste.len);
+
+	if (state.paste.len + len >= state.paste.size) {
+
+		size_t size = MAX(state.paste.size, 1024);
+
+		while (state.paste.len + len >= size)
+			size *= 2;
+
+		if ((state.paste.buf = realloc(state.paste.buf, size)) == NULL)
+			fatal("realloc: %s", strerror(errno));
+
+		state.paste.size = size;
+	}
+
+	memcpy(state.paste.buf + state.paste.len, buf, len);
+	state.paste.len += len;
+}
+
+static void
+state_input_hist(struct channel *c)
+{
+	/* Open the channel's persistent input history on first use,
+	 * as INPUT_HIST_DIR/<host>/<channel>, creating directories */
+
+	char path[1024];
+	size_t dir_len = strlen(INPUT_HIST_DIR);
+	size_t host_len;
+	int len;
+
+	if (!dir_len || !c->server || c->input.hist.file)
+		return;
+
+	len = snprintf(path, sizeof(path), "%s/%s/%s", INPUT_HIST_DIR, c->server->host, c->name);
+
+	if (len < 0 || (size_t)len >= sizeof(path)) {
+		newlinef(c, 0, FROM_ERROR, "Input history: path too long");
+		input_hist_file(&(c->input), "");
+		return;
+	}
+
+	host_len = dir_len + strlen(c->server->host) + 1;
+
+	for (char *p = path + host_len + 1; *p; p++)
+		*p = (*p == '/' ? '_' : tolower(*p));
+
+	path[host_len] = 0;
+	path[dir_len] = 0;
+	mkdir(path, 0700);
+	path[dir_len] = '/';
+	mkdir(path, 0700);
+	path[host_len] = '/';
+
+	if (input_hist_file(&(c->input), path) < 0)
+		newlinef(c, 0, FROM_ERROR, "Input history '%s': %s", path, strerror(errno));
+}
+
+static void
+state_input_search(int older)
+{
+	/* Search input history for the current search string, from
+	 * the current match, or the next older if requested */
+
+	struct channel *c = current_channel();
+	size_t pos = state.search.pos + (older && state.search.match_len);
+	uint16_t len = 0;
+	int search = (state.search.len || older);
+
+	if (search)
+		len = input_hist_search(&(c->input), state.search.str, &pos, state.search.match, sizeof(state.search.match));
+
+	if (len || !search) {
+		state.search.pos = pos;
+		state.search.match_len = len;
+	}
+
+	if (!state.search.match_len)
+		state.search.match[0] = 0;
+
+	action(action_search, "%sreverse-i-search '%s': %s",
+		((search && !len) ? "failed " : ""),
+		state.search.str,
+		state.search.match);
+}
+
 static int
 state_input_linef(struct channel *c)
 {
@@ -984,6 +1880,7 @@ state_input_linef(struct channel *c)
 	if ((len = input_write(&(c->input), buf, sizeof(buf), 0)) == 0)
 		return 0;
 
+	state_input_hist(c);
 	input_hist_push(&(c->input));
 
 	switch (buf[0]) {
@@ -1009,16 +1906,12 @@ state_input_linef(struct channel *c)
 void
 io_cb_read_inp(char *buf, size_t len)
 {
-	int redraw_input = 0;
+	int redraw_input;
 
 	if (len == 0)
 		fatal("zero length message");
-	else if (action_handler)
-		redraw_input = state_input_action(buf, len);
-	else if (iscntrl(*buf))
-		redraw_input = state_input_ctrlch(buf, len);
-	else
-		redraw_input = input_insert(&current_channel()->input, buf, len);
+
+	redraw_input = state_input(buf, len);
 
 	if (redraw_input)
 		draw(DRAW_INPUT);
@@ -1027,40 +1920,154 @@ io_cb_read_inp(char *buf, size_t len)
 }
 
 void
-io_cb_read_soc(char *buf, size_t len, const void *cb_obj)
+io_cb_read_soc(struct irc_message *m, const void *cb_obj)
 {
+	/* Messages arrive framed and parsed by the connection thread */
+
 	struct server *s = (struct server *)cb_obj;
-	struct channel *c = s->channel;
-	size_t ci = s->read.i;
-	size_t n = len;
+	struct timespec ts;
+	const char *msgid;
+	const char *time;
 
-	for (size_t i = 0; i < n; i++) {
+	if (s->ircv3_caps.server_time.set
+	 && (time = irc_message_tag(m, "time"))
+	 && irc_strtime(time, &ts) == 0)
+		state.time = &ts;
 
-		char cc = buf[i];
+	if ((msgid = irc_message_tag(m, "msgid")))
+		state.msgid = irc_strhash(msgid);
 
-		if (ci && cc == '\n' && ((i && buf[i - 1] == '\r') || (!i && s->read.cl == '\r'))) {
+	irc_recv(s, m);
 
-			s->read.buf[ci] = 0;
+	state.msgid = 0;
+	state.time = NULL;
 
-			debug_recv(ci, s->read.buf);
+	if (LAG_INTERVAL && s->registered && (server_lag_time() - s->lag.sent) >= (uint64_t)LAG_INTERVAL * 1000000000)
+		state_lag_probe(s);
 
-			struct irc_message m;
+	if (*STATS_FILE && (server_lag_time() - state.stats_dumped) >= (uint64_t)STATS_INTERVAL * 1000000000)
+		state_stats_dump();
+}
 
-			if (irc_message_parse(&m, s->read.buf) != 0)
-				newlinef(c, 0, FROM_ERROR, "failed to parse message");
-			else
-				irc_recv(s, &m);
+static void
+state_lag_probe(struct server *s)
+{
+	int ret;
+
+	s->lag.sent = server_lag_time();
+
+	if ((ret = io_sendf(s->connection, "PING :" SERVER_LAG_TOKEN "%llu", (unsigned long long)s->lag.sent)))
+		server_error(s, "sendf fail: %s", io_err(ret));
+}
+
+static void
+state_stats(struct server *s, void (*cb)(void*, const char*), void *arg)
+{
+	/* Format a server's stats, one line per callback, with received
+	 * messages in descending order of count */
+
+	char buf[512];
+	size_t cmd[SERVER_STATS_CMD_N];
+	size_t n = 0;
+	struct io_stats io;
+	unsigned long long secs = MAX((server_lag_time() - s->stats.t_start) / 1000000000, 1);
+
+	io_cx_stats(s->connection, &io);
 
-			ci = 0;
-		} else if (ci < IRC_MESSAGE_LEN && cc && cc != '\n' && cc != '\r') {
-			s->read.buf[ci++] = cc;
+	snprintf(buf, sizeof(buf), "Stats: %s:%s, %llus", s->host, s->port, secs);
+	cb(arg, buf);
+
+	snprintf(buf, sizeof(buf), " .. in:    %llu bytes, %llu lines, %llu parse errors",
+		(unsigned long long)io.bytes_in,
+		(unsigned long long)io.lines_in,
+		(unsigned long long)io.parse_err);
+	cb(arg, buf);
+
+	snprintf(buf, sizeof(buf), " .. out:   %llu bytes, %llu lines",
+		(unsigned long long)io.bytes_out,
+		(unsigned long long)io.lines_out);
+	cb(arg, buf);
+
+	snprintf(buf, sizeof(buf), " .. sendq: %u queued (max %u)", s->sendq.n, s->stats.sendq_max);
+	cb(arg, buf);
+
+	for (size_t i = 0; i < SERVER_STATS_CMD_N; i++) {
+
+		size_t j = n++;
+
+		if (!s->stats.cmd[i].n) {
+			n--;
+			continue;
 		}
+
+		for (; j && s->stats.cmd[cmd[j - 1]].n < s->stats.cmd[i].n; j--)
+			cmd[j] = cmd[j - 1];
+
+		cmd[j] = i;
 	}
 
-	s->read.cl = buf[n - 1];
-	s->read.i = ci;
+	for (size_t i = 0; i < n; i++) {
 
-	draw(DRAW_FLUSH);
+		unsigned long long count = s->stats.cmd[cmd[i]].n;
+		unsigned long long rate = count * 100 / secs;
+
+		snprintf(buf, sizeof(buf), " .. %-12s %llu, %llu.%02llu/s, %lluus avg",
+			s->stats.cmd[cmd[i]].name,
+			count,
+			rate / 100,
+			rate % 100,
+			(unsigned long long)(s->stats.cmd[cmd[i]].ns / count / 1000));
+		cb(arg, buf);
+	}
+}
+
+static void
+state_stats_dump(void)
+{
+	/* Write all servers' stats to STATS_FILE, replacing it */
+
+	char path[4096];
+	struct server *s;
+	FILE *f;
+
+	state.stats_dumped = server_lag_time();
+
+	if (snprintf(path, sizeof(path), "%s.tmp", STATS_FILE) >= (int)sizeof(path))
+		return;
+
+	if (!(f = fopen(path, "w"))) {
+		debug("fopen: %s: %s", path, strerror(errno));
+		return;
+	}
+
+	if ((s = state_server_list()->head)) {
+		do {
+			state_stats(s, state_stats_fputs, f);
+		} while ((s = s->next) != state_server_list()->head);
+	}
+
+	if (fclose(f) == EOF || rename(path, STATS_FILE) < 0) {
+		debug("stats: %s: %s", STATS_FILE, strerror(errno));
+		unlink(path);
+	}
+}
+
+static void
+state_stats_fputs(void *arg, const char *line)
+{
+	fprintf((FILE *)arg, "%s\n", line);
+}
+
+static void
+state_stats_newline(void *arg, const char *line)
+{
+	newlinef((struct channel *)arg, 0, FROM_INFO, "%s", line);
+}
+
+static void
+state_trace_newline(const char *line, void *arg)
+{
+	newlinef((struct channel *)arg, 0, FROM_INFO, "%s", line);
 }
 
 void
@@ -1075,6 +2082,8 @@ io_cb_cxed(const void *cb_obj)
 
 	s->connected = 1;
 
+	event(EVENT_CONNECT, s->host, NULL, NULL, NULL);
+
 	if ((ret = io_sendf(s->connection, "CAP LS " IRCV3_CAP_VERSION)))
 		server_error(s, "sendf fail: %s", io_err(ret));
 
@@ -1088,7 +2097,6 @@ io_cb_cxed(const void *cb_obj)
 		server_error(s, "sendf fail: %s", io_err(ret));
 
 	draw(DRAW_STATUS);
-	draw(DRAW_FLUSH);
 }
 
 void
@@ -1099,6 +2107,8 @@ io_cb_dxed(const void *cb_obj)
 
 	server_reset(s);
 
+	event(EVENT_DISCONNECT, s->host, NULL, NULL, NULL);
+
 	do {
 		newlinef(c, 0, FROM_ERROR, " -- disconnected --");
 		channel_reset(c);
@@ -1106,21 +2116,26 @@ io_cb_dxed(const void *cb_obj)
 	} while (c != s->channel);
 
 	draw(DRAW_STATUS);
-	draw(DRAW_FLUSH);
 }
 
 void
 io_cb_ping(const void *cb_obj, unsigned ping)
 {
-	int ret;
 	struct server *s = (struct server *)cb_obj;
 
 	s->ping = ping;
 
-	if (ping != IO_PING_MIN)
-		draw(DRAW_STATUS);
-	else if ((ret = io_sendf(s->connection, "PING :%s", s->host)))
-		server_error(s, "sendf fail: %s", io_err(ret));
+	/* Actively probe while the network state is in question */
+	if (ping)
+		state_lag_probe(s);
+
+	draw(DRAW_STATUS);
+}
+
+void
+io_cb_flush(void)
+{
+	/* Draw once per batch of connection events */
 
 	draw(DRAW_FLUSH);
 }
@@ -1135,6 +2150,17 @@ io_cb_sigwinch(unsigned cols, unsigned rows)
 	draw(DRAW_FLUSH);
 }
 
+void
+io_cb_tty(int attached)
+{
+	/* Drawing is skipped entirely while no terminal is attached */
+
+	if (attached)
+		draw_init();
+	else
+		draw_term();
+}
+
 void
 io_cb_info(const void *cb_obj, const char *fmt, ...)
 {
@@ -1144,8 +2170,6 @@ io_cb_info(const void *cb_obj, const char *fmt, ...)
 	newlinev(((struct server *)cb_obj)->channel, 0, FROM_INFO, fmt, ap);
 
 	va_end(ap);
-
-	draw(DRAW_FLUSH);
 }
 
 void
@@ -1157,6 +2181,4 @@ io_cb_error(const void *cb_obj, const char *fmt, ...)
 	newlinev(((struct server *)cb_obj)->channel, 0, FROM_ERROR, fmt, ap);
 
 	va_end(ap);
-
-	draw(DRAW_FLUSH);
 }
@@ -21,6 +21,14 @@
 void state_init(void);
 void state_term(void);
 
+/* Prepare an :upgrade after io_start returns, writing the session to a
+ * file at the given path buffer for the upgraded process, returns:
+ *   0: no upgrade pending, 1: upgrade prepared, -1: upgrade failed */
+int state_upgrade(char*, size_t);
+
+/* Abandon an upgrade prepared by state_upgrade, e.g. when exec fails */
+void state_upgrade_abort(const char*);
+
 /* Get tty dimensions */
 unsigned state_cols(void);
 unsigned state_rows(void);
@@ -34,5 +42,13 @@ struct channel* current_channel(void);
 struct server_list* state_server_list(void);
 void channel_set_current(struct channel*);
 void newlinef(struct channel*, enum buffer_line_type, const char*, const char*, ...);
+struct buffer_line* newline_prepend(
+	struct channel*,
+	enum buffer_line_type,
+	const char*,
+	const char*,
+	size_t,
+	size_t,
+	const struct timespec*);
 
 #endif
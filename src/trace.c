@@ -0,0 +1,371 @@
+#include "src/trace.h"
+
+#include "src/utils/utils.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Ring slots for traced events, must be a power of 2 */
+#define TRACE_RING_N 4096
+
+/* Bytes of payload stored per event, longer payloads are truncated */
+#define TRACE_DATA_LEN 88
+
+/* Milliseconds between draining traced events */
+#define TRACE_FLUSH_MS 100
+
+/* Maximum length of a formatted event */
+#define TRACE_LINE_MAX (TRACE_DATA_LEN + 256)
+
+#define TRACE_DATA_N (TRACE_DATA_LEN / sizeof(uint64_t))
+
+#define TRACE_SEQ_BUSY UINT64_MAX
+
+#define PT_CF(X) \
+	do {                                            \
+		int _ptcf = (X);                            \
+		if (_ptcf != 0) {                           \
+			fatal("%s: %s", (#X), strerror(_ptcf)); \
+		}                                           \
+	} while (0)
+
+/* Multiple producer ring slot, as a sequence lock: the sequence is
+ * busy while a slot is written and set to its index + 1 after, so
+ * readers can detect slots written or overwritten while reading. All
+ * fields are atomic, written and read relaxed */
+struct trace_slot
+{
+	atomic_uint_least64_t seq;
+	atomic_uint_least64_t t;    /* monotonic time, ns */
+	atomic_uint_least64_t src;  /* source line << 32 | thread */
+	atomic_uint_least64_t ev;   /* payload length << 16 | event */
+	atomic_uintptr_t file;      /* source file, a string literal */
+	atomic_uint_least64_t data[TRACE_DATA_N];
+};
+
+struct trace_ev
+{
+	uint64_t t;
+	const char *file;
+	unsigned line;
+	unsigned thread;
+	unsigned event;
+	size_t len;
+	union {
+		uint64_t w[TRACE_DATA_N];
+		char buf[TRACE_DATA_LEN];
+	} data;
+};
+
+static void *trace_thread(void*);
+static void trace_drain(int);
+static size_t trace_format(char*, size_t, const struct trace_ev*);
+static int trace_read(uint64_t, struct trace_ev*);
+static unsigned trace_thread_id(void);
+
+static const char *const trace_event_strs[] = {
+#define X(EVENT, NAME) NAME,
+	TRACE_EVENTS
+#undef X
+};
+
+/* Events are recorded from program start, before the writer thread */
+static struct trace_slot trace_ring[TRACE_RING_N];
+static atomic_uint_least64_t trace_tail_i;
+static atomic_uint trace_threads;
+static _Thread_local unsigned trace_thread_i;
+
+static FILE *trace_file;
+static atomic_int trace_stop;
+static int trace_fd[2];
+static pthread_t trace_tid;
+static uint64_t trace_head_i;
+static uint64_t trace_wait_i = UINT64_MAX;
+
+int
+trace_init(const char *path)
+{
+	if (!path || !*path) {
+		trace_file = stderr;
+	} else {
+		int fd;
+
+		if ((fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600)) < 0)
+			return -1;
+
+		if ((trace_file = fdopen(fd, "a")) == NULL)
+			fatal("fdopen: %s", strerror(errno));
+	}
+
+	if (pipe(trace_fd) < 0)
+		fatal("pipe: %s", strerror(errno));
+
+	if (fcntl(trace_fd[0], F_SETFL, O_NONBLOCK) < 0 || fcntl(trace_fd[1], F_SETFL, O_NONBLOCK) < 0)
+		fatal("fcntl: %s", strerror(errno));
+
+	if (fcntl(trace_fd[0], F_SETFD, FD_CLOEXEC) < 0 || fcntl(trace_fd[1], F_SETFD, FD_CLOEXEC) < 0)
+		fatal("fcntl: %s", strerror(errno));
+
+	atomic_init(&trace_stop, 0);
+
+	PT_CF(pthread_create(&trace_tid, NULL, trace_thread, NULL));
+
+	return 0;
+}
+
+void
+trace_term(void)
+{
+	if (!trace_file)
+		return;
+
+	atomic_store(&trace_stop, 1);
+
+	if (write(trace_fd[1], "", 1) < 0)
+		debug("write: %s", strerror(errno));
+
+	PT_CF(pthread_join(trace_tid, NULL));
+
+	close(trace_fd[0]);
+	close(trace_fd[1]);
+
+	if (trace_file != stderr)
+		fclose(trace_file);
+
+	trace_file = NULL;
+}
+
+void
+trace(enum trace_event event, const char *file, unsigned line, const char *data, size_t len)
+{
+	/* Record an event on the next slot, overwriting the oldest */
+
+	struct timespec ts;
+	struct trace_slot *slot;
+	uint64_t w[TRACE_DATA_N];
+	uint64_t i;
+	uint64_t seq;
+	size_t n = MIN(len, TRACE_DATA_LEN);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	if (n) {
+		w[(n - 1) / sizeof(*w)] = 0;
+		memcpy(w, data, n);
+	}
+
+	i = atomic_fetch_add_explicit(&trace_tail_i, 1, memory_order_relaxed);
+	slot = &(trace_ring[i & (TRACE_RING_N - 1)]);
+
+	seq = atomic_load_explicit(&(slot->seq), memory_order_relaxed);
+
+	/* Drop the event if the ring has lapped a writer still on the slot */
+	do {
+		if (seq == TRACE_SEQ_BUSY)
+			return;
+	} while (!atomic_compare_exchange_weak_explicit(&(slot->seq), &seq, TRACE_SEQ_BUSY, memory_order_relaxed, memory_order_relaxed));
+
+	atomic_thread_fence(memory_order_release);
+
+	atomic_store_explicit(&(slot->t), (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec, memory_order_relaxed);
+	atomic_store_explicit(&(slot->src), (uint64_t)line << 32 | trace_thread_id(), memory_order_relaxed);
+	atomic_store_explicit(&(slot->ev), (uint64_t)len << 16 | event, memory_order_relaxed);
+	atomic_store_explicit(&(slot->file), (uintptr_t)file, memory_order_relaxed);
+
+	for (size_t j = 0; j < (n + sizeof(*w) - 1) / sizeof(*w); j++)
+		atomic_store_explicit(&(slot->data[j]), w[j], memory_order_relaxed);
+
+	atomic_store_explicit(&(slot->seq), i + 1, memory_order_release);
+}
+
+void
+trace_printf(enum trace_event event, const char *file, unsigned line, const char *fmt, ...)
+{
+	char buf[TRACE_DATA_LEN + 1];
+	int ret;
+	va_list ap;
+
+	va_start(ap, fmt);
+	ret = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+
+	if (ret < 0)
+		return;
+
+	trace(event, file, line, buf, MIN((size_t)ret, TRACE_DATA_LEN));
+}
+
+unsigned
+trace_tail(unsigned n, trace_tail_cb cb, void *arg)
+{
+	char buf[TRACE_LINE_MAX];
+	struct trace_ev ev;
+	uint64_t tail = atomic_load_explicit(&trace_tail_i, memory_order_acquire);
+	uint64_t i = tail - MIN(tail, MIN(n, TRACE_RING_N));
+	unsigned ret = 0;
+
+	for (; i < tail; i++) {
+
+		if (!trace_read(i, &ev))
+			continue;
+
+		trace_format(buf, sizeof(buf), &ev);
+		cb(buf, arg);
+		ret++;
+	}
+
+	return ret;
+}
+
+static void*
+trace_thread(void *arg)
+{
+	/* Drain traced events on an interval, and once more when stopped */
+
+	struct pollfd pfd = { .fd = trace_fd[0], .events = POLLIN };
+	sigset_t sigset;
+
+	UNUSED(arg);
+
+	sigfillset(&sigset);
+	PT_CF(pthread_sigmask(SIG_BLOCK, &sigset, NULL));
+
+	for (;;) {
+
+		int stop = atomic_load(&trace_stop);
+
+		if (!stop && poll(&pfd, 1, TRACE_FLUSH_MS) < 0 && errno != EINTR)
+			fatal("poll: %s", strerror(errno));
+
+		trace_drain(stop);
+
+		if (stop)
+			break;
+	}
+
+	return NULL;
+}
+
+static void
+trace_drain(int stop)
+{
+	/* Write events recorded since the last drain, noting the count
+	 * overwritten before they could be written. An event not yet
+	 * written ends the drain, and is counted lost if it still isn't
+	 * on the next drain, since it may have been dropped, or overwritten
+	 * by a writer lapped on its slot */
+
+	char buf[TRACE_LINE_MAX];
+	struct trace_ev ev;
+	uint64_t lost = 0;
+	uint64_t tail = atomic_load_explicit(&trace_tail_i, memory_order_acquire);
+
+	if (tail - trace_head_i > TRACE_RING_N) {
+		lost = tail - trace_head_i - TRACE_RING_N;
+		trace_head_i = tail - TRACE_RING_N;
+	}
+
+	for (; trace_head_i < tail; trace_head_i++) {
+
+		if (!trace_read(trace_head_i, &ev)) {
+
+			if (!stop && trace_wait_i != trace_head_i && atomic_load(&trace_tail_i) - trace_head_i < TRACE_RING_N) {
+				trace_wait_i = trace_head_i;
+				break;
+			}
+
+			lost++;
+			continue;
+		}
+
+		if (lost) {
+			fprintf(trace_file, "-- %llu events lost\n", (unsigned long long)lost);
+			lost = 0;
+		}
+
+		trace_format(buf, sizeof(buf), &ev);
+		fprintf(trace_file, "%s\n", buf);
+	}
+
+	if (lost)
+		fprintf(trace_file, "-- %llu events lost\n", (unsigned long long)lost);
+
+	fflush(trace_file);
+}
+
+static size_t
+trace_format(char *buf, size_t len, const struct trace_ev *ev)
+{
+	int ret;
+	size_t n = MIN(ev->len, TRACE_DATA_LEN);
+
+	ret = snprintf(buf, len, "%llu.%06llu [%u] %-5s %s:%u %.*s%s",
+		(unsigned long long)(ev->t / 1000000000),
+		(unsigned long long)(ev->t % 1000000000 / 1000),
+		ev->thread,
+		(ev->event < TRACE_EVENT_SIZE ? trace_event_strs[ev->event] : "?"),
+		ev->file,
+		ev->line,
+		(int)n,
+		ev->data.buf,
+		(ev->len > n ? "..." : ""));
+
+	return (ret < 0 ? 0 : MIN((size_t)ret, len - 1));
+}
+
+static int
+trace_read(uint64_t i, struct trace_ev *ev)
+{
+	/* Read the event at index i, returning 0 if it's being written,
+	 * or was written for another index */
+
+	struct trace_slot *slot = &(trace_ring[i & (TRACE_RING_N - 1)]);
+	uint64_t seq = atomic_load_explicit(&(slot->seq), memory_order_acquire);
+	uint64_t src;
+	uint64_t e;
+
+	if (seq != i + 1)
+		return 0;
+
+	ev->t = atomic_load_explicit(&(slot->t), memory_order_relaxed);
+	src = atomic_load_explicit(&(slot->src), memory_order_relaxed);
+	e = atomic_load_explicit(&(slot->ev), memory_order_relaxed);
+	ev->file = (const char *)atomic_load_explicit(&(slot->file), memory_order_relaxed);
+
+	for (size_t j = 0; j < TRACE_DATA_N; j++)
+		ev->data.w[j] = atomic_load_explicit(&(slot->data[j]), memory_order_relaxed);
+
+	atomic_thread_fence(memory_order_acquire);
+
+	if (atomic_load_explicit(&(slot->seq), memory_order_relaxed) != seq)
+		return 0;
+
+	ev->line = (unsigned)(src >> 32);
+	ev->thread = (unsigned)(src & 0xFFFFFFFF);
+	ev->event = (unsigned)(e & 0xFFFF);
+	ev->len = (size_t)(e >> 16);
+
+	return 1;
+}
+
+static unsigned
+trace_thread_id(void)
+{
+	/* Threads are numbered in order of first traced event */
+
+	if (!trace_thread_i)
+		trace_thread_i = atomic_fetch_add_explicit(&trace_threads, 1, memory_order_relaxed) + 1;
+
+	return trace_thread_i;
+}
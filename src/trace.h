@@ -0,0 +1,59 @@
+#ifndef RIRC_TRACE_H
+#define RIRC_TRACE_H
+
+/* Debug tracing
+ *
+ * Trace points record an event id, its source file and line, the
+ * recording thread, a monotonic timestamp and a small payload on a
+ * fixed size ring, overwriting the oldest events. Recording never
+ * blocks or allocates; a writer thread periodically drains the ring
+ * to a file as lines of:
+ *
+ *   <seconds>.<microseconds> [<thread>] <event> <file>:<line> <payload>
+ *
+ * and the most recent events can be read back with trace_tail.
+ *
+ * Trace points are compiled in debug builds only, see utils.h
+ */
+
+#include <stddef.h>
+
+#define TRACE_EVENTS \
+	X(TRACE_DEBUG, "debug") \
+	X(TRACE_RECV,  "recv")  \
+	X(TRACE_SEND,  "send")  \
+	X(TRACE_TLS,   "tls")
+
+enum trace_event
+{
+#define X(EVENT, NAME) EVENT,
+	TRACE_EVENTS
+#undef X
+	TRACE_EVENT_SIZE
+};
+
+/* Start the writer thread, draining traced events to the given
+ * file path, returns -1 on failure ("": stderr) */
+int trace_init(const char*);
+
+/* Stop the writer thread, after draining traced events */
+void trace_term(void);
+
+/* Record an event, with args:
+ *   event, source file, source line, payload, payload length */
+void trace(enum trace_event, const char*, unsigned, const char*, size_t);
+
+/* Record an event with a formatted payload, with args:
+ *   event, source file, source line, format, ... */
+void trace_printf(enum trace_event, const char*, unsigned, const char*, ...);
+
+/* Trace tail callback, for events read oldest first, with args:
+ *   formatted event, callback arg */
+typedef void (*trace_tail_cb)(const char*, void*);
+
+/* Read up to the given number of most recently traced events,
+ * returning the number read, with args:
+ *   max events, callback, callback arg */
+unsigned trace_tail(unsigned, trace_tail_cb, void*);
+
+#endif
@@ -2,6 +2,7 @@
 
 #include <errno.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,6 +11,8 @@
 static inline int irc_ischanchar(char, int);
 static inline int irc_isnickchar(char, int);
 static inline int irc_toupper(enum casemapping, int);
+static int irc_message_parse_tags(struct irc_message*, char**);
+static void irc_message_tag_unescape(struct irc_message_tag*);
 
 int
 irc_isnick(const char *str)
@@ -150,7 +153,7 @@ irc_message_parse(struct irc_message *m, char *buf)
 {
 	/* RFC 2812, section 2.3.1
 	 *
-	 * message    =   [ ":" prefix SPACE ] command [ params ] crlf
+	 * message    =   [ "@" tags SPACE ] [ ":" prefix SPACE ] command [ params ] crlf
 	 * prefix     =   servername / ( nickname [ [ "!" user ] "@" host ] )
 	 * command    =   1*letter / 3digit
 	 * params     =   *14( SPACE middle ) [ SPACE ":" trailing ]
@@ -165,7 +168,14 @@ irc_message_parse(struct irc_message *m, char *buf)
 	 * crlf       =   %x0D %x0A   ; "carriage return" "linefeed"
 	 */
 
-	memset(m, 0, sizeof(*m));
+	/* Tags are only valid up to n_tags, skip clearing the store */
+	memset(m, 0, offsetof(struct irc_message, tags));
+
+	if (!irc_strtrim(&buf))
+		return -1;
+
+	if (*buf == '@' && irc_message_parse_tags(m, &buf))
+		return -1;
 
 	if (!irc_strtrim(&buf))
 		return -1;
@@ -285,6 +295,87 @@ irc_message_split(struct irc_message *m, const char **params, const char **trail
 	return 0;
 }
 
+const char*
+irc_message_tag(struct irc_message *m, const char *key)
+{
+	/* Return the unescaped value of a message tag, or NULL if not present.
+	 * Tags without a value, or with an empty value, return "" */
+
+	/* Duplicate keys are resolved to the last value given */
+	for (unsigned i = m->n_tags; i > 0; i--) {
+
+		struct irc_message_tag *tag = &(m->tags[i - 1]);
+
+		if (strcmp(tag->key, key))
+			continue;
+
+		if (!tag->unescaped)
+			irc_message_tag_unescape(tag);
+
+		return tag->val;
+	}
+
+	return NULL;
+}
+
+struct irc_message*
+irc_message_dup(const struct irc_message *m)
+{
+	/* Copy a parsed message with the span of the buffer it was parsed
+	 * from, rebasing its pointers into the copy, freed by free() */
+
+	const char *beg = m->command;
+	const char *end = m->command + m->len_command + 1;
+	struct irc_message *dup;
+	char *buf;
+
+	#define IRC_MESSAGE_SPAN(P, LEN) \
+		do { \
+			if ((P)) { \
+				beg = MIN(beg, (const char *)(P)); \
+				end = MAX(end, (const char *)(P) + (LEN) + 1); \
+			} \
+		} while (0)
+
+	#define IRC_MESSAGE_REBASE(P) \
+		do { \
+			if ((P)) \
+				(P) = buf + ((P) - beg); \
+		} while (0)
+
+	IRC_MESSAGE_SPAN(m->params, (m->params ? strlen(m->params) : 0));
+	IRC_MESSAGE_SPAN(m->from, m->len_from);
+	IRC_MESSAGE_SPAN(m->host, m->len_host);
+
+	for (unsigned i = 0; i < m->n_tags; i++) {
+		IRC_MESSAGE_SPAN(m->tags[i].key, m->tags[i].len_key);
+		IRC_MESSAGE_SPAN(m->tags[i].val, m->tags[i].len_val);
+	}
+
+	if ((dup = malloc(sizeof(*dup) + (size_t)(end - beg))) == NULL)
+		fatal("malloc: %s", strerror(errno));
+
+	buf = (char *)(dup + 1);
+
+	memcpy(dup, m, sizeof(*dup));
+	memcpy(buf, beg, (size_t)(end - beg));
+
+	IRC_MESSAGE_REBASE(dup->params);
+	IRC_MESSAGE_REBASE(dup->command);
+	IRC_MESSAGE_REBASE(dup->from);
+	IRC_MESSAGE_REBASE(dup->host);
+
+	for (unsigned i = 0; i < dup->n_tags; i++) {
+		IRC_MESSAGE_REBASE(dup->tags[i].key);
+		IRC_MESSAGE_REBASE(dup->tags[i].val);
+	}
+
+	#undef IRC_MESSAGE_SPAN
+	#undef IRC_MESSAGE_REBASE
+
+	return dup;
+}
+
 char*
 irc_strdup(const char *str)
 {
@@ -321,6 +412,120 @@ irc_strsep(char **str)
 	return *ret ? ret : NULL;
 }
 
+uint64_t
+irc_strhash(const char *str)
+{
+	/* 64-bit FNV-1a hash of a string, e.g. for comparing IRCv3 msgids */
+
+	uint64_t hash = 14695981039346656037ULL;
+
+	while (*str) {
+		hash ^= (unsigned char)*str++;
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+int
+irc_strtou(const char *str, unsigned *u, unsigned max)
+{
+	/* Parse a decimal unsigned integer in the range [0, max] */
+
+	unsigned long ul = 0;
+
+	if (!str || !*str)
+		return -1;
+
+	do {
+		if (*str < '0' || *str > '9')
+			return -1;
+
+		if ((ul = (ul * 10) + (unsigned long)(*str - '0')) > max)
+			return -1;
+
+	} while (*++str);
+
+	*u = (unsigned)ul;
+
+	return 0;
+}
+
+int
+irc_strtime(const char *str, struct timespec *ts)
+{
+	/* Parse an IRCv3 server-time timestamp, given in the fixed
+	 * ISO 8601 extended format, in UTC:
+	 *
+	 *   YYYY-MM-DDThh:mm:ss[.s*]Z
+	 *
+	 * Fractional seconds of any precision are accepted, and
+	 * truncated to nanoseconds */
+
+	const char *fmt = "dddd-dd-ddThh:mm:ss";
+	const char *p = str;
+	long nsec = 0;
+	long scale = 1000000000;
+	long days;
+	long year;
+	unsigned day;
+	unsigned hour;
+	unsigned min;
+	unsigned mon;
+	unsigned sec;
+
+	for (; *fmt; fmt++, p++) {
+		if (*fmt == '-' || *fmt == 'T' || *fmt == ':') {
+			if (*p != *fmt)
+				return -1;
+		} else if (*p < '0' || *p > '9') {
+			return -1;
+		}
+	}
+
+	#define D2(P) (((P)[0] - '0') * 10 + ((P)[1] - '0'))
+	year = D2(str) * 100 + D2(str + 2);
+	mon  = D2(str + 5);
+	day  = D2(str + 8);
+	hour = D2(str + 11);
+	min  = D2(str + 14);
+	sec  = D2(str + 17);
+	#undef D2
+
+	if (year < 1970 || mon < 1 || mon > 12 || day < 1 || day > 31 || hour > 23 || min > 59 || sec > 60)
+		return -1;
+
+	if (*p == '.') {
+
+		if (*++p < '0' || *p > '9')
+			return -1;
+
+		for (; *p >= '0' && *p <= '9'; p++) {
+			if ((scale /= 10))
+				nsec += (*p - '0') * scale;
+		}
+	}
+
+	if (*p++ != 'Z' || *p)
+		return -1;
+
+	/* Days since the epoch from a proleptic Gregorian calendar date,
+	 * computed in eras of 400 years with March as the first month */
+	year -= (mon <= 2);
+	days = (year / 400) * 146097
+	     + (year % 400) * 365
+	     + (year % 400) / 4
+	     - (year % 400) / 100
+	     + (153 * (mon > 2 ? mon - 3 : mon + 9) + 2) / 5
+	     + (day - 1)
+	     - 719468;
+
+	ts->tv_sec  = (time_t)days * 86400 + hour * 3600 + min * 60 + sec;
+	ts->tv_nsec = nsec;
+
+	return 0;
+}
+
 char*
 irc_strtrim(char **str)
 {
@@ -337,6 +542,113 @@ irc_strtrim(char **str)
 	return *p ? p : NULL;
 }
 
+static int
+irc_message_parse_tags(struct irc_message *m, char **buf)
+{
+	/* IRCv3 message-tags
+	 *
+	 * tags          =   "@" tag *( ";" tag ) SPACE
+	 * tag           =   key [ "=" escaped_value ]
+	 * key           =   [ client_prefix ] [ vendor "/" ] 1*( ALPHA / DIGIT / "-" )
+	 * client_prefix =   %x2B ; '+'
+	 * escaped_value =   *( %x01-07 / %x08-09 / %x0B-0C / %x0E-1F / %x21-3A / %x3C-FF )
+	 *                   ; any octet except NUL, CR, LF, ";" and SPACE
+	 *
+	 * Keys and values are stored as spans into the message buffer,
+	 * values are unescaped in place when first accessed */
+
+	char *p = *buf + 1;
+	char sep;
+
+	do {
+		char *key = p;
+		char *val = NULL;
+		size_t len_key;
+		size_t len_val = 0;
+
+		while (*p && *p != ' ' && *p != ';' && *p != '=')
+			p++;
+
+		len_key = p - key;
+
+		if (*p == '=') {
+			*p++ = 0;
+			val = p;
+
+			while (*p && *p != ' ' && *p != ';')
+				p++;
+
+			len_val = p - val;
+		}
+
+		if ((sep = *p))
+			*p++ = 0;
+
+		if (!len_key || m->n_tags == IRC_MESSAGE_TAGS_MAX)
+			continue;
+
+		m->tags[m->n_tags].key = key;
+		m->tags[m->n_tags].val = (val ? val : key + len_key);
+		m->tags[m->n_tags].len_key = len_key;
+		m->tags[m->n_tags].len_val = len_val;
+		m->tags[m->n_tags].unescaped = 0;
+		m->n_tags++;
+
+	} while (sep == ';');
+
+	if (sep != ' ' || !m->n_tags)
+		return -1;
+
+	*buf = p;
+
+	return 0;
+}
+
+static void
+irc_message_tag_unescape(struct irc_message_tag *tag)
+{
+	/* IRCv3 message-tags, escaping values
+	 *
+	 *   \:  -> ';'
+	 *   \s  -> ' '
+	 *   \\  -> '\'
+	 *   \r  -> CR
+	 *   \n  -> LF
+	 *
+	 * Any other escaped character is taken literally, and
+	 * a trailing unpaired '\' is dropped */
+
+	char *r = tag->val;
+	char *w = tag->val;
+	char *end = tag->val + tag->len_val;
+
+	while (r < end) {
+
+		if (*r != '\\') {
+			*w++ = *r++;
+			continue;
+		}
+
+		if (++r == end)
+			break;
+
+		switch (*r) {
+			case ':': *w++ = ';';  break;
+			case 's': *w++ = ' ';  break;
+			case 'r': *w++ = '\r'; break;
+			case 'n': *w++ = '\n'; break;
+			default:  *w++ = *r;   break;
+		}
+
+		r++;
+	}
+
+	*w = 0;
+
+	tag->len_val = w - tag->val;
+	tag->unescaped = 1;
+}
+
 static inline int
 irc_ischanchar(char c, int first)
 {
@@ -1,8 +1,10 @@
 #ifndef RIRC_UTILS_UTILS_H
 #define RIRC_UTILS_UTILS_H
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
 #define ARR_LEN(A) (sizeof((A)) / sizeof((A)[0]))
 
@@ -23,13 +25,17 @@
 	fprintf(stderr, "\n"); \
 	fflush(stderr);
 
+/* Debug trace points, recorded on the trace ring, see trace.h */
 #if !(defined NDEBUG) && !(defined TESTING)
+#include "src/trace.h"
 #define debug(...) \
-	do { MESSAGE("", __VA_ARGS__); } while (0)
+	do { trace_printf(TRACE_DEBUG, __FILE__, __LINE__, __VA_ARGS__); } while (0)
 #define debug_send(L, M) \
-	do { fprintf(stderr, "(--> %3zu) %s\n", (L), (M)); fflush(stderr); } while (0)
+	do { trace(TRACE_SEND, __FILE__, __LINE__, (const char *)(M), (L)); } while (0)
 #define debug_recv(L, M) \
-	do { fprintf(stderr, "(<-- %3zu) %s\n", (L), (M)); fflush(stderr); } while (0)
+	do { trace(TRACE_RECV, __FILE__, __LINE__, (const char *)(M), (L)); } while (0)
+#define debug_tls(F, L, ...) \
+	do { trace_printf(TRACE_TLS, (F), (L), __VA_ARGS__); } while (0)
 #else
 #define debug(...) \
 	do { ; } while (0)
@@ -37,6 +43,8 @@
 	do { ; } while (0)
 #define debug_recv(L, M) \
 	do { ; } while (0)
+#define debug_tls(F, L, ...) \
+	do { ; } while (0)
 #endif
 
 #ifndef fatal
@@ -54,6 +62,25 @@ enum casemapping
 	CASEMAPPING_STRICT_RFC1459
 };
 
+/* IRCv3 message-tags, maximum length of the tags
+ * section including the leading '@' and trailing ' ' */
+#define IRC_MESSAGE_TAGS_LEN 8191
+
+/* Maximum number of tags stored per message, any
+ * additional tags are parsed and discarded */
+#ifndef IRC_MESSAGE_TAGS_MAX
+#define IRC_MESSAGE_TAGS_MAX 16
+#endif
+
+struct irc_message_tag
+{
+	const char *key;
+	char *val;
+	size_t len_key;
+	size_t len_val;
+	unsigned unescaped : 1;
+};
+
 struct irc_message
 {
 	char *params;
@@ -64,7 +91,10 @@ struct irc_message
 	size_t len_from;
 	size_t len_host;
 	unsigned n_params;
+	unsigned n_tags;
 	unsigned split : 1;
+	/* Spans into the parsed message, values unescaped on access */
+	struct irc_message_tag tags[IRC_MESSAGE_TAGS_MAX];
 };
 
 int irc_ischan(const char*);
@@ -73,11 +103,16 @@ int irc_pinged(enum casemapping, const char*, const char*);
 int irc_strcmp(enum casemapping, const char*, const char*);
 int irc_strncmp(enum casemapping, const char*, const char*, size_t);
 char* irc_strdup(const char*);
+uint64_t irc_strhash(const char*);
 char* irc_strsep(char**);
 char* irc_strtrim(char**);
+int irc_strtime(const char*, struct timespec*);
+int irc_strtou(const char*, unsigned*, unsigned);
 
+struct irc_message* irc_message_dup(const struct irc_message*);
 int irc_message_param(struct irc_message*, char**);
 int irc_message_parse(struct irc_message*, char*);
 int irc_message_split(struct irc_message*, const char**, const char**);
+const char* irc_message_tag(struct irc_message*, const char*);
 
 #endif
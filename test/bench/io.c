@@ -0,0 +1,264 @@
+/* Input latency under connection load
+ *
+ * Loopback servers flood connections with messages while a client,
+ * attached as in daemon mode, sends keystrokes at a fixed interval.
+ * The latency from each keystroke being sent to its io_cb_read_inp
+ * callback is reported, with the message throughput over the run.
+ *
+ * make -f Makefile.dev bench, or:
+ *   build/bench/io.b [connections [keystrokes]] */
+
+#include "src/io.c"
+#include "src/utils/utils.c"
+#include "test/trace.mock.c"
+
+#include <stdatomic.h>
+
+#define BENCH_CX_MAX    64
+#define BENCH_KEY_MAX   100000
+#define BENCH_KEY_NS    2000000   /* keystroke interval */
+#define BENCH_WARMUP_NS 200000000 /* before the first keystroke */
+
+struct bench_server
+{
+	int fd;         /* Listening socket */
+	pthread_t tid;
+};
+
+const char *default_ca_file;
+const char *default_ca_path;
+
+static _Atomic int bench_done;
+static _Atomic uint64_t bench_key_sent[BENCH_KEY_MAX];
+static char bench_path[64];
+static uint64_t bench_key_lat[BENCH_KEY_MAX];
+static uint64_t bench_lines;
+static unsigned bench_cxed;
+static unsigned bench_keys;
+static unsigned bench_keys_n;
+
+void io_cb_dxed(const void *obj) { UNUSED(obj); }
+void io_cb_error(const void *obj, const char *fmt, ...) { UNUSED(obj); UNUSED(fmt); }
+void io_cb_flush(void) { }
+void io_cb_info(const void *obj, const char *fmt, ...) { UNUSED(obj); UNUSED(fmt); }
+void io_cb_ping(const void *obj, unsigned ping) { UNUSED(obj); UNUSED(ping); }
+void io_cb_sigwinch(unsigned cols, unsigned rows) { UNUSED(cols); UNUSED(rows); }
+void io_cb_tty(int attached) { UNUSED(attached); }
+
+void
+io_cb_cxed(const void *obj)
+{
+	UNUSED(obj);
+
+	bench_cxed++;
+}
+
+void
+io_cb_read_inp(char *buf, size_t len)
+{
+	uint64_t t = io_clock_us();
+
+	UNUSED(buf);
+
+	for (size_t i = 0; i < len && bench_keys < bench_keys_n; i++, bench_keys++)
+		bench_key_lat[bench_keys] = t - atomic_load(&bench_key_sent[bench_keys]);
+
+	if (bench_keys == bench_keys_n)
+		io_stop();
+}
+
+void
+io_cb_read_soc(struct irc_message *m, const void *obj)
+{
+	UNUSED(m);
+	UNUSED(obj);
+
+	bench_lines++;
+}
+
+static void*
+bench_server_thread(void *arg)
+{
+	/* Accept a connection and write messages until it's closed */
+
+	char buf[4096];
+	int soc;
+	size_t len = 0;
+	struct bench_server *srv = arg;
+
+	while (len + 64 < sizeof(buf))
+		len += (size_t)snprintf(buf + len, sizeof(buf) - len, ":nick!user@host PRIVMSG #chan :%04zu\r\n", len);
+
+	if ((soc = accept(srv->fd, NULL, NULL)) < 0)
+		fatal("accept: %s", strerror(errno));
+
+	while (!atomic_load(&bench_done) && send(soc, buf, len, MSG_NOSIGNAL) > 0)
+		continue;
+
+	close(soc);
+
+	return NULL;
+}
+
+static void*
+bench_client_thread(void *arg)
+{
+	/* Send keystrokes to the daemon, recording when each was sent */
+
+	int soc;
+	struct sockaddr_un addr;
+	struct timespec ts = { .tv_sec = 0, .tv_nsec = BENCH_WARMUP_NS };
+
+	UNUSED(arg);
+
+	if (io_unix_addr(&addr, bench_path) < 0)
+		fatal("io_unix_addr");
+
+	if ((soc = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		fatal("socket: %s", strerror(errno));
+
+	if (connect(soc, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+		fatal("connect: %s", strerror(errno));
+
+	(void) nanosleep(&ts, NULL);
+
+	ts.tv_nsec = BENCH_KEY_NS;
+
+	for (unsigned i = 0; i < bench_keys_n; i++) {
+
+		unsigned char msg[3] = { IO_CLIENT_MSG_INP, 1, 'x' };
+
+		atomic_store(&bench_key_sent[i], io_clock_us());
+
+		if (send(soc, msg, sizeof(msg), MSG_NOSIGNAL) != sizeof(msg))
+			fatal("send: %s", strerror(errno));
+
+		(void) nanosleep(&ts, NULL);
+	}
+
+	/* Held open until the daemon stops */
+	while (!atomic_load(&bench_done))
+		(void) nanosleep(&ts, NULL);
+
+	close(soc);
+
+	return NULL;
+}
+
+static int
+bench_cmp(const void *p1, const void *p2)
+{
+	uint64_t t1 = *(const uint64_t *)p1;
+	uint64_t t2 = *(const uint64_t *)p2;
+
+	return (t1 > t2) - (t1 < t2);
+}
+
+int
+main(int argc, char **argv)
+{
+	char dir[] = "/tmp/rirc.bench.XXXXXX";
+	char port[8];
+	int out;
+	pthread_t client;
+	struct bench_server srv[BENCH_CX_MAX];
+	struct connection *cx[BENCH_CX_MAX];
+	uint64_t t;
+	unsigned cx_n = 8;
+
+	bench_keys_n = 1000;
+
+	if (argc > 1 && ((cx_n = (unsigned)strtoul(argv[1], NULL, 10)) == 0 || cx_n > BENCH_CX_MAX))
+		fatal("connections: 1-%d", BENCH_CX_MAX);
+
+	if (argc > 2 && ((bench_keys_n = (unsigned)strtoul(argv[2], NULL, 10)) == 0 || bench_keys_n > BENCH_KEY_MAX))
+		fatal("keystrokes: 1-%d", BENCH_KEY_MAX);
+
+	if (!mkdtemp(dir))
+		fatal("mkdtemp: %s", strerror(errno));
+
+	snprintf(bench_path, sizeof(bench_path), "%s/soc", dir);
+
+	/* Results are written to the original stdout, replaced by the client */
+	if ((out = dup(STDOUT_FILENO)) < 0)
+		fatal("dup: %s", strerror(errno));
+
+	io_init();
+
+	for (unsigned i = 0; i < cx_n; i++) {
+
+		struct sockaddr_in sa = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+		socklen_t len = sizeof(sa);
+
+		if ((srv[i].fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+			fatal("socket: %s", strerror(errno));
+
+		if (bind(srv[i].fd, (struct sockaddr *)&sa, sizeof(sa)) < 0
+		 || listen(srv[i].fd, 1) < 0
+		 || getsockname(srv[i].fd, (struct sockaddr *)&sa, &len) < 0)
+			fatal("listen: %s", strerror(errno));
+
+		PT_CF(pthread_create(&(srv[i].tid), NULL, bench_server_thread, &srv[i]));
+
+		snprintf(port, sizeof(port), "%d", ntohs(sa.sin_port));
+
+		cx[i] = connection(NULL, "127.0.0.1", port, NULL, NULL, NULL, 0);
+
+		if (io_cx(cx[i]))
+			fatal("io_cx");
+	}
+
+	{
+		struct sockaddr_un addr;
+
+		if (io_unix_addr(&addr, bench_path) < 0)
+			fatal("io_unix_addr");
+
+		if ((io_daemon_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+			fatal("socket: %s", strerror(errno));
+
+		if (bind(io_daemon_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(io_daemon_fd, 1) < 0)
+			fatal("listen: %s", strerror(errno));
+	}
+
+	PT_CF(pthread_create(&client, NULL, bench_client_thread, NULL));
+
+	t = io_clock_us();
+
+	io_start();
+
+	t = io_clock_us() - t;
+
+	atomic_store(&bench_done, 1);
+
+	for (unsigned i = 0; i < cx_n; i++) {
+		io_dx(cx[i], 1);
+		PT_CF(pthread_join(srv[i].tid, NULL));
+		close(srv[i].fd);
+	}
+
+	PT_CF(pthread_join(client, NULL));
+
+	io_client_close();
+	close(io_daemon_fd);
+	unlink(bench_path);
+	rmdir(dir);
+
+	if (bench_cxed != cx_n)
+		fatal("connected: %u/%u", bench_cxed, cx_n);
+
+	qsort(bench_key_lat, bench_keys_n, sizeof(bench_key_lat[0]), bench_cmp);
+
+	dprintf(out, "connections: %u, keystrokes: %u, lines/s: %llu\n",
+		cx_n,
+		bench_keys_n,
+		(unsigned long long)(bench_lines * 1000000 / (t ? t : 1)));
+
+	dprintf(out, "keystroke latency (us): p50: %llu, p90: %llu, p99: %llu, max: %llu\n",
+		(unsigned long long)bench_key_lat[bench_keys_n / 2],
+		(unsigned long long)bench_key_lat[bench_keys_n * 90 / 100],
+		(unsigned long long)bench_key_lat[bench_keys_n * 99 / 100],
+		(unsigned long long)bench_key_lat[bench_keys_n - 1]);
+
+	return EXIT_SUCCESS;
+}
@@ -22,7 +22,7 @@ t__buffer_newline(struct buffer *buffer, const char *t)
 {
 	/* Abstract newline with default values */
 
-	buffer_newline(buffer, BUFFER_LINE_OTHER, "", t, 0, strlen(t), 0);
+	buffer_newline(buffer, BUFFER_LINE_OTHER, "", t, 0, strlen(t), 0, NULL);
 }
 
 static void
@@ -232,7 +232,22 @@ test_buffer_index_overflow(void)
 static void
 test_buffer_newline(void)
 {
-	// TODO
+	/* Test line timestamps, default or given */
+
+	struct buffer_line *line;
+	struct timespec ts = { .tv_sec = 1319042451, .tv_nsec = 620000000 };
+	time_t t = time(NULL);
+
+	buffer_newline(b, BUFFER_LINE_OTHER, "", "a", 0, 1, 0, NULL);
+
+	line = buffer_head(b);
+	assert_true(line->time.tv_sec >= t);
+
+	buffer_newline(b, BUFFER_LINE_OTHER, "", "b", 0, 1, 0, &ts);
+
+	line = buffer_head(b);
+	assert_eq(line->time.tv_sec, 1319042451);
+	assert_eq(line->time.tv_nsec, 620000000);
 }
 
 static void
@@ -253,7 +268,7 @@ test_buffer_newline_prefix(void)
 	text_str = "abc";
 	text_len = strlen(text_str);
 
-	buffer_newline(b, BUFFER_LINE_OTHER, from_str, text_str, from_len, text_len, 0);
+	buffer_newline(b, BUFFER_LINE_OTHER, from_str, text_str, from_len, text_len, 0, NULL);
 
 	line = buffer_head(b);
 
@@ -261,7 +276,7 @@ test_buffer_newline_prefix(void)
 	assert_strcmp(line->from, "testing");
 	assert_ueq(line->from_len, strlen("testing"));
 
-	buffer_newline(b, BUFFER_LINE_OTHER, from_str, text_str, from_len, text_len, '@');
+	buffer_newline(b, BUFFER_LINE_OTHER, from_str, text_str, from_len, text_len, '@', NULL);
 
 	line = buffer_head(b);
 
@@ -288,20 +303,59 @@ test_buffer_newline_prefix(void)
 	from_str = _from;
 	from_len = FROM_LENGTH_MAX;
 
-	buffer_newline(b, BUFFER_LINE_OTHER, from_str, text_str, from_len, text_len, 0);
+	buffer_newline(b, BUFFER_LINE_OTHER, from_str, text_str, from_len, text_len, 0, NULL);
 
 	line = buffer_head(b);
 	assert_ueq(line->from_len, FROM_LENGTH_MAX);
 	assert_eq(line->from[FROM_LENGTH_MAX - 1], 'c');
 
 
-	buffer_newline(b, BUFFER_LINE_OTHER, from_str, text_str, from_len, text_len, '@');
+	buffer_newline(b, BUFFER_LINE_OTHER, from_str, text_str, from_len, text_len, '@', NULL);
 
 	line = buffer_head(b);
 	assert_ueq(line->from_len, FROM_LENGTH_MAX);
 	assert_eq(line->from[FROM_LENGTH_MAX - 1], 'b');
 }
 
+static void
+test_buffer_prepend(void)
+{
+	/* Test adding lines before the buffer tail */
+
+	struct buffer_line *line;
+	struct timespec ts = { .tv_sec = 1, .tv_nsec = 0 };
+
+	/* empty buffer, scrollback is locked to the new line */
+	assert_ptr_not_null((line = buffer_prepend(b, BUFFER_LINE_OTHER, "", "b", 0, 1, 0, &ts)));
+	assert_ptr_eq(buffer_head(b), line);
+	assert_ptr_eq(buffer_tail(b), line);
+	assert_ptr_eq(buffer_line(b, b->scrollback), line);
+	assert_eq(line->time.tv_sec, 1);
+	assert_ueq(buffer_size(b), 1);
+
+	t__buffer_newline(b, "c");
+
+	assert_ptr_not_null(buffer_prepend(b, BUFFER_LINE_OTHER, "from", "a", 4, 1, '@', NULL));
+	assert_ueq(buffer_size(b), 3);
+	assert_strcmp(buffer_tail(b)->text, "a");
+	assert_strcmp(buffer_tail(b)->from, "@from");
+	assert_strcmp(buffer_head(b)->text, "c");
+	assert_strcmp(buffer_line(b, b->tail + 1)->text, "b");
+	assert_ueq(b->pad, 5);
+
+	/* scrollback is unchanged */
+	assert_strcmp(buffer_line(b, b->scrollback)->text, "c");
+
+	/* full buffer */
+	for (unsigned i = buffer_size(b); i < BUFFER_LINES_MAX; i++)
+		assert_ptr_not_null(buffer_prepend(b, BUFFER_LINE_OTHER, "", "x", 0, 1, 0, NULL));
+
+	assert_ueq(buffer_size(b), BUFFER_LINES_MAX);
+	assert_ptr_null(buffer_prepend(b, BUFFER_LINE_OTHER, "", "y", 0, 1, 0, NULL));
+	assert_strcmp(buffer_head(b)->text, "c");
+	assert_strcmp(buffer_tail(b)->text, "x");
+}
+
 static int
 test_init(void)
 {
@@ -332,6 +386,7 @@ main(void)
 		TESTCASE(test_buffer_index_overflow),
 		TESTCASE(test_buffer_newline),
 		TESTCASE(test_buffer_newline_prefix),
+		TESTCASE(test_buffer_prepend),
 	};
 
 	return run_tests(test_init, test_term, tests);
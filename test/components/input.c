@@ -3,6 +3,7 @@
 /* Preclude definitions for testing */
 #define INPUT_LEN_MAX 16
 #define INPUT_HIST_MAX 4
+#define INPUT_HIST_FILE_MAX 8
 
 #include "src/components/input.c"
 
@@ -305,6 +306,205 @@ test_input_hist(void)
 	input_free(&inp);
 }
 
+static void
+test_input_hist_search(void)
+{
+	struct input inp;
+	size_t pos;
+
+	input_init(&inp);
+
+	/* Test searching without history */
+	pos = 0;
+	assert_eq(input_hist_search(&inp, "a", &pos, buf, sizeof(buf)), 0);
+
+	assert_eq(input_insert(&inp, "abc", 3), 1);
+	assert_eq(input_hist_push(&inp), 1);
+	assert_eq(input_insert(&inp, "xyz", 3), 1);
+	assert_eq(input_hist_push(&inp), 1);
+	assert_eq(input_insert(&inp, "abcabc", 6), 1);
+	assert_eq(input_hist_push(&inp), 1);
+
+	/* Test searching from most recent */
+	pos = 0;
+	assert_eq(input_hist_search(&inp, "bc", &pos, buf, sizeof(buf)), 6);
+	assert_strcmp(buf, "abcabc");
+	assert_ueq(pos, 0);
+
+	/* Test searching from current position is inclusive */
+	assert_eq(input_hist_search(&inp, "bca", &pos, buf, sizeof(buf)), 6);
+	assert_ueq(pos, 0);
+
+	/* Test searching older */
+	pos = 1;
+	assert_eq(input_hist_search(&inp, "bc", &pos, buf, sizeof(buf)), 3);
+	assert_strcmp(buf, "abc");
+	assert_ueq(pos, 2);
+
+	pos = 3;
+	assert_eq(input_hist_search(&inp, "bc", &pos, buf, sizeof(buf)), 0);
+	assert_ueq(pos, 3);
+
+	/* Test no match */
+	pos = 0;
+	assert_eq(input_hist_search(&inp, "abd", &pos, buf, sizeof(buf)), 0);
+	assert_eq(input_hist_search(&inp, "abcabca", &pos, buf, sizeof(buf)), 0);
+
+	/* Test match is truncated to max */
+	pos = 0;
+	assert_eq(input_hist_search(&inp, "y", &pos, buf, 3), 2);
+	assert_strcmp(buf, "xy");
+
+	input_free(&inp);
+}
+
+static void
+test_input_hist_file(void)
+{
+	char path[] = "/tmp/rirc.input.XXXXXX";
+	char line[INPUT_LEN_MAX + 2];
+	struct input inp;
+	size_t pos;
+	int fd;
+
+	if ((fd = mkstemp(path)) < 0 || fcntl(fd, F_SETFL, O_APPEND) < 0)
+		test_abort("mkstemp failed");
+
+	/* Test existing entries, including partial and empty lines */
+	assert_eq(write(fd, "aaa\n\nbbb\nccc\nddd\neee\nfff", 24), 24);
+
+	input_init(&inp);
+
+	assert_eq(input_hist_file(&inp, path), 0);
+
+	/* Test history is loaded on first use */
+	assert_ueq(input_hist_size(&inp), 0);
+	assert_eq(input_hist_back(&inp), 1);
+	CHECK_INPUT_WRITE(&inp, "eee");
+	assert_ueq(inp.hist.file->n, 5);
+	assert_ueq(input_hist_size(&inp), 4);
+	assert_strcmp(INPUT_HIST_LINE(&inp, inp.hist.tail), "bbb");
+
+	/* Test pushing appends to the file, terminating the partial line */
+	assert_eq(input_reset(&inp), 1);
+	assert_eq(write(fd, "\n", 1), 1);
+	assert_eq(input_insert(&inp, "ggg", 3), 1);
+	assert_eq(input_hist_push(&inp), 1);
+
+	pos = 0;
+	assert_eq(input_hist_search(&inp, "g", &pos, buf, sizeof(buf)), 3);
+	assert_strcmp(buf, "ggg");
+	assert_ueq(inp.hist.file->n, 7);
+
+	pos = 0;
+	assert_eq(input_hist_search(&inp, "ff", &pos, buf, sizeof(buf)), 3);
+	assert_strcmp(buf, "fff");
+	assert_ueq(pos, 1);
+
+	pos = 0;
+	assert_eq(input_hist_search(&inp, "a", &pos, buf, sizeof(buf)), 3);
+	assert_strcmp(buf, "aaa");
+	assert_ueq(pos, 6);
+
+	/* Test the index drops the oldest entries when full */
+	assert_eq(input_insert(&inp, "hhh", 3), 1);
+	assert_eq(input_hist_push(&inp), 1);
+	assert_eq(input_insert(&inp, "iii", 3), 1);
+	assert_eq(input_hist_push(&inp), 1);
+
+	pos = 0;
+	assert_eq(input_hist_search(&inp, "a", &pos, buf, sizeof(buf)), 0);
+	assert_eq(input_hist_search(&inp, "e", &pos, buf, sizeof(buf)), 3);
+	assert_ueq(inp.hist.file->n, 5);
+
+	/* Test long lines are truncated */
+	memset(line, 'x', sizeof(line) - 1);
+	line[sizeof(line) - 1] = '\n';
+	assert_eq(write(fd, line, sizeof(line)), (ssize_t)sizeof(line));
+
+	pos = 0;
+	assert_eq(input_hist_search(&inp, "x", &pos, buf, sizeof(buf)), INPUT_LEN_MAX);
+
+	/* Test history persists */
+	input_free(&inp);
+	input_init(&inp);
+
+	assert_eq(input_hist_file(&inp, path), 0);
+	assert_eq(input_hist_back(&inp), 1);
+	CHECK_INPUT_WRITE(&inp, "xxxxxxxxxxxxxxxx");
+	assert_eq(input_hist_back(&inp), 1);
+	CHECK_INPUT_WRITE(&inp, "iii");
+
+	input_free(&inp);
+
+	/* Test failing to open */
+	input_init(&inp);
+	assert_eq(input_hist_file(&inp, "/tmp/rirc.input.none/none"), -1);
+	assert_eq(input_insert(&inp, "abc", 3), 1);
+	assert_eq(input_hist_push(&inp), 1);
+	assert_eq(input_hist_back(&inp), 1);
+	CHECK_INPUT_WRITE(&inp, "abc");
+	pos = 0;
+	assert_eq(input_hist_search(&inp, "b", &pos, buf, sizeof(buf)), 3);
+	input_free(&inp);
+
+	close(fd);
+	unlink(path);
+}
+
+static void
+test_input_hist_secret(void)
+{
+	/* Test lines that may carry credentials aren't persisted */
+
+	const char *lines[] = {
+		":connect h -w x",
+		"--pass=x",
+		"--sasl-pass x",
+		":quote PASS x",
+		"/oper name x",
+		"/msg ns IDENTIFY",
+		"identify x",
+		"REGISTER x",
+	};
+
+	char path[] = "/tmp/rirc.input.XXXXXX";
+	char file[64];
+	struct input inp;
+	int fd;
+
+	if ((fd = mkstemp(path)) < 0)
+		test_abort("mkstemp failed");
+
+	input_init(&inp);
+
+	assert_eq(input_hist_file(&inp, path), 0);
+
+	for (size_t i = 0; i < ARR_LEN(lines); i++) {
+		assert_eq(input_insert(&inp, lines[i], strlen(lines[i])), 1);
+		assert_eq(input_hist_push(&inp), 1);
+	}
+
+	assert_eq(input_insert(&inp, "/join #pass", 11), 1);
+	assert_eq(input_hist_push(&inp), 1);
+
+	/* Test all lines are kept in memory */
+	assert_eq(input_hist_back(&inp), 1);
+	CHECK_INPUT_WRITE(&inp, "/join #pass");
+	assert_eq(input_hist_back(&inp), 1);
+	CHECK_INPUT_WRITE(&inp, "REGISTER x");
+
+	/* Test only the line without credentials is appended */
+	memset(file, 0, sizeof(file));
+	assert_eq(read(fd, file, sizeof(file) - 1), 12);
+	assert_strcmp(file, "/join #pass\n");
+
+	input_free(&inp);
+
+	close(fd);
+	unlink(path);
+}
+
 static void
 test_input_move(void)
 {
@@ -576,6 +776,9 @@ main(void)
 		TESTCASE(test_input_ins),
 		TESTCASE(test_input_del),
 		TESTCASE(test_input_hist),
+		TESTCASE(test_input_hist_search),
+		TESTCASE(test_input_hist_file),
+		TESTCASE(test_input_hist_secret),
 		TESTCASE(test_input_move),
 		TESTCASE(test_input_frame),
 		TESTCASE(test_input_write),
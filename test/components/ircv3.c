@@ -7,6 +7,7 @@
 	X("cap-3", cap_3, (IRCV3_CAP_NO_DEL | IRCV3_CAP_NO_REQ))
 
 #include "src/components/ircv3.c"
+#include "src/utils/utils.c"
 
 static void
 test_ircv3_caps(void)
@@ -59,12 +60,65 @@ test_ircv3_caps_reset(void)
 	assert_eq(caps.cap_3.supports_req, 1);
 }
 
+static void
+test_ircv3_batch(void)
+{
+	struct ircv3_batch *b1;
+	struct ircv3_batch *b2;
+	struct ircv3_batch *b3;
+	struct ircv3_batches batches;
+
+	ircv3_batches(&batches);
+
+	assert_ptr_not_null((b1 = ircv3_batch_add(&batches, "ref1", "netjoin", "irc.a irc.b")));
+	assert_ptr_not_null((b2 = ircv3_batch_add(&batches, "ref2", "netsplit", NULL)));
+	assert_ptr_not_null((b3 = ircv3_batch_add(&batches, "ref3", "labeled-response", NULL)));
+	assert_ptr_null(ircv3_batch_add(&batches, "ref2", "netsplit", NULL));
+
+	assert_eq(b1->type, IRCV3_BATCH_NETJOIN);
+	assert_eq(b2->type, IRCV3_BATCH_NETSPLIT);
+	assert_eq(b3->type, IRCV3_BATCH_OTHER);
+	assert_eq(ircv3_batch_add(&batches, "ref5", "chathistory", "#chan")->type, IRCV3_BATCH_CHATHISTORY);
+	assert_strcmp(b1->params, "irc.a irc.b");
+	assert_strcmp(b2->params, "");
+	assert_strcmp(b3->params, "");
+
+	assert_ptr_eq(ircv3_batch_get(&batches, "ref1"), b1);
+	assert_ptr_eq(ircv3_batch_get(&batches, "ref2"), b2);
+	assert_ptr_eq(ircv3_batch_get(&batches, "ref3"), b3);
+	assert_ptr_null(ircv3_batch_get(&batches, "ref4"));
+
+	for (unsigned i = 0; i < 100; i++)
+		ircv3_batch_event(b1, "nick", "#chan");
+
+	ircv3_batch_event(b2, "nick", NULL)->text = irc_strdup("text");
+
+	assert_ueq(b1->n_events, 100);
+	assert_ueq(b2->n_events, 1);
+	assert_strcmp(b1->events[99].nick, "nick");
+	assert_strcmp(b1->events[99].chan, "#chan");
+	assert_ptr_null(b2->events[0].chan);
+	assert_ptr_null(b1->events[0].text);
+	assert_ueq(b1->events[0].msgid, 0);
+
+	ircv3_batch_del(&batches, b2);
+
+	assert_ptr_eq(ircv3_batch_get(&batches, "ref1"), b1);
+	assert_ptr_null(ircv3_batch_get(&batches, "ref2"));
+	assert_ptr_eq(ircv3_batch_get(&batches, "ref3"), b3);
+
+	ircv3_batches_reset(&batches);
+
+	assert_ptr_null(batches.head);
+}
+
 int
 main(void)
 {
 	struct testcase tests[] = {
 		TESTCASE(test_ircv3_caps),
 		TESTCASE(test_ircv3_caps_reset),
+		TESTCASE(test_ircv3_batch),
 	};
 
 	return run_tests(NULL, NULL, tests);
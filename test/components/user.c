@@ -164,13 +164,78 @@ test_user_list_free(void)
 	user_list_free(&ulist);
 }
 
+static void
+test_user_info(void)
+{
+	/* Test add/del/get/rpl/set cached user info */
+
+	struct user_info *u1, *u2;
+	struct user_info_list uilist;
+
+	memset(&uilist, 0, sizeof(uilist));
+
+	assert_ptr_null(user_info_get(&uilist, CASEMAPPING_RFC1459, "aaa"));
+
+	/* test add, get or create */
+	assert_ptr_not_null((u1 = user_info_add(&uilist, CASEMAPPING_RFC1459, "aaa")));
+	assert_ptr_eq(user_info_add(&uilist, CASEMAPPING_RFC1459, "AAA"), u1);
+	assert_ptr_eq(user_info_get(&uilist, CASEMAPPING_RFC1459, "aaa"), u1);
+	assert_ptr_null(u1->account);
+	assert_ptr_null(u1->away);
+	assert_ptr_null(u1->host);
+	assert_ptr_null(u1->realname);
+	assert_ueq(uilist.count, 1);
+
+	/* test set */
+	user_info_set(&(u1->account), "account");
+	user_info_set(&(u1->away), "away");
+	user_info_set(&(u1->host), "user@host");
+	user_info_set(&(u1->realname), "realname");
+	user_info_set(&(u1->away), NULL);
+	user_info_set(&(u1->host), "user@host2");
+
+	assert_strcmp(u1->account, "account");
+	assert_ptr_null(u1->away);
+	assert_strcmp(u1->host, "user@host2");
+	assert_strcmp(u1->realname, "realname");
+
+	/* test rpl, fields maintained */
+	assert_ptr_not_null((u2 = user_info_add(&uilist, CASEMAPPING_RFC1459, "bbb")));
+	assert_eq(user_info_rpl(&uilist, CASEMAPPING_RFC1459, "ccc", "ddd"), USER_ERR_NOT_FOUND);
+	assert_eq(user_info_rpl(&uilist, CASEMAPPING_RFC1459, "aaa", "bbb"), USER_ERR_DUPLICATE);
+	assert_eq(user_info_rpl(&uilist, CASEMAPPING_RFC1459, "aaa", "ccc"), USER_ERR_NONE);
+	assert_ptr_null(user_info_get(&uilist, CASEMAPPING_RFC1459, "aaa"));
+	assert_ptr_not_null((u1 = user_info_get(&uilist, CASEMAPPING_RFC1459, "ccc")));
+	assert_strcmp(u1->nick, "ccc");
+	assert_strcmp(u1->account, "account");
+	assert_strcmp(u1->host, "user@host2");
+	assert_strcmp(u1->realname, "realname");
+	assert_ueq(uilist.count, 2);
+
+	/* test rpl, change case */
+	assert_eq(user_info_rpl(&uilist, CASEMAPPING_RFC1459, "ccc", "CCC"), USER_ERR_NONE);
+	assert_strcmp(user_info_get(&uilist, CASEMAPPING_RFC1459, "ccc")->nick, "CCC");
+
+	/* test del */
+	assert_eq(user_info_del(&uilist, CASEMAPPING_RFC1459, "aaa"), USER_ERR_NOT_FOUND);
+	assert_eq(user_info_del(&uilist, CASEMAPPING_RFC1459, "bbb"), USER_ERR_NONE);
+	assert_ptr_null(user_info_get(&uilist, CASEMAPPING_RFC1459, "bbb"));
+	assert_ueq(uilist.count, 1);
+
+	user_info_free(&uilist);
+
+	assert_ptr_null(user_info_get(&uilist, CASEMAPPING_RFC1459, "ccc"));
+	assert_ueq(uilist.count, 0);
+}
+
 int
 main(void)
 {
 	struct testcase tests[] = {
 		TESTCASE(test_user_list),
 		TESTCASE(test_user_list_casemapping),
-		TESTCASE(test_user_list_free)
+		TESTCASE(test_user_list_free),
+		TESTCASE(test_user_info)
 	};
 
 	return run_tests(NULL, NULL, tests);
@@ -13,17 +13,21 @@
 #include "src/state.c"
 #include "src/utils/utils.c"
 
+#include "test/event.mock.c"
+#include "test/trace.mock.c"
 #include "test/handlers/irc_recv.mock.c"
 #include "test/handlers/irc_send.mock.c"
 #include "test/io.mock.c"
+#include "test/log.mock.c"
 #include "test/rirc.mock.c"
+#include "test/snapshot.mock.c"
 
 static void
 t__buffer_newline(struct buffer *b, const char *t)
 {
 	/* Abstract newline with default values */
 
-	buffer_newline(b, BUFFER_LINE_OTHER, "", t, 0, strlen(t), 0);
+	buffer_newline(b, BUFFER_LINE_OTHER, "", t, 0, strlen(t), 0, NULL);
 }
 
 static void
@@ -0,0 +1,272 @@
+#include "test/test.h"
+
+#include "src/event.c"
+#include "src/utils/utils.c"
+
+#include <time.h>
+
+static char dir[] = "/tmp/rirc.event.XXXXXX";
+static char path[64];
+static char buf[4096];
+
+static int
+subscribe(void)
+{
+	/* Connect a subscriber, waiting for the writer thread to accept it */
+
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct timespec ts = { .tv_nsec = 1000000 };
+	int soc;
+
+	strcpy(addr.sun_path, path);
+
+	if ((soc = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		test_abort("socket failed");
+
+	if (connect(soc, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+		test_abort("connect failed");
+
+	for (int i = 0; i < 1000 && !atomic_load(&(event_subs[0].active)); i++)
+		nanosleep(&ts, NULL);
+
+	return soc;
+}
+
+static const char*
+read_lines(int soc, unsigned n)
+{
+	/* Read the given number of lines, with the time fields removed */
+
+	char *p;
+	size_t len = 0;
+	ssize_t ret;
+
+	while (n) {
+
+		if ((ret = read(soc, buf + len, sizeof(buf) - len - 1)) <= 0)
+			test_abort("read failed");
+
+		for (ssize_t i = 0; i < ret; i++) {
+			if (buf[len + i] == '\n')
+				n--;
+		}
+
+		len += ret;
+	}
+
+	buf[len] = 0;
+
+	while ((p = strstr(buf, ",\"time\":"))) {
+
+		char *end = p + 8;
+
+		while (*end >= '0' && *end <= '9')
+			end++;
+
+		memmove(p, end, strlen(end) + 1);
+	}
+
+	return buf;
+}
+
+static void
+test_event_disabled(void)
+{
+	assert_eq(event_init(""), 0);
+	assert_ptr_null(event_subs);
+	event(EVENT_MESSAGE, "host", "#chan", "nick", "text");
+	event_term();
+}
+
+static void
+test_event_stream(void)
+{
+	int soc;
+
+	assert_eq(event_init(path), 0);
+
+	soc = subscribe();
+
+	event(EVENT_CONNECT, "host", NULL, NULL, NULL);
+	event(EVENT_MESSAGE, "host", "#chan", "nick", "text \"1\"\\ \x02" "bold");
+	event(EVENT_PART, "host", "#chan", "nick", NULL);
+	event_lag("host", 42);
+
+	assert_strcmp(read_lines(soc, 4),
+		"{\"type\":\"connect\",\"host\":\"host\"}\n"
+		"{\"type\":\"message\",\"host\":\"host\",\"target\":\"#chan\",\"nick\":\"nick\",\"text\":\"text \\\"1\\\"\\\\ \\u0002bold\"}\n"
+		"{\"type\":\"part\",\"host\":\"host\",\"target\":\"#chan\",\"nick\":\"nick\"}\n"
+		"{\"type\":\"lag\",\"host\":\"host\",\"ms\":42}\n");
+
+	/* Test fields are truncated */
+	memset(buf, 'x', sizeof(buf) - 1);
+	buf[sizeof(buf) - 1] = 0;
+	event(EVENT_MESSAGE, "host", "#chan", "nick", buf);
+
+	read_lines(soc, 1);
+
+	assert_lt(strlen(buf), EVENT_LEN_MAX);
+	assert_strcmp(buf + strlen(buf) - 6, "xxx\"}\n");
+
+	close(soc);
+	event_term();
+
+	/* Test the socket is removed */
+	assert_eq(access(path, F_OK), -1);
+}
+
+static void
+test_event_socket(void)
+{
+	/* Test a stale socket is replaced, and a live listener's isn't */
+
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	int soc;
+
+	strcpy(addr.sun_path, path);
+
+	if ((soc = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		test_abort("socket failed");
+
+	if (bind(soc, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(soc, 1) < 0)
+		test_abort("bind failed");
+
+	errno = 0;
+	assert_eq(event_init(path), -1);
+	assert_eq(errno, EADDRINUSE);
+	assert_ptr_null(event_subs);
+	assert_eq(access(path, F_OK), 0);
+
+	close(soc);
+
+	assert_eq(event_init(path), 0);
+	assert_eq(access(path, F_OK), 0);
+
+	errno = 0;
+	assert_eq(event_init(path), -1);
+	assert_eq(errno, EADDRINUSE);
+
+	event_term();
+
+	assert_eq(access(path, F_OK), -1);
+}
+
+static void
+test_event_utf8(void)
+{
+	/* Test bytes not part of a valid UTF-8 sequence are replaced */
+
+	#define CHECK_EVENT_STR(S, R) \
+		buf[event_str(buf, sizeof(buf), "k", (S))] = 0; \
+		assert_strcmp(buf, ",\"k\":\"" R "\"");
+
+	CHECK_EVENT_STR("a\xc3\xa9", "a\xc3\xa9");
+	CHECK_EVENT_STR("\xe2\x82\xac", "\xe2\x82\xac");
+	CHECK_EVENT_STR("\xf0\x9f\x98\x80", "\xf0\x9f\x98\x80");
+	CHECK_EVENT_STR("\xf4\x8f\xbf\xbf", "\xf4\x8f\xbf\xbf");
+
+	/* Invalid and continuation bytes */
+	CHECK_EVENT_STR("a\xff" "b", "a\xef\xbf\xbd" "b");
+	CHECK_EVENT_STR("\x80\xbf", "\xef\xbf\xbd\xef\xbf\xbd");
+
+	/* Truncated sequences */
+	CHECK_EVENT_STR("\xc3", "\xef\xbf\xbd");
+	CHECK_EVENT_STR("\xe2\x82" "a", "\xef\xbf\xbd\xef\xbf\xbd" "a");
+
+	/* Overlong encodings, surrogates, and code points above U+10FFFF */
+	CHECK_EVENT_STR("\xc0\xaf", "\xef\xbf\xbd\xef\xbf\xbd");
+	CHECK_EVENT_STR("\xe0\x80\xaf", "\xef\xbf\xbd\xef\xbf\xbd\xef\xbf\xbd");
+	CHECK_EVENT_STR("\xed\xa0\x80", "\xef\xbf\xbd\xef\xbf\xbd\xef\xbf\xbd");
+	CHECK_EVENT_STR("\xf4\x90\x80\x80", "\xef\xbf\xbd\xef\xbf\xbd\xef\xbf\xbd\xef\xbf\xbd");
+
+	#undef CHECK_EVENT_STR
+
+	/* Test sequences aren't split when truncated */
+	assert_ueq(event_str(buf, 16, "k", "\xf0\x9f\x98\x80\xf0\x9f\x98\x80"), 11);
+	buf[11] = 0;
+	assert_strcmp(buf, ",\"k\":\"\xf0\x9f\x98\x80\"");
+}
+
+static void
+test_event_dropped(void)
+{
+	/* Test events are dropped without waiting when a subscriber's ring
+	 * is full, and the count dropped precedes its next event */
+
+	struct event_sub *sub;
+	size_t len;
+
+	if ((event_subs = calloc(EVENT_SUBS_MAX, sizeof(*event_subs))) == NULL)
+		test_abort("calloc failed");
+
+	if (pipe(event_fd) < 0)
+		test_abort("pipe failed");
+
+	sub = &(event_subs[0]);
+	atomic_store(&(sub->active), 1);
+
+	event(EVENT_JOIN, "host", "#chan", "nick", NULL);
+
+	len = atomic_load(&(sub->tail));
+
+	while (atomic_load(&(sub->tail)) + len <= EVENT_RING_LEN)
+		event(EVENT_JOIN, "host", "#chan", "nick", NULL);
+
+	assert_ueq(sub->dropped, 0);
+
+	event(EVENT_JOIN, "host", "#chan", "nick", NULL);
+	event(EVENT_JOIN, "host", "#chan", "nick", NULL);
+
+	assert_ueq(sub->dropped, 2);
+
+	/* Consume the ring */
+	atomic_store(&(sub->head), atomic_load(&(sub->tail)));
+
+	event(EVENT_PART, "host", "#chan", "nick", NULL);
+
+	assert_ueq(sub->dropped, 0);
+
+	len = atomic_load(&(sub->tail)) - atomic_load(&(sub->head));
+
+	for (size_t i = 0; i < len; i++)
+		buf[i] = sub->buf[(atomic_load(&(sub->head)) + i) & (EVENT_RING_LEN - 1)];
+
+	buf[len] = 0;
+
+	assert_ptr_eq(strstr(buf, "{\"type\":\"dropped\",\"count\":2}\n{\"type\":\"part\""), buf);
+
+	close(event_fd[0]);
+	close(event_fd[1]);
+	free(event_subs);
+
+	event_subs = NULL;
+}
+
+int
+main(void)
+{
+	struct testcase tests[] = {
+		TESTCASE(test_event_disabled),
+		TESTCASE(test_event_stream),
+		TESTCASE(test_event_socket),
+		TESTCASE(test_event_utf8),
+		TESTCASE(test_event_dropped)
+	};
+
+	char cmd[64];
+	int ret;
+
+	if (!mkdtemp(dir))
+		test_abort("mkdtemp failed");
+
+	snprintf(path, sizeof(path), "%s/events", dir);
+
+	ret = run_tests(NULL, NULL, tests);
+
+	snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+
+	if (system(cmd))
+		test_abort("cleanup failed");
+
+	return ret;
+}
@@ -0,0 +1,24 @@
+#ifndef EVENT_MOCK_C
+#define EVENT_MOCK_C
+
+int event_init(const char *path) { UNUSED(path); return 0; }
+void event_term(void) { ; }
+
+void
+event(enum event_type type, const char *host, const char *target, const char *nick, const char *text)
+{
+	UNUSED(type);
+	UNUSED(host);
+	UNUSED(target);
+	UNUSED(nick);
+	UNUSED(text);
+}
+
+void
+event_lag(const char *host, unsigned ms)
+{
+	UNUSED(host);
+	UNUSED(ms);
+}
+
+#endif
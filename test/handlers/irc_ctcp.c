@@ -14,7 +14,8 @@
 #include "src/handlers/ircv3.c"
 #include "src/utils/utils.c"
 #include "test/draw.mock.c"
-
+#include "test/event.mock.c"
+#include "test/handlers/irc_send.mock.c"
 #include "test/io.mock.c"
 #include "test/state.mock.c"
 
@@ -14,6 +14,8 @@
 #include "src/utils/utils.c"
 
 #include "test/draw.mock.c"
+#include "test/event.mock.c"
+#include "test/handlers/irc_send.mock.c"
 #include "test/io.mock.c"
 #include "test/state.mock.c"
 
@@ -704,11 +706,59 @@ test_recv_ping(void)
 static void
 test_recv_pong(void)
 {
-	/* PONG <server> [<server2>] */
+	/* PONG <server> [<token>] */
+
+	char buf[64];
+
+	CHECK_RECV("PONG", 1, 1, 0);
+	assert_strcmp(mock_line[0], "PONG: server is null");
 
-	CHECK_RECV("PONG", 0, 0, 0);
 	CHECK_RECV("PONG s1", 0, 0, 0);
 	CHECK_RECV("PONG s1 s2", 0, 0, 0);
+	CHECK_RECV("PONG s1 rirc-", 0, 0, 0);
+	CHECK_RECV("PONG s1 rirc-1x", 0, 0, 0);
+	CHECK_RECV("PONG s1 rirc-99999999999999999999", 0, 0, 0);
+
+	assert_eq(s->lag.n, 0);
+
+	/* send queue pacing */
+	s->sendq.pending = 1;
+	CHECK_RECV("PONG s1 :" SERVER_SENDQ_TOKEN, 0, 0, 0);
+	assert_eq(s->sendq.pending, 0);
+	assert_eq(s->lag.n, 0);
+
+	/* lag probe, 300ms */
+	snprintf(buf, sizeof(buf), "PONG s1 :" SERVER_LAG_TOKEN "%llu",
+		(unsigned long long)(server_lag_time() - 300000000));
+
+	mock_reset_io();
+	mock_reset_state();
+	assert_eq(irc_message_parse(&m, buf), 0);
+	assert_eq(irc_recv(s, &m), 0);
+	assert_eq(mock_line_n, 0);
+
+	assert_eq(s->lag.n, 1);
+	assert_eq(s->lag.hist[3], 1);
+	assert_true(s->lag.avg >= 300 && s->lag.avg < 500);
+	assert_eq(s->lag.avg, s->lag.last);
+
+	/* lag probe echoed as the only param, 10ms */
+	snprintf(buf, sizeof(buf), "PONG " SERVER_LAG_TOKEN "%llu",
+		(unsigned long long)(server_lag_time() - 10000000));
+
+	assert_eq(irc_message_parse(&m, buf), 0);
+	assert_eq(irc_recv(s, &m), 0);
+
+	assert_eq(s->lag.n, 2);
+	assert_eq(s->lag.hist[0], 1);
+	assert_true(s->lag.last >= 10 && s->lag.last < 50);
+	assert_true(s->lag.avg < 300);
+
+	server_reset(s);
+
+	assert_eq(s->lag.n, 0);
+	assert_eq(s->lag.avg, 0);
+	assert_eq(s->lag.hist[0], 1);
 }
 
 static void
@@ -1084,6 +1134,288 @@ test_recv_ircv3_away(void)
 	CHECK_RECV(":nick-filter!user@host AWAY", 0, 0, 0);
 }
 
+static void
+test_recv_ircv3_batch(void)
+{
+	/* :server BATCH +<reference> <type> [params]
+	 * :server BATCH -<reference> */
+
+	struct user_info *u;
+
+	threshold_join = 0;
+	threshold_part = 0;
+	threshold_quit = 0;
+
+	CHECK_RECV("BATCH", 1, 1, 0);
+	assert_strcmp(mock_chan[0], "host");
+	assert_strcmp(mock_line[0], "BATCH: reference is null");
+
+	CHECK_RECV("BATCH +", 1, 1, 0);
+	assert_strcmp(mock_chan[0], "host");
+	assert_strcmp(mock_line[0], "BATCH: reference is empty");
+
+	CHECK_RECV("BATCH +ref", 1, 1, 0);
+	assert_strcmp(mock_chan[0], "host");
+	assert_strcmp(mock_line[0], "BATCH: type is null");
+
+	CHECK_RECV("BATCH ref", 1, 1, 0);
+	assert_strcmp(mock_chan[0], "host");
+	assert_strcmp(mock_line[0], "BATCH: invalid reference 'ref'");
+
+	CHECK_RECV("BATCH -ref", 1, 1, 0);
+	assert_strcmp(mock_chan[0], "host");
+	assert_strcmp(mock_line[0], "BATCH: reference 'ref' not found");
+
+	/* test other messages in a batch are replayed when closed */
+	CHECK_RECV("BATCH +ref1 chathistory #c1", 0, 0, 0);
+	CHECK_RECV("BATCH +ref1 chathistory #c1", 1, 1, 0);
+	assert_strcmp(mock_line[0], "BATCH: duplicate reference 'ref1'");
+
+	CHECK_RECV("@batch=ref1 :nick1!user@host JOIN #c1", 0, 0, 0);
+	assert_ptr_null(user_list_get(&(c1->users), s->casemapping, "nick1", 0));
+
+	CHECK_RECV("BATCH -ref1", 0, 1, 0);
+	assert_strcmp(mock_chan[0], "#c1");
+	assert_strcmp(mock_line[0], "nick1!user@host has joined");
+	assert_ptr_not_null(user_list_get(&(c1->users), s->casemapping, "nick1", 0));
+	assert_ptr_null(s->ircv3_batches.head);
+
+	/* test unknown batch types are replayed when closed, in order,
+	 * with nested batches opened and closed as received */
+	CHECK_RECV("BATCH +ref9 example.com/unknown", 0, 0, 0);
+	CHECK_RECV("@batch=ref9 :nick9!user@host JOIN #c2", 0, 0, 0);
+	CHECK_RECV("@batch=ref9 BATCH +ref10 netsplit irc.a irc.b", 0, 0, 0);
+	CHECK_RECV("@batch=ref10 :nick9!user@host QUIT :irc.a irc.b", 0, 0, 0);
+	CHECK_RECV("@batch=ref9 BATCH -ref10", 0, 0, 0);
+	CHECK_RECV("@batch=ref9 :nick9!user@host PRIVMSG #c2 :text", 0, 0, 0);
+	CHECK_RECV("@batch=ref9 :nick9!user@host PART #c2", 0, 0, 0);
+	CHECK_RECV("@batch=ref9 :nick9!user@host PRIVMSG", 0, 0, 0);
+	assert_ptr_null(user_list_get(&(c2->users), s->casemapping, "nick9", 0));
+
+	CHECK_RECV("BATCH -ref9", 0, 4, 0);
+	assert_strcmp(mock_chan[0], "#c2");
+	assert_strcmp(mock_line[0], "nick9!user@host has joined");
+	assert_strcmp(mock_chan[1], "#c2");
+	assert_strcmp(mock_line[1], "text");
+	assert_strcmp(mock_chan[2], "#c2");
+	assert_strcmp(mock_line[2], "nick9!user@host has parted");
+	assert_strcmp(mock_chan[3], "host");
+	assert_strcmp(mock_line[3], "PRIVMSG: target is null");
+	assert_ptr_null(user_list_get(&(c2->users), s->casemapping, "nick9", 0));
+	assert_ptr_null(s->ircv3_batches.head);
+
+	/* test netjoin */
+	CHECK_RECV("BATCH +ref2 netjoin irc.a irc.b", 0, 0, 0);
+	CHECK_RECV("@batch=ref2 :nick2!user@host JOIN #c1", 0, 0, 0);
+	CHECK_RECV("@batch=ref2 :nick3!user@host JOIN #c1", 0, 0, 0);
+	CHECK_RECV("@batch=ref2 :nick2!user@host JOIN #c3", 0, 0, 0);
+	CHECK_RECV("@batch=ref2 :nick4!user@host JOIN #c4", 0, 0, 0);
+	CHECK_RECV("@batch=ref2 JOIN #c1", 1, 1, 0);
+	assert_strcmp(mock_line[0], "JOIN: sender's nick is null");
+	CHECK_RECV("@batch=ref2 :nick5!user@host JOIN", 1, 1, 0);
+	assert_strcmp(mock_line[0], "JOIN: channel is null");
+
+	assert_ptr_null(user_list_get(&(c1->users), s->casemapping, "nick2", 0));
+
+	CHECK_RECV("BATCH -ref2", 0, 2, 0);
+	assert_strcmp(mock_chan[0], "#c1");
+	assert_strcmp(mock_line[0], "Netjoin [irc.a irc.b], 2 joined: nick2 nick3");
+	assert_strcmp(mock_chan[1], "#c3");
+	assert_strcmp(mock_line[1], "Netjoin [irc.a irc.b], 1 joined: nick2");
+	assert_ptr_not_null(user_list_get(&(c1->users), s->casemapping, "nick2", 0));
+	assert_ptr_not_null(user_list_get(&(c1->users), s->casemapping, "nick3", 0));
+	assert_ptr_not_null(user_list_get(&(c3->users), s->casemapping, "nick2", 0));
+	assert_ptr_null(s->ircv3_batches.head);
+
+	/* test netjoin user info is cached */
+	assert_ptr_not_null((u = user_info_get(&(s->user_info), s->casemapping, "nick2")));
+	assert_strcmp(u->host, "user@host");
+	assert_ptr_not_null(user_info_get(&(s->user_info), s->casemapping, "nick3"));
+	assert_ptr_null(user_info_get(&(s->user_info), s->casemapping, "nick4"));
+
+	/* test netjoin extended-join user info is cached */
+	s->ircv3_caps.extended_join.set = 1;
+
+	CHECK_RECV("BATCH +ref8 netjoin irc.a irc.b", 0, 0, 0);
+	CHECK_RECV("@batch=ref8 :nick6!user6@host6 JOIN #c1 account6 :real name6", 0, 0, 0);
+	CHECK_RECV("@batch=ref8 :nick7!user7@host7 JOIN #c1 * :real name7", 0, 0, 0);
+	CHECK_RECV("@batch=ref8 :nick8!user8@host8 JOIN #c1 *", 1, 1, 0);
+	assert_strcmp(mock_line[0], "JOIN: realname is null");
+	CHECK_RECV("BATCH -ref8", 0, 1, 0);
+	assert_strcmp(mock_line[0], "Netjoin [irc.a irc.b], 2 joined: nick6 nick7");
+
+	s->ircv3_caps.extended_join.set = 0;
+
+	assert_ptr_not_null((u = user_info_get(&(s->user_info), s->casemapping, "nick6")));
+	assert_strcmp(u->host, "user6@host6");
+	assert_strcmp(u->account, "account6");
+	assert_strcmp(u->realname, "real name6");
+	assert_ptr_not_null((u = user_info_get(&(s->user_info), s->casemapping, "nick7")));
+	assert_ptr_null(u->account);
+	assert_strcmp(u->realname, "real name7");
+
+	assert_eq(user_list_del(&(c1->users), s->casemapping, "nick6"), USER_ERR_NONE);
+	assert_eq(user_list_del(&(c1->users), s->casemapping, "nick7"), USER_ERR_NONE);
+	user_info_del(&(s->user_info), s->casemapping, "nick6");
+	user_info_del(&(s->user_info), s->casemapping, "nick7");
+
+	/* test netsplit */
+	CHECK_RECV("BATCH +ref3 netsplit irc.a irc.b", 0, 0, 0);
+	CHECK_RECV("@batch=ref3 :nick1!user@host QUIT :irc.a irc.b", 0, 0, 0);
+	CHECK_RECV("@batch=ref3 :nick2!user@host QUIT :irc.a irc.b", 0, 0, 0);
+	CHECK_RECV("@batch=ref3 :nick6!user@host QUIT :irc.a irc.b", 0, 0, 0);
+
+	/* test other messages in the batch are replayed after the summary */
+	CHECK_RECV("@batch=ref3 :nick3!user@host PART #c1", 0, 0, 0);
+
+	assert_ptr_not_null(user_list_get(&(c1->users), s->casemapping, "nick1", 0));
+
+	CHECK_RECV("BATCH -ref3", 0, 3, 0);
+	assert_strcmp(mock_chan[0], "#c1");
+	assert_strcmp(mock_line[0], "Netsplit [irc.a irc.b], 2 quit: nick1 nick2");
+	assert_strcmp(mock_chan[1], "#c3");
+	assert_strcmp(mock_line[1], "Netsplit [irc.a irc.b], 1 quit: nick2");
+	assert_strcmp(mock_chan[2], "#c1");
+	assert_strcmp(mock_line[2], "nick3!user@host has parted");
+	assert_eq(c1->users.count, 0);
+	assert_eq(c3->users.count, 0);
+	assert_ptr_null(s->ircv3_batches.head);
+
+	/* test netsplit user info is removed */
+	assert_ptr_null(user_info_get(&(s->user_info), s->casemapping, "nick1"));
+	assert_ptr_null(user_info_get(&(s->user_info), s->casemapping, "nick2"));
+	assert_ptr_null(user_info_get(&(s->user_info), s->casemapping, "nick3"));
+
+	/* test threshold_quit */
+	assert_eq(user_list_add(&(c1->users), CASEMAPPING_RFC1459, "nick1", (struct mode){0}), USER_ERR_NONE);
+
+	threshold_quit = -1;
+
+	CHECK_RECV("BATCH +ref4 netsplit irc.a irc.b", 0, 0, 0);
+	CHECK_RECV("@batch=ref4 :nick1!user@host QUIT :irc.a irc.b", 0, 0, 0);
+	CHECK_RECV("BATCH -ref4", 0, 0, 0);
+	assert_eq(c1->users.count, 0);
+
+	/* test chathistory */
+	buffer_newline(&(c1->buffer), BUFFER_LINE_CHAT, "nick1", "live", 5, 4, 0, NULL);
+	buffer_head(&(c1->buffer))->msgid = irc_strhash("id4");
+
+	CHECK_RECV("BATCH +ref6 chathistory #c1", 0, 0, 0);
+	CHECK_RECV("@batch=ref6;msgid=id1;time=2021-01-01T00:00:01.000Z :nick1!user@host PRIVMSG #c1 :one", 0, 0, 0);
+	CHECK_RECV("@batch=ref6;msgid=id2;time=2021-01-01T00:00:02.000Z :me!user@host PRIVMSG #c1 :two", 0, 0, 0);
+	CHECK_RECV("@batch=ref6;msgid=id3 :nick2!user@host NOTICE #c1 :me: three", 0, 0, 0);
+	CHECK_RECV("@batch=ref6;msgid=id4 :nick1!user@host PRIVMSG #c1 :live", 0, 0, 0);
+	CHECK_RECV("@batch=ref6 :nick1!user@host PRIVMSG #c1 :\001ACTION waves\001", 0, 0, 0);
+	CHECK_RECV("@batch=ref6 :nick1!user@host PRIVMSG #c1 :\001VERSION\001", 0, 0, 0);
+	CHECK_RECV("@batch=ref6 :nick1!user@host PRIVMSG #c1", 1, 1, 0);
+	assert_strcmp(mock_line[0], "PRIVMSG: message is null");
+
+	c1->history = 1;
+
+	CHECK_RECV("BATCH -ref6", 0, 0, 0);
+	assert_eq(c1->history, 0);
+	assert_ueq(buffer_size(&(c1->buffer)), 5);
+	assert_strcmp(buffer_line(&(c1->buffer), c1->buffer.tail + 0)->text, "one");
+	assert_strcmp(buffer_line(&(c1->buffer), c1->buffer.tail + 0)->from, "nick1");
+	assert_eq(buffer_line(&(c1->buffer), c1->buffer.tail + 0)->type, BUFFER_LINE_CHAT);
+	assert_eq(buffer_line(&(c1->buffer), c1->buffer.tail + 0)->time.tv_sec, 1609459201);
+	assert_true(buffer_line(&(c1->buffer), c1->buffer.tail + 0)->msgid == irc_strhash("id1"));
+	assert_strcmp(buffer_line(&(c1->buffer), c1->buffer.tail + 1)->text, "two");
+	assert_eq(buffer_line(&(c1->buffer), c1->buffer.tail + 1)->type, BUFFER_LINE_CHAT_RIRC);
+	assert_strcmp(buffer_line(&(c1->buffer), c1->buffer.tail + 2)->text, "me: three");
+	assert_eq(buffer_line(&(c1->buffer), c1->buffer.tail + 2)->type, BUFFER_LINE_PINGED);
+	assert_strcmp(buffer_line(&(c1->buffer), c1->buffer.tail + 3)->text, "nick1 waves");
+	assert_strcmp(buffer_line(&(c1->buffer), c1->buffer.tail + 3)->from, "*");
+	assert_strcmp(buffer_line(&(c1->buffer), c1->buffer.tail + 4)->text, "live");
+
+	CHECK_RECV("BATCH +ref7 chathistory #c4", 0, 0, 0);
+	CHECK_RECV("BATCH -ref7", 1, 1, 0);
+	assert_strcmp(mock_line[0], "BATCH: chathistory target '#c4' not found");
+
+	/* test unclosed batches are reset */
+	CHECK_RECV("BATCH +ref5 netsplit irc.a irc.b", 0, 0, 0);
+	CHECK_RECV("@batch=ref5 :nick1!user@host QUIT :irc.a irc.b", 0, 0, 0);
+	server_reset(s);
+	assert_ptr_null(s->ircv3_batches.head);
+
+	threshold_quit = 0;
+}
+
+static void
+test_recv_user_info(void)
+{
+	/* Test user info is cached from JOIN, ACCOUNT, AWAY, CHGHOST
+	 * and updated on NICK, PART, KICK and QUIT */
+
+	struct user_info *u;
+
+	threshold_account = 0;
+	threshold_away = 0;
+	threshold_chghost = 0;
+	threshold_join = 0;
+	threshold_nick = 0;
+	threshold_part = 0;
+	threshold_quit = 0;
+
+	s->ircv3_caps.extended_join.set = 1;
+
+	CHECK_RECV(":nick1!user@host JOIN #c1 account :real name", 0, 1, 0);
+	CHECK_RECV(":nick1!user@host JOIN #c2 * :real name", 0, 1, 0);
+	assert_ptr_not_null((u = user_info_get(&(s->user_info), s->casemapping, "nick1")));
+	assert_strcmp(u->host, "user@host");
+	assert_strcmp(u->realname, "real name");
+	assert_ptr_null(u->account);
+
+	s->ircv3_caps.extended_join.set = 0;
+
+	CHECK_RECV(":nick1!user@host ACCOUNT account", 0, 2, 0);
+	assert_strcmp(u->account, "account");
+
+	CHECK_RECV(":nick1!user@host AWAY :away message", 0, 2, 0);
+	assert_strcmp(u->away, "away message");
+
+	CHECK_RECV(":nick1!user@host AWAY", 0, 2, 0);
+	assert_ptr_null(u->away);
+
+	CHECK_RECV(":nick1!user@host CHGHOST user2 host2", 0, 2, 0);
+	assert_strcmp(u->host, "user2@host2");
+
+	CHECK_RECV(":nick1!user@host NICK nick2", 0, 2, 0);
+	assert_ptr_null(user_info_get(&(s->user_info), s->casemapping, "nick1"));
+	assert_ptr_not_null((u = user_info_get(&(s->user_info), s->casemapping, "nick2")));
+	assert_strcmp(u->account, "account");
+
+	/* test info is kept while on a common channel */
+	CHECK_RECV(":nick2!user@host PART #c1", 0, 1, 0);
+	assert_ptr_not_null(user_info_get(&(s->user_info), s->casemapping, "nick2"));
+
+	CHECK_RECV(":me!user@host KICK #c2 nick2", 0, 1, 0);
+	assert_ptr_null(user_info_get(&(s->user_info), s->casemapping, "nick2"));
+
+	CHECK_RECV(":nick3!user@host JOIN #c1", 0, 1, 0);
+	assert_ptr_not_null(user_info_get(&(s->user_info), s->casemapping, "nick3"));
+
+	CHECK_RECV(":nick3!user@host QUIT", 0, 1, 0);
+	assert_ptr_null(user_info_get(&(s->user_info), s->casemapping, "nick3"));
+
+	/* test info is removed when parting or being kicked from a channel */
+	CHECK_RECV(":nick4!user@host JOIN #c1", 0, 1, 0);
+	CHECK_RECV(":nick4!user@host JOIN #c3", 0, 1, 0);
+	CHECK_RECV(":nick5!user@host JOIN #c1", 0, 1, 0);
+	assert_ptr_not_null(user_info_get(&(s->user_info), s->casemapping, "nick4"));
+	assert_ptr_not_null(user_info_get(&(s->user_info), s->casemapping, "nick5"));
+
+	CHECK_RECV(":me!user@host PART #c1", 0, 1, 0);
+	assert_ptr_not_null(user_info_get(&(s->user_info), s->casemapping, "nick4"));
+	assert_ptr_null(user_info_get(&(s->user_info), s->casemapping, "nick5"));
+
+	CHECK_RECV(":nick6!user@host JOIN #c3", 0, 1, 0);
+	assert_ptr_not_null(user_info_get(&(s->user_info), s->casemapping, "nick6"));
+
+	CHECK_RECV(":nick!user@host KICK #c3 me", 0, 1, 0);
+	assert_true(TREE_EMPTY(&(s->user_info)));
+}
+
 static void
 test_recv_ircv3_chghost(void)
 {
@@ -1423,6 +1755,43 @@ test_irc_recv_314(void)
 	/* TODO */
 }
 
+static void
+test_irc_recv_315(void)
+{
+	/* RPL_ENDOFWHO
+	 *
+	 * <mask> :End of WHO list */
+
+	s->whox = 1;
+
+	/* test WHOX requests are paced, one pending at a time */
+	CHECK_RECV("366 me #c1", 0, 0, 1);
+	assert_strcmp(mock_send[0], "WHO #c1 %tcuhnfar," WHOX_TOKEN);
+	assert_eq(s->who, 1);
+
+	CHECK_RECV("366 me #c2", 0, 0, 0);
+	CHECK_RECV("366 me #c3", 0, 0, 0);
+	assert_eq(c2->who, 1);
+	assert_eq(c3->who, 1);
+
+	CHECK_RECV("315 me #c1 :End of WHO list", 0, 0, 1);
+	assert_strcmp(mock_send[0], "WHO #c2 %tcuhnfar," WHOX_TOKEN);
+	assert_eq(c2->who, 0);
+
+	CHECK_RECV("315 me #c2 :End of WHO list", 0, 0, 1);
+	assert_strcmp(mock_send[0], "WHO #c3 %tcuhnfar," WHOX_TOKEN);
+	assert_eq(c3->who, 0);
+
+	CHECK_RECV("315 me #c3 :End of WHO list", 0, 0, 0);
+	assert_eq(s->who, 0);
+
+	/* test WHOX unsupported */
+	s->whox = 0;
+
+	CHECK_RECV("366 me #c1", 0, 0, 0);
+	assert_eq(c1->who, 0);
+}
+
 static void
 test_irc_recv_317(void)
 {
@@ -1675,6 +2044,43 @@ test_irc_recv_353(void)
 	assert_strcmp(mock_line[0], "#zz: @n1 +n2 @+n3 +@n4");
 }
 
+static void
+test_irc_recv_354(void)
+{
+	/* RPL_WHOSPCRPL
+	 *
+	 * <token> <channel> <user> <host> <nick> <flags> <account> :<realname> */
+
+	struct user_info *u;
+
+	/* test other tokens are handled as generic info */
+	CHECK_RECV("354 me 1 #c1 nick1", 0, 1, 0);
+	assert_strcmp(mock_chan[0], "host");
+	assert_strcmp(mock_line[0], "[#c1 nick1]");
+
+	CHECK_RECV("354 me " WHOX_TOKEN " #c1 user host nick1 H@ account", 1, 1, 0);
+	assert_strcmp(mock_line[0], "RPL_WHOSPCRPL: realname is null");
+
+	CHECK_RECV("354 me " WHOX_TOKEN " #c1 user host nick1 H@ account :real name", 0, 0, 0);
+	assert_ptr_not_null((u = user_info_get(&(s->user_info), s->casemapping, "nick1")));
+	assert_strcmp(u->account, "account");
+	assert_strcmp(u->host, "user@host");
+	assert_strcmp(u->realname, "real name");
+	assert_ptr_null(u->away);
+
+	CHECK_RECV("354 me " WHOX_TOKEN " #c1 user host nick1 G 0 :real name", 0, 0, 0);
+	assert_ptr_null(u->account);
+	assert_strcmp(u->away, "");
+
+	/* test known away message is kept */
+	user_info_set(&(u->away), "away message");
+	CHECK_RECV("354 me " WHOX_TOKEN " #c1 user host nick1 G* 0 :real name", 0, 0, 0);
+	assert_strcmp(u->away, "away message");
+
+	CHECK_RECV("354 me " WHOX_TOKEN " #c1 user host nick1 H 0 :real name", 0, 0, 0);
+	assert_ptr_null(u->away);
+}
+
 static void
 test_irc_recv_366(void)
 {
@@ -1928,7 +2334,9 @@ main(void)
 		TESTCASE(test_recv_ircv3_cap),
 		TESTCASE(test_recv_ircv3_account),
 		TESTCASE(test_recv_ircv3_away),
+		TESTCASE(test_recv_ircv3_batch),
 		TESTCASE(test_recv_ircv3_chghost),
+		TESTCASE(test_recv_user_info),
 		#define X(numeric) \
 		TESTCASE(test_irc_recv_##numeric),
 		IRC_RECV_NUMERICS
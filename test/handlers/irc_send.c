@@ -109,6 +109,61 @@ test_irc_send_message(void)
 	s->registered = 1;
 }
 
+static void
+test_irc_send_queue(void)
+{
+	c_chan->joined = 1;
+
+	server_sendq_push(s, "chan", "line 1");
+	server_sendq_push(s, "unknown", "line 2");
+	server_sendq_push(s, "chan", "line 3");
+	server_sendq_push(s, "priv", "line 4");
+	server_sendq_push(s, "chan", "line 5");
+	server_sendq_push(s, "chan", "line 6");
+
+	assert_eq(s->sendq.n, 6);
+
+	/* burst, skipping closed channels, followed by PING */
+	mock_reset_io();
+	mock_reset_state();
+	assert_eq(irc_send_queue(s), 0);
+	assert_eq(mock_send_n, 5);
+	assert_strcmp(mock_send[0], "PRIVMSG chan :line 1");
+	assert_strcmp(mock_send[1], "PRIVMSG chan :line 3");
+	assert_strcmp(mock_send[2], "PRIVMSG priv :line 4");
+	assert_strcmp(mock_send[3], "PRIVMSG chan :line 5");
+	assert_strcmp(mock_send[4], "PING :" SERVER_SENDQ_TOKEN);
+	assert_eq(s->sendq.n, 1);
+	assert_eq(s->sendq.pending, 1);
+
+	/* paced on PONG */
+	mock_reset_io();
+	assert_eq(irc_send_queue(s), 0);
+	assert_eq(mock_send_n, 0);
+
+	s->sendq.pending = 0;
+
+	/* final burst, no PING */
+	mock_reset_io();
+	assert_eq(irc_send_queue(s), 0);
+	assert_eq(mock_send_n, 1);
+	assert_strcmp(mock_send[0], "PRIVMSG chan :line 6");
+	assert_eq(s->sendq.n, 0);
+	assert_eq(s->sendq.pending, 0);
+	assert_ptr_null(s->sendq.head);
+	assert_ptr_null(s->sendq.tail);
+
+	/* reset on disconnect */
+	server_sendq_push(s, "chan", "line 7");
+	s->sendq.pending = 1;
+	server_reset(s);
+	assert_eq(s->sendq.n, 0);
+	assert_eq(s->sendq.pending, 0);
+	assert_ptr_null(s->sendq.head);
+
+	s->registered = 1;
+}
+
 static void
 test_send_away(void)
 {
@@ -561,6 +616,7 @@ main(void)
 	struct testcase tests[] = {
 		TESTCASE(test_irc_send_command),
 		TESTCASE(test_irc_send_message),
+		TESTCASE(test_irc_send_queue),
 #define X(cmd) TESTCASE(test_send_##cmd),
 		SEND_HANDLERS
 #undef X
@@ -15,3 +15,10 @@ irc_send_message(struct server *s, struct channel *c, const char *m)
 	UNUSED(m);
 	return 0;
 }
+
+int
+irc_send_queue(struct server *s)
+{
+	UNUSED(s);
+	return 0;
+}
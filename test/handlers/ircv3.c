@@ -23,6 +23,8 @@
 #include "src/utils/utils.c"
 
 #include "test/draw.mock.c"
+#include "test/event.mock.c"
+#include "test/handlers/irc_send.mock.c"
 #include "test/io.mock.c"
 #include "test/state.mock.c"
 
@@ -7,6 +7,15 @@ static char mock_send[MOCK_SEND_N][MOCK_SEND_LEN];
 static unsigned mock_send_i;
 static unsigned mock_send_n;
 static int cxed;
+static int mock_fd = -1; /* detached socket */
+static int mock_attached;
+static int mock_client; /* daemon's attached client */
+static struct io_latency mock_latency;
+static struct io_stats mock_stats;
+
+const unsigned io_latency_hist[IO_LATENCY_HIST_N - 1] = {
+	250, 500, 1000, 2500, 5000, 10000, 25000
+};
 
 void
 mock_reset_io(void)
@@ -15,6 +24,10 @@ mock_reset_io(void)
 	mock_send_n = 0;
 	memset(mock_send, 0, MOCK_SEND_LEN * MOCK_SEND_N);
 	cxed = 0;
+	mock_fd = -1;
+	mock_attached = 0;
+	mock_client = 0;
+	memset(&mock_stats, 0, sizeof(mock_stats));
 }
 
 int
@@ -56,6 +69,68 @@ connection(
 	return NULL;
 }
 
+void
+io_cx_cfg(struct connection *c, struct io_cx_cfg *cfg)
+{
+	UNUSED(c);
+
+	memset(cfg, 0, sizeof(*cfg));
+
+	cfg->flags = (IO_IPV_UNSPEC | IO_TLS_ENABLED | IO_TLS_VRFY_REQUIRED);
+	cfg->ping_max = IO_PING_MAX;
+	cfg->ping_min = IO_PING_MIN;
+	cfg->active = cxed;
+	cfg->fd = mock_fd;
+	cfg->rbuf = "partial";
+	cfg->rbuf_len = ((mock_fd < 0) ? 0 : 7);
+}
+
+int
+io_cx_attach(struct connection *c, int fd, const char *buf, size_t len)
+{
+	UNUSED(c);
+	UNUSED(buf);
+	UNUSED(len);
+
+	if (fd < 0 || cxed)
+		return -1;
+
+	cxed = 1;
+	mock_attached = 1;
+	return 0;
+}
+
+int
+io_cx_detach(struct connection *c)
+{
+	UNUSED(c);
+
+	if (!cxed)
+		return -1;
+
+	cxed = 0;
+	mock_fd = 3;
+	return mock_fd;
+}
+
+int
+io_daemon_detach(void)
+{
+	if (!mock_client)
+		return -1;
+
+	mock_client = 0;
+	return 0;
+}
+
+int
+io_set_ping(struct connection *c, unsigned ping_min, unsigned ping_max)
+{
+	UNUSED(c);
+
+	return (ping_max && ping_min > ping_max);
+}
+
 int
 io_cx(struct connection *c)
 {
@@ -82,6 +157,20 @@ io_dx(struct connection *c, int destroy)
 	return -1;
 }
 
+void
+io_cx_stats(struct connection *c, struct io_stats *stats)
+{
+	UNUSED(c);
+
+	*stats = mock_stats;
+}
+
+void
+io_latency(struct io_latency *latency)
+{
+	*latency = mock_latency;
+}
+
 const char*
 io_err(int err)
 {
@@ -95,3 +184,4 @@ unsigned io_tty_rows(void) { return 0; }
 void io_init(void) { ; }
 void io_start(void) { ; }
 void io_stop(void) { ; }
+void io_term(void) { ; }
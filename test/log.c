@@ -0,0 +1,286 @@
+#include "test/test.h"
+
+/* Preclude definitions for testing */
+#define LOG_FILES_MAX 2
+
+#include "src/log.c"
+#include "src/utils/utils.c"
+
+static char dir[] = "/tmp/rirc.log.XXXXXX";
+static char buf[4096];
+
+static const char*
+read_file(const char *path)
+{
+	char p[LOG_PATH_MAX];
+	FILE *f;
+	size_t n;
+
+	snprintf(p, sizeof(p), "%s/%s", dir, path);
+
+	if (!(f = fopen(p, "r")))
+		return NULL;
+
+	n = fread(buf, 1, sizeof(buf) - 1, f);
+	buf[n] = 0;
+
+	fclose(f);
+
+	return buf;
+}
+
+static time_t
+day(int d, int h)
+{
+	struct tm tm = {
+		.tm_year = 121,
+		.tm_mon = 0,
+		.tm_mday = d,
+		.tm_hour = h,
+		.tm_isdst = -1,
+	};
+
+	return mktime(&tm);
+}
+
+static void
+test_log_disabled(void)
+{
+	log_init("");
+	assert_ptr_null(log_ring);
+	log_line("host", "#chan", day(1, 12), "nick", "text");
+	log_term();
+}
+
+static void
+test_log_line(void)
+{
+	log_init(dir);
+
+	log_line("host", "#chan", day(1, 12), "nick", "text 1");
+	log_line("host", "#chan", day(1, 13), ">>", "nick has joined");
+	log_line("host", "#Other/Chan", day(1, 13), "nick", "text 2");
+	log_line("host", "..", day(1, 13), "nick", "text 3");
+
+	log_term();
+
+	assert_strcmp(read_file("host/#chan/2021-01-01.log"),
+		"2021-01-01T12:00:00+0000 nick text 1\n"
+		"2021-01-01T13:00:00+0000 >> nick has joined\n");
+
+	assert_strcmp(read_file("host/#other_chan/2021-01-01.log"),
+		"2021-01-01T13:00:00+0000 nick text 2\n");
+
+	assert_strcmp(read_file("host/_./2021-01-01.log"),
+		"2021-01-01T13:00:00+0000 nick text 3\n");
+
+	/* Test lines are appended */
+	log_init(dir);
+	log_line("host", "#chan", day(1, 14), "nick", "text 4");
+	log_term();
+
+	assert_strcmp(read_file("host/#chan/2021-01-01.log"),
+		"2021-01-01T12:00:00+0000 nick text 1\n"
+		"2021-01-01T13:00:00+0000 >> nick has joined\n"
+		"2021-01-01T14:00:00+0000 nick text 4\n");
+}
+
+static void
+test_log_rotate(void)
+{
+	log_init(dir);
+
+	log_line("rotate", "#chan", day(1, 23), "nick", "text 1");
+	log_line("rotate", "#chan", day(2, 0), "nick", "text 2");
+	log_line("rotate", "#chan", day(2, 1), "nick", "text 3");
+
+	log_term();
+
+	assert_strcmp(read_file("rotate/#chan/2021-01-01.log"),
+		"2021-01-01T23:00:00+0000 nick text 1\n");
+
+	assert_strcmp(read_file("rotate/#chan/2021-01-02.log"),
+		"2021-01-02T00:00:00+0000 nick text 2\n"
+		"2021-01-02T01:00:00+0000 nick text 3\n");
+}
+
+static void
+test_log_files(void)
+{
+	/* Test more channels than open files */
+
+	log_init(dir);
+
+	for (int i = 0; i < 3; i++) {
+		log_line("files", "#a", day(1, 0), "nick", "a");
+		log_line("files", "#b", day(1, 0), "nick", "b");
+		log_line("files", "#c", day(1, 0), "nick", "c");
+	}
+
+	log_term();
+
+	assert_strcmp(read_file("files/#a/2021-01-01.log"),
+		"2021-01-01T00:00:00+0000 nick a\n"
+		"2021-01-01T00:00:00+0000 nick a\n"
+		"2021-01-01T00:00:00+0000 nick a\n");
+
+	assert_strcmp(read_file("files/#c/2021-01-01.log"),
+		"2021-01-01T00:00:00+0000 nick c\n"
+		"2021-01-01T00:00:00+0000 nick c\n"
+		"2021-01-01T00:00:00+0000 nick c\n");
+
+	for (size_t i = 0; i < LOG_FILES_MAX; i++)
+		assert_eq(log_files[i].fd, -1);
+}
+
+static void
+test_log_dropped(void)
+{
+	log_init(dir);
+
+	/* Test dropped lines are noted in the next line's file */
+	log_dropped = 3;
+	log_line("dropped", "#chan", day(1, 0), "nick", "text");
+
+	log_term();
+
+	assert_strcmp(read_file("dropped/#chan/2021-01-01.log"),
+		"2021-01-01T00:00:00+0000 -- 3 lines not logged\n"
+		"2021-01-01T00:00:00+0000 nick text\n");
+}
+
+static int
+tail_cb(time_t t, const char *from, size_t from_len, const char *text, size_t text_len, void *arg)
+{
+	char *p = buf + strlen(buf);
+
+	snprintf(p, sizeof(buf) - (p - buf), "%lld %.*s %.*s\n",
+		(long long)t, (int)from_len, from, (int)text_len, text);
+
+	return (arg && text[text_len - 1] == '2');
+}
+
+static void
+test_log_tail(void)
+{
+	char path[LOG_PATH_MAX];
+	FILE *f;
+
+	log_init(dir);
+
+	/* Test logging disabled, or no logs */
+	assert_eq(log_tail("tail", "#chan", 10, tail_cb, NULL), 0);
+
+	log_line("tail", "#chan", day(1, 12), "nick", "text 1");
+	log_line("tail", "#chan", day(2, 12), ">>", "text 2");
+	log_line("tail", "#chan", day(2, 13), "nick", "text 3 with spaces");
+	log_line("tail", "#chan", day(3, 12), "nick", "text 4");
+
+	log_term();
+
+	/* Test partial, malformed and other timezone lines */
+	snprintf(path, sizeof(path), "%s/tail/#chan/2021-01-03.log", dir);
+
+	if (!(f = fopen(path, "a")))
+		test_abort("fopen failed");
+
+	fputs("malformed\n2021-01-03T12:00:00-0130 nick text 5\n2021-01-03T12:00:00", f);
+	fclose(f);
+
+	log_init(dir);
+
+	*buf = 0;
+	assert_eq(log_tail("tail", "#chan", 10, tail_cb, NULL), 5);
+	assert_strcmp(buf,
+		"1609680600 nick text 5\n"
+		"1609675200 nick text 4\n"
+		"1609592400 nick text 3 with spaces\n"
+		"1609588800 >> text 2\n"
+		"1609502400 nick text 1\n");
+
+	/* Test reading stops at max lines */
+	*buf = 0;
+	assert_eq(log_tail("tail", "#chan", 3, tail_cb, NULL), 3);
+	assert_strcmp(buf,
+		"1609680600 nick text 5\n"
+		"1609675200 nick text 4\n"
+		"1609592400 nick text 3 with spaces\n");
+
+	/* Test reading stops by callback */
+	*buf = 0;
+	assert_eq(log_tail("tail", "#chan", 10, tail_cb, buf), 4);
+
+	/* Test channel names are case folded */
+	*buf = 0;
+	assert_eq(log_tail("tail", "#CHAN", 1, tail_cb, NULL), 1);
+
+	log_term();
+
+	assert_eq(log_tail("tail", "#chan", 10, tail_cb, NULL), 0);
+}
+
+static void
+test_log_ring(void)
+{
+	/* Test lines are queued without waiting when the ring is full */
+
+	if ((log_ring = calloc(1, sizeof(*log_ring))) == NULL)
+		test_abort("calloc failed");
+
+	if (pipe(log_fd) < 0)
+		test_abort("pipe failed");
+
+	for (size_t i = 0; i < LOG_RING_N + 2; i++)
+		log_line("ring", "#chan", day(1, 0), "nick", "text");
+
+	assert_ueq(atomic_load(&(log_ring->tail)), LOG_RING_N);
+	assert_ueq(log_dropped, 2);
+
+	/* Test fields are truncated */
+	memset(buf, 'x', LOG_TEXT_MAX + 10);
+	buf[LOG_TEXT_MAX + 10] = 0;
+
+	atomic_store(&(log_ring->head), 1);
+	log_line("ring", "#chan", day(1, 0), "nick", buf);
+	assert_ueq(log_dropped, 0);
+	assert_ueq(log_ring->evs[0].dropped, 2);
+	assert_ueq(strlen(log_ring->evs[0].buf + 16), LOG_TEXT_MAX);
+
+	close(log_fd[0]);
+	close(log_fd[1]);
+	free(log_ring);
+
+	log_ring = NULL;
+	log_dropped = 0;
+}
+
+int
+main(void)
+{
+	struct testcase tests[] = {
+		TESTCASE(test_log_disabled),
+		TESTCASE(test_log_line),
+		TESTCASE(test_log_rotate),
+		TESTCASE(test_log_files),
+		TESTCASE(test_log_dropped),
+		TESTCASE(test_log_tail),
+		TESTCASE(test_log_ring)
+	};
+
+	char cmd[64];
+	int ret;
+
+	setenv("TZ", "UTC", 1);
+
+	if (!mkdtemp(dir))
+		test_abort("mkdtemp failed");
+
+	ret = run_tests(NULL, NULL, tests);
+
+	snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+
+	if (system(cmd))
+		test_abort("cleanup failed");
+
+	return ret;
+}
@@ -0,0 +1,47 @@
+#ifndef LOG_MOCK_C
+#define LOG_MOCK_C
+
+#define MOCK_LOG_LINES_N 8
+
+/* Lines read by log_tail, newest first */
+static struct {
+	time_t t;
+	const char *from;
+	const char *text;
+} mock_log_lines[MOCK_LOG_LINES_N];
+static unsigned mock_log_lines_n;
+
+void log_init(const char *dir) { UNUSED(dir); }
+void log_term(void) { ; }
+
+unsigned
+log_tail(const char *host, const char *chan, unsigned max, log_tail_cb cb, void *arg)
+{
+	unsigned n;
+
+	UNUSED(host);
+	UNUSED(chan);
+
+	for (n = 0; n < mock_log_lines_n && n < max; n++) {
+
+		const char *from = mock_log_lines[n].from;
+		const char *text = mock_log_lines[n].text;
+
+		if ((*cb)(mock_log_lines[n].t, from, strlen(from), text, strlen(text), arg))
+			return n + 1;
+	}
+
+	return n;
+}
+
+void
+log_line(const char *host, const char *chan, time_t t, const char *from, const char *text)
+{
+	UNUSED(host);
+	UNUSED(chan);
+	UNUSED(t);
+	UNUSED(from);
+	UNUSED(text);
+}
+
+#endif
@@ -12,9 +12,13 @@
 #include "src/utils/utils.c"
 
 #include "test/draw.mock.c"
+#include "test/event.mock.c"
+#include "test/trace.mock.c"
 #include "test/handlers/irc_recv.mock.c"
 #include "test/handlers/irc_send.mock.c"
 #include "test/io.mock.c"
+#include "test/log.mock.c"
+#include "test/snapshot.mock.c"
 
 static void
 test_dummy(void)
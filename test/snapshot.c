@@ -0,0 +1,343 @@
+#include "test/test.h"
+
+#include "src/components/buffer.c"
+#include "src/components/channel.c"
+#include "src/components/input.c"
+#include "src/components/ircv3.c"
+#include "src/components/mode.c"
+#include "src/components/server.c"
+#include "src/components/user.c"
+#include "src/handlers/irc_send.c"
+#include "src/snapshot.c"
+#include "src/state.c"
+#include "src/utils/utils.c"
+
+#include "test/draw.mock.c"
+#include "test/event.mock.c"
+#include "test/trace.mock.c"
+#include "test/handlers/irc_recv.mock.c"
+#include "test/io.mock.c"
+#include "test/log.mock.c"
+#include "test/rirc.mock.c"
+
+static char path[] = "/tmp/rirc.snapshot.XXXXXX";
+
+static const char*
+hist_line(struct input *inp, uint16_t i)
+{
+	return inp->hist.ptrs[(inp->hist.tail + i) & (INPUT_HIST_MAX - 1)];
+}
+
+static void
+test_snapshot_restore(void)
+{
+	struct channel *c1;
+	struct channel *c2;
+	struct channel *c3;
+	struct server *s1;
+	struct server *s2;
+	struct timespec ts = { .tv_sec = 1609502400, .tv_nsec = 500 };
+	char buf[INPUT_LEN_MAX + 1];
+
+	s1 = server("host1", "6667", "pass", "user1", "real1", NULL);
+	s2 = server("host2", "6697", NULL, "user2", "real2", "+i");
+
+	assert_eq(server_set_nicks(s1, "nick1,nick2"), 0);
+	server_set_sasl(s2, "PLAIN", "sasl_user", "sasl_pass");
+
+	c1 = channel("#c1", CHANNEL_T_CHANNEL);
+	c2 = channel("#c2", CHANNEL_T_CHANNEL);
+	c3 = channel("priv", CHANNEL_T_PRIVMSG);
+
+	c1->server = s1;
+	c2->server = s1;
+	c3->server = s2;
+	c2->parted = 1;
+
+	channel_key_add(c1, "key");
+	channel_list_add(&(s1->clist), c1);
+	channel_list_add(&(s1->clist), c2);
+	channel_list_add(&(s2->clist), c3);
+	server_list_add(state_server_list(), s1);
+	server_list_add(state_server_list(), s2);
+
+	buffer_newline(&(c1->buffer), BUFFER_LINE_CHAT, "nick", "text 1", 4, 6, '@', &ts);
+	buffer_newline(&(c1->buffer), BUFFER_LINE_JOIN, FROM_JOIN, "nick has joined", 2, 15, 0, &ts);
+	buffer_head(&(c1->buffer))->msgid = 123;
+	buffer_newline(&(c3->buffer), BUFFER_LINE_CHAT_RIRC, "me", "text 2", 2, 6, 0, NULL);
+
+	input_insert(&(c1->input), "hist 1", 6);
+	input_hist_push(&(c1->input));
+	input_insert(&(c1->input), "hist 2", 6);
+	input_hist_push(&(c1->input));
+	input_insert(&(c1->input), "working", 7);
+
+	channel_set_current(c2);
+
+	mock_reset_io();
+	io_cx(s2->connection);
+
+	assert_eq(snapshot_write(path), 0);
+
+	state_term();
+	state_init();
+	mock_reset_io();
+
+	assert_ptr_null(state_server_list()->head);
+
+	assert_eq(snapshot_read(path, 0), 0);
+
+	/* Test servers, ordering and settings */
+	assert_ptr_not_null((s1 = state_server_list()->head));
+	assert_ptr_not_null((s2 = s1->next));
+	assert_ptr_eq(s2->next, s1);
+	assert_strcmp(s1->host, "host1");
+	assert_strcmp(s1->port, "6667");
+	assert_strcmp(s1->pass, "pass");
+	assert_strcmp(s1->username, "user1");
+	assert_strcmp(s1->realname, "real1");
+	assert_ptr_null(s1->mode);
+	assert_ueq(s1->nicks.size, 2);
+	assert_strcmp(s1->nicks.set[0], "nick1");
+	assert_strcmp(s1->nicks.set[1], "nick2");
+	assert_strcmp(s2->host, "host2");
+	assert_strcmp(s2->mode, "+i");
+	assert_ptr_null(s2->pass);
+	assert_eq(s2->ircv3_sasl.mech, IRCV3_SASL_MECH_PLAIN);
+	assert_strcmp(s2->ircv3_sasl.user, "sasl_user");
+	assert_strcmp(s2->ircv3_sasl.pass, "sasl_pass");
+
+	/* Test active connections are reconnected */
+	assert_eq(cxed, 1);
+
+	/* Test channels, ordering and state */
+	assert_ueq(s1->clist.count, 3);
+	assert_ptr_not_null((c1 = s1->channel->next));
+	assert_ptr_not_null((c2 = c1->next));
+	assert_strcmp(c1->name, "#c1");
+	assert_strcmp(c1->key, "key");
+	assert_strcmp(c2->name, "#c2");
+	assert_eq(c2->parted, 1);
+	assert_eq(c1->parted, 0);
+	assert_ptr_eq(current_channel(), c2);
+	assert_ptr_not_null((c3 = channel_list_get(&(s2->clist), "priv", s2->casemapping)));
+	assert_eq(c3->type, CHANNEL_T_PRIVMSG);
+
+	/* Test buffers */
+	assert_ueq(buffer_size(&(c1->buffer)), 2);
+	assert_eq(buffer_tail(&(c1->buffer))->type, BUFFER_LINE_CHAT);
+	assert_strcmp(buffer_tail(&(c1->buffer))->from, "@nick");
+	assert_strcmp(buffer_tail(&(c1->buffer))->text, "text 1");
+	assert_eq(buffer_tail(&(c1->buffer))->time.tv_sec, ts.tv_sec);
+	assert_eq(buffer_tail(&(c1->buffer))->time.tv_nsec, ts.tv_nsec);
+	assert_eq(buffer_head(&(c1->buffer))->type, BUFFER_LINE_JOIN);
+	assert_strcmp(buffer_head(&(c1->buffer))->text, "nick has joined");
+	assert_ueq(buffer_head(&(c1->buffer))->msgid, 123);
+	assert_eq(c1->logs, 1);
+	assert_ueq(buffer_size(&(c2->buffer)), 0);
+	assert_ueq(buffer_size(&(c3->buffer)), 1);
+	assert_strcmp(buffer_head(&(c3->buffer))->text, "text 2");
+
+	/* Test input */
+	assert_ueq(input_write(&(c1->input), buf, sizeof(buf), 0), 7);
+	assert_strcmp(buf, "working");
+	assert_ueq((uint16_t)(c1->input.hist.head - c1->input.hist.tail), 2);
+	assert_strcmp(hist_line(&(c1->input), 0), "hist 1");
+	assert_strcmp(hist_line(&(c1->input), 1), "hist 2");
+
+	/* Test restoring merges with existing servers and channels, without
+	 * overwriting non-empty buffers */
+	buffer_newline(&(c3->buffer), BUFFER_LINE_CHAT, "nick", "text 3", 4, 6, 0, NULL);
+
+	assert_eq(snapshot_read(path, 0), 0);
+	assert_ptr_eq(state_server_list()->head, s1);
+	assert_ptr_eq(s1->next, s2);
+	assert_ptr_eq(s2->next, s1);
+	assert_ueq(s1->clist.count, 3);
+	assert_ueq(buffer_size(&(c1->buffer)), 2);
+	assert_ueq(buffer_size(&(c3->buffer)), 2);
+	assert_ueq((uint16_t)(c1->input.hist.head - c1->input.hist.tail), 2);
+}
+
+static void
+test_snapshot_resume(void)
+{
+	struct channel *c;
+	struct server *s;
+	struct user *u;
+
+	s = server("host", "6667", NULL, "user", "real", NULL);
+	c = channel("#chan", CHANNEL_T_CHANNEL);
+	c->server = s;
+	c->joined = 1;
+
+	channel_list_add(&(s->clist), c);
+	server_list_add(state_server_list(), s);
+
+	s->registered = 1;
+	s->casemapping = CASEMAPPING_ASCII;
+	s->ircv3_caps.server_time.set = 1;
+	server_nick_set(s, "me");
+
+	assert_eq(mode_cfg(&(s->mode_cfg), "(qov)~@+", MODE_CFG_PREFIX), 0);
+	assert_eq(mode_usermode_set(&(s->usermodes), &(s->mode_cfg), 'i', 1), 0);
+	assert_eq(mode_chanmode_set(&(c->chanmodes), &(s->mode_cfg), 'n', 1), 0);
+	assert_eq(user_list_add(&(c->users), s->casemapping, "nick1", (struct mode){0}), USER_ERR_NONE);
+	assert_eq(user_list_add(&(c->users), s->casemapping, "nick2", (struct mode){0}), USER_ERR_NONE);
+	assert_eq(mode_prfxmode_set(&(user_list_get(&(c->users), s->casemapping, "nick2", 0)->prfxmodes), &(s->mode_cfg), 'q', 1), 0);
+
+	mock_reset_io();
+	io_cx(s->connection);
+	assert_eq(io_cx_detach(s->connection), 3);
+
+	assert_eq(snapshot_write(path), 0);
+
+	/* Test the session isn't restored without resuming the connection */
+	state_term();
+	state_init();
+	mock_reset_io();
+
+	assert_eq(snapshot_read(path, 0), 0);
+	assert_ptr_not_null((s = state_server_list()->head));
+	assert_ptr_not_null((c = s->channel->next));
+	assert_eq(cxed, 1);
+	assert_eq(mock_attached, 0);
+	assert_eq(s->registered, 0);
+	assert_eq(s->casemapping, CASEMAPPING_RFC1459);
+	assert_eq(c->joined, 0);
+	assert_ueq(c->users.count, 0);
+
+	/* Test the session is restored when resuming the connection */
+	state_term();
+	state_init();
+	mock_reset_io();
+
+	assert_eq(snapshot_read(path, 1), 0);
+	assert_ptr_not_null((s = state_server_list()->head));
+	assert_ptr_not_null((c = s->channel->next));
+	assert_eq(mock_attached, 1);
+	assert_eq(s->connected, 1);
+	assert_eq(s->registered, 1);
+	assert_eq(s->casemapping, CASEMAPPING_ASCII);
+	assert_eq(s->ircv3_caps.server_time.set, 1);
+	assert_eq(s->ircv3_caps.batch.set, 0);
+	assert_strcmp(s->nick, "me");
+	assert_strcmp(s->mode_str.str, "i");
+	assert_strcmp(s->mode_cfg.PREFIX.F, "qov");
+	assert_strcmp(s->mode_cfg.PREFIX.T, "~@+");
+	assert_eq(c->joined, 1);
+	assert_strcmp(c->chanmodes_str.str, "n");
+	assert_ueq(c->users.count, 2);
+	assert_ptr_not_null(user_list_get(&(c->users), s->casemapping, "nick1", 0));
+	assert_ptr_not_null((u = user_list_get(&(c->users), s->casemapping, "nick2", 0)));
+	assert_eq(u->prfxmodes.prefix, '~');
+}
+
+static void
+test_snapshot_invalid(void)
+{
+	char buf[8192];
+	FILE *f;
+	size_t n;
+
+	/* Test missing file */
+	errno = 0;
+	assert_eq(snapshot_read("/tmp/rirc.snapshot.missing", 0), -1);
+	assert_eq(errno, ENOENT);
+
+	/* Test unwritable path */
+	assert_eq(snapshot_write("/tmp/rirc.snapshot.missing/file"), -1);
+
+	server_list_add(state_server_list(), server("host", "6667", NULL, "user", "real", NULL));
+	newlinef(state_server_list()->head->channel, 0, "nick", "text");
+
+	assert_eq(snapshot_write(path), 0);
+
+	state_term();
+	state_init();
+
+	if (!(f = fopen(path, "r")))
+		test_abort("fopen failed");
+
+	n = fread(buf, 1, sizeof(buf), f);
+	fclose(f);
+
+	/* Test bad version */
+	buf[8]++;
+
+	if (!(f = fopen(path, "w")) || fwrite(buf, 1, n, f) != n || fclose(f))
+		test_abort("fwrite failed");
+
+	errno = 0;
+	assert_eq(snapshot_read(path, 0), -1);
+	assert_eq(errno, EINVAL);
+	assert_ptr_null(state_server_list()->head);
+
+	buf[8]--;
+
+	/* Test truncated */
+	if (!(f = fopen(path, "w")) || fwrite(buf, 1, n - 1, f) != n - 1 || fclose(f))
+		test_abort("fwrite failed");
+
+	assert_eq(snapshot_read(path, 0), -1);
+	assert_ptr_null(state_server_list()->head);
+
+	/* Test corrupt lengths, state is unchanged */
+	for (size_t i = 24; i < n; i++) {
+
+		char c = buf[i];
+
+		buf[i] = (char) 0xFF;
+
+		if (!(f = fopen(path, "w")) || fwrite(buf, 1, n, f) != n || fclose(f))
+			test_abort("fwrite failed");
+
+		if (snapshot_read(path, 0) < 0)
+			assert_ptr_null(state_server_list()->head);
+
+		state_term();
+		state_init();
+
+		buf[i] = c;
+	}
+}
+
+static int
+test_init(void)
+{
+	state_init();
+
+	return 0;
+}
+
+static int
+test_term(void)
+{
+	state_term();
+
+	return 0;
+}
+
+int
+main(void)
+{
+	struct testcase tests[] = {
+		TESTCASE(test_snapshot_restore),
+		TESTCASE(test_snapshot_resume),
+		TESTCASE(test_snapshot_invalid),
+	};
+
+	int fd;
+	int ret;
+
+	if ((fd = mkstemp(path)) < 0)
+		test_abort("mkstemp failed");
+
+	close(fd);
+
+	ret = run_tests(test_init, test_term, tests);
+
+	unlink(path);
+
+	return ret;
+}
@@ -12,9 +12,13 @@
 #include "src/utils/utils.c"
 
 #include "test/draw.mock.c"
+#include "test/event.mock.c"
+#include "test/trace.mock.c"
 #include "test/handlers/irc_recv.mock.c"
 #include "test/io.mock.c"
+#include "test/log.mock.c"
 #include "test/rirc.mock.c"
+#include "test/snapshot.mock.c"
 
 #define INP_S(S) io_cb_read_inp((S), strlen(S))
 #define INP_C(C) io_cb_read_inp((char[]){(C)}, 1)
@@ -141,11 +145,19 @@ test_command_close(void)
 	/* test closing middle channel*/
 	channel_set_current(c3);
 
+	assert_eq(user_list_add(&(c3->users), CASEMAPPING_RFC1459, "nick1", (struct mode){0}), USER_ERR_NONE);
+	assert_eq(user_list_add(&(c3->users), CASEMAPPING_RFC1459, "nick2", (struct mode){0}), USER_ERR_NONE);
+	assert_eq(user_list_add(&(c4->users), CASEMAPPING_RFC1459, "nick2", (struct mode){0}), USER_ERR_NONE);
+	assert_ptr_not_null(user_info_add(&(s2->user_info), CASEMAPPING_RFC1459, "nick1"));
+	assert_ptr_not_null(user_info_add(&(s2->user_info), CASEMAPPING_RFC1459, "nick2"));
+
 	INP_COMMAND(":close");
 
 	assert_ptr_null(action_handler);
 	assert_ptr_null(action_message());
 	assert_strcmp(current_channel()->name, "#c4");
+	assert_ptr_null(user_info_get(&(s2->user_info), CASEMAPPING_RFC1459, "nick1"));
+	assert_ptr_not_null(user_info_get(&(s2->user_info), CASEMAPPING_RFC1459, "nick2"));
 
 	/* test closing last channel*/
 	channel_set_current(c5);
@@ -286,6 +298,16 @@ test_command_connect(void)
 	assert_strcmp(current_channel()->name, "host-1");
 	INP_C(0x0A);
 
+	INP_COMMAND(":connect host --ping-min");
+	assert_strcmp(action_message(), "connect: '--ping-min' requires an argument");
+	assert_strcmp(current_channel()->name, "host-1");
+	INP_C(0x0A);
+
+	INP_COMMAND(":connect host --ping-max");
+	assert_strcmp(action_message(), "connect: '--ping-max' requires an argument");
+	assert_strcmp(current_channel()->name, "host-1");
+	INP_C(0x0A);
+
 	/* Test invalid arguments */
 	INP_COMMAND(":connect host xyz");
 	assert_strcmp(action_message(), ":connect [hostname [options]]");
@@ -307,6 +329,21 @@ test_command_connect(void)
 	assert_strcmp(current_channel()->name, "host-1");
 	INP_C(0x0A);
 
+	INP_COMMAND(":connect host --ping-min 1s");
+	assert_strcmp(action_message(), "connect: invalid option for '--ping-min' '1s'");
+	assert_strcmp(current_channel()->name, "host-1");
+	INP_C(0x0A);
+
+	INP_COMMAND(":connect host --ping-max 86401");
+	assert_strcmp(action_message(), "connect: invalid option for '--ping-max' '86401'");
+	assert_strcmp(current_channel()->name, "host-1");
+	INP_C(0x0A);
+
+	INP_COMMAND(":connect host --ping-min 30 --ping-max 20");
+	assert_strcmp(action_message(), "connect: '--ping-min' 30 exceeds '--ping-max' 20");
+	assert_strcmp(current_channel()->name, "host-1");
+	INP_C(0x0A);
+
 	INP_COMMAND(":connect host-1");
 	assert_strcmp(action_message(), "connect: duplicate server: host-1:6697");
 	assert_strcmp(current_channel()->name, "host-1");
@@ -383,6 +420,11 @@ test_command_connect(void)
 	assert_ptr_not_null(channel_list_get(&(s->clist), "#a1", s->casemapping));
 	assert_ptr_not_null(channel_list_get(&(s->clist), "b2", s->casemapping));
 	assert_ptr_not_null(channel_list_get(&(s->clist), "#c3", s->casemapping));
+
+	INP_COMMAND(":connect host-4 --ping-min 10 --ping-max 20");
+
+	assert_strcmp(action_message(), NULL);
+	assert_strcmp(current_channel()->name, "host-4");
 }
 
 static void
@@ -452,6 +494,672 @@ test_command_quit(void)
 	assert_ptr_null(action_message());
 }
 
+static void
+test_command_detach(void)
+{
+	INP_COMMAND(":detach with args");
+
+	assert_strcmp(action_message(), "detach: Unknown arg 'with'");
+
+	/* clear error */
+	INP_C(0x0A);
+
+	INP_COMMAND(":detach");
+
+	assert_strcmp(action_message(), "detach: Not running as a daemon");
+
+	/* clear error */
+	INP_C(0x0A);
+
+	mock_client = 1;
+
+	INP_COMMAND(":detach");
+
+	assert_ptr_null(action_message());
+	assert_eq(mock_client, 0);
+}
+
+static void
+test_command_upgrade(void)
+{
+	char path[256];
+
+	assert_eq(state_upgrade(path, sizeof(path)), 0);
+
+	INP_COMMAND(":upgrade with args");
+
+	assert_strcmp(action_message(), "upgrade: Unknown arg 'with'");
+
+	/* clear error */
+	INP_C(0x0A);
+
+	INP_COMMAND(":upgrade");
+
+	assert_ptr_null(action_message());
+
+	/* Test path overflow */
+	assert_eq(state_upgrade(path, 1), -1);
+	assert_strcmp(CURRENT_LINE, "upgrade: File name too long");
+	assert_eq(state_upgrade(path, sizeof(path)), 0);
+
+	INP_COMMAND(":upgrade");
+
+	assert_eq(state_upgrade(path, sizeof(path)), 1);
+	assert_eq(unlink(path), 0);
+	assert_eq(state_upgrade(path, sizeof(path)), 0);
+
+	/* Test an abandoned upgrade reattaches detached connections */
+	mock_reset_io();
+
+	INP_COMMAND(":connect host");
+	INP_COMMAND(":upgrade");
+
+	assert_eq(state_upgrade(path, sizeof(path)), 1);
+	assert_eq(mock_fd, 3);
+	assert_eq(mock_attached, 0);
+
+	state_upgrade_abort(path);
+
+	assert_eq(access(path, F_OK), -1);
+	assert_eq(mock_attached, 1);
+}
+
+static void
+test_command_whois(void)
+{
+	struct server *s;
+	struct user_info *u;
+
+	INP_COMMAND(":whois nick");
+
+	assert_strcmp(action_message(), "whois: This is not a server");
+
+	/* clear error */
+	INP_C(0x0A);
+
+	if (!(s = server("host", "port", NULL, "user", "real", NULL)))
+		test_abort("Failed test setup");
+
+	if (server_list_add(state_server_list(), s))
+		test_abort("Failed to add server");
+
+	channel_set_current(s->channel);
+
+	INP_COMMAND(":whois");
+
+	assert_strcmp(action_message(), "whois: Nick required");
+
+	/* clear error */
+	INP_C(0x0A);
+
+	INP_COMMAND(":whois nick with args");
+
+	assert_strcmp(action_message(), "whois: Unknown arg 'with'");
+
+	/* clear error */
+	INP_C(0x0A);
+
+	INP_COMMAND(":whois nick");
+
+	assert_strcmp(action_message(), "whois: No info cached for 'nick'");
+
+	/* clear error */
+	INP_C(0x0A);
+
+	u = user_info_add(&(s->user_info), s->casemapping, "nick");
+	user_info_set(&(u->host), "user@host");
+
+	INP_COMMAND(":whois NICK");
+
+	assert_ptr_null(action_message());
+	assert_strcmp(CURRENT_LINE, "nick!user@host (*)");
+
+	user_info_set(&(u->account), "account");
+	user_info_set(&(u->away), "away message");
+	user_info_set(&(u->realname), "real name");
+
+	INP_COMMAND(":whois nick");
+
+	assert_ptr_null(action_message());
+	assert_strcmp(CURRENT_LINE, "nick is away: away message");
+	assert_strcmp(buffer_line(&(s->channel->buffer), s->channel->buffer.head - 3)->text, "nick!user@host (real name)");
+	assert_strcmp(buffer_line(&(s->channel->buffer), s->channel->buffer.head - 2)->text, "nick is logged in as account");
+}
+
+static void
+test_command_lag(void)
+{
+	struct server *s;
+
+	INP_COMMAND(":lag");
+
+	assert_strcmp(action_message(), "lag: This is not a server");
+
+	/* clear error */
+	INP_C(0x0A);
+
+	if (!(s = server("host", "port", NULL, "user", "real", NULL)))
+		test_abort("Failed test setup");
+
+	if (server_list_add(state_server_list(), s))
+		test_abort("Failed to add server");
+
+	channel_set_current(s->channel);
+
+	INP_COMMAND(":lag args");
+
+	assert_strcmp(action_message(), "lag: Unknown arg 'args'");
+
+	/* clear error */
+	INP_C(0x0A);
+
+	INP_COMMAND(":lag");
+
+	assert_strcmp(action_message(), "lag: No lag measured");
+
+	/* clear error */
+	INP_C(0x0A);
+
+	s->lag.avg = 120;
+	s->lag.last = 60;
+	s->lag.n = 3;
+	s->lag.hist[1] = 1;
+	s->lag.hist[2] = 1;
+	s->lag.hist[7] = 1;
+
+	INP_COMMAND(":lag");
+
+	assert_ptr_null(action_message());
+	assert_strcmp(CURRENT_LINE, " .. >=5000ms: 1");
+	assert_strcmp(buffer_line(&(s->channel->buffer), s->channel->buffer.head - 9)->text, "Lag: 120ms (last 60ms, 3 measured)");
+	assert_strcmp(buffer_line(&(s->channel->buffer), s->channel->buffer.head - 8)->text, " .. <   50ms: 0");
+	assert_strcmp(buffer_line(&(s->channel->buffer), s->channel->buffer.head - 7)->text, " .. <  100ms: 1");
+}
+
+static void
+test_command_stats(void)
+{
+	struct server *s;
+
+	INP_COMMAND(":stats");
+
+	assert_strcmp(action_message(), "stats: This is not a server");
+
+	/* clear error */
+	INP_C(0x0A);
+
+	if (!(s = server("host", "port", NULL, "user", "real", NULL)))
+		test_abort("Failed test setup");
+
+	if (server_list_add(state_server_list(), s))
+		test_abort("Failed to add server");
+
+	channel_set_current(s->channel);
+
+	INP_COMMAND(":stats args");
+
+	assert_strcmp(action_message(), "stats: Unknown arg 'args'");
+
+	/* clear error */
+	INP_C(0x0A);
+
+	mock_stats.bytes_in = 1000;
+	mock_stats.bytes_out = 200;
+	mock_stats.lines_in = 20;
+	mock_stats.lines_out = 4;
+	mock_stats.parse_err = 1;
+
+	s->stats.t_start = server_lag_time() - 10 * 1000000000ULL;
+	s->stats.sendq_max = 3;
+	s->stats.cmd[0].name = "JOIN";
+	s->stats.cmd[0].n = 2;
+	s->stats.cmd[0].ns = 4000;
+	s->stats.cmd[5].name = "PRIVMSG";
+	s->stats.cmd[5].n = 15;
+	s->stats.cmd[5].ns = 45000;
+
+	INP_COMMAND(":stats");
+
+	assert_ptr_null(action_message());
+	assert_strcmp(CURRENT_LINE, " .. JOIN         2, 0.20/s, 2us avg");
+	assert_strcmp(buffer_line(&(s->channel->buffer), s->channel->buffer.head - 6)->text, "Stats: host:port, 10s");
+	assert_strcmp(buffer_line(&(s->channel->buffer), s->channel->buffer.head - 5)->text, " .. in:    1000 bytes, 20 lines, 1 parse errors");
+	assert_strcmp(buffer_line(&(s->channel->buffer), s->channel->buffer.head - 4)->text, " .. out:   200 bytes, 4 lines");
+	assert_strcmp(buffer_line(&(s->channel->buffer), s->channel->buffer.head - 3)->text, " .. sendq: 0 queued (max 3)");
+	assert_strcmp(buffer_line(&(s->channel->buffer), s->channel->buffer.head - 2)->text, " .. PRIVMSG      15, 1.50/s, 3us avg");
+}
+
+static void
+test_command_trace(void)
+{
+	INP_COMMAND(":trace");
+
+	assert_strcmp(action_message(), "trace: No events traced");
+
+	/* clear error */
+	INP_C(0x0A);
+
+	INP_COMMAND(":trace 0");
+
+	assert_strcmp(action_message(), "trace: Invalid count '0'");
+
+	/* clear error */
+	INP_C(0x0A);
+
+	INP_COMMAND(":trace -1");
+
+	assert_strcmp(action_message(), "trace: Invalid count '-1'");
+
+	/* clear error */
+	INP_C(0x0A);
+
+	INP_COMMAND(":trace 1 args");
+
+	assert_strcmp(action_message(), "trace: Unknown arg 'args'");
+
+	/* clear error */
+	INP_C(0x0A);
+
+	mock_trace_n = 30;
+
+	INP_COMMAND(":trace");
+
+	assert_ptr_null(action_message());
+	assert_strcmp(CURRENT_LINE, "event 19");
+
+	INP_COMMAND(":trace 3");
+
+	assert_ptr_null(action_message());
+	assert_strcmp(CURRENT_LINE, "event 2");
+	assert_strcmp(buffer_line(&(current_channel()->buffer), current_channel()->buffer.head - 3)->text, "event 0");
+
+	mock_trace_n = 0;
+}
+
+static void
+test_command_latency(void)
+{
+	INP_COMMAND(":latency args");
+
+	assert_strcmp(action_message(), "latency: Unknown arg 'args'");
+
+	/* clear error */
+	INP_C(0x0A);
+
+	INP_COMMAND(":latency");
+
+	assert_strcmp(action_message(), "latency: No input measured");
+
+	/* clear error */
+	INP_C(0x0A);
+
+	mock_latency.hist[0] = 2;
+	mock_latency.hist[7] = 1;
+	mock_latency.max = 30000;
+	mock_latency.n = 3;
+	mock_latency.sum = 30300;
+
+	INP_COMMAND(":latency");
+
+	assert_ptr_null(action_message());
+	assert_strcmp(CURRENT_LINE, " .. >=25000us: 1");
+	assert_strcmp(buffer_line(&(current_channel()->buffer), current_channel()->buffer.head - 9)->text, "Input latency: 10100us (max 30000us, 3 measured)");
+	assert_strcmp(buffer_line(&(current_channel()->buffer), current_channel()->buffer.head - 8)->text, " .. <   250us: 2");
+}
+
+static void
+test_command_snapshot(void)
+{
+	INP_COMMAND(":snapshot");
+
+	assert_strcmp(action_message(), "snapshot: No file configured");
+
+	/* clear error */
+	INP_C(0x0A);
+
+	INP_COMMAND(":snapshot file args");
+
+	assert_strcmp(action_message(), "snapshot: Unknown arg 'args'");
+
+	/* clear error */
+	INP_C(0x0A);
+
+	INP_COMMAND(":snapshot file");
+
+	assert_ptr_null(action_message());
+	assert_strcmp(CURRENT_LINE, "Snapshot written to 'file'");
+}
+
+static void
+test_paste(void)
+{
+	char buf[INPUT_LEN_MAX + 1];
+	struct channel *c;
+	struct server *s;
+
+	if (!(s = server("host", "port", NULL, "user", "real", NULL)))
+		test_abort("Failed test setup");
+
+	if (server_list_add(state_server_list(), s))
+		test_abort("Failed to add server");
+
+	c = channel("#chan", CHANNEL_T_CHANNEL);
+	c->server = s;
+	channel_list_add(&(s->clist), c);
+	channel_set_current(c);
+
+	/* single line, inserted as input */
+	INP_S("\x1b[200~line 1\tx\r\x1b[201~");
+	assert_ptr_null(action_message());
+	assert_eq(input_write(&(c->input), buf, sizeof(buf), 0), 8);
+	assert_strcmp(buf, "line 1 x");
+
+	input_reset(&(c->input));
+
+	/* multiple lines, not on channel */
+	INP_S("\x1b[200~line 1\rline 2\x1b[201~");
+	assert_strcmp(action_message(), "paste: Not registered with server");
+
+	/* clear error */
+	INP_C(0x0A);
+
+	server_nicks_next(s);
+
+	s->registered = 1;
+	c->joined = 1;
+
+	/* multiple lines, cancelled */
+	INP_S("\x1b[200~line 1\rline 2\x1b[201~");
+	assert_strcmp(action_message(), "Send 2 lines to '#chan'?   [y/n]");
+
+	mock_reset_io();
+	INP_C('n');
+	assert_ptr_null(action_message());
+	assert_eq(mock_send_n, 0);
+	assert_eq(s->sendq.n, 0);
+
+	/* multiple lines, split across reads, with partial end sequences */
+	INP_S("\x1b[200~line 1\r\n\r\nli");
+	INP_S("ne \x1b[2 2\r\x1b");
+	assert_ptr_null(action_message());
+	INP_S("[201~");
+	assert_strcmp(action_message(), "Send 2 lines to '#chan'?   [y/n]");
+
+	mock_reset_io();
+	INP_C('y');
+	assert_ptr_null(action_message());
+	assert_eq(mock_send_n, 2);
+	assert_strcmp(mock_send[0], "PRIVMSG #chan :line 1");
+	assert_strcmp(mock_send[1], "PRIVMSG #chan :line \x1b[2 2");
+
+	/* paced multiple lines, with input following the paste */
+	mock_reset_io();
+	INP_S("\x1b[200~1\r2\r3\r4\r5\r6\x1b[201~y");
+	assert_ptr_null(action_message());
+	assert_eq(mock_send_n, 5);
+	assert_strcmp(mock_send[3], "PRIVMSG #chan :4");
+	assert_strcmp(mock_send[4], "PING :" SERVER_SENDQ_TOKEN);
+	assert_eq(s->sendq.n, 2);
+
+	input_reset(&(c->input));
+}
+
+static void
+test_input_search(void)
+{
+	char buf[INPUT_LEN_MAX + 1];
+	struct channel *c = current_channel();
+
+	assert_eq(input_insert(&(c->input), "abc 1", 5), 1);
+	assert_eq(input_hist_push(&(c->input)), 1);
+	assert_eq(input_insert(&(c->input), "xyz 2", 5), 1);
+	assert_eq(input_hist_push(&(c->input)), 1);
+	assert_eq(input_insert(&(c->input), "abc 3", 5), 1);
+	assert_eq(input_hist_push(&(c->input)), 1);
+
+	/* search, cancelled */
+	INP_C(CTRL('r'));
+	assert_strcmp(action_message(), "reverse-i-search '': ");
+	INP_C('b');
+	assert_strcmp(action_message(), "reverse-i-search 'b': abc 3");
+	INP_C(CTRL('c'));
+	assert_ptr_null(action_message());
+	assert_eq(input_write(&(c->input), buf, sizeof(buf), 0), 0);
+
+	/* search older matches, multiple characters per read */
+	INP_C(CTRL('r'));
+	INP_S("bc");
+	assert_strcmp(action_message(), "reverse-i-search 'bc': abc 3");
+	INP_C(CTRL('r'));
+	assert_strcmp(action_message(), "reverse-i-search 'bc': abc 1");
+	INP_C(CTRL('r'));
+	assert_strcmp(action_message(), "failed reverse-i-search 'bc': abc 1");
+
+	/* escape sequences are ignored */
+	INP_S("\x1b[A");
+	assert_strcmp(action_message(), "failed reverse-i-search 'bc': abc 1");
+
+	/* search string extended, and shortened */
+	INP_C('d');
+	assert_strcmp(action_message(), "failed reverse-i-search 'bcd': abc 1");
+	INP_C(0x7F);
+	assert_strcmp(action_message(), "reverse-i-search 'bc': abc 3");
+	INP_C(0x7F);
+	INP_C(0x7F);
+	assert_strcmp(action_message(), "reverse-i-search '': ");
+	INP_S("z ");
+	assert_strcmp(action_message(), "reverse-i-search 'z ': xyz 2");
+
+	/* match accepted as input */
+	INP_C(0x0A);
+	assert_ptr_null(action_message());
+	assert_eq(input_write(&(c->input), buf, sizeof(buf), 0), 5);
+	assert_strcmp(buf, "xyz 2");
+
+	input_reset(&(c->input));
+}
+
+static void
+test_channel_logs(void)
+{
+	struct buffer_line *line;
+	struct channel *c;
+	struct server *s;
+
+	if (!(s = server("host", "port", NULL, "user", "real", NULL)))
+		test_abort("Failed test setup");
+
+	if (server_list_add(state_server_list(), s))
+		test_abort("Failed to add server");
+
+	server_nicks_next(s);
+
+	c = channel("#chan", CHANNEL_T_CHANNEL);
+	c->server = s;
+	channel_list_add(&(s->clist), c);
+
+	/* newest first, over two days */
+	mock_log_lines[0].t = 1609502400 + 86400;
+	mock_log_lines[0].from = "nick";
+	mock_log_lines[0].text = "text 3";
+	mock_log_lines[1].t = 1609502400;
+	mock_log_lines[1].from = FROM_JOIN;
+	mock_log_lines[1].text = "nick has joined";
+	mock_log_lines[2].t = 1609502400 - 3600;
+	mock_log_lines[2].from = s->nick;
+	mock_log_lines[2].text = "text 1";
+	mock_log_lines_n = 3;
+
+	newlinef(c, BUFFER_LINE_CHAT, "nick", "text 4");
+
+	/* date, 2 lines, date, 1 line, date, new line */
+	assert_eq(buffer_size(&(c->buffer)), 7);
+
+	line = buffer_line(&(c->buffer), c->buffer.tail);
+	assert_eq(line->type, BUFFER_LINE_OTHER);
+	assert_strcmp(line->from, FROM_INFO);
+
+	line = buffer_line(&(c->buffer), c->buffer.tail + 1);
+	assert_eq(line->type, BUFFER_LINE_CHAT_RIRC);
+	assert_strcmp(line->text, "text 1");
+	assert_eq(line->time.tv_sec, 1609502400 - 3600);
+
+	line = buffer_line(&(c->buffer), c->buffer.tail + 2);
+	assert_eq(line->type, BUFFER_LINE_JOIN);
+	assert_strcmp(line->text, "nick has joined");
+
+	line = buffer_line(&(c->buffer), c->buffer.tail + 3);
+	assert_eq(line->type, BUFFER_LINE_OTHER);
+
+	line = buffer_line(&(c->buffer), c->buffer.tail + 4);
+	assert_eq(line->type, BUFFER_LINE_CHAT);
+	assert_strcmp(line->from, "nick");
+	assert_strcmp(line->text, "text 3");
+
+	line = buffer_line(&(c->buffer), c->buffer.tail + 5);
+	assert_eq(line->type, BUFFER_LINE_OTHER);
+
+	line = buffer_line(&(c->buffer), c->buffer.tail + 6);
+	assert_strcmp(line->text, "text 4");
+
+	/* buffers are only prefilled once */
+	buffer(&(c->buffer));
+	newlinef(c, BUFFER_LINE_CHAT, "nick", "text 5");
+	assert_eq(buffer_size(&(c->buffer)), 2);
+
+	/* the rirc buffer isn't prefilled */
+	newlinef(state.default_channel, 0, FROM_INFO, "text");
+	assert_eq(buffer_size(&(state.default_channel->buffer)), 1);
+
+	mock_log_lines_n = 0;
+}
+
+static void
+test_newline_prepend(void)
+{
+	struct buffer_line *line;
+	struct channel *c;
+	struct timespec ts = { .tv_sec = 1609502400 };
+
+	c = channel("#chan", CHANNEL_T_CHANNEL);
+
+	/* empty buffer, line and date */
+	assert_ptr_not_null(newline_prepend(c, BUFFER_LINE_CHAT, "nick", "text 3", 4, 6, &ts));
+	assert_eq(buffer_size(&(c->buffer)), 2);
+	assert_eq(c->buffer.time_last, ts.tv_sec);
+
+	line = buffer_line(&(c->buffer), c->buffer.tail);
+	assert_eq(line->type, BUFFER_LINE_OTHER);
+	assert_strcmp(line->from, FROM_INFO);
+
+	/* same day, prepended below the day's date */
+	ts.tv_sec -= 60;
+	assert_ptr_not_null(newline_prepend(c, BUFFER_LINE_CHAT, "nick", "text 2", 4, 6, &ts));
+	assert_eq(buffer_size(&(c->buffer)), 3);
+
+	line = buffer_line(&(c->buffer), c->buffer.tail);
+	assert_eq(line->type, BUFFER_LINE_OTHER);
+	assert_eq(line->time.tv_sec, ts.tv_sec + 60);
+	assert_strcmp(buffer_line(&(c->buffer), c->buffer.tail + 1)->text, "text 2");
+	assert_strcmp(buffer_line(&(c->buffer), c->buffer.tail + 2)->text, "text 3");
+
+	/* previous day, prepended with a new date */
+	ts.tv_sec -= 86400;
+	assert_ptr_not_null(newline_prepend(c, BUFFER_LINE_CHAT, "nick", "text 1", 4, 6, &ts));
+	assert_eq(buffer_size(&(c->buffer)), 5);
+	assert_eq(buffer_line(&(c->buffer), c->buffer.tail + 0)->type, BUFFER_LINE_OTHER);
+	assert_strcmp(buffer_line(&(c->buffer), c->buffer.tail + 1)->text, "text 1");
+	assert_eq(buffer_line(&(c->buffer), c->buffer.tail + 2)->type, BUFFER_LINE_OTHER);
+	assert_strcmp(buffer_line(&(c->buffer), c->buffer.tail + 3)->text, "text 2");
+
+	/* oldest line without a date, e.g. after lines were overwritten */
+	buffer(&(c->buffer));
+	buffer_newline(&(c->buffer), BUFFER_LINE_CHAT, "nick", "text 2", 4, 6, 0, &ts);
+	ts.tv_sec -= 86400;
+	assert_ptr_not_null(newline_prepend(c, BUFFER_LINE_CHAT, "nick", "text 1", 4, 6, &ts));
+	assert_eq(buffer_size(&(c->buffer)), 4);
+	assert_eq(buffer_line(&(c->buffer), c->buffer.tail + 0)->type, BUFFER_LINE_OTHER);
+	assert_strcmp(buffer_line(&(c->buffer), c->buffer.tail + 1)->text, "text 1");
+	assert_eq(buffer_line(&(c->buffer), c->buffer.tail + 2)->type, BUFFER_LINE_OTHER);
+	assert_eq(buffer_line(&(c->buffer), c->buffer.tail + 2)->time.tv_sec, ts.tv_sec + 86400);
+	assert_strcmp(buffer_line(&(c->buffer), c->buffer.tail + 3)->text, "text 2");
+
+	/* full buffer */
+	buffer(&(c->buffer));
+
+	for (unsigned i = 0; i < BUFFER_LINES_MAX - 1; i++)
+		buffer_newline(&(c->buffer), BUFFER_LINE_CHAT, "nick", "text", 4, 4, 0, &ts);
+
+	ts.tv_sec -= 86400;
+	assert_ptr_null(newline_prepend(c, BUFFER_LINE_CHAT, "nick", "text", 4, 4, &ts));
+	assert_eq(buffer_size(&(c->buffer)), BUFFER_LINES_MAX - 1);
+
+	channel_free(c);
+}
+
+static void
+test_buffer_scrollback_history(void)
+{
+	struct channel *c;
+	struct server *s;
+	struct timespec ts = { .tv_sec = 1609459201, .tv_nsec = 500000000 };
+
+	if (!(s = server("host", "port", NULL, "user", "real", NULL)))
+		test_abort("Failed test setup");
+
+	if (server_list_add(state_server_list(), s))
+		test_abort("Failed to add server");
+
+	c = channel("#chan", CHANNEL_T_CHANNEL);
+	c->server = s;
+	channel_list_add(&(s->clist), c);
+
+	/* test caps not set */
+	mock_reset_io();
+	buffer_scrollback_history(c);
+	assert_eq(mock_send_n, 0);
+
+	s->registered = 1;
+	s->ircv3_caps.batch.set = 1;
+	s->ircv3_caps.chathistory.set = 1;
+
+	/* test server buffer */
+	mock_reset_io();
+	buffer_scrollback_history(s->channel);
+	assert_eq(mock_send_n, 0);
+
+	/* test empty buffer */
+	mock_reset_io();
+	buffer_scrollback_history(c);
+	assert_eq(mock_send_n, 1);
+	assert_strcmp(mock_send[0], "CHATHISTORY LATEST #chan * 50");
+	assert_eq(c->history, 1);
+
+	/* test pending request */
+	mock_reset_io();
+	buffer_scrollback_history(c);
+	assert_eq(mock_send_n, 0);
+
+	/* test pending request expired */
+	c->history_time -= HISTORY_TIMEOUT;
+	buffer_newline(&(c->buffer), BUFFER_LINE_CHAT, "nick", "text", 4, 4, 0, &ts);
+	mock_reset_io();
+	buffer_scrollback_history(c);
+	assert_eq(mock_send_n, 1);
+	assert_strcmp(mock_send[0], "CHATHISTORY BEFORE #chan timestamp=2021-01-01T00:00:01.500Z 50");
+
+	/* test rate limit */
+	c->history = 0;
+	mock_reset_io();
+	buffer_scrollback_history(c);
+	assert_eq(mock_send_n, 0);
+
+	c->history_time -= HISTORY_INTERVAL;
+	mock_reset_io();
+	buffer_scrollback_history(c);
+	assert_eq(mock_send_n, 1);
+}
+
 static void
 test_state(void)
 {
@@ -527,6 +1235,19 @@ main(void)
 		TESTCASE(test_command_connect),
 		TESTCASE(test_command_disconnect),
 		TESTCASE(test_command_quit),
+		TESTCASE(test_command_detach),
+		TESTCASE(test_command_upgrade),
+		TESTCASE(test_command_whois),
+		TESTCASE(test_command_lag),
+		TESTCASE(test_command_latency),
+		TESTCASE(test_command_stats),
+		TESTCASE(test_command_trace),
+		TESTCASE(test_command_snapshot),
+		TESTCASE(test_paste),
+		TESTCASE(test_input_search),
+		TESTCASE(test_channel_logs),
+		TESTCASE(test_newline_prepend),
+		TESTCASE(test_buffer_scrollback_history),
 		TESTCASE(test_state),
 	};
 
@@ -63,5 +63,11 @@ newline(struct channel *c, enum buffer_line_type t, const char *f, const char *f
 	assert_gt(r2, 0);
 }
 
+struct buffer_line*
+newline_prepend(struct channel *c, enum buffer_line_type t, const char *f, const char *s, size_t f_len, size_t s_len, const struct timespec *ts)
+{
+	return buffer_prepend(&(c->buffer), t, f, s, f_len, s_len, 0, ts);
+}
+
 struct channel* current_channel(void) { return NULL; }
 void channel_set_current(struct channel *c) { UNUSED(c); }
@@ -0,0 +1,194 @@
+#include "test/test.h"
+
+#include "src/trace.c"
+#include "src/utils/utils.c"
+
+#define TRACE_THREADS 4
+#define TRACE_THREAD_EVENTS 20000
+
+static char dir[] = "/tmp/rirc.trace.XXXXXX";
+static char path[64];
+static char lines[8][TRACE_LINE_MAX];
+static unsigned lines_n;
+
+static void
+tail_cb(const char *line, void *arg)
+{
+	/* Keep the last lines read, with the time and thread removed */
+
+	const char *p = strchr(strchr(line, ' ') + 1, ' ') + 1;
+
+	UNUSED(arg);
+
+	snprintf(lines[lines_n++ % ARR_LEN(lines)], sizeof(lines[0]), "%s", p);
+}
+
+static void
+check_cb(const char *line, void *arg)
+{
+	/* Check an event's payload was read whole */
+
+	const char *p = strrchr(line, ' ') + 1;
+	unsigned *torn = arg;
+
+	if (!strstr(line, __FILE__))
+		return;
+
+	for (size_t i = 1; p[i]; i++) {
+		if (p[i] != p[0])
+			(*torn)++;
+	}
+}
+
+static void*
+trace_thread_test(void *arg)
+{
+	char buf[TRACE_DATA_LEN];
+
+	memset(buf, *(const char *)arg, sizeof(buf));
+
+	for (size_t i = 0; i < TRACE_THREAD_EVENTS; i++)
+		trace(TRACE_DEBUG, __FILE__, __LINE__, buf, (i % sizeof(buf)) + 1);
+
+	return NULL;
+}
+
+static void
+test_trace_tail(void)
+{
+	char buf[TRACE_DATA_LEN + 10];
+
+	lines_n = 0;
+
+	assert_ueq(trace_tail(1, tail_cb, NULL), 0);
+
+	trace(TRACE_SEND, "src/io.c", 10, "PRIVMSG #chan :text", 19);
+	trace(TRACE_RECV, "src/io.c", 20, ":nick PRIVMSG #chan :text", 25);
+	trace_printf(TRACE_DEBUG, "src/state.c", 30, "%s: %d", "debug", 42);
+
+	assert_ueq(trace_tail(10, tail_cb, NULL), 3);
+	assert_strcmp(lines[0], "send  src/io.c:10 PRIVMSG #chan :text");
+	assert_strcmp(lines[1], "recv  src/io.c:20 :nick PRIVMSG #chan :text");
+	assert_strcmp(lines[2], "debug src/state.c:30 debug: 42");
+
+	lines_n = 0;
+
+	assert_ueq(trace_tail(1, tail_cb, NULL), 1);
+	assert_strcmp(lines[0], "debug src/state.c:30 debug: 42");
+
+	/* Test payloads are truncated */
+	memset(buf, 'x', sizeof(buf));
+
+	trace(TRACE_TLS, "tls.c", 1, buf, sizeof(buf));
+
+	lines_n = 0;
+
+	assert_ueq(trace_tail(1, tail_cb, NULL), 1);
+	assert_ueq(strlen(lines[0]), strlen("tls   tls.c:1 ") + TRACE_DATA_LEN + 3);
+	assert_strcmp(lines[0] + strlen(lines[0]) - 5, "xx...");
+}
+
+static void
+test_trace_overwrite(void)
+{
+	/* Test the oldest events are overwritten when the ring is full */
+
+	uint64_t tail = atomic_load(&trace_tail_i);
+	unsigned last = (TRACE_RING_N - 1) % ARR_LEN(lines);
+
+	for (unsigned i = 0; i < TRACE_RING_N + 5; i++)
+		trace_printf(TRACE_DEBUG, "file.c", i, "%u", i);
+
+	lines_n = 0;
+
+	assert_ueq(trace_tail(TRACE_RING_N + 10, tail_cb, NULL), TRACE_RING_N);
+	assert_ueq(atomic_load(&trace_tail_i) - tail, TRACE_RING_N + 5);
+	assert_strcmp(lines[last], "debug file.c:4100 4100");
+	assert_strcmp(lines[0], "debug file.c:4093 4093");
+}
+
+static void
+test_trace_threads(void)
+{
+	/* Test events recorded concurrently are read whole, or not at all */
+
+	char c[TRACE_THREADS];
+	pthread_t tids[TRACE_THREADS];
+	unsigned torn = 0;
+
+	for (size_t i = 0; i < TRACE_THREADS; i++) {
+		c[i] = (char)('a' + i);
+		if (pthread_create(&tids[i], NULL, trace_thread_test, &c[i]))
+			test_abort("pthread_create failed");
+	}
+
+	for (size_t i = 0; i < 100; i++)
+		trace_tail(TRACE_RING_N, check_cb, &torn);
+
+	for (size_t i = 0; i < TRACE_THREADS; i++) {
+		if (pthread_join(tids[i], NULL))
+			test_abort("pthread_join failed");
+	}
+
+	assert_ueq(torn, 0);
+	assert_gt(trace_tail(TRACE_RING_N, check_cb, &torn), 0);
+	assert_ueq(torn, 0);
+	assert_ueq(atomic_load(&trace_threads), TRACE_THREADS + 1);
+}
+
+static void
+test_trace_drain(void)
+{
+	static char buf[1 << 20];
+	FILE *f;
+	size_t len;
+
+	assert_eq(trace_init(path), 0);
+
+	trace(TRACE_SEND, "src/io.c", 10, "PING :1", 7);
+	trace(TRACE_RECV, "src/io.c", 20, "PONG :1", 7);
+
+	trace_term();
+
+	if (!(f = fopen(path, "r")))
+		test_abort("fopen failed");
+
+	len = fread(buf, 1, sizeof(buf) - 1, f);
+	buf[len] = 0;
+
+	fclose(f);
+
+	/* Test events overwritten before the writer started are noted */
+	assert_ptr_eq(strstr(buf, "-- "), buf);
+	assert_ptr_not_null(strstr(buf, " events lost\n"));
+	assert_ptr_not_null(strstr(buf, "] send  src/io.c:10 PING :1\n"));
+	assert_strcmp(buf + len - strlen("] recv  src/io.c:20 PONG :1\n"), "] recv  src/io.c:20 PONG :1\n");
+}
+
+int
+main(void)
+{
+	struct testcase tests[] = {
+		TESTCASE(test_trace_tail),
+		TESTCASE(test_trace_overwrite),
+		TESTCASE(test_trace_threads),
+		TESTCASE(test_trace_drain)
+	};
+
+	char cmd[64];
+	int ret;
+
+	if (!mkdtemp(dir))
+		test_abort("mkdtemp failed");
+
+	snprintf(path, sizeof(path), "%s/trace", dir);
+
+	ret = run_tests(NULL, NULL, tests);
+
+	snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+
+	if (system(cmd))
+		test_abort("cleanup failed");
+
+	return ret;
+}
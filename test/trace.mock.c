@@ -0,0 +1,42 @@
+#ifndef TRACE_MOCK_C
+#define TRACE_MOCK_C
+
+static unsigned mock_trace_n;
+
+int trace_init(const char *path) { UNUSED(path); return 0; }
+void trace_term(void) { ; }
+
+void
+trace(enum trace_event event, const char *file, unsigned line, const char *data, size_t len)
+{
+	UNUSED(event);
+	UNUSED(file);
+	UNUSED(line);
+	UNUSED(data);
+	UNUSED(len);
+}
+
+void
+trace_printf(enum trace_event event, const char *file, unsigned line, const char *fmt, ...)
+{
+	UNUSED(event);
+	UNUSED(file);
+	UNUSED(line);
+	UNUSED(fmt);
+}
+
+unsigned
+trace_tail(unsigned n, trace_tail_cb cb, void *arg)
+{
+	char buf[32];
+	unsigned i;
+
+	for (i = 0; i < n && i < mock_trace_n; i++) {
+		snprintf(buf, sizeof(buf), "event %u", i);
+		cb(buf, arg);
+	}
+
+	return i;
+}
+
+#endif
@@ -13,6 +13,52 @@ test_irc_isnick(void)
 	/* TODO */
 }
 
+static void
+test_irc_message_dup(void)
+{
+	char *param;
+	struct irc_message m;
+	struct irc_message *dup;
+
+	/* Test the copy is independent of the parsed buffer */
+	char mesg[] = "@batch=ref;a=\\s :nick!user@host CMD arg1 :trailing arg";
+
+	assert_eq(irc_message_parse(&m, mesg), 0);
+	assert_strcmp(irc_message_tag(&m, "a"), " ");
+
+	dup = irc_message_dup(&m);
+
+	memset(mesg, 0, sizeof(mesg));
+
+	assert_ueq(dup->n_tags, 2);
+	assert_strcmp(irc_message_tag(dup, "batch"), "ref");
+	assert_strcmp(irc_message_tag(dup, "a"), " ");
+	assert_strcmp(dup->command, "CMD");
+	assert_strcmp(dup->from,    "nick");
+	assert_strcmp(dup->host,    "user@host");
+	assert_eq(irc_message_param(dup, &param), 1);
+	assert_strcmp(param, "arg1");
+	assert_eq(irc_message_param(dup, &param), 1);
+	assert_strcmp(param, "trailing arg");
+
+	free(dup);
+
+	/* Test a message without tags, prefix or params */
+	char mesg2[] = "CMD";
+
+	assert_eq(irc_message_parse(&m, mesg2), 0);
+
+	dup = irc_message_dup(&m);
+
+	memset(mesg2, 0, sizeof(mesg2));
+
+	assert_strcmp(dup->command, "CMD");
+	assert_ptr_null(dup->from);
+	assert_ptr_null(dup->params);
+
+	free(dup);
+}
+
 static void
 test_irc_message_param(void)
 {
@@ -362,6 +408,98 @@ test_irc_message_split(void)
 #undef CHECK_IRC_MESSAGE_SPLIT
 }
 
+static void
+test_irc_message_tag(void)
+{
+	struct irc_message m;
+
+#define CHECK_IRC_MESSAGE_PARSE(M, R) \
+	assert_eq(irc_message_parse(&m, (M)), (R));
+
+	/* Test ordinary tags */
+	char mesg1[] = "@time=2020-01-01T00:00:00.000Z;msgid=abc :nick!user@host CMD arg :trailing";
+
+	CHECK_IRC_MESSAGE_PARSE(mesg1, 0);
+	assert_ueq(m.n_tags, 2);
+	assert_strcmp(irc_message_tag(&m, "time"), "2020-01-01T00:00:00.000Z");
+	assert_strcmp(irc_message_tag(&m, "msgid"), "abc");
+	assert_strcmp(irc_message_tag(&m, "batch"), NULL);
+	assert_strcmp(m.command, "CMD");
+	assert_strcmp(m.from,    "nick");
+	assert_strcmp(m.host,    "user@host");
+	assert_strcmp(m.params,  "arg :trailing");
+
+	/* Test tags without values, vendor and client prefixed keys */
+	char mesg2[] = "@a;b=;+example.com/c=1 CMD";
+
+	CHECK_IRC_MESSAGE_PARSE(mesg2, 0);
+	assert_ueq(m.n_tags, 3);
+	assert_strcmp(irc_message_tag(&m, "a"), "");
+	assert_strcmp(irc_message_tag(&m, "b"), "");
+	assert_strcmp(irc_message_tag(&m, "+example.com/c"), "1");
+	assert_strcmp(m.command, "CMD");
+	assert_strcmp(m.from,    NULL);
+	assert_strcmp(m.params,  NULL);
+
+	/* Test escaped values */
+	char mesg3[] = "@a=\\:\\s\\\\\\r\\n;b=x\\y\\;c=\\s\\s :nick CMD";
+
+	CHECK_IRC_MESSAGE_PARSE(mesg3, 0);
+	assert_ueq(m.n_tags, 3);
+	assert_strcmp(irc_message_tag(&m, "a"), "; \\\r\n");
+	assert_strcmp(irc_message_tag(&m, "b"), "xy");
+	assert_strcmp(irc_message_tag(&m, "c"), "  ");
+	assert_ueq(m.tags[0].len_val, 5);
+	assert_ueq(m.tags[1].len_val, 2);
+
+	/* Test values are unescaped once */
+	assert_strcmp(irc_message_tag(&m, "a"), "; \\\r\n");
+
+	/* Test duplicate keys resolve to the last value */
+	char mesg4[] = "@a=1;a=2 CMD";
+
+	CHECK_IRC_MESSAGE_PARSE(mesg4, 0);
+	assert_strcmp(irc_message_tag(&m, "a"), "2");
+
+	/* Test empty tags are skipped */
+	char mesg5[] = "@;a=1;;b=2; CMD";
+
+	CHECK_IRC_MESSAGE_PARSE(mesg5, 0);
+	assert_ueq(m.n_tags, 2);
+	assert_strcmp(irc_message_tag(&m, "a"), "1");
+	assert_strcmp(irc_message_tag(&m, "b"), "2");
+
+	/* Test tags exceeding the store are discarded */
+	char mesg6[] = "@t1;t2;t3;t4;t5;t6;t7;t8;t9;t10;t11;t12;t13;t14;t15;t16;t17 CMD";
+
+	CHECK_IRC_MESSAGE_PARSE(mesg6, 0);
+	assert_ueq(m.n_tags, IRC_MESSAGE_TAGS_MAX);
+	assert_strcmp(irc_message_tag(&m, "t16"), "");
+	assert_strcmp(irc_message_tag(&m, "t17"), NULL);
+	assert_strcmp(m.command, "CMD");
+
+	/* Test untagged message clears previous tags */
+	char mesg7[] = "CMD";
+
+	CHECK_IRC_MESSAGE_PARSE(mesg7, 0);
+	assert_ueq(m.n_tags, 0);
+	assert_strcmp(irc_message_tag(&m, "t1"), NULL);
+
+	/* Error: empty tags */
+	char mesg8[] = "@ CMD";
+	CHECK_IRC_MESSAGE_PARSE(mesg8, -1);
+
+	/* Error: no command */
+	char mesg9[] = "@a=1";
+	CHECK_IRC_MESSAGE_PARSE(mesg9, -1);
+
+	/* Error: no command after tags */
+	char mesg10[] = "@a=1 ";
+	CHECK_IRC_MESSAGE_PARSE(mesg10, -1);
+
+#undef CHECK_IRC_MESSAGE_PARSE
+}
+
 static void
 test_irc_pinged(void)
 {
@@ -518,6 +656,88 @@ test_irc_strsep(void)
 	assert_ptr_null(irc_strsep(&p));
 }
 
+static void
+test_irc_strhash(void)
+{
+	/* Test 64-bit FNV-1a string hashing */
+
+	assert_true(irc_strhash("") == 0xcbf29ce484222325);
+	assert_true(irc_strhash("a") == 0xaf63dc4c8601ec8c);
+	assert_true(irc_strhash("foobar") == 0x85944171f73967e8);
+	assert_true(irc_strhash("msgid-1") != irc_strhash("msgid-2"));
+}
+
+static void
+test_irc_strtou(void)
+{
+	unsigned u = 1;
+
+	assert_eq(irc_strtou("0", &u, 10), 0);
+	assert_ueq(u, 0);
+
+	assert_eq(irc_strtou("10", &u, 10), 0);
+	assert_ueq(u, 10);
+
+	assert_eq(irc_strtou("0086400", &u, 86400), 0);
+	assert_ueq(u, 86400);
+
+	/* invalid */
+	u = 1;
+	assert_eq(irc_strtou(NULL, &u, 10), -1);
+	assert_eq(irc_strtou("", &u, 10), -1);
+	assert_eq(irc_strtou("11", &u, 10), -1);
+	assert_eq(irc_strtou("-1", &u, 10), -1);
+	assert_eq(irc_strtou("+1", &u, 10), -1);
+	assert_eq(irc_strtou("1s", &u, 10), -1);
+	assert_eq(irc_strtou(" 1", &u, 10), -1);
+	assert_eq(irc_strtou("99999999999999999999999", &u, 86400), -1);
+	assert_ueq(u, 1);
+}
+
+static void
+test_irc_strtime(void)
+{
+	/* Test parsing IRCv3 server-time timestamps */
+
+	struct timespec ts;
+
+	assert_eq(irc_strtime("1970-01-01T00:00:00Z", &ts), 0);
+	assert_eq(ts.tv_sec, 0);
+	assert_eq(ts.tv_nsec, 0);
+
+	assert_eq(irc_strtime("2011-10-19T16:40:51.620Z", &ts), 0);
+	assert_eq(ts.tv_sec, 1319042451);
+	assert_eq(ts.tv_nsec, 620000000);
+
+	/* leap day, end of century */
+	assert_eq(irc_strtime("2000-02-29T23:59:59Z", &ts), 0);
+	assert_eq(ts.tv_sec, 951868799);
+
+	assert_eq(irc_strtime("2000-03-01T00:00:00Z", &ts), 0);
+	assert_eq(ts.tv_sec, 951868800);
+
+	/* fractional seconds truncated to nanoseconds */
+	assert_eq(irc_strtime("2021-01-01T00:00:00.1Z", &ts), 0);
+	assert_eq(ts.tv_sec, 1609459200);
+	assert_eq(ts.tv_nsec, 100000000);
+
+	assert_eq(irc_strtime("2021-01-01T00:00:00.1234567899Z", &ts), 0);
+	assert_eq(ts.tv_nsec, 123456789);
+
+	/* invalid */
+	assert_eq(irc_strtime("", &ts), -1);
+	assert_eq(irc_strtime("2021-01-01", &ts), -1);
+	assert_eq(irc_strtime("2021-01-01T00:00:00", &ts), -1);
+	assert_eq(irc_strtime("2021-01-01 00:00:00Z", &ts), -1);
+	assert_eq(irc_strtime("2021-01-01T00:00:00.Z", &ts), -1);
+	assert_eq(irc_strtime("2021-01-01T00:00:00Zx", &ts), -1);
+	assert_eq(irc_strtime("2021-13-01T00:00:00Z", &ts), -1);
+	assert_eq(irc_strtime("2021-01-00T00:00:00Z", &ts), -1);
+	assert_eq(irc_strtime("2021-01-01T24:00:00Z", &ts), -1);
+	assert_eq(irc_strtime("1969-12-31T23:59:59Z", &ts), -1);
+	assert_eq(irc_strtime("2021-0a-01T00:00:00Z", &ts), -1);
+}
+
 static void
 test_irc_strtrim(void)
 {
@@ -547,13 +767,18 @@ main(void)
 	struct testcase tests[] = {
 		TESTCASE(test_irc_ischan),
 		TESTCASE(test_irc_isnick),
+		TESTCASE(test_irc_message_dup),
 		TESTCASE(test_irc_message_param),
 		TESTCASE(test_irc_message_parse),
 		TESTCASE(test_irc_message_split),
+		TESTCASE(test_irc_message_tag),
 		TESTCASE(test_irc_pinged),
 		TESTCASE(test_irc_strcmp),
 		TESTCASE(test_irc_strncmp),
 		TESTCASE(test_irc_strsep),
+		TESTCASE(test_irc_strhash),
+		TESTCASE(test_irc_strtime),
+		TESTCASE(test_irc_strtou),
 		TESTCASE(test_irc_strtrim),
 		TESTCASE(test_irc_toupper)
 	};